@@ -10,19 +10,279 @@
  * 
  * Created a lexer function with minimal features. Capable of generating these tokens: INT_KEYWORD, RETURN_KEYWORD, IDENTIFIER, L_PARAN, R_PARAN, L_BRACE, R_BRACE, INT_LITERAL, SEMICOLON, UNKNOWN
  * <hr>
+ * @date 14-10-2026
+ * 
+ * Created a recursive-descent parser for functions of the form int name() { return N; }. AST nodes live in one flat pool and refer to each other by index. Run with --dump-ast to print the tree.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Created an x86-64 backend. -S writes assembly, -c writes an ELF object file directly, -o picks the output file.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Functions now take parameters and have local variables, if/else, while, calls and the usual arithmetic, comparison and logical operators. The AST is lowered into an SSA IR that is optimized with constant folding, copy propagation, unreachable block removal, block merging and dead code elimination before code generation. Run with --dump-ir to print the IR and -O0 to skip the passes.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Values now live in registers, handed out by a linear-scan register allocator. Values that live across calls get callee-saved registers, and the rest of the values go on the stack only when registers run out.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Added a preprocessor with #include, #define (object-like and function-like), #undef, #if/#ifdef/#ifndef/#elif/#else/#endif, #pragma once and #error. Use -I to add include directories. Each header is lexed once per file, and headers with an include guard or #pragma once are skipped without being read again.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * The compiler now takes any number of source files. -j N compiles up to N of them at once on a work-stealing thread pool. All files share one interner, which can be read without taking a lock.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Large files are now lexed on several threads when -j allows more threads than there are files. The file is cut into chunks at newlines, the chunks are lexed at the same time, and a short fix-up pass repairs chunks that started inside a comment.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Headers can now be cached on disk with --token-cache=DIR. Each header's tokens are written once in a flat, checksummed format keyed by its contents, and later runs map the file instead of lexing the header again.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Generated code can now be cached per function with --function-cache=DIR. Every function definition is fingerprinted by its tokens and the output options; functions that did not change since the last build skip lowering, optimization and code generation, and their code is copied from the cache instead.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * -ftime-report (or -ftime-report=json) writes, for every file, the wall and CPU time of each phase, the token and byte rates, and the allocation count and arena footprint to stderr.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Added a benchmark suite: --bench generates synthetic corpora (identifier-, literal- and comment-heavy, and deeply nested) of --bench-size bytes and reports the MB/s and tokens/s of the lexer and of the whole pipeline. --bench-save and --bench-baseline record results and flag regressions against them.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * The token dump is now formatted into a buffer and written out in large blocks instead of one printf() per token. --emit-tokens=bin writes a compact binary record stream instead, with the kind, file, offset, length, line and column of every token.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Lines and columns in diagnostics now come from a line-start table per file. The table is built with the vectorized newline search the first time a file needs one, and each lookup is a binary search, so many errors in a large file no longer rescan it from the start.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Added a compile server. cc --server=SOCKET listens on a Unix socket, and cc --connect=SOCKET ARGS... has it compile with the client's arguments, working directory, stdout and stderr. The server keeps its interner and the lexed tokens of every header it has read across requests, checking each header with a single stat() before reusing it, so builds with many small files skip process startup and the reading and lexing of shared headers.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Punctuators and literals are now lexed by a DFA built once from a table of every C11 punctuator and a short list of literal rules. Bytes that behave alike share a column, so each byte is one lookup in a small state-by-class table and one branch. The lexer now knows all C11 punctuators, longest match first, and hex, octal and floating literals, suffixes, and character literals.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Input and output errors are now always reported. Sources are read as plain bytes, NULs and all, from files or pipes, with interrupted reads retried and real read errors kept apart from the end of the file; a failed read names the file and the reason. Token, AST and IR dumps check that their output was actually written, so a full disk or a closed pipe makes the compiler fail instead of exiting with success.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Errors now go through a diagnostics collector. Each file reports into a buffer of its own, and the buffers are printed in command-line order as files finish, so -j builds print the same diagnostics in the same order as serial ones. -fmax-errors=N stops after N errors: files that can no longer print an error are cancelled, whether they have started or not.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Added profile-guided optimization. Code built with -fprofile-generate counts how often every basic block runs and writes the counts to a profile named after the source file's path when the program exits; -fprofile-use reads them back, lays out the hot successor of every branch as the fall-through and moves blocks that never ran to the end of their function, and weighs spill decisions by how often each block ran instead of by loop depth. Both take an optional =DIR for where the profiles go.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * Integer literals are now parsed by the lexer: plain decimal literals below 2^31 are converted eight digits at a time and their value is stored as the token's payload, so the parser and #if read it directly. Hexadecimal and octal literals and the u/l suffixes are now accepted, both in code and in #if.
+ * <hr>
+ * @date 14-10-2026
+ * 
+ * When -j leaves a file more than one thread, its functions are now lowered, optimized and generated on the thread pool, in runs of about the same size. Their code and errors are put back together in source order, so the output is the same for any -j.
+ * <hr>
  */
 
+// POSIX.1-2008 plus the BSD and System V extensions the compile server 
+// and the source reader use (st_mtim, madvise() and its advice).
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <elf.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#if defined(__SSE2__) || (defined(__x86_64__) && defined(__GNUC__))
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief Structure representing one block of arena memory.
+ * 
+ * Blocks are chained together, newest first. Each block hands out 
+ * memory from its data area until it is full, at which point the 
+ * arena starts a new, larger block.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} ArenaBlock;
+
+/**
+ * @brief Structure representing a bump allocator.
+ * 
+ * An Arena owns every allocation made for one translation unit. 
+ * Individual allocations are never freed; the whole arena is released 
+ * at once with free_arena(). It also keeps simple counters so the 
+ * memory use of a compilation can be reported.
+ */
+typedef struct {
+    ArenaBlock* current;
+    void* last_allocation;
+    size_t block_size;
+    size_t allocation_count;
+    size_t bytes_used;
+    size_t bytes_reserved;
+} Arena;
+
+/**
+ * @brief Structure representing the contents of a source file.
+ * 
+ * The SourceBuffer structure holds the whole file as one contiguous 
+ * block of memory together with its length. The block is either a 
+ * read-only memory mapping of the file or a heap copy when the file 
+ * cannot be mapped (pipes, empty files, special files).
+ */
+typedef struct {
+    const char* data;
+    size_t length;
+    int mapped;
+} SourceBuffer;
+
+/**
+ * @brief Structure representing the line starts of a file.
+ * 
+ * starts[i] is the offset of the first byte of line i + 1, so 
+ * starts[0] is always 0. The table is built the first time a position 
+ * in the file has to be turned into a line and column; until then 
+ * starts is NULL.
+ */
+typedef struct {
+    uint32_t* starts;
+    size_t count;
+    size_t capacity;
+} LineTable;
+
+/**
+ * @brief Structure representing one file in a SourceMap.
+ */
+typedef struct {
+    const char* name;
+    const char* data;
+    uint32_t base;
+    uint32_t length;
+    LineTable lines;
+} SourceFile;
+
+/**
+ * @brief Structure representing the files a translation unit is made of.
+ * 
+ * Every file gets its own range of one 32-bit offset space, starting 
+ * at its base, so a single offset identifies both a file and a 
+ * position in it. Tokens from different files can then share a token 
+ * list without storing a file per token. Bases increase with the 
+ * file index, so the file of an offset is found by binary search.
+ */
+typedef struct {
+    Arena* arena;
+    SourceFile* files;
+    size_t count;
+    size_t capacity;
+} SourceMap;
+
+/**
+ * @brief Structure representing one interned string.
+ * 
+ * The text is owned by the interner, so it stays valid after the 
+ * source buffer it was first seen in has been released. The hash is 
+ * computed once, when the string is first interned.
+ */
+typedef struct {
+    const char* text;
+    uint32_t length;
+    uint32_t hash;
+} InternEntry;
+
+/**
+ * @brief Number of entries in the first interner segment, as a power of two.
+ */
+#define INTERN_SEGMENT_SHIFT 8
+
+/**
+ * @brief Number of interner segments, enough for every 32-bit symbol ID.
+ */
+#define INTERN_SEGMENT_COUNT 24
+
+/**
+ * @brief Structure representing the hash table of an interner.
+ * 
+ * An open-addressing table (linear probing). Each slot packs the 
+ * precomputed hash into its upper 32 bits and the symbol ID plus one 
+ * into its lower 32 bits, 0 marking an empty slot, so a slot is 
+ * published with a single atomic store.
+ */
+typedef struct {
+    size_t slot_count;
+    _Atomic uint64_t slots[];
+} InternTable;
+
+/**
+ * @brief Structure representing the string interner.
+ * 
+ * The interner maps every distinct string to a small, stable symbol ID 
+ * so later stages can compare names with an integer compare. It is 
+ * shared by every thread of the compiler. Lookups of strings that are 
+ * already interned take no lock. Adding a string takes the lock, 
+ * fills in the entry and only then publishes its slot, so a reader 
+ * either misses the string and retries under the lock, or sees a 
+ * complete entry.
+ * 
+ * Entries never move once written: segment k holds the next 
+ * 2^(INTERN_SEGMENT_SHIFT + k) symbol IDs. Tables are not freed when 
+ * they are replaced by bigger ones, so a reader still probing an old 
+ * table is safe.
+ */
+typedef struct {
+    Arena* arena;
+    pthread_mutex_t lock;
+    _Atomic(InternTable*) table;
+    _Atomic(InternEntry*) segments[INTERN_SEGMENT_COUNT];
+    _Atomic size_t size;
+} Interner;
+
+/**
+ * @brief Symbol value used by tokens that do not name anything.
+ */
+#define NO_SYMBOL UINT32_MAX
 
 /**
  * @brief Enum representing different types of tokens.
  * 
  * This enum defines the possible token types that can be recognized 
  * during lexing, including keywords, identifiers, literals, and 
- * symbols like parentheses and braces.
+ * symbols like parentheses and braces. The keywords beyond int and 
+ * return come after UNKNOWN so the numbering of the original token 
+ * types stays stable.
  */
 typedef enum {
     INT_KEYWORD,
@@ -34,246 +294,13383 @@ typedef enum {
     R_BRACE,
     INT_LITERAL,
     SEMICOLON,
-    UNKNOWN
+    UNKNOWN,
+    AUTO_KEYWORD,
+    BREAK_KEYWORD,
+    CASE_KEYWORD,
+    CHAR_KEYWORD,
+    CONST_KEYWORD,
+    CONTINUE_KEYWORD,
+    DEFAULT_KEYWORD,
+    DO_KEYWORD,
+    DOUBLE_KEYWORD,
+    ELSE_KEYWORD,
+    ENUM_KEYWORD,
+    EXTERN_KEYWORD,
+    FLOAT_KEYWORD,
+    FOR_KEYWORD,
+    GOTO_KEYWORD,
+    IF_KEYWORD,
+    INLINE_KEYWORD,
+    LONG_KEYWORD,
+    REGISTER_KEYWORD,
+    RESTRICT_KEYWORD,
+    SHORT_KEYWORD,
+    SIGNED_KEYWORD,
+    SIZEOF_KEYWORD,
+    STATIC_KEYWORD,
+    STRUCT_KEYWORD,
+    SWITCH_KEYWORD,
+    TYPEDEF_KEYWORD,
+    UNION_KEYWORD,
+    UNSIGNED_KEYWORD,
+    VOID_KEYWORD,
+    VOLATILE_KEYWORD,
+    WHILE_KEYWORD,
+    ALIGNAS_KEYWORD,
+    ALIGNOF_KEYWORD,
+    ATOMIC_KEYWORD,
+    BOOL_KEYWORD,
+    COMPLEX_KEYWORD,
+    GENERIC_KEYWORD,
+    IMAGINARY_KEYWORD,
+    NORETURN_KEYWORD,
+    STATIC_ASSERT_KEYWORD,
+    THREAD_LOCAL_KEYWORD,
+    END_OF_FILE,
+    COMMA,
+    PLUS,
+    MINUS,
+    STAR,
+    SLASH,
+    PERCENT,
+    TILDE,
+    BANG,
+    ASSIGN,
+    EQUAL_EQUAL,
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+    AND_AND,
+    OR_OR,
+    HASH,
+    STRING_LITERAL,
+    L_BRACKET,
+    R_BRACKET,
+    DOT,
+    ARROW,
+    PLUS_PLUS,
+    MINUS_MINUS,
+    AMPERSAND,
+    PIPE,
+    CARET,
+    QUESTION,
+    COLON,
+    SHIFT_LEFT,
+    SHIFT_RIGHT,
+    ELLIPSIS,
+    STAR_ASSIGN,
+    SLASH_ASSIGN,
+    PERCENT_ASSIGN,
+    PLUS_ASSIGN,
+    MINUS_ASSIGN,
+    SHIFT_LEFT_ASSIGN,
+    SHIFT_RIGHT_ASSIGN,
+    AND_ASSIGN,
+    XOR_ASSIGN,
+    OR_ASSIGN,
+    HASH_HASH,
+    CHAR_LITERAL,
+    FLOAT_LITERAL,
+    TOKEN_KIND_COUNT
 } TokenType;
 
 /**
- * @brief Structure representing a single token.
+ * @brief Enum representing the character class bits used by the lexer.
  * 
- * A Token structure contains two fields: a token type from the 
- * TokenType enum and a value which is a string representing the 
- * token's content.
+ * Every byte value has a set of these bits in char_class, so the lexer 
+ * classifies a byte with one table load instead of several 
+ * locale-dependent <ctype.h> calls.
  */
-typedef struct {
-    TokenType type;
-    char* value;
-} Token;
+typedef enum {
+    CHAR_SPACE = 1 << 0,
+    CHAR_IDENT_START = 1 << 1,
+    CHAR_IDENT_CONTINUE = 1 << 2,
+    CHAR_DIGIT = 1 << 3,
+    CHAR_PUNCT = 1 << 4
+} CharClass;
 
 /**
- * @brief Structure representing a list of tokens.
+ * @brief Structure holding the scan kernels picked for this CPU.
  * 
- * The TokenList structure holds an array of Token objects, along 
- * with its size (the number of tokens in the list) and its capacity 
- * (the maximum number of tokens the list can hold before resizing).
+ * Each kernel scans forward from p and stops at end at the latest.
  */
 typedef struct {
-    Token* tokens;
-    size_t size;
-    size_t capacity;
-} TokenList;
-
-
-TokenList* create_token_list(size_t init_capacity);
-void free_token_list(TokenList* list);
-void print_tokens(TokenList *list);
-Token* add_token(TokenList* list, TokenType type, const char* value);
-TokenList* lex(const char* filename);
+    const char* (*skip_whitespace)(const char* p, const char* end);
+    const char* (*scan_identifier)(const char* p, const char* end);
+    const char* (*find_byte)(const char* p, const char* end, char byte);
+} ScanKernels;
 
+/**
+ * @brief Structure representing one entry of the keyword table.
+ */
+typedef struct {
+    const char* text;
+    size_t length;
+    TokenType type;
+} KeywordEntry;
 
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        perror("ERROR: File not provided.");
-        exit(EXIT_FAILURE);
-    }
+/**
+ * @brief Largest number of states the lexer DFA can have.
+ */
+#define LEXER_DFA_MAX_STATES 128
 
-    const char* filename = argv[1];
-    TokenList* tokens = lex(filename);
+/**
+ * @brief Largest number of byte classes the lexer DFA can have.
+ */
+#define LEXER_DFA_MAX_CLASSES 64
 
-    if (tokens) {
-        print_tokens(tokens);
-        free_token_list(tokens);
-    } else {
-        perror("ERROR: Lexing file.");
-        exit(EXIT_FAILURE); 
-    }
+/**
+ * @brief Enum representing the fixed states of the lexer DFA.
+ * 
+ * DFA_STOP ends the token before the byte that led to it. The states 
+ * of the punctuators are numbered from DFA_FIRST_PUNCTUATOR on, in the 
+ * order build_lexer_dfa() adds them.
+ */
+typedef enum {
+    DFA_STOP,
+    DFA_START,
+    DFA_UNKNOWN,
+    DFA_ZERO,
+    DFA_DECIMAL,
+    DFA_HEX,
+    DFA_INT_SUFFIX,
+    DFA_FRACTION,
+    DFA_HEX_FRACTION,
+    DFA_EXPONENT_SIGN,
+    DFA_EXPONENT,
+    DFA_FLOAT_SUFFIX,
+    DFA_STRING,
+    DFA_STRING_ESCAPE,
+    DFA_STRING_END,
+    DFA_CHAR,
+    DFA_CHAR_ESCAPE,
+    DFA_CHAR_END,
+    DFA_FIRST_PUNCTUATOR
+} DfaState;
 
-    return 0;
-}
+/**
+ * @brief Structure representing one entry of the punctuator table.
+ */
+typedef struct {
+    const char* text;
+    TokenType type;
+} PunctuatorEntry;
 
 /**
-* * LEXER
-* First stage.
-* Performs lexical analysis on file content and generates a list of tokens.
-*/
+ * @brief Structure representing one rule of the lexer DFA.
+ * 
+ * Every byte in bytes (every byte at all when bytes is NULL) moves 
+ * the DFA from state from to state to. Later rules override earlier 
+ * ones.
+ */
+typedef struct {
+    DfaState from;
+    const char* bytes;
+    DfaState to;
+} DfaRule;
 
 /**
- * @brief Creates a new token list with a given initial capacity.
+ * @brief Structure representing the DFA that lexes everything but 
+ * whitespace, comments and identifiers.
  * 
- * Allocates memory for a TokenList and its tokens array, initializes 
- * the list size to 0, and sets the capacity to the specified value.
+ * Bytes are first mapped to a class, then next is indexed by state 
+ * and class, so each byte costs one table lookup. token is the token 
+ * type of a token ending in a state, or TOKEN_KIND_COUNT if no token 
+ * ends there.
+ */
+typedef struct {
+    uint8_t class_of[256];
+    uint8_t next[LEXER_DFA_MAX_STATES][LEXER_DFA_MAX_CLASSES];
+    uint8_t token[LEXER_DFA_MAX_STATES];
+    size_t state_count;
+    size_t class_count;
+} LexerDfa;
+
+/**
+ * @brief Structure representing a single token.
  * 
- * @param init_capacity The initial capacity of the token list.
- * @return A pointer to the newly created TokenList.
+ * A Token structure contains a token type from the TokenType enum and 
+ * a span (offset and length) into the source buffer it was lexed from. 
+ * The token's text is never copied; use token_text() when a 
+ * NUL-terminated string is actually needed. IDENTIFIER tokens also 
+ * carry the interned symbol ID of their name; every other token has 
+ * NO_SYMBOL. INT_LITERAL tokens carry their int_literal_payload() in 
+ * value, which is 0 for every other token.
  */
-TokenList* create_token_list(size_t init_capacity) {
-    TokenList* list = malloc(sizeof(TokenList));
+typedef struct {
+    TokenType type;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t symbol;
+    uint32_t value;
+} Token;
 
-    list -> size = 0;
-    list -> capacity = init_capacity;
-    list -> tokens = malloc(sizeof(Token) * init_capacity);
+/**
+ * @brief Flag of an INT_LITERAL payload that holds the literal's length 
+ * instead of its value.
+ * 
+ * Plain decimal literals below 2^31 are parsed by the lexer and their 
+ * payload is the value, from which the length follows, since they have 
+ * no leading zeros. Any other literal is left to the parser, with its 
+ * length and this flag as payload.
+ */
+#define LITERAL_LENGTH_FLAG 0x80000000u
 
-    return list;
-}
+/**
+ * @brief Number of tokens per TokenList chunk, as a power of two.
+ */
+#define TOKEN_CHUNK_SHIFT 12
+#define TOKEN_CHUNK_SIZE ((size_t)1 << TOKEN_CHUNK_SHIFT)
 
 /**
- * @brief Frees the memory used by a token list.
+ * @brief Structure representing a list of tokens.
  * 
- * This function iterates through the tokens in the list, freeing the 
- * memory for each token's value. After that, it frees the memory for 
- * the tokens array and the TokenList struct itself.
+ * The TokenList structure stores tokens as a struct of arrays: one 
+ * byte of kind, a 32-bit source offset and a 32-bit payload per token. 
+ * The payload is the symbol ID for IDENTIFIER tokens, the 
+ * int_literal_payload() for INT_LITERAL tokens and the length for 
+ * every other token. Each array is split into fixed-size chunks, 
+ * so growing the list allocates new chunks and only ever copies the 
+ * small tables that point at them; token i lives at index 
+ * i % TOKEN_CHUNK_SIZE of chunk i / TOKEN_CHUNK_SIZE.
  * 
- * @param list A pointer to the TokenList to be freed.
+ * The list also keeps the source text the offsets refer to and the 
+ * interner holding identifier names, both of which must outlive it, 
+ * and the line table used to turn offsets into lines and columns. 
+ * A preprocessed list holds tokens from several files; it has a 
+ * source map, and its offsets are offsets in the map instead of in 
+ * source. The list and its chunks belong to an arena and are released 
+ * together with it.
  */
-void free_token_list(TokenList* list) {
-    for (size_t i = 0; i < (list -> size); i++) {
-        free(list -> tokens[i].value);
-    }
-
-    free(list -> tokens);
-    free(list);
-}
+typedef struct {
+    Arena* arena;
+    Interner* interner;
+    const char* source;
+    size_t source_length;
+    LineTable* lines;
+    const SourceMap* source_map;
+    uint8_t** kinds;
+    uint32_t** offsets;
+    uint32_t** payloads;
+    size_t size;
+    size_t chunk_count;
+    size_t chunk_capacity;
+} TokenList;
 
 /**
- * @brief Prints the tokens in a token list.
+ * @brief Number of tokens the lexer can buffer for lookahead.
  * 
- * This function iterates through the tokens in the list and prints 
- * their type and value to the standard output in a readable format.
+ * Must be a power of two. peek_token() can look at most this many 
+ * tokens ahead.
+ */
+#define LEXER_LOOKAHEAD 4
+
+/**
+ * @brief Structure representing a pull-style lexer.
  * 
- * @param list A pointer to the TokenList to be printed.
+ * A Lexer produces tokens one at a time from a source buffer, so a 
+ * consumer never has to hold the whole token stream in memory. Tokens 
+ * that have been peeked at but not consumed yet are kept in a small 
+ * ring buffer.
  */
-void print_tokens(TokenList *list) {
-    for (size_t i = 0; i < (list -> size); i++) {
-        printf("Type: %d, Value: %s\n", list -> tokens[i].type, list -> tokens[i].value);
-    }
-}
+typedef struct {
+    Interner* interner;
+    const char* source;
+    size_t length;
+    size_t position;
+    Token ring[LEXER_LOOKAHEAD];
+    size_t head;
+    size_t count;
+} Lexer;
 
 /**
- * @brief Adds a token to the token list.
+ * @brief Version of the token cache format.
  * 
- * This function checks if there is enough capacity in the list to add 
- * a new token. If not, it reallocates memory to double the capacity. 
- * Then, it creates a new token, assigns it a type and value, and 
- * appends it to the list.
+ * Bump it whenever the lexer changes what it produces for a file.
+ */
+#define TOKEN_CACHE_VERSION 4
+
+/**
+ * @brief First bytes of every token cache file.
+ */
+#define TOKEN_CACHE_MAGIC "CCTOKEN"
+
+/**
+ * @brief Structure representing the header of a token cache file.
  * 
- * @param list A pointer to the TokenList to which the token will be added.
- * @param type The type of the token to be added.
- * @param value The value of the token to be added.
- * @return A pointer to the newly added Token.
- */
-Token* add_token(TokenList* list, TokenType type, const char* value) {
-    if ((list -> size) >= (list -> capacity)) {
-        list -> capacity *= 2;
-        list -> tokens = realloc(list -> tokens, sizeof(Token) * (list -> capacity));
-    
-        if (!list -> tokens) {
-            perror("ERROR: Failed to reallocate token list.");
-            exit(EXIT_FAILURE);
-        }
-    }
+ * Every *_offset is a byte offset from the start of the file. The 
+ * arrays are token_count kinds (one byte each), offsets and payloads 
+ * (four bytes each), then string_count CachedString entries and the 
+ * characters they refer to. Identifier payloads, and guard, are 
+ * indices into the strings instead of symbol IDs. file_hash is the 
+ * cache_file_hash() of the file. The file is in the 
+ * byte order of the machine that wrote it; the key check rejects files 
+ * from elsewhere.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t key;
+    uint64_t source_length;
+    uint64_t file_size;
+    uint32_t token_count;
+    uint32_t string_count;
+    uint32_t guard;
+    uint32_t kind_count;
+    uint64_t kinds_offset;
+    uint64_t offsets_offset;
+    uint64_t payloads_offset;
+    uint64_t strings_offset;
+    uint64_t characters_offset;
+    uint64_t characters_size;
+    uint64_t file_hash;
+} TokenCacheHeader;
 
+/**
+ * @brief Structure representing one identifier in a token cache file.
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} CachedString;
 
-    Token* token = &(list -> tokens[list -> size++]);
+/**
+ * @brief Maximum nesting depth of #include directives.
+ */
+#define MAX_INCLUDE_DEPTH 200
 
-    token -> type = type;
-    token -> value = strdup(value);
+/**
+ * @brief Value of file_of_path for a path known not to exist.
+ */
+#define MISSING_FILE UINT32_MAX
 
-    return token;
-}
+/**
+ * @brief Structure representing a file the preprocessor has loaded.
+ * 
+ * Every file is read and lexed once per translation unit, however 
+ * often it is included. guard is the macro of the file's include 
+ * guard, or NO_SYMBOL when the file does not have the 
+ * #ifndef/#define/#endif shape; pragma_once is set once the file has 
+ * been seen to contain #pragma once. cache is the mapped token cache 
+ * file the tokens were loaded from, if any.
+ */
+typedef struct {
+    uint32_t path;
+    uint32_t file;
+    SourceBuffer* source;
+    SourceBuffer* cache;
+    TokenList* tokens;
+    uint32_t guard;
+    uint8_t pragma_once;
+    uint8_t included;
+} CachedFile;
 
 /**
- * @brief Lexes a source file into a list of tokens.
+ * @brief Structure representing a header kept in memory by the compile 
+ * server.
  * 
- * This function reads a file character by character, classifies the 
- * characters into tokens (such as keywords, identifiers, literals, 
- * and symbols), and stores them in a dynamically allocated TokenList.
+ * The header and everything it owns live in arena. Before every reuse 
+ * the file is checked against the device, inode, size and modification 
+ * time it was read with. Its contents are copied rather than mapped, so 
+ * a file truncated under a long-running server cannot fault a later 
+ * read.
+ */
+typedef struct {
+    Arena* arena;
+    SourceBuffer* source;
+    SourceBuffer* cache;
+    TokenList* tokens;
+    uint32_t guard;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+} ResidentHeader;
+
+/**
+ * @brief Structure representing the headers shared by all requests to 
+ * a compile server.
  * 
- * @param filename The name of the file to be lexed.
- * @return A pointer to the TokenList containing the lexed tokens.
- * @note Returns NULL if the file cannot be opened.
+ * header_of_path is indexed by the symbol ID of a header's real path. A 
+ * header that changed on disk is replaced at once, but the old one goes 
+ * on the stale list and is only freed between requests, since files 
+ * still being compiled may hold its tokens.
  */
-TokenList* lex(const char* filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("ERROR: Failed to open file. File may not exist.");
-        return NULL;
-    }
+typedef struct {
+    pthread_mutex_t lock;
+    Arena* arena;
+    ResidentHeader** header_of_path;
+    size_t capacity;
+    ResidentHeader** stale;
+    size_t stale_count;
+    size_t stale_capacity;
+} HeaderCache;
 
-    TokenList* tokens = create_token_list(10);
+/**
+ * @brief Structure representing a macro definition.
+ * 
+ * Body and parameters are kept as tokens and symbols. expanding is 
+ * set while the macro's own expansion is being rescanned, so it is 
+ * not expanded again inside it.
+ */
+typedef struct {
+    Token* body;
+    uint32_t body_count;
+    uint32_t* parameters;
+    uint32_t parameter_count;
+    uint8_t function_like;
+    uint8_t defined;
+    uint8_t expanding;
+} Macro;
 
-    char c;
-    char buffer[256]; // Buffer for identifiers or keywords
-    int buffer_index = 0;
+/**
+ * @brief Structure representing an open #if, #ifdef or #ifndef.
+ */
+typedef struct {
+    Token directive;
+    uint8_t parent_active;
+    uint8_t active;
+    uint8_t taken;
+    uint8_t seen_else;
+} Conditional;
 
-    while ((c = fgetc(file)) != EOF) {
-        if (isspace(c)) {
-            continue;
-        } else if (isalpha(c)) {
-            buffer[buffer_index++] = c;
+/**
+ * @brief Structure representing a growable array of tokens.
+ */
+typedef struct {
+    Token* tokens;
+    size_t count;
+    size_t capacity;
+} TokenBuffer;
 
-            while (isalnum(c = fgetc(file))) {
-                buffer[buffer_index++] = c;
-            }
+/**
+ * @brief Structure representing a stream of tokens being preprocessed.
+ * 
+ * Tokens come from the pending stack first, then from the backing 
+ * source: either the raw tokens of a file, read up to the next 
+ * directive, or a plain array. Macro expansions are pushed onto the 
+ * pending stack in reverse, under an END_OF_FILE marker whose symbol 
+ * is the macro's, so the end of an expansion is seen when the marker 
+ * is popped.
+ */
+typedef struct {
+    TokenBuffer pending;
+    const TokenList* list;
+    uint32_t base;
+    const Token* array;
+    size_t array_count;
+    size_t position;
+} TokenReader;
 
-            buffer[buffer_index] = '\0';
-            //ungetc(c, file);
+/**
+ * @brief Structure representing the state of the preprocessor.
+ * 
+ * file_of_path and macros are indexed by symbol ID: file_of_path maps 
+ * the interned spelling of a path to its file index plus one, or to 
+ * MISSING_FILE; macros holds the definition of every name. Both are 
+ * grown on demand and zero-filled.
+ */
+typedef struct {
+    Arena* arena;
+    Interner* interner;
+    SourceMap* map;
+    TokenList* output;
+    const char* const* include_paths;
+    size_t include_path_count;
+    const char* cache_directory;
+    HeaderCache* headers;
+    CachedFile* files;
+    size_t file_count;
+    size_t file_capacity;
+    uint32_t* file_of_path;
+    size_t file_of_path_capacity;
+    Macro* macros;
+    size_t macro_capacity;
+    Conditional* conditionals;
+    size_t conditional_count;
+    size_t conditional_capacity;
+    size_t conditional_base;
+    TokenBuffer line;
+    size_t depth;
+    uint32_t defined_symbol;
+    int failed;
+} Preprocessor;
 
-            if (strcmp(buffer, "int") == 0) {
-                add_token(tokens, INT_KEYWORD, "int");
-            } else if (strcmp(buffer, "return") == 0) {
-                add_token(tokens, RETURN_KEYWORD, "return");
-            } else {
-                add_token(tokens, IDENTIFIER, buffer);
-            }
+/**
+ * @brief Structure representing a value computed by an #if directive.
+ * 
+ * #if computes in intmax_t and uintmax_t, which are 64 bits here. 
+ * value holds the bits and is_unsigned tells which of the two types 
+ * they have.
+ */
+typedef struct {
+    uint64_t value;
+    int is_unsigned;
+} IfValue;
 
-            buffer_index = 0;
-            for (size_t i = 0; i < sizeof(buffer); i++) {
-                buffer[i] = '\0';
-            }
-        } else if (isdigit(c)) {
-            buffer[buffer_index++] = c;
+/**
+ * @brief Structure representing the state of #if evaluation.
+ * 
+ * unevaluated counts the enclosing && and || operands that are 
+ * skipped by short-circuiting, where division by zero is not an error.
+ */
+typedef struct {
+    Preprocessor* preprocessor;
+    TokenReader reader;
+    Token current;
+    int unevaluated;
+    int failed;
+    const char* message;
+} IfExpression;
 
-            while (isdigit(c = fgetc(file))) {
-                buffer[buffer_index++] = c;
-            }
+/**
+ * @brief Smallest chunk a file is cut into for parallel lexing.
+ */
+#define LEX_CHUNK_SIZE ((size_t)1 << 20)
 
-            buffer[buffer_index] = '\0';
-            ungetc(c, file);
+/**
+ * @brief Structure representing one chunk of a file lexed in parallel.
+ * 
+ * The chunk covers [start, end) of the file. resume is the offset of 
+ * the first token at or after end, which is where lexing of the next 
+ * chunk really begins. After the fix-up pass, tokens[first] onwards 
+ * are the chunk's tokens and output is the index of the first of them 
+ * in the final list.
+ */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint32_t resume;
+    size_t first;
+    size_t output;
+    Token* tokens;
+    size_t count;
+    size_t capacity;
+} LexChunk;
 
-            add_token(tokens, INT_LITERAL, buffer);
-            buffer_index = 0;
-            for (size_t i = 0; i < sizeof(buffer); i++) {
-                buffer[i] = '\0';
+/**
+ * @brief Structure representing a file being lexed in parallel.
+ */
+typedef struct {
+    const SourceBuffer* source;
+    Interner* interner;
+    LexChunk* chunks;
+    TokenList* list;
+} ParallelLex;
+
+/**
+ * @brief Enum representing the kinds of AST nodes.
+ * 
+ * Node 0 of every AST is an AST_NONE node, so an index of 0 can stand 
+ * for "no node" wherever a child is optional or a parse failed.
+ */
+typedef enum {
+    AST_NONE,
+    AST_TRANSLATION_UNIT,
+    AST_FUNCTION,
+    AST_PARAM,
+    AST_BLOCK,
+    AST_RETURN,
+    AST_DECLARATION,
+    AST_IF,
+    AST_WHILE,
+    AST_EXPRESSION_STATEMENT,
+    AST_INT_LITERAL,
+    AST_IDENTIFIER,
+    AST_ASSIGN,
+    AST_UNARY,
+    AST_BINARY,
+    AST_CALL
+} AstKind;
+
+/**
+ * @brief Structure representing a single AST node.
+ * 
+ * Nodes live in one contiguous pool and refer to each other, and to 
+ * the tokens they came from, by 32-bit index. What lhs and rhs mean 
+ * depends on the kind:
+ * 
+ * - AST_TRANSLATION_UNIT: lhs/rhs are the start and count of its 
+ *   functions in the extra array.
+ * - AST_FUNCTION: token is the name; lhs is the body block, or 0 for 
+ *   a declaration without one; rhs is the index in the extra array of 
+ *   the parameter count, followed by the AST_PARAM nodes.
+ * - AST_PARAM: token is the name.
+ * - AST_BLOCK: lhs/rhs are the start and count of its statements in 
+ *   the extra array.
+ * - AST_RETURN: lhs is the returned expression.
+ * - AST_DECLARATION: token is the name; lhs is the initializer, or 0.
+ * - AST_IF: lhs is the condition; rhs is the index in the extra array 
+ *   of the then statement, followed by the else statement or 0.
+ * - AST_WHILE: lhs is the condition; rhs is the body.
+ * - AST_EXPRESSION_STATEMENT: lhs is the expression.
+ * - AST_INT_LITERAL: lhs is the value.
+ * - AST_IDENTIFIER: token is the name.
+ * - AST_ASSIGN: lhs is the AST_IDENTIFIER assigned to; rhs is the value.
+ * - AST_UNARY: token is the operator; lhs is the operand.
+ * - AST_BINARY: token is the operator; lhs and rhs are the operands.
+ * - AST_CALL: token is the callee's name; lhs/rhs are the start and 
+ *   count of its arguments in the extra array.
+ */
+typedef struct {
+    AstKind kind;
+    uint32_t token;
+    uint32_t lhs;
+    uint32_t rhs;
+} AstNode;
+
+/**
+ * @brief Structure representing a parsed translation unit.
+ * 
+ * The Ast holds the node pool and the extra array, which stores the 
+ * child lists of nodes with a variable number of children as runs of 
+ * node indices. Both arrays grow inside the arena.
+ */
+typedef struct {
+    Arena* arena;
+    const TokenList* tokens;
+    AstNode* nodes;
+    size_t node_count;
+    size_t node_capacity;
+    uint32_t* extra;
+    size_t extra_count;
+    size_t extra_capacity;
+    uint32_t root;
+} Ast;
+
+/**
+ * @brief Structure representing the state of the parser.
+ * 
+ * The scratch stack collects the children of the list being parsed; 
+ * once the list is complete they are copied into the extra array as 
+ * one contiguous run, so nested lists never interleave.
+ */
+typedef struct {
+    Ast* ast;
+    const TokenList* tokens;
+    const char* filename;
+    size_t position;
+    uint32_t* scratch;
+    size_t scratch_count;
+    size_t scratch_capacity;
+} Parser;
+
+/**
+ * @brief Enum representing the opcodes of the IR.
+ */
+typedef enum {
+    IR_NOP,
+    IR_CONST,
+    IR_PARAM,
+    IR_COPY,
+    IR_PHI,
+    IR_CALL,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_MOD,
+    IR_EQ,
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+    IR_NEG,
+    IR_NOT,
+    IR_LOGICAL_NOT,
+    IR_JUMP,
+    IR_BRANCH,
+    IR_RETURN
+} IrOpcode;
+
+/**
+ * @brief Structure representing one SSA instruction.
+ * 
+ * An instruction's index in its function is the value it defines, so 
+ * operands are plain indices. The fields used depend on the opcode:
+ * - IR_CONST: imm is the value.
+ * - IR_PARAM: imm is the parameter's position.
+ * - IR_COPY, unary opcodes, IR_BRANCH, IR_RETURN: a is the operand.
+ * - Binary opcodes: a and b are the operands.
+ * - IR_PHI: a/b are the start and count of its operands in the extra 
+ *   array, one per predecessor of its block, in the same order.
+ * - IR_CALL: imm is the callee's symbol ID; a/b are the start and 
+ *   count of its arguments in the extra array.
+ * - IR_JUMP, IR_BRANCH: the targets are the successors of the block; 
+ *   a branch takes the first one when its operand is non-zero.
+ */
+typedef struct {
+    uint8_t op;
+    uint32_t block;
+    uint32_t a;
+    uint32_t b;
+    int32_t imm;
+} IrInstruction;
+
+/**
+ * @brief Structure representing a basic block.
+ * 
+ * Phis are kept apart from the other instructions so that SSA 
+ * construction can add them to a block that already has code. A 
+ * block is sealed once all of its predecessors are known; the phis 
+ * created before that are completed when it is sealed.
+ */
+typedef struct {
+    uint32_t* phis;
+    size_t phi_count;
+    size_t phi_capacity;
+    uint32_t* instructions;
+    size_t instruction_count;
+    size_t instruction_capacity;
+    uint32_t* predecessors;
+    size_t predecessor_count;
+    size_t predecessor_capacity;
+    uint32_t successors[2];
+    size_t successor_count;
+    uint32_t* incomplete_phis;
+    size_t incomplete_phi_count;
+    size_t incomplete_phi_capacity;
+    uint8_t sealed;
+    uint8_t reachable;
+} IrBlock;
+
+/**
+ * @brief Structure representing a function in SSA form.
+ * 
+ * Block 0 is the entry block.
+ */
+typedef struct {
+    uint32_t name;
+    uint32_t token;
+    uint32_t parameter_count;
+    IrInstruction* instructions;
+    size_t instruction_count;
+    size_t instruction_capacity;
+    IrBlock* blocks;
+    size_t block_count;
+    size_t block_capacity;
+    uint32_t* extra;
+    size_t extra_count;
+    size_t extra_capacity;
+} IrFunction;
+
+/**
+ * @brief Structure representing the IR of a translation unit.
+ */
+typedef struct {
+    Arena* arena;
+    const Interner* interner;
+    IrFunction* functions;
+    size_t function_count;
+} IrModule;
+
+/**
+ * @brief Structure binding a name to a variable.
+ * 
+ * variable is the variable's index plus one, so 0 means unbound; depth 
+ * is the scope depth it was declared at.
+ */
+typedef struct {
+    uint32_t variable;
+    uint32_t depth;
+} Binding;
+
+/**
+ * @brief Structure recording a binding hidden by a declaration.
+ */
+typedef struct {
+    uint32_t symbol;
+    Binding previous;
+} ShadowedBinding;
+
+/**
+ * @brief Structure representing the state of AST to IR lowering.
+ * 
+ * bindings is indexed by symbol ID and holds the innermost declaration 
+ * of every name; declarations push the binding they hide onto the 
+ * shadowed stack and leaving a scope pops them back. The definitions 
+ * map holds the value of each (variable, block) pair for SSA 
+ * construction.
+ */
+typedef struct {
+    Arena* arena;
+    Arena* scratch;
+    const Ast* ast;
+    const TokenList* tokens;
+    const char* filename;
+    IrFunction* function;
+    uint32_t current_block;
+    int terminated;
+    int failed;
+    Binding* bindings;
+    ShadowedBinding* shadowed;
+    size_t shadowed_count;
+    size_t shadowed_capacity;
+    uint32_t scope_depth;
+    uint32_t variable_count;
+    uint64_t* definition_keys;
+    uint32_t* definition_values;
+    size_t definition_count;
+    size_t definition_capacity;
+} IrBuilder;
+
+/**
+ * @brief Structure representing a growable output buffer.
+ */
+typedef struct {
+    Arena* arena;
+    char* data;
+    size_t size;
+    size_t capacity;
+} OutputBuffer;
+
+/**
+ * @brief Enum representing the x86-64 general purpose registers.
+ * 
+ * The values are the register numbers used in instruction encodings.
+ */
+typedef enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+} X86Register;
+
+/**
+ * @brief Enum representing the output formats of the emitter.
+ */
+typedef enum {
+    EMIT_ASSEMBLY,
+    EMIT_OBJECT
+} EmitFormat;
+
+/**
+ * @brief Enum representing the condition codes of jcc and setcc.
+ * 
+ * The values are the condition numbers used in instruction encodings.
+ */
+typedef enum {
+    CONDITION_E = 0x4,
+    CONDITION_NE = 0x5,
+    CONDITION_L = 0xc,
+    CONDITION_GE = 0xd,
+    CONDITION_LE = 0xe,
+    CONDITION_G = 0xf,
+    CONDITION_ALWAYS = 0x10
+} X86Condition;
+
+/**
+ * @brief Enum representing the two-operand instructions of emit_alu().
+ */
+typedef enum {
+    ALU_ADD,
+    ALU_SUB,
+    ALU_IMUL,
+    ALU_CMP
+} AluOp;
+
+/**
+ * @brief Enum representing the kinds of instruction operands.
+ */
+typedef enum {
+    LOCATION_NONE,
+    LOCATION_IMMEDIATE,
+    LOCATION_REGISTER,
+    LOCATION_STACK
+} LocationKind;
+
+/**
+ * @brief Structure representing where a value lives.
+ * 
+ * value is the constant, the register number or the offset of the 
+ * stack slot from %rbp, depending on kind.
+ */
+typedef struct {
+    LocationKind kind;
+    int32_t value;
+} Location;
+
+/**
+ * @brief Structure representing a jump whose target is not yet known.
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t label;
+} LabelFixup;
+
+/**
+ * @brief Structure representing a call the linker has to resolve.
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t name;
+} CodeRelocation;
+
+/**
+ * @brief Structure representing a function symbol in the emitted code.
+ */
+typedef struct {
+    uint32_t name;
+    uint32_t offset;
+    uint32_t size;
+} CodeSymbol;
+
+/**
+ * @brief Structure representing a reference from the code to the 
+ * profile data.
+ * 
+ * offset is the position of a rel32 field in the code; addend is the 
+ * offset of the target in the profile data, minus the distance from the 
+ * field to the end of its instruction.
+ */
+typedef struct {
+    uint32_t offset;
+    int32_t addend;
+} DataRelocation;
+
+/**
+ * @brief Version of the profile file format.
+ */
+#define PROFILE_VERSION 1
+
+/**
+ * @brief First bytes of every profile file.
+ */
+#define PROFILE_MAGIC "CCPROF"
+
+/**
+ * @brief x86-64 Linux system call numbers used by the profile writer.
+ */
+#define X86_64_SYS_WRITE 1
+#define X86_64_SYS_OPEN 2
+#define X86_64_SYS_CLOSE 3
+
+/**
+ * @brief Structure representing the header of a profile file.
+ * 
+ * The header is followed by function_count records, each made of a 
+ * ProfileRecord and its counters.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t function_count;
+} ProfileHeader;
+
+/**
+ * @brief Structure representing the profile of one function.
+ * 
+ * name_hash is the hash_bytes() of the function's name and checksum the 
+ * ir_shape_hash() of its IR; they are followed by counter_count 64-bit 
+ * counters, one per block.
+ */
+typedef struct {
+    uint64_t name_hash;
+    uint64_t checksum;
+    uint64_t counter_count;
+} ProfileRecord;
+
+/**
+ * @brief Structure representing a function of a loaded profile.
+ */
+typedef struct {
+    uint64_t name_hash;
+    uint64_t checksum;
+    const uint64_t* counters;
+    uint64_t counter_count;
+} ProfileEntry;
+
+/**
+ * @brief Structure representing a profile read back for -fprofile-use.
+ * 
+ * The entries point into the file and are sorted by name hash.
+ */
+typedef struct {
+    SourceBuffer* file;
+    ProfileEntry* entries;
+    size_t count;
+} ProfileData;
+
+/**
+ * @brief Structure representing the state of the code emitter.
+ * 
+ * The code buffer holds assembly text or raw machine code depending 
+ * on the format. Function symbols and calls are recorded as they are 
+ * emitted so the object writer can build the symbol table and the 
+ * relocations. Labels are local to the current function.
+ * 
+ * With instrument set, profile_data holds the counters of every 
+ * function emitted so far and the code refers to them through 
+ * data_relocations. profile holds the counts read back for 
+ * -fprofile-use, or is NULL.
+ */
+typedef struct {
+    EmitFormat format;
+    Arena* arena;
+    const Interner* interner;
+    OutputBuffer code;
+    CodeSymbol* symbols;
+    size_t symbol_count;
+    size_t symbol_capacity;
+    uint32_t* label_offsets;
+    size_t label_capacity;
+    LabelFixup* fixups;
+    size_t fixup_count;
+    size_t fixup_capacity;
+    CodeRelocation* relocations;
+    size_t relocation_count;
+    size_t relocation_capacity;
+    int instrument;
+    const char* profile_path;
+    OutputBuffer profile_data;
+    uint32_t profile_function_count;
+    uint32_t profile_writer;
+    DataRelocation* data_relocations;
+    size_t data_relocation_count;
+    size_t data_relocation_capacity;
+    const ProfileData* profile;
+} Emitter;
+
+/**
+ * @brief Structure representing a move between two locations.
+ */
+typedef struct {
+    Location destination;
+    Location source;
+} Move;
+
+/**
+ * @brief Structure representing the live interval of a value.
+ * 
+ * start and end are instruction positions in the block layout. hint 
+ * is the register the value would best live in, or -1.
+ */
+typedef struct {
+    uint32_t value;
+    uint32_t start;
+    uint32_t end;
+    double weight;
+    int8_t hint;
+    uint8_t crosses_call;
+} LiveInterval;
+
+/**
+ * @brief Structure representing the state of code generation for one function.
+ * 
+ * Besides the emitter, it holds what register allocation works out 
+ * for the function: the block layout, the loop depth and live-in set 
+ * of every block, the live intervals and, finally, where every value 
+ * lives and which callee-saved registers the prologue has to save. 
+ * block_counts holds how often each block ran when the function has a 
+ * profile, and is NULL otherwise.
+ */
+typedef struct {
+    Emitter* emitter;
+    IrFunction* function;
+    Arena* arena;
+    uint32_t* layout;
+    size_t layout_count;
+    uint32_t* loop_depths;
+    const uint64_t* block_counts;
+    double* block_weights;
+    uint32_t* block_starts;
+    uint32_t* block_ends;
+    uint64_t* live_in;
+    size_t live_words;
+    LiveInterval* intervals;
+    uint32_t* call_positions;
+    size_t call_count;
+    Location* locations;
+    X86Register saved_registers[5];
+    size_t saved_count;
+    int32_t frame_size;
+} FunctionGenerator;
+
+/**
+ * @brief Version of the function cache format.
+ * 
+ * Bump it whenever lowering, the optimizer or the code generator 
+ * changes the code produced for a function.
+ */
+#define FUNCTION_CACHE_VERSION 1
+
+/**
+ * @brief First bytes of every function cache file.
+ */
+#define FUNCTION_CACHE_MAGIC "CCFCODE"
+
+/**
+ * @brief Structure representing the header of a function cache file.
+ * 
+ * The header is followed by code_size bytes of code, then, at 
+ * relocations_offset, relocation_count CachedRelocation entries and 
+ * the characters of the callee names they refer to. file_hash is the 
+ * cache_file_hash() of the file.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t key;
+    uint64_t file_size;
+    uint32_t format;
+    uint32_t code_size;
+    uint32_t relocation_count;
+    uint32_t characters_size;
+    uint64_t relocations_offset;
+    uint64_t characters_offset;
+    uint64_t file_hash;
+} FunctionCacheHeader;
+
+/**
+ * @brief Structure representing a call in a function cache file.
+ * 
+ * offset is relative to the start of the function's code and name 
+ * points into the characters of the file.
+ */
+typedef struct {
+    uint32_t offset;
+    CachedString name;
+} CachedRelocation;
+
+/**
+ * @brief Structure representing the function cache of one translation unit.
+ * 
+ * Every top-level node of the translation unit has a slot, in order. 
+ * defined flags the slots that are function definitions, keys holds 
+ * their fingerprints and entries the mapped cache file of every hit. 
+ * hits flags the same slots as entries so lowering can skip them.
+ */
+typedef struct {
+    Arena* arena;
+    Interner* interner;
+    const char* directory;
+    EmitFormat format;
+    uint32_t* names;
+    uint64_t* keys;
+    SourceBuffer** entries;
+    uint8_t* defined;
+    uint8_t* hits;
+    size_t count;
+} FunctionCache;
+
+/**
+ * @brief Enum representing what the compiler produces for a file.
+ */
+typedef enum {
+    OUTPUT_TOKENS,
+    OUTPUT_AST,
+    OUTPUT_IR,
+    OUTPUT_ASSEMBLY,
+    OUTPUT_OBJECT
+} OutputMode;
+
+/**
+ * @brief Enum representing the formats of the token dump.
+ */
+typedef enum {
+    TOKEN_FORMAT_TEXT,
+    TOKEN_FORMAT_BINARY
+} TokenFormat;
+
+/**
+ * @brief Version of the binary token stream format.
+ */
+#define TOKEN_STREAM_VERSION 1
+
+/**
+ * @brief First bytes of every binary token stream.
+ */
+#define TOKEN_STREAM_MAGIC "CCTOKENS"
+
+/**
+ * @brief Number of bytes a token dump collects before writing them out.
+ */
+#define TOKEN_OUTPUT_FLUSH_SIZE ((size_t)1 << 20)
+
+/**
+ * @brief Structure representing how far line counting got in one file.
+ * 
+ * Tokens mostly come in source order, so each position is found by 
+ * scanning on from the previous one rather than from the start.
+ */
+typedef struct {
+    uint32_t position;
+    uint32_t line;
+    uint32_t line_start;
+} LineCursor;
+
+/**
+ * @brief Enum representing the formats of the time report.
+ */
+typedef enum {
+    REPORT_NONE,
+    REPORT_TEXT,
+    REPORT_JSON
+} ReportFormat;
+
+/**
+ * @brief Enum representing the phases the time report measures.
+ */
+typedef enum {
+    PHASE_READ,
+    PHASE_LEX,
+    PHASE_PREPROCESS,
+    PHASE_PARSE,
+    PHASE_IR,
+    PHASE_OPTIMIZE,
+    PHASE_CODEGEN,
+    PHASE_WRITE,
+    PHASE_COUNT
+} CompilePhase;
+
+/**
+ * @brief Structure representing the time report of one file.
+ * 
+ * Times are in seconds and add up over every stretch a phase runs. 
+ * CPU time is that of the thread compiling the file, so the helper 
+ * threads of a parallel lex count towards wall time only.
+ */
+typedef struct {
+    double wall[PHASE_COUNT];
+    double cpu[PHASE_COUNT];
+    CompilePhase phase;
+    double wall_start;
+    double cpu_start;
+    size_t token_count;
+    size_t byte_count;
+} TimeReport;
+
+/**
+ * @brief Enum representing the token mixes of the benchmark corpora.
+ */
+typedef enum {
+    MIX_IDENTIFIERS,
+    MIX_LITERALS,
+    MIX_COMMENTS,
+    MIX_NESTED,
+    MIX_COUNT
+} CorpusMix;
+
+/**
+ * @brief Enum representing what a benchmark measures.
+ * 
+ * BENCH_LEX times lex() alone; BENCH_PIPELINE times every stage from 
+ * lexing to the finished object file, without writing it.
+ */
+typedef enum {
+    BENCH_LEX,
+    BENCH_PIPELINE,
+    BENCH_KIND_COUNT
+} BenchKind;
+
+/**
+ * @brief Fraction of its baseline throughput a benchmark may lose 
+ * before it counts as a regression.
+ */
+#define BENCH_TOLERANCE 0.10
+
+/**
+ * @brief Structure holding the options of --bench.
+ * 
+ * mix is a CorpusMix, or -1 for every mix. baseline, save and 
+ * corpus_directory are NULL unless given.
+ */
+typedef struct {
+    int enabled;
+    size_t size;
+    int mix;
+    size_t runs;
+    const char* baseline;
+    const char* save;
+    const char* corpus_directory;
+} BenchOptions;
+
+/**
+ * @brief Structure holding the options of one compiler invocation.
+ */
+typedef struct {
+    OutputMode mode;
+    const char* output_path;
+    int optimize;
+    const char** include_paths;
+    size_t include_path_count;
+    size_t thread_count;
+    const char* token_cache;
+    const char* function_cache;
+    ReportFormat time_report;
+    TokenFormat token_format;
+    HeaderCache* headers;
+    size_t error_limit;
+    const char* profile_generate;
+    const char* profile_use;
+} CompileOptions;
+
+/**
+ * @brief Magic bytes at the start of every compile server request.
+ */
+#define SERVER_MAGIC "CCSERVE"
+
+/**
+ * @brief Version of the compile server protocol.
+ */
+#define SERVER_VERSION 1
+
+/**
+ * @brief Largest request body the compile server accepts.
+ */
+#define SERVER_MAX_REQUEST (1 << 20)
+
+/**
+ * @brief Seconds the compile server waits for a client's request.
+ */
+#define SERVER_TIMEOUT 5
+
+/**
+ * @brief Structure representing the fixed part of a compile server 
+ * request.
+ * 
+ * It is sent together with the client's stdout and stderr as SCM_RIGHTS 
+ * descriptors, and followed by length bytes of NUL-terminated strings: 
+ * the client's working directory, then its arguments. The server 
+ * replies with the exit status as an int32_t.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t length;
+} ServerRequest;
+
+/**
+ * @brief Function type of a task run by the thread pool.
+ */
+typedef void (*TaskFunction)(void* context, size_t task);
+
+/**
+ * @brief Structure representing the task deque of one pool worker.
+ * 
+ * A Chase-Lev deque of the task indices in [top, bottom). The owner 
+ * takes tasks from the bottom and other workers steal from the top. 
+ * All tasks are known before the workers start, so nothing is ever 
+ * pushed and the deque needs no storage beyond its two ends. The 
+ * padding keeps each deque on its own cache line.
+ */
+typedef struct {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    char padding[64 - 2 * sizeof(int64_t)];
+} WorkDeque;
+
+/**
+ * @brief Structure representing a work-stealing thread pool.
+ */
+typedef struct {
+    WorkDeque* deques;
+    size_t worker_count;
+    TaskFunction function;
+    void* context;
+} ThreadPool;
+
+/**
+ * @brief Structure representing one thread of a ThreadPool.
+ */
+typedef struct {
+    ThreadPool* pool;
+    size_t index;
+} PoolWorker;
+
+/**
+ * @brief Structure representing the diagnostics reported for one file.
+ * 
+ * Only the thread compiling the file appends to the buffer. Once done 
+ * is set, only the thread printing diagnostics touches it. Each of the 
+ * errors is one line of data.
+ */
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+    size_t errors;
+    _Atomic int done;
+} DiagnosticBuffer;
+
+/**
+ * @brief Structure collecting the diagnostics of one compiler 
+ * invocation.
+ * 
+ * Every file reports into its own buffer, so reporting takes no lock. 
+ * Finished buffers are printed in the order of the files on the 
+ * command line, by whichever thread holds printing; next is the first 
+ * file not printed yet and printed the number of errors printed so far.
+ * 
+ * Printing stops after error_limit errors (0 for no limit) in 
+ * command-line order, so the errors shown do not depend on the 
+ * schedule. Every file after cancel_after can no longer print an error 
+ * and is cancelled: it is set once the files up to it are known to 
+ * hold error_limit errors, either when they are printed or when a 
+ * single file reports that many.
+ */
+typedef struct {
+    DiagnosticBuffer* buffers;
+    size_t file_count;
+    _Atomic size_t next;
+    atomic_flag printing;
+    size_t printed;
+    size_t error_limit;
+    _Atomic size_t cancel_after;
+} Diagnostics;
+
+/**
+ * @brief Structure representing the files of one compiler invocation.
+ */
+typedef struct {
+    const char** filenames;
+    const CompileOptions* options;
+    Interner* interner;
+    int* statuses;
+    Diagnostics* diagnostics;
+} CompileJob;
+
+/**
+ * @brief Structure representing a run of functions compiled by one task.
+ * 
+ * The run covers [first, end) of the functions of a ParallelCodegen. 
+ * Its IR and code live in an arena of its own, and its code is 
+ * generated into an emitter of its own, one symbol per function.
+ */
+typedef struct {
+    size_t first;
+    size_t end;
+    Arena* arena;
+    Emitter emitter;
+    int failed;
+} FunctionRun;
+
+/**
+ * @brief Structure representing a translation unit whose functions are 
+ * compiled in parallel.
+ * 
+ * positions holds the position in the translation unit of every 
+ * function definition to compile, in source order, and redefined flags 
+ * by position the definitions of a name already defined earlier. The 
+ * errors of every run go into their own buffer of diagnostics.
+ */
+typedef struct {
+    const Ast* ast;
+    const char* filename;
+    const Emitter* emitter;
+    const FunctionCache* cache;
+    int optimize;
+    uint32_t* positions;
+    uint8_t* redefined;
+    FunctionRun* runs;
+    Diagnostics* diagnostics;
+} ParallelCodegen;
+
+
+ArenaBlock* create_arena_block(size_t size);
+Arena* create_arena(size_t block_size);
+void free_arena(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+char* arena_strndup(Arena* arena, const char* text, size_t length);
+void* arena_grow_array(Arena* arena, void* array, size_t* capacity, size_t needed, size_t element_size);
+char* read_whole_fd(int fd, size_t size_hint, size_t* length);
+SourceBuffer* read_source_file(const char* filename);
+void free_source_buffer(SourceBuffer* source);
+SourceMap* create_source_map(Arena* arena);
+uint32_t add_source_file(SourceMap* map, const char* name, const char* data, size_t length);
+uint32_t find_source_file(const SourceMap* map, uint32_t offset);
+void build_line_table(Arena* arena, LineTable* table, const char* data, size_t length);
+void find_line_column(Arena* arena, LineTable* table, const char* data, size_t length, uint32_t offset, size_t* line, size_t* column);
+uint32_t hash_string(const char* text, size_t length);
+InternTable* create_intern_table(Arena* arena, size_t slot_count);
+Interner* create_interner(void);
+void free_interner(Interner* interner);
+const InternEntry* intern_entry(const Interner* interner, uint32_t symbol);
+void grow_interner_slots(Interner* interner);
+uint32_t find_interned(const Interner* interner, const InternTable* table, uint32_t hash, const char* text, size_t length, size_t* slot);
+uint32_t intern(Interner* interner, const char* text, size_t length);
+size_t interner_size(const Interner* interner);
+const char* symbol_text(const Interner* interner, uint32_t symbol);
+size_t symbol_length(const Interner* interner, uint32_t symbol);
+TokenList* create_token_list(Arena* arena, Interner* interner, const char* source, size_t source_length);
+int print_tokens(const TokenList* list, FILE* stream);
+void advance_line_cursor(LineCursor* cursor, const char* data, uint32_t offset);
+int write_token_stream(const TokenList* list, const char* filename, FILE* stream);
+uint32_t token_payload_of(const Token* token);
+void add_token(TokenList* list, const Token* token);
+TokenType token_kind(const TokenList* list, size_t index);
+uint32_t token_offset(const TokenList* list, size_t index);
+uint32_t token_payload(const TokenList* list, size_t index);
+uint32_t token_length(const TokenList* list, size_t index);
+Token get_token(const TokenList* list, size_t index);
+char* token_text(Arena* arena, const TokenList* list, size_t index);
+const char* token_chars(const TokenList* list, size_t index);
+void locate_offset(const TokenList* list, uint32_t offset, const char** filename, size_t* line, size_t* column);
+void prepare_line_tables(const TokenList* list);
+TokenType lookup_keyword(const char* text, size_t length);
+void build_lexer_dfa(void);
+uint32_t parse_eight_digits(uint64_t chunk);
+uint32_t int_literal_payload(const char* text, size_t length);
+uint32_t int_literal_length(uint32_t payload);
+int parse_integer_literal(const char* text, size_t length, uint64_t* value);
+size_t backtrack_dfa(const char* src, size_t start, size_t end, TokenType* type);
+void init_lexer(Lexer* lexer, Interner* interner, const SourceBuffer* source);
+Token scan_token(Lexer* lexer);
+Token next_token(Lexer* lexer);
+const Token* peek_token(Lexer* lexer, size_t k);
+TokenList* lex(Arena* arena, Interner* interner, const SourceBuffer* source);
+void resize_token_list(TokenList* list, size_t size);
+void set_token(TokenList* list, size_t index, const Token* token);
+void lex_chunk_from(const ParallelLex* job, LexChunk* chunk, uint32_t start);
+void lex_chunk_task(void* context, size_t task);
+void copy_chunk_task(void* context, size_t task);
+TokenList* lex_parallel(Arena* arena, Interner* interner, const SourceBuffer* source, size_t thread_count);
+const char* scalar_skip_whitespace(const char* p, const char* end);
+const char* scalar_scan_identifier(const char* p, const char* end);
+const char* scalar_find_byte(const char* p, const char* end, char byte);
+void select_scan_kernels(void);
+const char* skip_whitespace(const char* p, const char* end);
+const char* scan_identifier(const char* p, const char* end);
+const char* find_newline(const char* p, const char* end);
+const char* skip_line_comment(const char* p, const char* end);
+const char* skip_block_comment(const char* p, const char* end);
+
+uint64_t hash_bytes(const void* data, size_t length);
+uint64_t token_cache_key(const SourceBuffer* source);
+char* cache_path(Arena* arena, const char* directory, uint64_t key, const char* extension);
+void write_cache_file(Arena* arena, const char* path, const OutputBuffer* out);
+uint64_t cache_file_hash(const char* data, size_t size, size_t header_size);
+TokenList* load_token_cache(Arena* arena, Interner* interner, const char* directory, uint64_t key, const SourceBuffer* source, uint32_t* guard, SourceBuffer** mapping);
+void store_token_cache(Arena* arena, const char* directory, uint64_t key, const TokenList* tokens, uint32_t guard, size_t source_length);
+void* grow_symbol_table(Arena* arena, void* table, size_t* capacity, uint32_t symbol, size_t element_size);
+Macro* find_macro(Preprocessor* preprocessor, uint32_t symbol);
+int macro_defined(const Preprocessor* preprocessor, uint32_t symbol);
+void push_token(Arena* arena, TokenBuffer* buffer, const Token* token);
+const char* pp_token_chars(const Preprocessor* preprocessor, const Token* token);
+int token_is(const Preprocessor* preprocessor, const Token* token, const char* text);
+void vpreprocessor_diagnostic(Preprocessor* preprocessor, int error, uint32_t offset, const char* format, va_list arguments);
+void preprocessor_error(Preprocessor* preprocessor, uint32_t offset, const char* format, ...);
+void preprocessor_warning(Preprocessor* preprocessor, uint32_t offset, const char* format, ...);
+int is_line_start(const char* data, uint32_t offset);
+int newline_between(const char* data, uint32_t from, uint32_t to);
+int raw_token_is(const TokenList* list, size_t index, const char* text);
+int is_directive_start(const TokenList* list, size_t index);
+uint32_t detect_include_guard(const TokenList* list);
+Token reader_next(Preprocessor* preprocessor, TokenReader* reader);
+TokenType reader_peek(Preprocessor* preprocessor, TokenReader* reader);
+void expand_tokens(Preprocessor* preprocessor, const Token* tokens, size_t count, TokenBuffer* out);
+int expand_macro(Preprocessor* preprocessor, TokenReader* reader, const Token* name);
+Token next_expanded_token(Preprocessor* preprocessor, TokenReader* reader);
+void advance_if_expression(IfExpression* expression);
+IfValue parse_if_unary(IfExpression* expression);
+IfValue parse_if_binary(IfExpression* expression, int min_precedence);
+int evaluate_condition(Preprocessor* preprocessor, const Token* directive, const Token* tokens, size_t count);
+int same_macro_definition(const Preprocessor* preprocessor, const Macro* macro, const Macro* new_macro);
+void define_macro(Preprocessor* preprocessor, const Token* directive, const Token* tokens, size_t count);
+char* join_path(Arena* arena, const char* directory, size_t directory_length, const char* name, size_t name_length);
+void set_file_of_path(Preprocessor* preprocessor, uint32_t path, uint32_t value);
+uint32_t add_cached_file(Preprocessor* preprocessor, const char* path, SourceBuffer* source, TokenList* tokens, uint32_t guard, int owned);
+uint32_t load_file(Preprocessor* preprocessor, const char* path);
+uint32_t find_include(Preprocessor* preprocessor, uint32_t including, const char* name, size_t length, int angled);
+void include_file(Preprocessor* preprocessor, uint32_t including, const Token* directive, const Token* tokens, size_t count);
+void push_conditional(Preprocessor* preprocessor, const Token* directive, int parent_active, int value);
+int preprocessor_active(const Preprocessor* preprocessor);
+void handle_directive(Preprocessor* preprocessor, uint32_t file, TokenReader* reader);
+void preprocess_file(Preprocessor* preprocessor, uint32_t file);
+Preprocessor* create_preprocessor(Arena* arena, Interner* interner, const char* const* include_paths, size_t include_path_count, const char* cache_directory, HeaderCache* headers);
+TokenList* preprocess(Preprocessor* preprocessor, const char* filename, SourceBuffer* source, TokenList* tokens);
+void free_preprocessor(Preprocessor* preprocessor);
+Ast* create_ast(Arena* arena, const TokenList* tokens);
+uint32_t add_ast_node(Ast* ast, AstKind kind, uint32_t token, uint32_t lhs, uint32_t rhs);
+void push_scratch(Parser* parser, uint32_t node);
+uint32_t pop_scratch_to_extra(Parser* parser, size_t scratch_start);
+TokenType parser_peek(const Parser* parser);
+void parser_error(const Parser* parser, const char* message);
+int expect_token(Parser* parser, TokenType type, const char* message);
+int binary_precedence(TokenType type);
+uint32_t parse_int_literal(Parser* parser);
+uint32_t parse_call(Parser* parser);
+uint32_t parse_primary(Parser* parser);
+uint32_t parse_unary(Parser* parser);
+uint32_t parse_binary(Parser* parser, int min_precedence);
+uint32_t parse_expression(Parser* parser);
+uint32_t parse_condition(Parser* parser);
+uint32_t parse_statement(Parser* parser);
+uint32_t parse_block(Parser* parser);
+uint32_t parse_parameters(Parser* parser);
+uint32_t parse_function(Parser* parser);
+Ast* parse(Arena* arena, const TokenList* tokens, const char* filename);
+void print_ast_node(const Ast* ast, uint32_t node, int depth);
+void print_ast(const Ast* ast);
+void report_error_at(const TokenList* tokens, const char* filename, size_t token, const char* message);
+uint32_t add_ir_instruction(IrFunction* function, Arena* arena, IrOpcode op, uint32_t block, uint32_t a, uint32_t b, int32_t imm);
+uint32_t add_ir_extra(IrFunction* function, Arena* arena, const uint32_t* values, size_t count);
+uint32_t add_ir_block(IrFunction* function, Arena* arena);
+void push_block_list(Arena* arena, uint32_t** list, size_t* count, size_t* capacity, uint32_t value);
+void add_ir_edge(IrFunction* function, Arena* arena, uint32_t from, uint32_t to);
+void remove_ir_edge(IrFunction* function, uint32_t from, uint32_t to);
+size_t find_definition_slot(const IrBuilder* builder, uint64_t key);
+void write_variable(IrBuilder* builder, uint32_t variable, uint32_t block, uint32_t value);
+uint32_t add_ir_phi(IrBuilder* builder, uint32_t block);
+void add_phi_operands(IrBuilder* builder, uint32_t variable, uint32_t phi);
+uint32_t read_variable(IrBuilder* builder, uint32_t variable, uint32_t block);
+void seal_block(IrBuilder* builder, uint32_t block);
+uint32_t emit_ir(IrBuilder* builder, IrOpcode op, uint32_t a, uint32_t b, int32_t imm);
+void emit_ir_jump(IrBuilder* builder, uint32_t target);
+void emit_ir_branch(IrBuilder* builder, uint32_t condition, uint32_t if_true, uint32_t if_false);
+void switch_to_block(IrBuilder* builder, uint32_t block);
+uint32_t current_ir_block(IrBuilder* builder);
+uint32_t node_symbol(const IrBuilder* builder, uint32_t node);
+void lowering_error(IrBuilder* builder, uint32_t node, const char* format);
+uint32_t declare_variable(IrBuilder* builder, uint32_t node);
+void leave_scope(IrBuilder* builder, size_t shadowed_start);
+uint32_t lower_logical(IrBuilder* builder, uint32_t node, int is_and);
+uint32_t lower_expression(IrBuilder* builder, uint32_t node);
+void lower_statement(IrBuilder* builder, uint32_t node);
+void lower_function(IrBuilder* builder, uint32_t node, IrFunction* function);
+void init_ir_builder(IrBuilder* builder, Arena* arena, const Ast* ast, const char* filename);
+IrModule* lower_to_ir(Arena* arena, const Ast* ast, const char* filename, const uint8_t* skip);
+int ir_operand_count(uint8_t op);
+uint32_t resolve_value(uint32_t* replacements, uint32_t value);
+void rewrite_operands(IrFunction* function, uint32_t* replacements);
+int propagate_copies(IrFunction* function, Arena* arena);
+int fold_operation(IrOpcode op, int32_t a, int32_t b, int32_t* result);
+int fold_constants(IrFunction* function);
+int remove_unreachable_blocks(IrFunction* function, Arena* arena);
+int merge_blocks(IrFunction* function, Arena* arena);
+void split_critical_edges(IrFunction* function, Arena* arena);
+void mark_live(uint8_t* live, uint32_t* stack, size_t* top, uint32_t value);
+int eliminate_dead_code(IrFunction* function, Arena* arena);
+void optimize_function(IrFunction* function, Arena* arena);
+void optimize_module(IrModule* module);
+void print_ir_instruction(const IrModule* module, const IrFunction* function, uint32_t value);
+void print_ir(const IrModule* module);
+void init_output_buffer(OutputBuffer* buffer, Arena* arena, size_t capacity);
+char* reserve_output(OutputBuffer* buffer, size_t count);
+void output_bytes(OutputBuffer* buffer, const void* data, size_t count);
+void output_string(OutputBuffer* buffer, const char* text);
+void output_format(OutputBuffer* buffer, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void output_u8(OutputBuffer* buffer, uint8_t value);
+void output_u32(OutputBuffer* buffer, uint32_t value);
+void output_unsigned(OutputBuffer* buffer, uint64_t value);
+size_t encode_varint(unsigned char* bytes, uint64_t value);
+void output_varint(OutputBuffer* buffer, uint64_t value);
+int flush_output(OutputBuffer* buffer, FILE* stream);
+int finish_stream(FILE* stream);
+void align_output(OutputBuffer* buffer, size_t alignment);
+int write_output_file(const OutputBuffer* buffer, const char* path);
+size_t get_value_operands(const IrFunction* function, const IrInstruction* instruction, uint32_t buffer[2], const uint32_t** operands);
+void compute_block_layout(FunctionGenerator* generator);
+void add_live_out(const FunctionGenerator* generator, uint32_t block, uint64_t* live);
+void compute_liveness(FunctionGenerator* generator);
+void extend_interval(FunctionGenerator* generator, uint32_t value, uint32_t position);
+double use_weight(uint32_t loop_depth);
+void compute_block_weights(FunctionGenerator* generator);
+void build_live_intervals(FunctionGenerator* generator);
+int compare_interval_starts(const void* a, const void* b);
+int reserved_register(int reg);
+int choose_register(const LiveInterval* interval, LiveInterval* const* active);
+double spill_cost(const LiveInterval* interval);
+void allocate_registers(FunctionGenerator* generator);
+void emit_parallel_moves(Emitter* emitter, Move* moves, size_t count);
+Location register_location(X86Register reg);
+Location stack_location(int32_t displacement);
+Location immediate_location(int32_t value);
+void format_location(char* buffer, size_t size, Location location);
+void init_emitter(Emitter* emitter, Arena* arena, const Interner* interner, EmitFormat format);
+void begin_function(Emitter* emitter, uint32_t name, size_t label_count);
+void end_function(Emitter* emitter);
+void emit_modrm(Emitter* emitter, uint16_t opcode, int wide, int reg, Location rm, int byte_registers);
+void emit_mov_imm32(Emitter* emitter, X86Register reg, int32_t value);
+void emit_move(Emitter* emitter, Location destination, Location source);
+void emit_alu(Emitter* emitter, AluOp op, X86Register destination, Location source);
+void emit_immediate(Emitter* emitter, int32_t value, int short_form);
+void emit_unary(Emitter* emitter, int extension, const char* mnemonic, Location operand);
+void emit_cltd(Emitter* emitter);
+void emit_test(Emitter* emitter, X86Register reg);
+const char* condition_name(X86Condition condition);
+void emit_set_condition(Emitter* emitter, X86Condition condition, X86Register reg);
+void bind_label(Emitter* emitter, uint32_t label);
+void emit_label_operand(Emitter* emitter, uint32_t label);
+void emit_jump(Emitter* emitter, X86Condition condition, uint32_t label);
+void emit_call(Emitter* emitter, uint32_t name);
+void emit_syscall(Emitter* emitter, int32_t number);
+void emit_push(Emitter* emitter, X86Register reg);
+void emit_adjust_stack(Emitter* emitter, int32_t amount);
+void emit_prologue(Emitter* emitter, int32_t frame_size);
+void emit_leave(Emitter* emitter);
+void emit_ret(Emitter* emitter);
+int ir_has_value(uint8_t op);
+int same_location(Location a, Location b);
+void emit_save_register(Emitter* emitter, X86Register reg, int32_t displacement, int restore);
+void generate_epilogue(FunctionGenerator* generator);
+void generate_phi_moves(FunctionGenerator* generator, uint32_t block);
+void generate_call(FunctionGenerator* generator, uint32_t value);
+void generate_instruction(FunctionGenerator* generator, uint32_t value, uint32_t next_block);
+void generate_function(Emitter* emitter, IrFunction* function);
+void generate_code(Emitter* emitter, IrModule* module, const FunctionCache* cache);
+void output_section_header(OutputBuffer* buffer, uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size, uint32_t link, uint32_t info, uint64_t alignment, uint64_t entry_size);
+void write_elf_object(const Emitter* emitter, OutputBuffer* out);
+void finish_emitter(Emitter* emitter, OutputBuffer* out);
+uint64_t function_cache_key(const TokenList* tokens, size_t first, size_t end, EmitFormat format, int optimize);
+SourceBuffer* load_cached_function(const FunctionCache* cache, uint64_t key);
+FunctionCache* create_function_cache(Arena* arena, Interner* interner, const char* directory, const Ast* ast, EmitFormat format, int optimize);
+void splice_cached_function(Emitter* emitter, const FunctionCache* cache, size_t index);
+void store_cached_function(const Emitter* emitter, const FunctionCache* cache, size_t index, size_t relocation_start);
+void free_function_cache(FunctionCache* cache);
+size_t append_function_code(Emitter* emitter, const Emitter* fragment, size_t index, size_t relocation);
+void compile_function_run(void* context, size_t task);
+int generate_code_parallel(Emitter* emitter, const Ast* ast, const char* filename, const FunctionCache* cache, int optimize, size_t thread_count);
+char* profile_path(Arena* arena, const char* filename, const char* directory, int absolute);
+uint64_t mix_hash(uint64_t hash, uint64_t value);
+uint64_t ir_shape_hash(const IrFunction* function);
+int compare_profile_entries(const void* a, const void* b);
+int load_profile(Arena* arena, const char* path, ProfileData** profile);
+const uint64_t* find_profile_counts(const ProfileData* profile, const Interner* interner, const IrFunction* function, uint64_t checksum);
+void free_profile(ProfileData* profile);
+int prepare_profiles(Emitter* emitter, const char* filename, const CompileOptions* options, ProfileData** profile);
+void enable_profile_generation(Emitter* emitter, const char* path);
+uint32_t add_profile_record(Emitter* emitter, const IrFunction* function, uint64_t checksum);
+void emit_data_operand(Emitter* emitter, uint32_t offset, int32_t trailing);
+void emit_profile_increment(Emitter* emitter, uint32_t offset);
+void emit_data_address(Emitter* emitter, X86Register reg, uint32_t offset);
+void output_data_directives(OutputBuffer* buffer, const unsigned char* data, size_t size);
+void emit_profile_writer(Emitter* emitter);
+int parse_arguments(int argc, char** argv, CompileOptions* options, BenchOptions* bench, const char** filenames, size_t* file_count, long* jobs);
+int run_compiler(int argc, char** argv, Interner* interner, HeaderCache* headers);
+char* default_output_path(Arena* arena, const char* filename, const char* extension);
+int compile_file(const char* filename, const CompileOptions* options, Interner* interner);
+void compile_task(void* context, size_t task);
+int pop_task(WorkDeque* deque, size_t* task);
+int steal_task(WorkDeque* deque, size_t* task);
+void* run_worker(void* argument);
+double read_clock(clockid_t clock);
+void begin_phase(TimeReport* report, CompilePhase phase);
+void end_phase(TimeReport* report);
+void count_input(TimeReport* report, const TokenList* tokens);
+void print_json_string(FILE* stream, const char* text);
+void print_time_report(const TimeReport* report, const char* filename, const Arena* arena, ReportFormat format);
+uint64_t next_random(uint64_t* state);
+void generate_corpus_function(OutputBuffer* out, CorpusMix mix, size_t index, uint64_t* state);
+void generate_corpus(OutputBuffer* out, CorpusMix mix, size_t size);
+double run_benchmark(BenchKind kind, const SourceBuffer* source, size_t* token_count);
+int compare_doubles(const void* a, const void* b);
+int parse_size(const char* text, size_t* size);
+int run_benchmarks(const BenchOptions* options);
+HeaderCache* create_header_cache(void);
+ResidentHeader* load_resident_header(Interner* interner, const char* path, const char* cache_directory);
+const ResidentHeader* find_resident_header(HeaderCache* cache, Interner* interner, const char* path, const char* cache_directory);
+void free_resident_header(ResidentHeader* header);
+void sweep_header_cache(HeaderCache* cache);
+void free_header_cache(HeaderCache* cache);
+int read_exactly(int fd, void* data, size_t size);
+int write_exactly(int fd, const void* data, size_t size);
+int open_server_socket(const char* path, struct sockaddr_un* address);
+void stop_server(int signal_number);
+int serve_request(int connection, Interner* interner, HeaderCache* headers);
+int run_server(const char* path);
+int run_client(const char* path, int argc, char** argv);
+Diagnostics* create_diagnostics(size_t file_count, size_t error_limit);
+void free_diagnostics(Diagnostics* diagnostics);
+void append_diagnostic(DiagnosticBuffer* buffer, const char* format, va_list arguments);
+void append_diagnostic_format(DiagnosticBuffer* buffer, const char* format, ...);
+void vreport_diagnostic(int error, const char* filename, size_t line, size_t column, const char* format, va_list arguments);
+void vreport_error(const char* filename, size_t line, size_t column, const char* format, va_list arguments);
+void report_error(const char* filename, size_t line, size_t column, const char* format, ...);
+void report_system_error(const char* message);
+int file_cancelled(Diagnostics* diagnostics, size_t file);
+int diagnostics_cancelled(void);
+void cancel_files_after(Diagnostics* diagnostics, size_t file);
+void print_diagnostics(Diagnostics* diagnostics);
+void forward_diagnostics(const DiagnosticBuffer* buffer);
+void begin_diagnostics(Diagnostics* diagnostics, size_t file);
+void finish_diagnostics(Diagnostics* diagnostics, size_t file);
+void run_tasks(size_t task_count, size_t worker_count, TaskFunction function, void* context);
+
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strncmp(argv[1], "--server=", 9) == 0) {
+        return run_server(argv[1] + 9);
+    }
+
+    if (argc > 1 && strncmp(argv[1], "--connect=", 10) == 0) {
+        return run_client(argv[1] + 10, argc - 2, argv + 2);
+    }
+
+    Interner* interner = create_interner();
+    int status = run_compiler(argc, argv, interner, NULL);
+
+    free_interner(interner);
+    return status;
+}
+
+/**
+ * @brief Parses the command line of one compiler invocation.
+ * 
+ * @param argc The number of arguments.
+ * @param argv The arguments; argv[0] is skipped.
+ * @param options A pointer to the CompileOptions to fill in.
+ * @param bench A pointer to the BenchOptions to fill in.
+ * @param filenames Receives the input files; room for argc entries.
+ * @param file_count Receives the number of input files.
+ * @param jobs Receives the value of -j.
+ * @return 1 on success, or 0 after reporting an invalid argument.
+ */
+int parse_arguments(int argc, char** argv, CompileOptions* options, BenchOptions* bench, const char** filenames, size_t* file_count, long* jobs) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump-ast") == 0) {
+            options -> mode = OUTPUT_AST;
+        } else if (strcmp(argv[i], "--emit-tokens=text") == 0 || strcmp(argv[i], "--emit-tokens=bin") == 0) {
+            options -> mode = OUTPUT_TOKENS;
+            options -> token_format = argv[i][14] == 'b' ? TOKEN_FORMAT_BINARY : TOKEN_FORMAT_TEXT;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            options -> mode = OUTPUT_IR;
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            options -> optimize = strcmp(argv[i], "-O0") != 0;
+        } else if (strncmp(argv[i], "--token-cache=", 14) == 0) {
+            options -> token_cache = argv[i] + 14;
+        } else if (strncmp(argv[i], "--function-cache=", 17) == 0) {
+            options -> function_cache = argv[i] + 17;
+        } else if (strcmp(argv[i], "-ftime-report") == 0 || strcmp(argv[i], "-ftime-report=text") == 0) {
+            options -> time_report = REPORT_TEXT;
+        } else if (strcmp(argv[i], "-ftime-report=json") == 0) {
+            options -> time_report = REPORT_JSON;
+        } else if (strcmp(argv[i], "-fprofile-generate") == 0 || strncmp(argv[i], "-fprofile-generate=", 19) == 0) {
+            options -> profile_generate = argv[i][18] ? argv[i] + 19 : "";
+        } else if (strcmp(argv[i], "-fprofile-use") == 0 || strncmp(argv[i], "-fprofile-use=", 14) == 0) {
+            options -> profile_use = argv[i][13] ? argv[i] + 14 : "";
+        } else if (strncmp(argv[i], "-fmax-errors=", 13) == 0) {
+            char* end;
+            long limit = strtol(argv[i] + 13, &end, 10);
+
+            if (!argv[i][13] || *end || limit < 0) {
+                fprintf(stderr, "ERROR: Invalid error limit '%s'.\n", argv[i] + 13);
+                return 0;
+            }
+
+            options -> error_limit = (size_t)limit;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench -> enabled = 1;
+        } else if (strncmp(argv[i], "--bench-size=", 13) == 0) {
+            if (!parse_size(argv[i] + 13, &(bench -> size))) {
+                fprintf(stderr, "ERROR: Invalid benchmark size '%s'.\n", argv[i] + 13);
+                return 0;
+            }
+        } else if (strncmp(argv[i], "--bench-mix=", 12) == 0) {
+            static const char* const mixes[MIX_COUNT] = { "identifiers", "literals", "comments", "nested" };
+
+            bench -> mix = -1;
+            for (int mix = 0; mix < MIX_COUNT; mix++) {
+                if (strcmp(argv[i] + 12, mixes[mix]) == 0) {
+                    bench -> mix = mix;
+                }
+            }
+
+            if (bench -> mix < 0 && strcmp(argv[i] + 12, "all") != 0) {
+                fprintf(stderr, "ERROR: Unknown benchmark mix '%s'.\n", argv[i] + 12);
+                return 0;
+            }
+        } else if (strncmp(argv[i], "--bench-runs=", 13) == 0) {
+            char* end;
+            long runs = strtol(argv[i] + 13, &end, 10);
+
+            if (*end || runs < 1) {
+                fprintf(stderr, "ERROR: Invalid number of benchmark runs '%s'.\n", argv[i] + 13);
+                return 0;
+            }
+
+            bench -> runs = (size_t)runs;
+        } else if (strncmp(argv[i], "--bench-baseline=", 17) == 0) {
+            bench -> baseline = argv[i] + 17;
+        } else if (strncmp(argv[i], "--bench-save=", 13) == 0) {
+            bench -> save = argv[i] + 13;
+        } else if (strncmp(argv[i], "--bench-corpus=", 15) == 0) {
+            bench -> corpus_directory = argv[i] + 15;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            options -> mode = OUTPUT_ASSEMBLY;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            options -> mode = OUTPUT_OBJECT;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            options -> output_path = argv[++i];
+        } else if (strncmp(argv[i], "-I", 2) == 0 && (argv[i][2] || i + 1 < argc)) {
+            options -> include_paths[options -> include_path_count++] = argv[i][2] ? argv[i] + 2 : argv[++i];
+        } else if (strncmp(argv[i], "-j", 2) == 0 && (argv[i][2] || i + 1 < argc)) {
+            const char* value = argv[i][2] ? argv[i] + 2 : argv[++i];
+            char* end;
+
+            *jobs = strtol(value, &end, 10);
+            if (*end || *jobs < 1) {
+                fprintf(stderr, "ERROR: Invalid number of jobs '%s'.\n", value);
+                return 0;
+            }
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "ERROR: Unknown option '%s'.\n", argv[i]);
+            return 0;
+        } else {
+            filenames[(*file_count)++] = argv[i];
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Runs one compiler invocation.
+ * 
+ * @param argc The number of arguments.
+ * @param argv The arguments; argv[0] is skipped.
+ * @param interner A pointer to the Interner to use.
+ * @param headers The compile server's header cache, or NULL when not 
+ * running under the server.
+ * @return The exit status of the invocation.
+ */
+int run_compiler(int argc, char** argv, Interner* interner, HeaderCache* headers) {
+    CompileOptions options = { OUTPUT_TOKENS, NULL, 1, NULL, 0, 1, NULL, NULL, REPORT_NONE, TOKEN_FORMAT_TEXT, headers, 0, NULL, NULL };
+    BenchOptions bench = { 0, (size_t)1 << 20, -1, 5, NULL, NULL, NULL };
+    const char** filenames = malloc(sizeof(const char*) * (size_t)argc);
+    size_t file_count = 0;
+    long jobs = 1;
+
+    options.include_paths = malloc(sizeof(const char*) * (size_t)argc);
+    if (!filenames || !options.include_paths) {
+        perror("ERROR: Failed to allocate argument lists.");
+        exit(EXIT_FAILURE);
+    }
+
+    int status = parse_arguments(argc, argv, &options, &bench, filenames, &file_count, &jobs) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (status == EXIT_SUCCESS && bench.enabled && headers) {
+        fprintf(stderr, "ERROR: --bench cannot be run by the compile server.\n");
+        status = EXIT_FAILURE;
+    } else if (status == EXIT_SUCCESS && bench.enabled) {
+        select_scan_kernels();
+        status = run_benchmarks(&bench);
+    } else if (status == EXIT_SUCCESS && file_count == 0) {
+        perror("ERROR: File not provided.");
+        status = EXIT_FAILURE;
+    } else if (status == EXIT_SUCCESS && file_count > 1 && options.output_path && (options.mode == OUTPUT_ASSEMBLY || options.mode == OUTPUT_OBJECT)) {
+        fprintf(stderr, "ERROR: -o cannot be used with more than one input file.\n");
+        status = EXIT_FAILURE;
+    } else if (status == EXIT_SUCCESS) {
+        // Threads the files cannot use between them go to lexing and 
+        // generating code for each file.
+        options.thread_count = (size_t)jobs > file_count ? (size_t)jobs / file_count : 1;
+
+        select_scan_kernels();
+
+        int* statuses = malloc(sizeof(int) * file_count);
+        Diagnostics* diagnostics = create_diagnostics(file_count, options.error_limit);
+        CompileJob job = { filenames, &options, interner, statuses, diagnostics };
+
+        if (!statuses) {
+            perror("ERROR: Failed to allocate argument lists.");
+            exit(EXIT_FAILURE);
+        }
+
+        run_tasks(file_count, (size_t)jobs, compile_task, &job);
+
+        for (size_t i = 0; i < file_count; i++) {
+            if (statuses[i] != EXIT_SUCCESS) {
+                status = EXIT_FAILURE;
+            }
+        }
+
+        if (atomic_load(&(diagnostics -> cancel_after)) != SIZE_MAX) {
+            fprintf(stderr, "ERROR: Stopped after %zu errors (-fmax-errors=%zu).\n", options.error_limit, options.error_limit);
+        }
+
+        free_diagnostics(diagnostics);
+        free(statuses);
+    }
+
+    free(filenames);
+    free(options.include_paths);
+    return status;
+}
+
+/**
+ * @brief Compiles one file of a CompileJob.
+ * 
+ * Files cancelled by the error limit before they start are skipped.
+ * 
+ * @param context A pointer to the CompileJob.
+ * @param task The index of the file.
+ */
+void compile_task(void* context, size_t task) {
+    CompileJob* job = context;
+
+    if (file_cancelled(job -> diagnostics, task)) {
+        job -> statuses[task] = EXIT_FAILURE;
+    } else {
+        begin_diagnostics(job -> diagnostics, task);
+        job -> statuses[task] = compile_file(job -> filenames[task], job -> options, job -> interner);
+    }
+
+    finish_diagnostics(job -> diagnostics, task);
+}
+
+/**
+ * @brief Derives an output file name from a source file name.
+ * 
+ * Like other C compilers, foo/bar.c becomes bar.s or bar.o in the 
+ * current directory.
+ * 
+ * @param arena A pointer to the Arena the name is allocated from.
+ * @param filename The source file name.
+ * @param extension The extension of the output, including the dot.
+ * @return The output file name.
+ */
+char* default_output_path(Arena* arena, const char* filename, const char* extension) {
+    const char* base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+
+    const char* dot = strrchr(base, '.');
+    size_t stem = dot && dot != base ? (size_t)(dot - base) : strlen(base);
+    char* path = arena_alloc(arena, stem + strlen(extension) + 1);
+
+    memcpy(path, base, stem);
+    strcpy(path + stem, extension);
+
+    return path;
+}
+
+/**
+ * @brief Runs the compiler pipeline on one source file.
+ * 
+ * Every allocation for the file comes from one arena, which is freed 
+ * once the output has been written. Files share nothing but the 
+ * interner, so several can be compiled at once on different threads; 
+ * a dump is written to stdout in one piece. With -ftime-report the 
+ * time spent in each phase is written to stderr at the end.
+ * 
+ * @param filename The name of the source file.
+ * @param options The options of this invocation.
+ * @param interner A pointer to the Interner shared by all files.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if any stage failed.
+ */
+int compile_file(const char* filename, const CompileOptions* options, Interner* interner) {
+    TimeReport report;
+
+    memset(&report, 0, sizeof(report));
+    begin_phase(&report, PHASE_READ);
+
+    SourceBuffer* source = read_source_file(filename);
+    if (!source) {
+        report_error(NULL, 0, 0, "Failed to read '%s': %s.", filename, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    end_phase(&report);
+
+    Arena* arena = create_arena(64 * 1024);
+    Preprocessor* preprocessor = create_preprocessor(arena, interner, options -> include_paths, options -> include_path_count, options -> token_cache, options -> headers);
+
+    begin_phase(&report, PHASE_LEX);
+    TokenList* tokens = lex_parallel(arena, interner, source, options -> thread_count);
+    end_phase(&report);
+
+    int status = EXIT_SUCCESS;
+
+    report.byte_count = source -> length;
+
+    if (!tokens) {
+        report_system_error("Lexing file.");
+        status = EXIT_FAILURE;
+    } else {
+        begin_phase(&report, PHASE_PREPROCESS);
+        tokens = preprocess(preprocessor, filename, source, tokens);
+        end_phase(&report);
+    }
+
+    if (diagnostics_cancelled()) {
+        tokens = NULL;
+    }
+
+    if (tokens) {
+        count_input(&report, tokens);
+    }
+
+    if (!tokens) {
+        status = EXIT_FAILURE;
+    } else if (options -> mode == OUTPUT_TOKENS) {
+        begin_phase(&report, PHASE_WRITE);
+        flockfile(stdout);
+        int written = options -> token_format == TOKEN_FORMAT_BINARY ? write_token_stream(tokens, filename, stdout) : print_tokens(tokens, stdout);
+        if (written < 0 || finish_stream(stdout) < 0) {
+            report_system_error("Failed to write tokens.");
+            status = EXIT_FAILURE;
+        }
+        funlockfile(stdout);
+        end_phase(&report);
+    } else {
+        begin_phase(&report, PHASE_PARSE);
+        Ast* ast = parse(arena, tokens, filename);
+        end_phase(&report);
+
+        if (diagnostics_cancelled()) {
+            ast = NULL;
+        }
+
+        int object = options -> mode == OUTPUT_OBJECT;
+        FunctionCache* cache = NULL;
+        IrModule* module = NULL;
+
+        // Functions are compiled in parallel from the AST, so the time 
+        // spent lowering and optimizing them counts as code generation. 
+        // Counters are numbered in emission order, so instrumenting 
+        // stays serial.
+        int parallel = ast && options -> thread_count > 1 && ast -> nodes[ast -> root].rhs > 1 && !options -> profile_generate && (object || options -> mode == OUTPUT_ASSEMBLY);
+
+        // Cached code holds neither counters nor the effect of a profile.
+        if (ast && options -> function_cache && !options -> profile_generate && !options -> profile_use && (object || options -> mode == OUTPUT_ASSEMBLY)) {
+            begin_phase(&report, PHASE_CODEGEN);
+            cache = create_function_cache(arena, interner, options -> function_cache, ast, object ? EMIT_OBJECT : EMIT_ASSEMBLY, options -> optimize);
+            end_phase(&report);
+        }
+
+        if (ast && options -> mode != OUTPUT_AST && !parallel) {
+            begin_phase(&report, PHASE_IR);
+            module = lower_to_ir(arena, ast, filename, cache ? cache -> hits : NULL);
+            end_phase(&report);
+
+            if (module && options -> optimize) {
+                begin_phase(&report, PHASE_OPTIMIZE);
+                optimize_module(module);
+                end_phase(&report);
+            }
+        }
+
+        if (!ast || (options -> mode != OUTPUT_AST && !parallel && !module)) {
+            status = EXIT_FAILURE;
+        } else if (options -> mode == OUTPUT_AST) {
+            begin_phase(&report, PHASE_WRITE);
+            flockfile(stdout);
+            print_ast(ast);
+            if (finish_stream(stdout) < 0) {
+                report_system_error("Failed to write the AST.");
+                status = EXIT_FAILURE;
+            }
+            funlockfile(stdout);
+            end_phase(&report);
+        } else if (options -> mode == OUTPUT_IR) {
+            begin_phase(&report, PHASE_WRITE);
+            flockfile(stdout);
+            print_ir(module);
+            if (finish_stream(stdout) < 0) {
+                report_system_error("Failed to write the IR.");
+                status = EXIT_FAILURE;
+            }
+            funlockfile(stdout);
+            end_phase(&report);
+        } else {
+            const char* output_path = options -> output_path;
+            Emitter emitter;
+            OutputBuffer output;
+            ProfileData* profile = NULL;
+
+            if (!output_path) {
+                output_path = default_output_path(arena, filename, object ? ".o" : ".s");
+            }
+
+            begin_phase(&report, PHASE_CODEGEN);
+            init_emitter(&emitter, arena, interner, object ? EMIT_OBJECT : EMIT_ASSEMBLY);
+            if (!prepare_profiles(&emitter, filename, options, &profile)) {
+                status = EXIT_FAILURE;
+            } else if (parallel && !generate_code_parallel(&emitter, ast, filename, cache, options -> optimize, options -> thread_count)) {
+                status = EXIT_FAILURE;
+            } else {
+                if (!parallel) {
+                    generate_code(&emitter, module, cache);
+                }
+                finish_emitter(&emitter, &output);
+            }
+            end_phase(&report);
+
+            if (status == EXIT_SUCCESS) {
+                begin_phase(&report, PHASE_WRITE);
+                if (write_output_file(&output, output_path) < 0) {
+                    report_system_error("Failed to write output file.");
+                    status = EXIT_FAILURE;
+                }
+                end_phase(&report);
+            }
+
+            free_profile(profile);
+        }
+
+        free_function_cache(cache);
+    }
+
+    if (options -> time_report != REPORT_NONE) {
+        print_time_report(&report, filename, arena, options -> time_report);
+    }
+
+    free_preprocessor(preprocessor);
+    free_arena(arena);
+    free_source_buffer(source);
+    return status;
+}
+
+/**
+* * TIME REPORT
+* Measures where a compilation spends its time and memory.
+* Each phase is timed with the wall clock and the CPU clock of the 
+* compiling thread; the memory figures come from the counters the 
+* arena keeps anyway.
+*/
+
+/**
+ * @brief Reads a clock.
+ * 
+ * @param clock The clock to read.
+ * @return The time of the clock in seconds.
+ */
+double read_clock(clockid_t clock) {
+    struct timespec time;
+
+    clock_gettime(clock, &time);
+
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Starts timing a phase.
+ * 
+ * @param report A pointer to the TimeReport.
+ * @param phase The phase that starts.
+ */
+void begin_phase(TimeReport* report, CompilePhase phase) {
+    report -> phase = phase;
+    report -> wall_start = read_clock(CLOCK_MONOTONIC);
+    report -> cpu_start = read_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+/**
+ * @brief Stops timing the phase started by the last begin_phase() call.
+ * 
+ * @param report A pointer to the TimeReport.
+ */
+void end_phase(TimeReport* report) {
+    report -> wall[report -> phase] += read_clock(CLOCK_MONOTONIC) - report -> wall_start;
+    report -> cpu[report -> phase] += read_clock(CLOCK_THREAD_CPUTIME_ID) - report -> cpu_start;
+}
+
+/**
+ * @brief Records how much input a translation unit was made of.
+ * 
+ * Included files count towards the bytes as well as the tokens, so 
+ * both rates describe the same input.
+ * 
+ * @param report A pointer to the TimeReport.
+ * @param tokens A pointer to the preprocessed TokenList.
+ */
+void count_input(TimeReport* report, const TokenList* tokens) {
+    report -> token_count = tokens -> size;
+
+    if (tokens -> source_map) {
+        report -> byte_count = 0;
+
+        for (size_t i = 0; i < (tokens -> source_map -> count); i++) {
+            report -> byte_count += tokens -> source_map -> files[i].length;
+        }
+    }
+}
+
+/**
+ * @brief Writes a string to a stream as a JSON string literal.
+ * 
+ * @param stream The stream to write to.
+ * @param text The NUL-terminated string.
+ */
+void print_json_string(FILE* stream, const char* text) {
+    fputc('"', stream);
+
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(stream, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(stream, "\\u%04x", *c);
+        } else {
+            fputc(*c, stream);
+        }
+    }
+
+    fputc('"', stream);
+}
+
+/**
+ * @brief Writes the time report of a file to stderr.
+ * 
+ * The text format is a table meant for people. The JSON format is one 
+ * object on one line per file, so the reports of a whole build can be 
+ * collected and compared by tools.
+ * 
+ * @param report A pointer to the TimeReport.
+ * @param filename The name of the file.
+ * @param arena A pointer to the Arena of the file.
+ * @param format The format of the report.
+ */
+void print_time_report(const TimeReport* report, const char* filename, const Arena* arena, ReportFormat format) {
+    static const char* const phase_names[PHASE_COUNT] = {
+        "read", "lex", "preprocess", "parse", "ir", "optimize", "codegen", "write"
+    };
+
+    double wall = 0;
+    double cpu = 0;
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        wall += report -> wall[i];
+        cpu += report -> cpu[i];
+    }
+
+    // The rates are over the phases that read raw input.
+    double input_time = report -> wall[PHASE_LEX] + report -> wall[PHASE_PREPROCESS];
+    double tokens_per_second = input_time > 0 ? (double)(report -> token_count) / input_time : 0;
+    double bytes_per_second = input_time > 0 ? (double)(report -> byte_count) / input_time : 0;
+
+    flockfile(stderr);
+
+    if (format == REPORT_JSON) {
+        fprintf(stderr, "{\"file\":");
+        print_json_string(stderr, filename);
+        fprintf(stderr, ",\"phases\":{");
+
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(stderr, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", i ? "," : "", phase_names[i], report -> wall[i] * 1e3, report -> cpu[i] * 1e3);
+        }
+
+        fprintf(stderr, "},\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f},", wall * 1e3, cpu * 1e3);
+        fprintf(stderr, "\"tokens\":%zu,\"bytes\":%zu,\"tokens_per_second\":%.0f,\"bytes_per_second\":%.0f,", report -> token_count, report -> byte_count, tokens_per_second, bytes_per_second);
+        fprintf(stderr, "\"allocations\":%zu,\"arena_bytes_used\":%zu,\"arena_bytes_reserved\":%zu}\n", arena -> allocation_count, arena -> bytes_used, arena -> bytes_reserved);
+    } else {
+        fprintf(stderr, "Time report for %s:\n", filename);
+        fprintf(stderr, "  %-12s %12s %12s\n", "phase", "wall (ms)", "cpu (ms)");
+
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(stderr, "  %-12s %12.3f %12.3f\n", phase_names[i], report -> wall[i] * 1e3, report -> cpu[i] * 1e3);
+        }
+
+        fprintf(stderr, "  %-12s %12.3f %12.3f\n", "total", wall * 1e3, cpu * 1e3);
+        fprintf(stderr, "  %zu tokens (%.0f tokens/s), %zu bytes (%.1f MB/s)\n", report -> token_count, tokens_per_second, report -> byte_count, bytes_per_second / 1e6);
+        fprintf(stderr, "  %zu allocations, %zu bytes used, %zu bytes reserved (peak)\n", arena -> allocation_count, arena -> bytes_used, arena -> bytes_reserved);
+    }
+
+    funlockfile(stderr);
+}
+
+/**
+* * TIME REPORT END
+*/
+
+/**
+* * BENCHMARK
+* Synthetic corpora and throughput measurements for --bench.
+* Each corpus is generated in memory from a fixed seed, so every run 
+* of the same build measures the same input. Results can be saved as a 
+* baseline, and a later run compared against it flags regressions.
+*/
+
+/**
+ * @brief Returns the next number of a xorshift64* generator.
+ * 
+ * @param state A pointer to the generator state, which must not be 0.
+ * @return A pseudo-random 64-bit number.
+ */
+uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+/**
+ * @brief Appends one function definition of a corpus.
+ * 
+ * Every mix produces functions the whole pipeline accepts, so the 
+ * same corpora serve the lexer and the end-to-end benchmarks.
+ * 
+ * @param out A pointer to the OutputBuffer holding the corpus.
+ * @param mix The token mix of the corpus.
+ * @param index The index of the function, which keeps names unique.
+ * @param state A pointer to the random generator state.
+ */
+void generate_corpus_function(OutputBuffer* out, CorpusMix mix, size_t index, uint64_t* state) {
+    static const char* const words[] = {
+        "accumulated_total", "current_position", "remaining_budget", "scaled_weight",
+        "previous_result", "element_count", "partial_sum", "loop_counter_value"
+    };
+
+    switch (mix) {
+        case MIX_IDENTIFIERS: {
+            output_format(out, "int compute_identifier_heavy_%zu(int first_parameter_value, int second_parameter_value) {\n", index);
+            output_string(out, "    int running_value = first_parameter_value;\n");
+
+            for (size_t i = 0; i < 8; i++) {
+                const char* word = words[next_random(state) % 8];
+
+                output_format(out, "    int %s_%zu = running_value + second_parameter_value;\n", word, i);
+                output_format(out, "    running_value = %s_%zu - first_parameter_value;\n", word, i);
+            }
+
+            output_string(out, "    return running_value;\n}\n");
+            break;
+        }
+        case MIX_LITERALS:
+            output_format(out, "int literal_%zu(int a) {\n    int s = a;\n", index);
+
+            for (size_t i = 0; i < 8; i++) {
+                output_format(out, "    s = s * %u + %u - %u / %u;\n", (unsigned)(next_random(state) % 100000), (unsigned)(next_random(state) % 10000000), (unsigned)(next_random(state) % 1000000), (unsigned)(next_random(state) % 99 + 1));
+            }
+
+            output_string(out, "    return s;\n}\n");
+            break;
+        case MIX_COMMENTS:
+            output_format(out, "/*\n * Function %zu of the comment-heavy corpus. The text in here is\n * only there to be skipped by the lexer, like license headers and\n * documentation blocks in real code.\n */\n", index);
+            output_format(out, "int commented_%zu(int a) {\n", index);
+
+            for (size_t i = 0; i < 4; i++) {
+                output_format(out, "    // Step %zu adds a constant; the comment is longer than the code.\n", i);
+                output_format(out, "    a = a + %u; /* keep the value moving */\n", (unsigned)(next_random(state) % 1000));
+            }
+
+            output_string(out, "    return a;\n}\n");
+            break;
+        default: {
+            size_t depth = 16 + next_random(state) % 16;
+
+            output_format(out, "int nested_%zu(int a) {\n", index);
+
+            for (size_t i = 0; i < depth; i++) {
+                output_format(out, "%*s%s (a > %zu) {\n", (int)(4 + 2 * i), "", i % 3 == 2 ? "while" : "if", i);
+            }
+
+            output_format(out, "%*sa = a - 1;\n", (int)(4 + 2 * depth), "");
+
+            for (size_t i = depth; i-- > 0;) {
+                output_format(out, "%*s}\n", (int)(4 + 2 * i), "");
+            }
+
+            output_string(out, "    return a;\n}\n");
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Generates a synthetic corpus of at least size bytes.
+ * 
+ * @param out A pointer to an OutputBuffer that receives the corpus.
+ * @param mix The token mix of the corpus.
+ * @param size The size to reach; the last function may go past it.
+ */
+void generate_corpus(OutputBuffer* out, CorpusMix mix, size_t size) {
+    uint64_t state = 0x9e3779b97f4a7c15ull + (uint64_t)mix;
+
+    for (size_t index = 0; out -> size < size; index++) {
+        generate_corpus_function(out, mix, index, &state);
+    }
+}
+
+/**
+ * @brief Runs one benchmark on a corpus once.
+ * 
+ * Every run starts from a fresh arena and interner, so no run benefits 
+ * from the symbols or memory of the one before.
+ * 
+ * @param kind The benchmark to run.
+ * @param source A pointer to the corpus.
+ * @param token_count Receives the number of tokens lexed.
+ * @return The wall time of the run in seconds, or a negative number 
+ * if the corpus failed to compile.
+ */
+double run_benchmark(BenchKind kind, const SourceBuffer* source, size_t* token_count) {
+    Arena* arena = create_arena(64 * 1024);
+    Interner* interner = create_interner();
+    double start = read_clock(CLOCK_MONOTONIC);
+    TokenList* tokens = lex(arena, interner, source);
+    int failed = !tokens;
+
+    if (tokens && kind == BENCH_PIPELINE) {
+        Preprocessor* preprocessor = create_preprocessor(arena, interner, NULL, 0, NULL, NULL);
+        Ast* ast = (tokens = preprocess(preprocessor, "<bench>", (SourceBuffer*)source, tokens)) ? parse(arena, tokens, "<bench>") : NULL;
+        IrModule* module = ast ? lower_to_ir(arena, ast, "<bench>", NULL) : NULL;
+
+        if (module) {
+            Emitter emitter;
+            OutputBuffer output;
+
+            optimize_module(module);
+            init_emitter(&emitter, arena, interner, EMIT_OBJECT);
+            generate_code(&emitter, module, NULL);
+            finish_emitter(&emitter, &output);
+        }
+
+        failed = !module;
+        free_preprocessor(preprocessor);
+    }
+
+    double elapsed = read_clock(CLOCK_MONOTONIC) - start;
+
+    *token_count = tokens ? tokens -> size : 0;
+    free_interner(interner);
+    free_arena(arena);
+
+    return failed ? -1 : elapsed;
+}
+
+/**
+ * @brief Compares two doubles for qsort().
+ */
+int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Parses a size with an optional K, M or G suffix.
+ * 
+ * @param text The text to parse.
+ * @param size Receives the size in bytes.
+ * @return 1 on success, 0 if the text is not a valid size.
+ */
+int parse_size(const char* text, size_t* size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    int shift = 0;
+
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+
+    if (*end || end == text || value == 0 || value > (SIZE_MAX >> shift)) {
+        return 0;
+    }
+
+    *size = (size_t)value << shift;
+    return 1;
+}
+
+/**
+ * @brief Runs the benchmark suite.
+ * 
+ * Each benchmark runs once to warm up and then options -> runs times; 
+ * the best and the median run are reported. Throughput is computed 
+ * from the best run, which is the least disturbed by the rest of the 
+ * machine. A baseline holds one result per line:
+ * 
+ *     <benchmark> <mix> <bytes> <MB/s> <tokens/s>
+ * 
+ * Compared against a baseline, a benchmark regresses when its MB/s 
+ * falls more than BENCH_TOLERANCE below the baseline's.
+ * 
+ * @param options A pointer to the BenchOptions.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if a corpus failed to compile, 
+ * a file could not be used or a benchmark regressed.
+ */
+int run_benchmarks(const BenchOptions* options) {
+    static const char* const mix_names[MIX_COUNT] = { "identifiers", "literals", "comments", "nested" };
+    static const char* const kind_names[BENCH_KIND_COUNT] = { "lex", "pipeline" };
+
+    Arena* arena = create_arena(64 * 1024);
+    double* times = arena_alloc(arena, sizeof(double) * options -> runs);
+    FILE* baseline = options -> baseline ? fopen(options -> baseline, "r") : NULL;
+    FILE* save = options -> save ? fopen(options -> save, "w") : NULL;
+    int status = EXIT_SUCCESS;
+
+    if ((options -> baseline && !baseline) || (options -> save && !save)) {
+        perror("ERROR: Failed to open benchmark baseline.");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-9s %-12s %12s %12s %12s %12s %10s %14s\n", "benchmark", "mix", "bytes", "tokens", "best (ms)", "median (ms)", "MB/s", "tokens/s");
+
+    for (int mix = 0; mix < MIX_COUNT; mix++) {
+        if (options -> mix >= 0 && mix != options -> mix) {
+            continue;
+        }
+
+        Arena* corpus_arena = create_arena(64 * 1024);
+        OutputBuffer corpus;
+
+        init_output_buffer(&corpus, corpus_arena, options -> size + 64 * 1024);
+        generate_corpus(&corpus, (CorpusMix)mix, options -> size);
+
+        SourceBuffer source = { corpus.data, corpus.size, 0 };
+
+        if (options -> corpus_directory) {
+            char name[32];
+            int length = snprintf(name, sizeof(name), "%s.c", mix_names[mix]);
+
+            if (write_output_file(&corpus, join_path(corpus_arena, options -> corpus_directory, strlen(options -> corpus_directory), name, (size_t)length)) < 0) {
+                perror("ERROR: Failed to write benchmark corpus.");
+                status = EXIT_FAILURE;
+            }
+        }
+
+        for (int kind = 0; kind < BENCH_KIND_COUNT; kind++) {
+            size_t token_count = 0;
+
+            if (run_benchmark((BenchKind)kind, &source, &token_count) < 0) {
+                fprintf(stderr, "ERROR: The %s corpus failed to compile.\n", mix_names[mix]);
+                status = EXIT_FAILURE;
+                continue;
+            }
+
+            for (size_t run = 0; run < options -> runs; run++) {
+                times[run] = run_benchmark((BenchKind)kind, &source, &token_count);
+            }
+
+            qsort(times, options -> runs, sizeof(double), compare_doubles);
+
+            double best = times[0];
+            double median = times[options -> runs / 2];
+            double megabytes_per_second = best > 0 ? (double)source.length / best / 1e6 : 0;
+            double tokens_per_second = best > 0 ? (double)token_count / best : 0;
+
+            printf("%-9s %-12s %12zu %12zu %12.3f %12.3f %10.1f %14.0f\n", kind_names[kind], mix_names[mix], source.length, token_count, best * 1e3, median * 1e3, megabytes_per_second, tokens_per_second);
+
+            if (save) {
+                fprintf(save, "%s %s %zu %.3f %.0f\n", kind_names[kind], mix_names[mix], source.length, megabytes_per_second, tokens_per_second);
+            }
+
+            if (baseline) {
+                char kind_name[32];
+                char mix_name[32];
+                size_t bytes;
+                double baseline_megabytes;
+                double baseline_tokens;
+
+                rewind(baseline);
+
+                while (fscanf(baseline, "%31s %31s %zu %lf %lf", kind_name, mix_name, &bytes, &baseline_megabytes, &baseline_tokens) == 5) {
+                    if (strcmp(kind_name, kind_names[kind]) || strcmp(mix_name, mix_names[mix]) || bytes != source.length || baseline_megabytes <= 0) {
+                        continue;
+                    }
+
+                    double change = megabytes_per_second / baseline_megabytes - 1;
+                    int regressed = change < -BENCH_TOLERANCE;
+
+                    printf("    %+.1f%% against the baseline (%.1f MB/s)%s\n", change * 100, baseline_megabytes, regressed ? ", REGRESSION" : "");
+
+                    if (regressed) {
+                        status = EXIT_FAILURE;
+                    }
+                    break;
+                }
+            }
+        }
+
+        free_arena(corpus_arena);
+    }
+
+    if (baseline) {
+        fclose(baseline);
+    }
+
+    if (save && fclose(save) != 0) {
+        perror("ERROR: Failed to write benchmark baseline.");
+        status = EXIT_FAILURE;
+    }
+
+    free_arena(arena);
+    return status;
+}
+
+/**
+* * BENCHMARK END
+*/
+
+/**
+* * COMPILE SERVER
+* A long-running --server=SOCKET process that compiles on behalf of 
+* --connect=SOCKET clients. Requests are served one at a time, with the 
+* client's working directory, arguments, stdout and stderr, but all of 
+* them share one warm interner and one cache of lexed headers, so a 
+* build with many small files pays for process startup and for reading 
+* and lexing each header only once.
+*/
+
+/**
+ * @brief Set by SIGINT and SIGTERM to make run_server() shut down.
+ */
+static volatile sig_atomic_t server_stopping = 0;
+
+/**
+ * @brief Creates an empty header cache.
+ * 
+ * @return A pointer to the HeaderCache.
+ */
+HeaderCache* create_header_cache(void) {
+    HeaderCache* cache = malloc(sizeof(HeaderCache));
+
+    if (!cache) {
+        perror("ERROR: Failed to allocate header cache.");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(cache, 0, sizeof(HeaderCache));
+    pthread_mutex_init(&(cache -> lock), NULL);
+    cache -> arena = create_arena(64 * 1024);
+
+    return cache;
+}
+
+/**
+ * @brief Reads and lexes a header for the header cache.
+ * 
+ * The token cache is used as it is by load_file(), when one is given.
+ * 
+ * @param interner A pointer to the Interner.
+ * @param path The real path of the header.
+ * @param cache_directory The token cache directory, or NULL.
+ * @return A pointer to the new ResidentHeader, or NULL if the header 
+ * cannot be read or lexed.
+ */
+ResidentHeader* load_resident_header(Interner* interner, const char* path, const char* cache_directory) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    SourceBuffer* source = fstat(fd, &info) < 0 ? NULL : malloc(sizeof(SourceBuffer));
+    size_t length = 0;
+    char* data = source ? read_whole_fd(fd, S_ISREG(info.st_mode) ? (size_t)info.st_size : 0, &length) : NULL;
+    close(fd);
+
+    if (!data) {
+        free(source);
+        return NULL;
+    }
+
+    source -> data = data;
+    source -> length = length;
+    source -> mapped = 0;
+
+    Arena* arena = create_arena(64 * 1024);
+    ResidentHeader* header = arena_alloc(arena, sizeof(ResidentHeader));
+    uint64_t key = 0;
+
+    header -> arena = arena;
+    header -> source = source;
+    header -> cache = NULL;
+    header -> tokens = NULL;
+    header -> guard = NO_SYMBOL;
+    header -> device = info.st_dev;
+    header -> inode = info.st_ino;
+    header -> size = info.st_size;
+    header -> modified = info.st_mtim;
+
+    if (cache_directory) {
+        key = token_cache_key(source);
+        header -> tokens = load_token_cache(arena, interner, cache_directory, key, source, &(header -> guard), &(header -> cache));
+    }
+
+    if (!header -> tokens && (header -> tokens = lex(arena, interner, source))) {
+        header -> guard = detect_include_guard(header -> tokens);
+
+        if (cache_directory) {
+            store_token_cache(arena, cache_directory, key, header -> tokens, header -> guard, source -> length);
+        }
+    }
+
+    if (!header -> tokens) {
+        free_resident_header(header);
+        return NULL;
+    }
+
+    return header;
+}
+
+/**
+ * @brief Returns the cached copy of a header, loading it if needed.
+ * 
+ * Headers are keyed by their real path, so the same header reached 
+ * from different working directories or spellings is shared. One 
+ * stat() tells whether the cached copy is still current; a header that 
+ * changed is read and lexed again.
+ * 
+ * @param cache A pointer to the HeaderCache.
+ * @param interner A pointer to the Interner.
+ * @param path The path of the header.
+ * @param cache_directory The token cache directory, or NULL.
+ * @return A pointer to the header, valid until the next call to 
+ * sweep_header_cache(), or NULL if it cannot be loaded.
+ */
+const ResidentHeader* find_resident_header(HeaderCache* cache, Interner* interner, const char* path, const char* cache_directory) {
+    char* real = realpath(path, NULL);
+    struct stat info;
+
+    if (!real) {
+        return NULL;
+    }
+
+    if (stat(real, &info) < 0) {
+        free(real);
+        return NULL;
+    }
+
+    uint32_t symbol = intern(interner, real, strlen(real));
+
+    pthread_mutex_lock(&(cache -> lock));
+
+    ResidentHeader* header = symbol < cache -> capacity ? cache -> header_of_path[symbol] : NULL;
+    int current = header && header -> device == info.st_dev && header -> inode == info.st_ino && header -> size == info.st_size && header -> modified.tv_sec == info.st_mtim.tv_sec && header -> modified.tv_nsec == info.st_mtim.tv_nsec;
+
+    if (!current) {
+        ResidentHeader* loaded = load_resident_header(interner, real, cache_directory);
+
+        if (loaded) {
+            if (header) {
+                cache -> stale = arena_grow_array(cache -> arena, cache -> stale, &(cache -> stale_capacity), cache -> stale_count + 1, sizeof(ResidentHeader*));
+                cache -> stale[cache -> stale_count++] = header;
+            }
+
+            cache -> header_of_path = grow_symbol_table(cache -> arena, cache -> header_of_path, &(cache -> capacity), symbol, sizeof(ResidentHeader*));
+            cache -> header_of_path[symbol] = loaded;
+        }
+
+        header = loaded;
+    }
+
+    pthread_mutex_unlock(&(cache -> lock));
+    free(real);
+
+    return header;
+}
+
+/**
+ * @brief Releases a header and everything it owns.
+ * 
+ * @param header A pointer to the ResidentHeader.
+ */
+void free_resident_header(ResidentHeader* header) {
+    free_source_buffer(header -> source);
+
+    if (header -> cache) {
+        free_source_buffer(header -> cache);
+    }
+
+    free_arena(header -> arena);
+}
+
+/**
+ * @brief Frees the headers that have been replaced since the last call.
+ * 
+ * Must only be called when no file is being compiled.
+ * 
+ * @param cache A pointer to the HeaderCache.
+ */
+void sweep_header_cache(HeaderCache* cache) {
+    for (size_t i = 0; i < cache -> stale_count; i++) {
+        free_resident_header(cache -> stale[i]);
+    }
+
+    cache -> stale_count = 0;
+}
+
+/**
+ * @brief Releases a header cache and all of its headers.
+ * 
+ * @param cache A pointer to the HeaderCache.
+ */
+void free_header_cache(HeaderCache* cache) {
+    sweep_header_cache(cache);
+
+    for (size_t i = 0; i < cache -> capacity; i++) {
+        if (cache -> header_of_path[i]) {
+            free_resident_header(cache -> header_of_path[i]);
+        }
+    }
+
+    pthread_mutex_destroy(&(cache -> lock));
+    free_arena(cache -> arena);
+    free(cache);
+}
+
+/**
+ * @brief Reads exactly size bytes from a socket.
+ * 
+ * @param fd The socket.
+ * @param data The buffer to read into.
+ * @param size The number of bytes to read.
+ * @return 1 on success, or 0 if the peer closed the connection first 
+ * or reading failed.
+ */
+int read_exactly(int fd, void* data, size_t size) {
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t count = read(fd, (char*)data + done, size - done);
+
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            return 0;
+        }
+
+        done += (size_t)count;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Writes exactly size bytes to a socket.
+ * 
+ * A peer that has gone away is reported as a failure instead of raising 
+ * SIGPIPE.
+ * 
+ * @param fd The socket.
+ * @param data The bytes to write.
+ * @param size The number of bytes.
+ * @return 1 on success, or 0 on failure.
+ */
+int write_exactly(int fd, const void* data, size_t size) {
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t count = send(fd, (const char*)data + done, size - done, MSG_NOSIGNAL);
+
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            return 0;
+        }
+
+        done += (size_t)count;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Creates a Unix stream socket and the address of a socket path.
+ * 
+ * @param path The path of the socket.
+ * @param address Receives the address.
+ * @return The socket, or -1 with errno set.
+ */
+int open_server_socket(const char* path, struct sockaddr_un* address) {
+    if (strlen(path) >= sizeof(address -> sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address -> sun_family = AF_UNIX;
+    strcpy(address -> sun_path, path);
+
+    return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+/**
+ * @brief Records that the compile server has been asked to stop.
+ * 
+ * @param signal_number The signal received.
+ */
+void stop_server(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+/**
+ * @brief Serves one request of a compile server.
+ * 
+ * The client's descriptors are installed as stdout and stderr and its 
+ * working directory is entered while the request runs; both are put 
+ * back afterwards. A client that does not send its whole request 
+ * within SERVER_TIMEOUT seconds is dropped, so it cannot hold up the 
+ * clients behind it.
+ * 
+ * @param connection The connection to the client.
+ * @param interner A pointer to the Interner shared by all requests.
+ * @param headers A pointer to the HeaderCache shared by all requests.
+ * @return 1 if the request was served, or 0 if it was malformed.
+ */
+int serve_request(int connection, Interner* interner, HeaderCache* headers) {
+    ServerRequest request;
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec vector = { &request, sizeof(ServerRequest) };
+    struct msghdr message;
+    int descriptors[2] = { -1, -1 };
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+
+    struct timeval timeout = { SERVER_TIMEOUT, 0 };
+
+    if (setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        return 0;
+    }
+
+    ssize_t received = recvmsg(connection, &message, MSG_WAITALL);
+
+    for (struct cmsghdr* header = received > 0 ? CMSG_FIRSTHDR(&message) : NULL; header; header = CMSG_NXTHDR(&message, header)) {
+        if (header -> cmsg_level == SOL_SOCKET && header -> cmsg_type == SCM_RIGHTS) {
+            size_t count = (header -> cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+            for (size_t i = 0; i < count; i++) {
+                int fd;
+
+                memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                if (i < 2 && descriptors[i] < 0) {
+                    descriptors[i] = fd;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    char* body = NULL;
+    int valid = received == (ssize_t)sizeof(ServerRequest) && memcmp(request.magic, SERVER_MAGIC, sizeof(request.magic)) == 0 && request.version == SERVER_VERSION && request.length > 0 && request.length <= SERVER_MAX_REQUEST && descriptors[0] >= 0 && descriptors[1] >= 0;
+
+    if (valid && (body = malloc(request.length)) && read_exactly(connection, body, request.length) && body[request.length - 1] == '\0') {
+        const char* directory = body;
+        size_t argument_count = 0;
+
+        for (size_t i = strlen(body) + 1; i < request.length; i += strlen(body + i) + 1) {
+            argument_count++;
+        }
+
+        char** arguments = malloc(sizeof(char*) * (argument_count + 2));
+        int previous_directory = open(".", O_RDONLY | O_DIRECTORY);
+        int saved_output = dup(STDOUT_FILENO);
+        int saved_error = dup(STDERR_FILENO);
+        int32_t status = EXIT_FAILURE;
+
+        if (!arguments || previous_directory < 0 || saved_output < 0 || saved_error < 0) {
+            perror("ERROR: Failed to set up a compile server request.");
+            exit(EXIT_FAILURE);
+        }
+
+        arguments[0] = "cc";
+        argument_count = 1;
+        for (size_t i = strlen(body) + 1; i < request.length; i += strlen(body + i) + 1) {
+            arguments[argument_count++] = body + i;
+        }
+        arguments[argument_count] = NULL;
+
+        fflush(stdout);
+        fflush(stderr);
+        dup2(descriptors[0], STDOUT_FILENO);
+        dup2(descriptors[1], STDERR_FILENO);
+
+        if (chdir(directory) < 0) {
+            perror("ERROR: Failed to enter the client's working directory.");
+        } else {
+            status = run_compiler((int)argument_count, arguments, interner, headers);
+        }
+
+        fflush(stdout);
+        fflush(stderr);
+        dup2(saved_output, STDOUT_FILENO);
+        dup2(saved_error, STDERR_FILENO);
+
+        if (fchdir(previous_directory) < 0) {
+            perror("ERROR: Failed to leave the client's working directory.");
+            exit(EXIT_FAILURE);
+        }
+
+        close(previous_directory);
+        close(saved_output);
+        close(saved_error);
+        free(arguments);
+
+        write_exactly(connection, &status, sizeof(status));
+    } else {
+        valid = 0;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (descriptors[i] >= 0) {
+            close(descriptors[i]);
+        }
+    }
+
+    free(body);
+    return valid;
+}
+
+/**
+ * @brief Runs a compile server until it receives SIGINT or SIGTERM.
+ * 
+ * A socket left behind by a server that is no longer running is 
+ * replaced; one that still accepts connections is not. The server runs 
+ * whatever its clients ask for with its own rights, so the socket is 
+ * created readable and writable by its owner only.
+ * 
+ * @param path The path of the socket to listen on.
+ * @return The exit status of the server.
+ */
+int run_server(const char* path) {
+    struct sockaddr_un address;
+    int listener = open_server_socket(path, &address);
+    struct stat info;
+
+    if (listener < 0) {
+        perror("ERROR: Failed to create the compile server socket.");
+        return EXIT_FAILURE;
+    }
+
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        if (connect(listener, (struct sockaddr*)&address, sizeof(address)) == 0) {
+            fprintf(stderr, "ERROR: A compile server is already listening on '%s'.\n", path);
+            close(listener);
+            return EXIT_FAILURE;
+        }
+
+        close(listener);
+        unlink(path);
+        listener = open_server_socket(path, &address);
+    }
+
+    mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    int bound = listener >= 0 && bind(listener, (struct sockaddr*)&address, sizeof(address)) == 0;
+
+    umask(mask);
+
+    if (!bound || listen(listener, 64) < 0) {
+        perror("ERROR: Failed to listen on the compile server socket.");
+
+        if (listener >= 0) {
+            close(listener);
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    select_scan_kernels();
+
+    Interner* interner = create_interner();
+    HeaderCache* headers = create_header_cache();
+    int status = EXIT_SUCCESS;
+
+    while (!server_stopping) {
+        int connection = accept(listener, NULL, NULL);
+
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            perror("ERROR: Failed to accept a compile server connection.");
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        serve_request(connection, interner, headers);
+        close(connection);
+        sweep_header_cache(headers);
+    }
+
+    close(listener);
+    unlink(path);
+    free_header_cache(headers);
+    free_interner(interner);
+
+    return status;
+}
+
+/**
+ * @brief Has a compile server run the compiler with the given arguments.
+ * 
+ * @param path The path of the server's socket.
+ * @param argc The number of arguments.
+ * @param argv The arguments, without the program name.
+ * @return The exit status reported by the server.
+ */
+int run_client(const char* path, int argc, char** argv) {
+    struct sockaddr_un address;
+    int connection = open_server_socket(path, &address);
+
+    if (connection < 0 || connect(connection, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("ERROR: Failed to connect to the compile server.");
+
+        if (connection >= 0) {
+            close(connection);
+        }
+
+        return EXIT_FAILURE;
+    }
+
+    char* directory = getcwd(NULL, 0);
+    size_t length = directory ? strlen(directory) + 1 : 0;
+
+    for (int i = 0; i < argc; i++) {
+        length += strlen(argv[i]) + 1;
+    }
+
+    char* body = directory && length <= SERVER_MAX_REQUEST ? malloc(length) : NULL;
+    if (!body) {
+        perror("ERROR: Failed to build the compile server request.");
+        free(directory);
+        close(connection);
+        return EXIT_FAILURE;
+    }
+
+    size_t used = strlen(directory) + 1;
+
+    memcpy(body, directory, used);
+    for (int i = 0; i < argc; i++) {
+        size_t size = strlen(argv[i]) + 1;
+
+        memcpy(body + used, argv[i], size);
+        used += size;
+    }
+
+    ServerRequest request;
+    int descriptors[2] = { STDOUT_FILENO, STDERR_FILENO };
+    union {
+        struct cmsghdr header;
+        char data[CMSG_SPACE(sizeof(descriptors))];
+    } control;
+    struct iovec vector = { &request, sizeof(ServerRequest) };
+    struct msghdr message;
+
+    memset(&request, 0, sizeof(request));
+    memcpy(request.magic, SERVER_MAGIC, sizeof(request.magic));
+    request.version = SERVER_VERSION;
+    request.length = (uint32_t)length;
+
+    memset(&control, 0, sizeof(control));
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header -> cmsg_level = SOL_SOCKET;
+    header -> cmsg_type = SCM_RIGHTS;
+    header -> cmsg_len = CMSG_LEN(sizeof(descriptors));
+    memcpy(CMSG_DATA(header), descriptors, sizeof(descriptors));
+
+    int32_t status = EXIT_FAILURE;
+    int sent = sendmsg(connection, &message, MSG_NOSIGNAL) == (ssize_t)sizeof(ServerRequest) && write_exactly(connection, body, length);
+
+    if (!sent || !read_exactly(connection, &status, sizeof(status))) {
+        fprintf(stderr, "ERROR: The compile server did not complete the request.\n");
+        status = EXIT_FAILURE;
+    }
+
+    free(body);
+    free(directory);
+    close(connection);
+
+    return status;
+}
+
+/**
+* * COMPILE SERVER END
+*/
+
+/**
+* * DIAGNOSTICS
+* Collects the errors of a compiler invocation. Each file's errors go 
+* into a buffer of its own through a thread-local pointer, and are 
+* printed in command-line order as soon as every earlier file is done, 
+* so the output of -j builds is the same however the files are 
+* scheduled. Outside of a compile job errors go straight to stderr.
+*/
+
+/**
+ * @brief The Diagnostics the current thread reports into, or NULL.
+ */
+static _Thread_local Diagnostics* current_diagnostics = NULL;
+
+/**
+ * @brief The file of current_diagnostics the current thread reports 
+ * for.
+ */
+static _Thread_local size_t current_diagnostic_file = 0;
+
+/**
+ * @brief Creates the diagnostics of a compiler invocation.
+ * 
+ * @param file_count The number of files being compiled.
+ * @param error_limit The number of errors to stop after, or 0.
+ * @return A pointer to the new Diagnostics.
+ */
+Diagnostics* create_diagnostics(size_t file_count, size_t error_limit) {
+    Diagnostics* diagnostics = malloc(sizeof(Diagnostics));
+    DiagnosticBuffer* buffers = calloc(file_count, sizeof(DiagnosticBuffer));
+
+    if (!diagnostics || !buffers) {
+        perror("ERROR: Failed to allocate diagnostics.");
+        exit(EXIT_FAILURE);
+    }
+
+    diagnostics -> buffers = buffers;
+    diagnostics -> file_count = file_count;
+    atomic_init(&(diagnostics -> next), 0);
+    atomic_flag_clear(&(diagnostics -> printing));
+    diagnostics -> printed = 0;
+    diagnostics -> error_limit = error_limit;
+    atomic_init(&(diagnostics -> cancel_after), SIZE_MAX);
+
+    return diagnostics;
+}
+
+/**
+ * @brief Releases the diagnostics of a compiler invocation.
+ * 
+ * @param diagnostics A pointer to the Diagnostics.
+ */
+void free_diagnostics(Diagnostics* diagnostics) {
+    for (size_t i = 0; i < diagnostics -> file_count; i++) {
+        free(diagnostics -> buffers[i].data);
+    }
+
+    free(diagnostics -> buffers);
+    free(diagnostics);
+}
+
+/**
+ * @brief Appends formatted text to a diagnostic buffer.
+ * 
+ * @param buffer A pointer to the DiagnosticBuffer.
+ * @param format A printf-style format.
+ * @param arguments The arguments of the format.
+ */
+void append_diagnostic(DiagnosticBuffer* buffer, const char* format, va_list arguments) {
+    va_list copy;
+
+    va_copy(copy, arguments);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+
+    if (length < 0) {
+        return;
+    }
+
+    if (buffer -> size + (size_t)length + 1 > buffer -> capacity) {
+        size_t capacity = buffer -> capacity ? buffer -> capacity : 256;
+
+        while (capacity < buffer -> size + (size_t)length + 1) {
+            capacity *= 2;
+        }
+
+        char* data = realloc(buffer -> data, capacity);
+        if (!data) {
+            perror("ERROR: Failed to allocate diagnostics.");
+            exit(EXIT_FAILURE);
+        }
+
+        buffer -> data = data;
+        buffer -> capacity = capacity;
+    }
+
+    vsnprintf(buffer -> data + buffer -> size, (size_t)length + 1, format, arguments);
+    buffer -> size += (size_t)length;
+}
+
+/**
+ * @brief Appends formatted text to a diagnostic buffer.
+ * 
+ * @param buffer A pointer to the DiagnosticBuffer.
+ * @param format A printf-style format.
+ */
+void append_diagnostic_format(DiagnosticBuffer* buffer, const char* format, ...) {
+    va_list arguments;
+
+    va_start(arguments, format);
+    append_diagnostic(buffer, format, arguments);
+    va_end(arguments);
+}
+
+/**
+ * @brief Cancels every file after the given one.
+ * 
+ * @param diagnostics A pointer to the Diagnostics.
+ * @param file The index of the last file to keep.
+ */
+void cancel_files_after(Diagnostics* diagnostics, size_t file) {
+    size_t after = atomic_load(&(diagnostics -> cancel_after));
+
+    while (file < after && !atomic_compare_exchange_weak(&(diagnostics -> cancel_after), &after, file)) {
+    }
+}
+
+/**
+ * @brief Reports an error or a warning.
+ * 
+ * The message is written as one "ERROR: file:line:column: message" 
+ * line, or "ERROR: message" without a file, with "WARNING: " in place 
+ * of "ERROR: " for a warning. A file's errors past the error limit are 
+ * dropped, since they can never be printed; warnings do not count 
+ * towards the limit.
+ * 
+ * @param error 1 for an error, 0 for a warning.
+ * @param filename The file the diagnostic is in, or NULL.
+ * @param line The line of the diagnostic.
+ * @param column The column of the diagnostic.
+ * @param format A printf-style format for the message.
+ * @param arguments The arguments of the format.
+ */
+void vreport_diagnostic(int error, const char* filename, size_t line, size_t column, const char* format, va_list arguments) {
+    Diagnostics* diagnostics = current_diagnostics;
+    const char* prefix = error ? "ERROR: " : "WARNING: ";
+
+    if (!diagnostics) {
+        flockfile(stderr);
+        fputs(prefix, stderr);
+        if (filename) {
+            fprintf(stderr, "%s:%zu:%zu: ", filename, line, column);
+        }
+        vfprintf(stderr, format, arguments);
+        fputc('\n', stderr);
+        funlockfile(stderr);
+        return;
+    }
+
+    size_t file = current_diagnostic_file;
+    size_t limit = diagnostics -> error_limit;
+    DiagnosticBuffer* buffer = &(diagnostics -> buffers[file]);
+
+    if (error && limit && buffer -> errors >= limit) {
+        return;
+    }
+
+    if (error && ++(buffer -> errors) == limit) {
+        cancel_files_after(diagnostics, file);
+    }
+
+    append_diagnostic_format(buffer, "%s", prefix);
+    if (filename) {
+        append_diagnostic_format(buffer, "%s:%zu:%zu: ", filename, line, column);
+    }
+    append_diagnostic(buffer, format, arguments);
+    append_diagnostic_format(buffer, "\n");
+}
+
+/**
+ * @brief Reports an error; see vreport_diagnostic().
+ */
+void vreport_error(const char* filename, size_t line, size_t column, const char* format, va_list arguments) {
+    vreport_diagnostic(1, filename, line, column, format, arguments);
+}
+
+/**
+ * @brief Reports an error; see vreport_diagnostic().
+ * 
+ * @param filename The file the error is in, or NULL.
+ * @param line The line of the error.
+ * @param column The column of the error.
+ * @param format A printf-style format for the message.
+ */
+void report_error(const char* filename, size_t line, size_t column, const char* format, ...) {
+    va_list arguments;
+
+    va_start(arguments, format);
+    vreport_error(filename, line, column, format, arguments);
+    va_end(arguments);
+}
+
+/**
+ * @brief Reports a failed system call, like perror().
+ * 
+ * @param message The message, followed by the text of errno.
+ */
+void report_system_error(const char* message) {
+    report_error(NULL, 0, 0, "%s: %s", message, strerror(errno));
+}
+
+/**
+ * @brief Tells whether a file is cancelled by the error limit.
+ * 
+ * @param diagnostics A pointer to the Diagnostics.
+ * @param file The index of the file.
+ * @return 1 if the file should not be compiled any further.
+ */
+int file_cancelled(Diagnostics* diagnostics, size_t file) {
+    return file > atomic_load(&(diagnostics -> cancel_after));
+}
+
+/**
+ * @brief Tells whether the current thread's file is cancelled by the 
+ * error limit.
+ * 
+ * @return 1 if the current file should not be compiled any further.
+ */
+int diagnostics_cancelled(void) {
+    return current_diagnostics && file_cancelled(current_diagnostics, current_diagnostic_file);
+}
+
+/**
+ * @brief Prints the diagnostics of every finished file that has no 
+ * unfinished file before it.
+ * 
+ * Only one thread prints at a time, and only while it holds printing; 
+ * a thread that finds it taken returns at once. After letting go the 
+ * printer checks again, so a file finished while it was printing is 
+ * never left behind. Nothing is printed past the error limit.
+ * 
+ * @param diagnostics A pointer to the Diagnostics.
+ */
+void print_diagnostics(Diagnostics* diagnostics) {
+    for (;;) {
+        size_t next = atomic_load(&(diagnostics -> next));
+
+        if (next == diagnostics -> file_count || !atomic_load(&(diagnostics -> buffers[next].done))) {
+            return;
+        }
+
+        if (atomic_flag_test_and_set(&(diagnostics -> printing))) {
+            return;
+        }
+
+        next = atomic_load(&(diagnostics -> next));
+        while (next < diagnostics -> file_count && atomic_load(&(diagnostics -> buffers[next].done))) {
+            DiagnosticBuffer* buffer = &(diagnostics -> buffers[next]);
+            size_t size = buffer -> size;
+            size_t limit = diagnostics -> error_limit;
+
+            if (limit && diagnostics -> printed + buffer -> errors > limit) {
+                size_t lines = diagnostics -> printed < limit ? limit - diagnostics -> printed : 0;
+
+                for (size = 0; lines; size++) {
+                    lines -= buffer -> data[size] == '\n';
+                }
+            }
+
+            if (size) {
+                fwrite(buffer -> data, 1, size, stderr);
+            }
+            diagnostics -> printed += buffer -> errors;
+
+            if (limit && diagnostics -> printed >= limit) {
+                cancel_files_after(diagnostics, next);
+            }
+            free(buffer -> data);
+            buffer -> data = NULL;
+            buffer -> size = 0;
+            buffer -> capacity = 0;
+
+            atomic_store(&(diagnostics -> next), ++next);
+        }
+
+        fflush(stderr);
+        atomic_flag_clear(&(diagnostics -> printing));
+    }
+}
+
+/**
+ * @brief Reports the errors collected in a buffer of other diagnostics 
+ * as the current thread's own.
+ * 
+ * This is how the errors of the tasks a file is split into reach the 
+ * file, once they can be put in order. Every line of the buffer is one 
+ * error and counts towards the error limit like any other.
+ * 
+ * @param buffer A pointer to the DiagnosticBuffer.
+ */
+void forward_diagnostics(const DiagnosticBuffer* buffer) {
+    Diagnostics* diagnostics = current_diagnostics;
+
+    if (!buffer -> size) {
+        return;
+    }
+
+    if (!diagnostics) {
+        flockfile(stderr);
+        fwrite(buffer -> data, 1, buffer -> size, stderr);
+        funlockfile(stderr);
+        return;
+    }
+
+    size_t file = current_diagnostic_file;
+    size_t limit = diagnostics -> error_limit;
+    DiagnosticBuffer* target = &(diagnostics -> buffers[file]);
+    const char* line = buffer -> data;
+    const char* end = buffer -> data + buffer -> size;
+
+    while (line < end && !(limit && target -> errors >= limit)) {
+        const char* newline = memchr(line, '\n', (size_t)(end - line));
+        size_t length = newline ? (size_t)(newline - line) + 1 : (size_t)(end - line);
+
+        if (++(target -> errors) == limit) {
+            cancel_files_after(diagnostics, file);
+        }
+
+        append_diagnostic_format(target, "%.*s", (int)length, line);
+        line += length;
+    }
+}
+
+/**
+ * @brief Makes the current thread report into one file's buffer.
+ * 
+ * @param diagnostics A pointer to the Diagnostics, or NULL to report 
+ * straight to stderr again.
+ * @param file The index of the file.
+ */
+void begin_diagnostics(Diagnostics* diagnostics, size_t file) {
+    current_diagnostics = diagnostics;
+    current_diagnostic_file = file;
+}
+
+/**
+ * @brief Marks a file's diagnostics as complete and prints what can be 
+ * printed.
+ * 
+ * @param diagnostics A pointer to the Diagnostics.
+ * @param file The index of the file.
+ */
+void finish_diagnostics(Diagnostics* diagnostics, size_t file) {
+    begin_diagnostics(NULL, 0);
+    atomic_store(&(diagnostics -> buffers[file].done), 1);
+    print_diagnostics(diagnostics);
+}
+
+/**
+* * DIAGNOSTICS END
+*/
+
+/**
+* * THREAD POOL
+* Runs independent tasks on a fixed set of threads.
+* Tasks are split evenly between the workers up front; a worker that 
+* runs out of its own tasks steals from the others, so one slow task 
+* does not leave the rest of the machine idle.
+*/
+
+/**
+ * @brief Takes a task from the bottom of a worker's own deque.
+ * 
+ * @param deque A pointer to the WorkDeque of the calling worker.
+ * @param task Receives the task index.
+ * @return 1 if a task was taken, 0 if the deque is empty.
+ */
+int pop_task(WorkDeque* deque, size_t* task) {
+    int64_t bottom = atomic_load_explicit(&(deque -> bottom), memory_order_relaxed) - 1;
+
+    atomic_store_explicit(&(deque -> bottom), bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int64_t top = atomic_load_explicit(&(deque -> top), memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&(deque -> bottom), bottom + 1, memory_order_relaxed);
+        return 0;
+    }
+
+    // The last task may be contended; whoever moves top gets it.
+    if (top == bottom) {
+        int won = atomic_compare_exchange_strong_explicit(&(deque -> top), &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+
+        atomic_store_explicit(&(deque -> bottom), bottom + 1, memory_order_relaxed);
+        if (!won) {
+            return 0;
+        }
+    }
+
+    *task = (size_t)bottom;
+    return 1;
+}
+
+/**
+ * @brief Steals a task from the top of another worker's deque.
+ * 
+ * @param deque A pointer to the WorkDeque to steal from.
+ * @param task Receives the task index.
+ * @return 1 if a task was stolen, 0 if the deque is empty, -1 if 
+ * another worker got the task first and the deque may not be empty.
+ */
+int steal_task(WorkDeque* deque, size_t* task) {
+    int64_t top = atomic_load_explicit(&(deque -> top), memory_order_acquire);
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int64_t bottom = atomic_load_explicit(&(deque -> bottom), memory_order_acquire);
+
+    if (top >= bottom) {
+        return 0;
+    }
+
+    if (!atomic_compare_exchange_strong_explicit(&(deque -> top), &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return -1;
+    }
+
+    *task = (size_t)top;
+    return 1;
+}
+
+/**
+ * @brief Runs tasks until every deque of the pool is empty.
+ * 
+ * No task is ever added once the pool is running, so a worker can stop 
+ * as soon as one sweep over the other deques finds them all empty.
+ * 
+ * @param argument A pointer to the PoolWorker.
+ * @return NULL.
+ */
+void* run_worker(void* argument) {
+    PoolWorker* worker = argument;
+    ThreadPool* pool = worker -> pool;
+    size_t task;
+
+    for (;;) {
+        if (pop_task(&(pool -> deques[worker -> index]), &task)) {
+            pool -> function(pool -> context, task);
+            continue;
+        }
+
+        int contended = 0;
+        int stolen = 0;
+
+        for (size_t i = 1; i < (pool -> worker_count) && !stolen; i++) {
+            int result = steal_task(&(pool -> deques[(worker -> index + i) % pool -> worker_count]), &task);
+
+            contended |= result < 0;
+            stolen = result > 0;
+        }
+
+        if (stolen) {
+            pool -> function(pool -> context, task);
+        } else if (!contended) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Runs tasks 0 to task_count - 1 on a work-stealing thread pool.
+ * 
+ * The calling thread is one of the workers. With one worker, or one 
+ * task, everything runs on the calling thread. If a thread cannot be 
+ * started, the other workers steal its tasks.
+ * 
+ * @param task_count The number of tasks.
+ * @param worker_count The number of threads to use.
+ * @param function The function run for every task.
+ * @param context The context passed to every call of function.
+ */
+void run_tasks(size_t task_count, size_t worker_count, TaskFunction function, void* context) {
+    if (worker_count > task_count) {
+        worker_count = task_count;
+    }
+
+    if (worker_count <= 1) {
+        for (size_t i = 0; i < task_count; i++) {
+            function(context, i);
+        }
+        return;
+    }
+
+    ThreadPool pool = { calloc(worker_count, sizeof(WorkDeque)), worker_count, function, context };
+    PoolWorker* workers = malloc(sizeof(PoolWorker) * worker_count);
+    pthread_t* threads = malloc(sizeof(pthread_t) * worker_count);
+    size_t started = 0;
+
+    if (!pool.deques || !workers || !threads) {
+        perror("ERROR: Failed to allocate thread pool.");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        atomic_init(&(pool.deques[i].top), (int64_t)(task_count * i / worker_count));
+        atomic_init(&(pool.deques[i].bottom), (int64_t)(task_count * (i + 1) / worker_count));
+        workers[i].pool = &pool;
+        workers[i].index = i;
+    }
+
+    for (size_t i = 1; i < worker_count; i++) {
+        if (pthread_create(&threads[started], NULL, run_worker, &workers[i]) == 0) {
+            started++;
+        }
+    }
+
+    run_worker(&workers[0]);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(workers);
+    free(pool.deques);
+}
+
+/**
+* * THREAD POOL END
+*/
+
+/**
+* * ARENA
+* Bump allocator that owns the memory of one compilation.
+* Every stage allocates from the arena it is given and nothing is freed 
+* individually, so tearing a compilation down costs one free() per block.
+*/
+
+/**
+ * @brief Allocates a new arena block with room for at least size bytes.
+ * 
+ * @param size The minimum number of usable bytes in the block.
+ * @return A pointer to the new ArenaBlock.
+ */
+ArenaBlock* create_arena_block(size_t size) {
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+
+    if (!block) {
+        perror("ERROR: Failed to allocate arena block.");
+        exit(EXIT_FAILURE);
+    }
+
+    block -> next = NULL;
+    block -> size = size;
+    block -> used = 0;
+
+    return block;
+}
+
+/**
+ * @brief Creates a new arena.
+ * 
+ * The first block is allocated straight away. Later blocks double in 
+ * size, so the number of blocks stays logarithmic in the total memory 
+ * used by the compilation.
+ * 
+ * @param block_size The size of the first block in bytes.
+ * @return A pointer to the newly created Arena.
+ */
+Arena* create_arena(size_t block_size) {
+    Arena* arena = malloc(sizeof(Arena));
+
+    if (!arena) {
+        perror("ERROR: Failed to allocate arena.");
+        exit(EXIT_FAILURE);
+    }
+
+    arena -> current = create_arena_block(block_size);
+    arena -> last_allocation = NULL;
+    arena -> block_size = block_size;
+    arena -> allocation_count = 0;
+    arena -> bytes_used = 0;
+    arena -> bytes_reserved = block_size;
+
+    return arena;
+}
+
+/**
+ * @brief Frees an arena and every allocation made from it.
+ * 
+ * @param arena A pointer to the Arena to be freed.
+ */
+void free_arena(Arena* arena) {
+    ArenaBlock* block = arena -> current;
+
+    while (block) {
+        ArenaBlock* next = block -> next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+/**
+ * @brief Allocates memory from an arena.
+ * 
+ * The returned memory is suitably aligned for any type and stays valid 
+ * until the arena is freed. When the current block is full, a new block 
+ * of at least double the previous size is started.
+ * 
+ * @param arena A pointer to the Arena to allocate from.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the allocated memory.
+ */
+void* arena_alloc(Arena* arena, size_t size) {
+    size_t aligned = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    ArenaBlock* block = arena -> current;
+
+    if ((block -> size - block -> used) < aligned) {
+        size_t block_size = block -> size * 2;
+
+        while (block_size < aligned) {
+            block_size *= 2;
+        }
+
+        block = create_arena_block(block_size);
+        block -> next = arena -> current;
+        arena -> current = block;
+        arena -> bytes_reserved += block_size;
+    }
+
+    void* ptr = (char*)(block -> data) + block -> used;
+
+    block -> used += aligned;
+    arena -> last_allocation = ptr;
+    arena -> allocation_count++;
+    arena -> bytes_used += aligned;
+
+    return ptr;
+}
+
+/**
+ * @brief Grows an allocation made from an arena.
+ * 
+ * If ptr is the most recent allocation and the current block has room, 
+ * the allocation is extended in place. Otherwise a new allocation is 
+ * made and the old contents are copied over; the old memory is simply 
+ * left behind until the arena is freed.
+ * 
+ * @param arena A pointer to the Arena the allocation came from.
+ * @param ptr The allocation to grow, or NULL.
+ * @param old_size The current size of the allocation.
+ * @param new_size The requested size of the allocation.
+ * @return A pointer to the grown allocation.
+ */
+void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    ArenaBlock* block = arena -> current;
+
+    if (ptr && ptr == arena -> last_allocation) {
+        size_t offset = (size_t)((char*)ptr - (char*)(block -> data));
+        size_t aligned = (new_size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+
+        if (offset + aligned <= block -> size) {
+            arena -> bytes_used += (offset + aligned) - (block -> used);
+            block -> used = offset + aligned;
+            return ptr;
+        }
+    }
+
+    void* grown = arena_alloc(arena, new_size);
+
+    if (ptr) {
+        memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    }
+
+    return grown;
+}
+
+/**
+ * @brief Makes room for at least needed elements in an arena-backed array.
+ * 
+ * The capacity doubles (starting at 8) until it is large enough, and 
+ * the array is grown with arena_realloc().
+ * 
+ * @param arena A pointer to the Arena the array lives in.
+ * @param array The array, or NULL if it has not been allocated yet.
+ * @param capacity A pointer to the array's capacity in elements.
+ * @param needed The number of elements the array must hold.
+ * @param element_size The size of one element.
+ * @return A pointer to the (possibly moved) array.
+ */
+void* arena_grow_array(Arena* arena, void* array, size_t* capacity, size_t needed, size_t element_size) {
+    if (array && needed <= *capacity) {
+        return array;
+    }
+
+    size_t old_capacity = array ? *capacity : 0;
+    size_t new_capacity = old_capacity ? old_capacity : 8;
+
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+
+    *capacity = new_capacity;
+    return arena_realloc(arena, array, element_size * old_capacity, element_size * new_capacity);
+}
+
+/**
+ * @brief Copies a string of known length into an arena.
+ * 
+ * @param arena A pointer to the Arena to allocate from.
+ * @param text The characters to copy; they need not be NUL-terminated.
+ * @param length The number of characters to copy.
+ * @return A NUL-terminated copy of the text.
+ */
+char* arena_strndup(Arena* arena, const char* text, size_t length) {
+    char* copy = arena_alloc(arena, length + 1);
+
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    return copy;
+}
+
+/**
+* * ARENA END
+*/
+
+/**
+* * SOURCE INPUT
+* Loads a whole source file into one contiguous buffer so that every 
+* later stage can work on (and point into) the same memory.
+*/
+
+/**
+ * @brief Reads all remaining data from a file descriptor in one go.
+ * 
+ * Used as the fallback when a file cannot be memory-mapped. The buffer 
+ * starts at the size reported by fstat (or 4096 bytes when unknown) and 
+ * doubles until read() reports end of file, so pipes and files that 
+ * grow while being read are read to the end. Interrupted reads are 
+ * retried; any other error is reported, never mistaken for the end of 
+ * the file. The data is treated as plain bytes, NULs included.
+ * 
+ * @param fd The file descriptor to read from.
+ * @param size_hint The expected size of the file, or 0 if unknown.
+ * @param length Receives the number of bytes read.
+ * @return A heap buffer with the file contents, or NULL on failure 
+ * with errno set.
+ */
+char* read_whole_fd(int fd, size_t size_hint, size_t* length) {
+    size_t capacity = size_hint ? size_hint + 1 : 4096;
+    size_t used = 0;
+    char* data = malloc(capacity);
+
+    if (!data) {
+        return NULL;
+    }
+
+    for (;;) {
+        if (used == capacity) {
+            char* grown = capacity <= SIZE_MAX / 2 ? realloc(data, capacity * 2) : NULL;
+
+            if (!grown) {
+                free(data);
+                errno = ENOMEM;
+                return NULL;
+            }
+
+            data = grown;
+            capacity *= 2;
+        }
+
+        ssize_t count = read(fd, data + used, capacity - used);
+
+        if (count == 0) {
+            break;
+        } else if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count < 0) {
+            int error = errno;
+
+            free(data);
+            errno = error;
+            return NULL;
+        }
+
+        used += (size_t)count;
+    }
+
+    *length = used;
+    return data;
+}
+
+/**
+ * @brief Loads a source file into a contiguous buffer.
+ * 
+ * Regular, non-empty files are memory-mapped read-only, so no bytes are 
+ * copied and the kernel pages the file in as the lexer walks it. 
+ * Anything that cannot be mapped is read into a heap buffer with as few 
+ * read() calls as possible.
+ * 
+ * @param filename The name of the file to be loaded.
+ * @return A pointer to the SourceBuffer holding the file contents.
+ * @note Returns NULL with errno set if the file cannot be opened or 
+ * read, or is a directory.
+ */
+SourceBuffer* read_source_file(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        int error = errno;
+
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+
+    if (S_ISDIR(info.st_mode)) {
+        close(fd);
+        errno = EISDIR;
+        return NULL;
+    }
+
+    SourceBuffer* source = malloc(sizeof(SourceBuffer));
+    if (!source) {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+            close(fd);
+
+            source -> data = data;
+            source -> length = (size_t)info.st_size;
+            source -> mapped = 1;
+
+            return source;
+        }
+    }
+
+    size_t size_hint = S_ISREG(info.st_mode) ? (size_t)info.st_size : 0;
+    size_t length = 0;
+    char* data = read_whole_fd(fd, size_hint, &length);
+    int error = errno;
+    close(fd);
+
+    if (!data) {
+        free(source);
+        errno = error;
+        return NULL;
+    }
+
+    source -> data = data;
+    source -> length = length;
+    source -> mapped = 0;
+
+    return source;
+}
+
+/**
+ * @brief Releases a source buffer.
+ * 
+ * Unmaps or frees the file contents depending on how they were loaded, 
+ * then frees the SourceBuffer struct itself. Nothing may point into the 
+ * buffer after this call.
+ * 
+ * @param source A pointer to the SourceBuffer to be freed.
+ */
+void free_source_buffer(SourceBuffer* source) {
+    if (source -> mapped) {
+        munmap((void*)source -> data, source -> length);
+    } else {
+        free((void*)source -> data);
+    }
+
+    free(source);
+}
+
+/**
+ * @brief Creates an empty source map.
+ * 
+ * @param arena The arena the map and its file table are allocated in.
+ * @return A pointer to the SourceMap.
+ */
+SourceMap* create_source_map(Arena* arena) {
+    SourceMap* map = arena_alloc(arena, sizeof(SourceMap));
+
+    map -> arena = arena;
+    map -> files = NULL;
+    map -> count = 0;
+    map -> capacity = 0;
+
+    return map;
+}
+
+/**
+ * @brief Adds a file to a source map.
+ * 
+ * The file gets the range of offsets right after the previous file, 
+ * plus one so the end-of-file position of one file is not the first 
+ * character of the next. Neither name nor data are copied.
+ * 
+ * @param map A pointer to the SourceMap.
+ * @param name The name of the file, used in diagnostics.
+ * @param data The contents of the file.
+ * @param length The length of the contents in bytes.
+ * @return The index of the new file, or UINT32_MAX if the offset space 
+ * is exhausted.
+ */
+uint32_t add_source_file(SourceMap* map, const char* name, const char* data, size_t length) {
+    uint64_t base = 0;
+
+    if (map -> count > 0) {
+        const SourceFile* last = &(map -> files[map -> count - 1]);
+        base = (uint64_t)last -> base + last -> length + 1;
+    }
+
+    if (base + length >= UINT32_MAX) {
+        return UINT32_MAX;
+    }
+
+    map -> files = arena_grow_array(map -> arena, map -> files, &(map -> capacity), map -> count + 1, sizeof(SourceFile));
+
+    SourceFile* file = &(map -> files[map -> count]);
+    file -> name = name;
+    file -> data = data;
+    file -> base = (uint32_t)base;
+    file -> length = (uint32_t)length;
+    memset(&(file -> lines), 0, sizeof(LineTable));
+
+    return (uint32_t)(map -> count++);
+}
+
+/**
+ * @brief Finds the file an offset belongs to.
+ * 
+ * @param map A pointer to a SourceMap holding at least one file.
+ * @param offset An offset in the map.
+ * @return The index of the last file whose base is not past the offset.
+ */
+uint32_t find_source_file(const SourceMap* map, uint32_t offset) {
+    size_t low = 0;
+    size_t high = map -> count;
+
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+
+        if (map -> files[middle].base <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    return (uint32_t)low;
+}
+
+/**
+ * @brief Fills in the line starts of a file.
+ * 
+ * Newlines are found with the byte-search scan kernel, so the file 
+ * is scanned 16 or 32 bytes at a time.
+ * 
+ * @param arena A pointer to the Arena the table is allocated from.
+ * @param table A pointer to the empty LineTable.
+ * @param data The contents of the file.
+ * @param length The length of the file.
+ */
+void build_line_table(Arena* arena, LineTable* table, const char* data, size_t length) {
+    const char* end = data + length;
+
+    table -> starts = arena_grow_array(arena, NULL, &(table -> capacity), length / 32 + 1, sizeof(uint32_t));
+    table -> starts[0] = 0;
+    table -> count = 1;
+
+    for (const char* p = find_newline(data, end); p < end; p = find_newline(p + 1, end)) {
+        table -> starts = arena_grow_array(arena, table -> starts, &(table -> capacity), table -> count + 1, sizeof(uint32_t));
+        table -> starts[table -> count++] = (uint32_t)(p + 1 - data);
+    }
+}
+
+/**
+ * @brief Finds the line and column of an offset in a file.
+ * 
+ * The line table is built on the first call for the file; after that 
+ * every lookup is a binary search. Lines and columns start at 1.
+ * 
+ * @param arena A pointer to the Arena the table is allocated from.
+ * @param table A pointer to the LineTable of the file.
+ * @param data The contents of the file.
+ * @param length The length of the file.
+ * @param offset The offset in the file.
+ * @param line Receives the line number.
+ * @param column Receives the column number.
+ */
+void find_line_column(Arena* arena, LineTable* table, const char* data, size_t length, uint32_t offset, size_t* line, size_t* column) {
+    if (!table -> starts) {
+        build_line_table(arena, table, data, length);
+    }
+
+    size_t low = 0;
+    size_t high = table -> count;
+
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+
+        if (table -> starts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    *line = low + 1;
+    *column = offset - table -> starts[low] + 1;
+}
+
+/**
+* * SOURCE INPUT END
+*/
+
+/**
+* * INTERNER
+* Maps identifier text to stable symbol IDs.
+* A name is hashed and copied once, the first time it is seen; after 
+* that it is represented by its ID everywhere.
+*/
+
+/**
+ * @brief Hashes a string of known length.
+ * 
+ * Uses 32-bit FNV-1a, which is cheap for the short strings identifiers 
+ * usually are and spreads well enough for linear probing.
+ * 
+ * @param text The characters to hash; they need not be NUL-terminated.
+ * @param length The number of characters to hash.
+ * @return The hash of the string.
+ */
+uint32_t hash_string(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Allocates an empty interner hash table.
+ * 
+ * @param arena A pointer to the Arena to allocate from.
+ * @param slot_count The number of slots, a power of two.
+ * @return A pointer to the new InternTable.
+ */
+InternTable* create_intern_table(Arena* arena, size_t slot_count) {
+    InternTable* table = arena_alloc(arena, sizeof(InternTable) + sizeof(uint64_t) * slot_count);
+
+    table -> slot_count = slot_count;
+    for (size_t i = 0; i < slot_count; i++) {
+        atomic_init(&(table -> slots[i]), 0);
+    }
+
+    return table;
+}
+
+/**
+ * @brief Creates a new, empty string interner.
+ * 
+ * The interner has its own arena because interned names outlive the 
+ * translation unit they were first seen in.
+ * 
+ * @return A pointer to the newly created Interner.
+ */
+Interner* create_interner(void) {
+    Interner* interner = malloc(sizeof(Interner));
+
+    if (!interner) {
+        perror("ERROR: Failed to allocate interner.");
+        exit(EXIT_FAILURE);
+    }
+
+    interner -> arena = create_arena(64 * 1024);
+    pthread_mutex_init(&(interner -> lock), NULL);
+    atomic_init(&(interner -> table), create_intern_table(interner -> arena, 1024));
+    atomic_init(&(interner -> size), 0);
+
+    for (size_t i = 0; i < INTERN_SEGMENT_COUNT; i++) {
+        atomic_init(&(interner -> segments[i]), NULL);
+    }
+
+    return interner;
+}
+
+/**
+ * @brief Frees a string interner and every string interned in it.
+ * 
+ * @param interner A pointer to the Interner to be freed.
+ */
+void free_interner(Interner* interner) {
+    pthread_mutex_destroy(&(interner -> lock));
+    free_arena(interner -> arena);
+    free(interner);
+}
+
+/**
+ * @brief Returns the entry of a symbol.
+ * 
+ * @param interner A pointer to the Interner the symbol belongs to.
+ * @param symbol The symbol ID.
+ * @return A pointer to the InternEntry of the symbol.
+ */
+const InternEntry* intern_entry(const Interner* interner, uint32_t symbol) {
+    uint32_t segment = 31 - (uint32_t)__builtin_clz((symbol >> INTERN_SEGMENT_SHIFT) + 1);
+    uint32_t first = ((1u << segment) - 1) << INTERN_SEGMENT_SHIFT;
+    const InternEntry* entries = atomic_load_explicit(&(interner -> segments[segment]), memory_order_acquire);
+
+    return &(entries[symbol - first]);
+}
+
+/**
+ * @brief Doubles the number of hash slots in an interner.
+ * 
+ * Entries keep their precomputed hash, so rehashing never touches the 
+ * string data. Must be called with the interner's lock held.
+ * 
+ * @param interner A pointer to the Interner to be grown.
+ */
+void grow_interner_slots(Interner* interner) {
+    const InternTable* old_table = atomic_load_explicit(&(interner -> table), memory_order_relaxed);
+    InternTable* table = create_intern_table(interner -> arena, old_table -> slot_count * 2);
+    size_t mask = table -> slot_count - 1;
+    size_t size = atomic_load_explicit(&(interner -> size), memory_order_relaxed);
+
+    for (size_t symbol = 0; symbol < size; symbol++) {
+        uint32_t hash = intern_entry(interner, (uint32_t)symbol) -> hash;
+        size_t slot = hash & mask;
+
+        while (atomic_load_explicit(&(table -> slots[slot]), memory_order_relaxed)) {
+            slot = (slot + 1) & mask;
+        }
+
+        atomic_store_explicit(&(table -> slots[slot]), ((uint64_t)hash << 32) | (symbol + 1), memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&(interner -> table), table, memory_order_release);
+}
+
+/**
+ * @brief Looks a string up in one interner table.
+ * 
+ * @param interner A pointer to the Interner.
+ * @param table A pointer to the InternTable to probe.
+ * @param hash The hash of the string.
+ * @param text The characters of the string.
+ * @param length The number of characters.
+ * @param slot Receives the empty slot the probe ended at, if any.
+ * @return The symbol ID of the string, or NO_SYMBOL if the table does 
+ * not hold it.
+ */
+uint32_t find_interned(const Interner* interner, const InternTable* table, uint32_t hash, const char* text, size_t length, size_t* slot) {
+    size_t mask = table -> slot_count - 1;
+    size_t i = hash & mask;
+
+    for (;;) {
+        uint64_t value = atomic_load_explicit(&(table -> slots[i]), memory_order_acquire);
+
+        if (!value) {
+            *slot = i;
+            return NO_SYMBOL;
+        }
+
+        if ((uint32_t)(value >> 32) == hash) {
+            uint32_t symbol = (uint32_t)value - 1;
+            const InternEntry* entry = intern_entry(interner, symbol);
+
+            if (entry -> length == length && memcmp(entry -> text, text, length) == 0) {
+                return symbol;
+            }
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+/**
+ * @brief Interns a string and returns its symbol ID.
+ * 
+ * Looking up a string that has been seen before costs one hash and, 
+ * in the common case, one memcmp, and takes no lock. A new string is 
+ * copied into the interner's arena and given the next free symbol ID 
+ * under the interner's lock. Safe to call from any thread.
+ * 
+ * @param interner A pointer to the Interner to use.
+ * @param text The characters to intern; they need not be NUL-terminated.
+ * @param length The number of characters to intern.
+ * @return The symbol ID of the string.
+ */
+uint32_t intern(Interner* interner, const char* text, size_t length) {
+    uint32_t hash = hash_string(text, length);
+    size_t slot;
+    uint32_t symbol = find_interned(interner, atomic_load_explicit(&(interner -> table), memory_order_acquire), hash, text, length, &slot);
+
+    if (symbol != NO_SYMBOL) {
+        return symbol;
+    }
+
+    pthread_mutex_lock(&(interner -> lock));
+
+    // Another thread may have added the string, or replaced the table, 
+    // since the lookup above.
+    InternTable* table = atomic_load_explicit(&(interner -> table), memory_order_relaxed);
+    symbol = find_interned(interner, table, hash, text, length, &slot);
+
+    if (symbol == NO_SYMBOL) {
+        size_t size = atomic_load_explicit(&(interner -> size), memory_order_relaxed);
+        uint32_t segment = 31 - (uint32_t)__builtin_clz((uint32_t)(size >> INTERN_SEGMENT_SHIFT) + 1);
+
+        if (!atomic_load_explicit(&(interner -> segments[segment]), memory_order_relaxed)) {
+            size_t segment_size = (size_t)1 << (INTERN_SEGMENT_SHIFT + segment);
+            atomic_store_explicit(&(interner -> segments[segment]), arena_alloc(interner -> arena, sizeof(InternEntry) * segment_size), memory_order_release);
+        }
+
+        symbol = (uint32_t)size;
+        InternEntry* entry = (InternEntry*)intern_entry(interner, symbol);
+
+        entry -> text = arena_strndup(interner -> arena, text, length);
+        entry -> length = (uint32_t)length;
+        entry -> hash = hash;
+
+        atomic_store_explicit(&(interner -> size), size + 1, memory_order_release);
+        atomic_store_explicit(&(table -> slots[slot]), ((uint64_t)hash << 32) | (symbol + 1), memory_order_release);
+
+        // Keep the table at most half full so probe sequences stay short.
+        if ((size + 1) * 2 > table -> slot_count) {
+            grow_interner_slots(interner);
+        }
+    }
+
+    pthread_mutex_unlock(&(interner -> lock));
+    return symbol;
+}
+
+/**
+ * @brief Returns the number of symbols interned so far.
+ * 
+ * Every symbol ID handed out before the call is below the result, so 
+ * it can size tables indexed by the symbols of a translation unit.
+ * 
+ * @param interner A pointer to the Interner.
+ * @return The number of symbols.
+ */
+size_t interner_size(const Interner* interner) {
+    return atomic_load_explicit(&(interner -> size), memory_order_acquire);
+}
+
+/**
+ * @brief Returns the text of an interned symbol.
+ * 
+ * @param interner A pointer to the Interner the symbol belongs to.
+ * @param symbol The symbol ID.
+ * @return The NUL-terminated text of the symbol, owned by the interner.
+ */
+const char* symbol_text(const Interner* interner, uint32_t symbol) {
+    return intern_entry(interner, symbol) -> text;
+}
+
+/**
+ * @brief Returns the length of an interned symbol's text.
+ * 
+ * @param interner A pointer to the Interner the symbol belongs to.
+ * @param symbol The symbol ID.
+ * @return The number of characters in the symbol's text.
+ */
+size_t symbol_length(const Interner* interner, uint32_t symbol) {
+    return intern_entry(interner, symbol) -> length;
+}
+
+/**
+* * INTERNER END
+*/
+
+/**
+* * LEXER
+* First stage.
+* Performs lexical analysis on file content and generates a list of tokens.
+*/
+
+/**
+ * @brief Creates a new, empty token list.
+ * 
+ * Allocates a TokenList and its chunk tables from the arena. No chunk 
+ * is allocated until the first token is added. The list lives as long 
+ * as the arena does.
+ * 
+ * @param arena A pointer to the Arena the list is allocated from.
+ * @param interner A pointer to the Interner identifier tokens refer to.
+ * @param source The source text the tokens of this list will span.
+ * @param source_length The length of the source text.
+ * @return A pointer to the newly created TokenList.
+ */
+TokenList* create_token_list(Arena* arena, Interner* interner, const char* source, size_t source_length) {
+    TokenList* list = arena_alloc(arena, sizeof(TokenList));
+
+    list -> arena = arena;
+    list -> interner = interner;
+    list -> source = source;
+    list -> source_length = source_length;
+    list -> lines = arena_alloc(arena, sizeof(LineTable));
+    list -> source_map = NULL;
+    memset(list -> lines, 0, sizeof(LineTable));
+    list -> size = 0;
+    list -> chunk_count = 0;
+    list -> chunk_capacity = 16;
+    list -> kinds = arena_alloc(arena, sizeof(uint8_t*) * list -> chunk_capacity);
+    list -> offsets = arena_alloc(arena, sizeof(uint32_t*) * list -> chunk_capacity);
+    list -> payloads = arena_alloc(arena, sizeof(uint32_t*) * list -> chunk_capacity);
+
+    return list;
+}
+
+/**
+ * @brief Prints the tokens in a token list.
+ * 
+ * This function iterates through the tokens in the list and prints 
+ * their type and value in a readable format. The lines are formatted 
+ * by hand into a buffer that is written out a megabyte at a time, 
+ * since going through printf() for every token costs more than lexing.
+ * 
+ * @param list A pointer to the TokenList to be printed.
+ * @param stream The stream to print to.
+ * @return 0 on success, -1 if writing failed, with errno set.
+ */
+int print_tokens(const TokenList* list, FILE* stream) {
+    OutputBuffer out;
+
+    init_output_buffer(&out, list -> arena, TOKEN_OUTPUT_FLUSH_SIZE + 4096);
+
+    for (size_t i = 0; i < (list -> size); i++) {
+        uint32_t length = token_length(list, i);
+
+        output_bytes(&out, "Type: ", 6);
+        output_unsigned(&out, token_kind(list, i));
+        output_bytes(&out, ", Value: ", 9);
+        output_bytes(&out, token_chars(list, i), length);
+        output_u8(&out, '\n');
+
+        if (out.size >= TOKEN_OUTPUT_FLUSH_SIZE && flush_output(&out, stream) < 0) {
+            return -1;
+        }
+    }
+
+    return flush_output(&out, stream);
+}
+
+/**
+ * @brief Moves a line cursor to an offset in its file.
+ * 
+ * @param cursor A pointer to the LineCursor.
+ * @param data The contents of the file.
+ * @param offset The offset to move to.
+ */
+void advance_line_cursor(LineCursor* cursor, const char* data, uint32_t offset) {
+    if (offset < cursor -> position) {
+        cursor -> position = 0;
+        cursor -> line = 1;
+        cursor -> line_start = 0;
+    }
+
+    const char* p = data + cursor -> position;
+    const char* end = data + offset;
+
+    while ((p = memchr(p, '\n', (size_t)(end - p)))) {
+        p++;
+        cursor -> line++;
+        cursor -> line_start = (uint32_t)(p - data);
+    }
+
+    cursor -> position = offset;
+}
+
+/**
+ * @brief Writes the tokens in a token list as a binary record stream.
+ * 
+ * The stream starts with TOKEN_STREAM_MAGIC and then, as ULEB128 
+ * numbers, the format version, the number of files and the number of 
+ * tokens. Every file follows as the length of its name and the name. 
+ * Then comes one record per token: the length of the record and the 
+ * token's kind, file index, offset in the file, length, line and 
+ * column, again all ULEB128. Readers skip any bytes of a record past 
+ * the fields they know, so fields can be added without breaking them.
+ * 
+ * @param list A pointer to the TokenList to be written.
+ * @param filename The name of the file, for lists without a source map.
+ * @param stream The stream to write to.
+ * @return 0 on success, -1 if writing failed, with errno set.
+ */
+int write_token_stream(const TokenList* list, const char* filename, FILE* stream) {
+    const SourceMap* map = list -> source_map;
+    size_t file_count = map ? map -> count : 1;
+    LineCursor* cursors = arena_alloc(list -> arena, sizeof(LineCursor) * file_count);
+    OutputBuffer out;
+
+    init_output_buffer(&out, list -> arena, TOKEN_OUTPUT_FLUSH_SIZE + 4096);
+    output_bytes(&out, TOKEN_STREAM_MAGIC, 8);
+    output_varint(&out, TOKEN_STREAM_VERSION);
+    output_varint(&out, file_count);
+    output_varint(&out, list -> size);
+
+    for (size_t i = 0; i < file_count; i++) {
+        const char* name = map ? map -> files[i].name : filename;
+
+        output_varint(&out, strlen(name));
+        output_string(&out, name);
+
+        cursors[i].position = 0;
+        cursors[i].line = 1;
+        cursors[i].line_start = 0;
+    }
+
+    for (size_t i = 0; i < (list -> size); i++) {
+        uint32_t offset = token_offset(list, i);
+        uint32_t file = map ? find_source_file(map, offset) : 0;
+        const char* data = map ? map -> files[file].data : list -> source;
+        LineCursor* cursor = &(cursors[file]);
+        unsigned char record[6 * 10];
+        size_t size = 0;
+
+        offset -= map ? map -> files[file].base : 0;
+        advance_line_cursor(cursor, data, offset);
+
+        size += encode_varint(record + size, token_kind(list, i));
+        size += encode_varint(record + size, file);
+        size += encode_varint(record + size, offset);
+        size += encode_varint(record + size, token_length(list, i));
+        size += encode_varint(record + size, cursor -> line);
+        size += encode_varint(record + size, offset - cursor -> line_start + 1);
+
+        output_varint(&out, size);
+        output_bytes(&out, record, size);
+
+        if (out.size >= TOKEN_OUTPUT_FLUSH_SIZE && flush_output(&out, stream) < 0) {
+            return -1;
+        }
+    }
+
+    return flush_output(&out, stream);
+}
+
+/**
+ * @brief Returns what a token list stores as the payload of a token.
+ * 
+ * @param token A pointer to the token.
+ * @return The symbol ID of an IDENTIFIER token, the value of an 
+ * INT_LITERAL token or the length of any other token.
+ */
+uint32_t token_payload_of(const Token* token) {
+    if (token -> type == IDENTIFIER) {
+        return token -> symbol;
+    }
+
+    return token -> type == INT_LITERAL ? token -> value : token -> length;
+}
+
+/**
+ * @brief Adds a token to the token list.
+ * 
+ * This function checks if the last chunk of the list is full. If so, 
+ * it allocates one more chunk for each array from the list's arena, 
+ * doubling the chunk tables first if they are full; existing tokens 
+ * are never moved. Then it stores the token's kind, offset and payload 
+ * at the end of the list. No memory is allocated for the token's text.
+ * 
+ * @param list A pointer to the TokenList to which the token will be added.
+ * @param token The token to be added.
+ */
+void add_token(TokenList* list, const Token* token) {
+    size_t chunk = list -> size >> TOKEN_CHUNK_SHIFT;
+    size_t index = list -> size & (TOKEN_CHUNK_SIZE - 1);
+
+    if (chunk >= (list -> chunk_count)) {
+        if ((list -> chunk_count) >= (list -> chunk_capacity)) {
+            size_t old_capacity = list -> chunk_capacity;
+
+            list -> chunk_capacity *= 2;
+            list -> kinds = arena_realloc(list -> arena, list -> kinds, sizeof(uint8_t*) * old_capacity, sizeof(uint8_t*) * list -> chunk_capacity);
+            list -> offsets = arena_realloc(list -> arena, list -> offsets, sizeof(uint32_t*) * old_capacity, sizeof(uint32_t*) * list -> chunk_capacity);
+            list -> payloads = arena_realloc(list -> arena, list -> payloads, sizeof(uint32_t*) * old_capacity, sizeof(uint32_t*) * list -> chunk_capacity);
+        }
+
+        list -> kinds[chunk] = arena_alloc(list -> arena, sizeof(uint8_t) * TOKEN_CHUNK_SIZE);
+        list -> offsets[chunk] = arena_alloc(list -> arena, sizeof(uint32_t) * TOKEN_CHUNK_SIZE);
+        list -> payloads[chunk] = arena_alloc(list -> arena, sizeof(uint32_t) * TOKEN_CHUNK_SIZE);
+        list -> chunk_count++;
+    }
+
+    list -> kinds[chunk][index] = (uint8_t)(token -> type);
+    list -> offsets[chunk][index] = token -> offset;
+    list -> payloads[chunk][index] = token_payload_of(token);
+    list -> size++;
+}
+
+/**
+ * @brief Returns the kind of a token in a token list.
+ * 
+ * @param list A pointer to the TokenList.
+ * @param index The index of the token.
+ * @return The TokenType of the token.
+ */
+TokenType token_kind(const TokenList* list, size_t index) {
+    return (TokenType)(list -> kinds[index >> TOKEN_CHUNK_SHIFT][index & (TOKEN_CHUNK_SIZE - 1)]);
+}
+
+/**
+ * @brief Returns the source offset of a token in a token list.
+ * 
+ * @param list A pointer to the TokenList.
+ * @param index The index of the token.
+ * @return The offset of the token's first character in the source.
+ */
+uint32_t token_offset(const TokenList* list, size_t index) {
+    return list -> offsets[index >> TOKEN_CHUNK_SHIFT][index & (TOKEN_CHUNK_SIZE - 1)];
+}
+
+/**
+ * @brief Returns the payload of a token in a token list.
+ * 
+ * @param list A pointer to the TokenList.
+ * @param index The index of the token.
+ * @return The symbol ID of an IDENTIFIER token, the 
+ * int_literal_payload() of an INT_LITERAL token, or the length of any 
+ * other token.
+ */
+uint32_t token_payload(const TokenList* list, size_t index) {
+    return list -> payloads[index >> TOKEN_CHUNK_SHIFT][index & (TOKEN_CHUNK_SIZE - 1)];
+}
+
+/**
+ * @brief Returns the length of a token in a token list.
+ * 
+ * Identifier lengths are not stored per token; they come from the 
+ * interned name, and those of integer literals from their payload.
+ * 
+ * @param list A pointer to the TokenList.
+ * @param index The index of the token.
+ * @return The number of characters in the token.
+ */
+uint32_t token_length(const TokenList* list, size_t index) {
+    TokenType kind = token_kind(list, index);
+
+    if (kind == IDENTIFIER) {
+        return (uint32_t)symbol_length(list -> interner, token_payload(list, index));
+    }
+
+    if (kind == INT_LITERAL) {
+        return int_literal_length(token_payload(list, index));
+    }
+
+    return token_payload(list, index);
+}
+
+/**
+ * @brief Reassembles a Token from a token list.
+ * 
+ * @param list A pointer to the TokenList.
+ * @param index The index of the token.
+ * @return The token at that index.
+ */
+Token get_token(const TokenList* list, size_t index) {
+    Token token;
+
+    token.type = token_kind(list, index);
+    token.offset = token_offset(list, index);
+    token.length = token_length(list, index);
+    token.symbol = (token.type == IDENTIFIER) ? token_payload(list, index) : NO_SYMBOL;
+    token.value = (token.type == INT_LITERAL) ? token_payload(list, index) : 0;
+
+    return token;
+}
+
+/**
+ * @brief Builds a NUL-terminated copy of a token's text.
+ * 
+ * Tokens only store a span into the source, so this is the one place a 
+ * token's text gets allocated. It should only be called when a C string 
+ * is really needed, e.g. for diagnostics.
+ * 
+ * @param arena A pointer to the Arena the string is allocated from.
+ * @param list A pointer to the TokenList the token belongs to.
+ * @param index The index of the token whose text is wanted.
+ * @return A NUL-terminated string owned by the arena.
+ */
+char* token_text(Arena* arena, const TokenList* list, size_t index) {
+    return arena_strndup(arena, token_chars(list, index), token_length(list, index));
+}
+
+/**
+ * @brief Returns a pointer to the first character of a token.
+ * 
+ * @param list A pointer to the TokenList.
+ * @param index The index of the token.
+ * @return A pointer into the source the token was lexed from.
+ */
+const char* token_chars(const TokenList* list, size_t index) {
+    uint32_t offset = token_offset(list, index);
+
+    if (!list -> source_map) {
+        return list -> source + offset;
+    }
+
+    const SourceFile* file = &(list -> source_map -> files[find_source_file(list -> source_map, offset)]);
+
+    return file -> data + (offset - file -> base);
+}
+
+/**
+ * @brief Finds the file, line and column of a position in a token list.
+ * 
+ * @param list A pointer to the TokenList.
+ * @param offset An offset as stored in the list.
+ * @param filename Receives the name of the file, if the list has a 
+ * source map; left alone otherwise.
+ * @param line Receives the 1-based line number.
+ * @param column Receives the 1-based column number.
+ */
+void locate_offset(const TokenList* list, uint32_t offset, const char** filename, size_t* line, size_t* column) {
+    if (!list -> source_map) {
+        find_line_column(list -> arena, list -> lines, list -> source, list -> source_length, offset, line, column);
+        return;
+    }
+
+    SourceFile* file = &(list -> source_map -> files[find_source_file(list -> source_map, offset)]);
+
+    *filename = file -> name;
+    find_line_column(list -> source_map -> arena, &(file -> lines), file -> data, file -> length, offset - file -> base, line, column);
+}
+
+/**
+ * @brief Builds the line table of every file a token list comes from.
+ * 
+ * locate_offset() builds them lazily from the list's arena, which is 
+ * not safe on several threads at once; after this call it only reads.
+ * 
+ * @param list A pointer to the TokenList.
+ */
+void prepare_line_tables(const TokenList* list) {
+    if (!list -> source_map) {
+        if (!list -> lines -> starts) {
+            build_line_table(list -> arena, list -> lines, list -> source, list -> source_length);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < (list -> source_map -> count); i++) {
+        SourceFile* file = &(list -> source_map -> files[i]);
+
+        if (!file -> lines.starts) {
+            build_line_table(list -> source_map -> arena, &(file -> lines), file -> data, file -> length);
+        }
+    }
+}
+
+#define SP CHAR_SPACE
+#define ID (CHAR_IDENT_START | CHAR_IDENT_CONTINUE)
+#define DG (CHAR_DIGIT | CHAR_IDENT_CONTINUE)
+#define PU CHAR_PUNCT
+
+/**
+ * @brief Character class of every byte value.
+ * 
+ * Indexed by unsigned char, so bytes above 0x7f are safe to look up 
+ * and simply have no class. The table is the same in every locale.
+ */
+static const unsigned char char_class[256] = {
+    /* 0x00 */  0,  0,  0,  0,  0,  0,  0,  0,  0, SP, SP, SP, SP, SP,  0,  0,
+    /* 0x10 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    /* 0x20 */ SP, PU, PU, PU,  0, PU, PU, PU, PU, PU, PU, PU, PU, PU, PU, PU,
+    /* 0x30 */ DG, DG, DG, DG, DG, DG, DG, DG, DG, DG, PU, PU, PU, PU, PU, PU,
+    /* 0x40 */  0, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID,
+    /* 0x50 */ ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, PU, PU, PU, PU, ID,
+    /* 0x60 */  0, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID,
+    /* 0x70 */ ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, ID, PU, PU, PU, PU,  0,
+};
+
+#undef SP
+#undef ID
+#undef DG
+#undef PU
+
+/**
+ * @brief Perfect hash table of every C11 keyword.
+ * 
+ * Each keyword sits in the slot given by keyword_hash(). The hash 
+ * constants were picked so that no two keywords share a slot, which 
+ * makes a lookup one hash and at most one memcmp. Adding a keyword 
+ * means searching for new constants that keep the table collision free.
+ */
+static const KeywordEntry keyword_table[128] = {
+    [ 54] = { "auto",            4, AUTO_KEYWORD },
+    [109] = { "break",           5, BREAK_KEYWORD },
+    [ 12] = { "case",            4, CASE_KEYWORD },
+    [103] = { "char",            4, CHAR_KEYWORD },
+    [ 63] = { "const",           5, CONST_KEYWORD },
+    [ 14] = { "continue",        8, CONTINUE_KEYWORD },
+    [104] = { "default",         7, DEFAULT_KEYWORD },
+    [  1] = { "do",              2, DO_KEYWORD },
+    [ 13] = { "double",          6, DOUBLE_KEYWORD },
+    [113] = { "else",            4, ELSE_KEYWORD },
+    [ 99] = { "enum",            4, ENUM_KEYWORD },
+    [ 75] = { "extern",          6, EXTERN_KEYWORD },
+    [ 39] = { "float",           5, FLOAT_KEYWORD },
+    [ 40] = { "for",             3, FOR_KEYWORD },
+    [  6] = { "goto",            4, GOTO_KEYWORD },
+    [ 73] = { "if",              2, IF_KEYWORD },
+    [  9] = { "inline",          6, INLINE_KEYWORD },
+    [ 58] = { "int",             3, INT_KEYWORD },
+    [ 43] = { "long",            4, LONG_KEYWORD },
+    [ 95] = { "register",        8, REGISTER_KEYWORD },
+    [119] = { "restrict",        8, RESTRICT_KEYWORD },
+    [ 45] = { "return",          6, RETURN_KEYWORD },
+    [ 16] = { "short",           5, SHORT_KEYWORD },
+    [ 90] = { "signed",          6, SIGNED_KEYWORD },
+    [114] = { "sizeof",          6, SIZEOF_KEYWORD },
+    [ 49] = { "static",          6, STATIC_KEYWORD },
+    [125] = { "struct",          6, STRUCT_KEYWORD },
+    [  8] = { "switch",          6, SWITCH_KEYWORD },
+    [  4] = { "typedef",         7, TYPEDEF_KEYWORD },
+    [  0] = { "union",           5, UNION_KEYWORD },
+    [ 11] = { "unsigned",        8, UNSIGNED_KEYWORD },
+    [ 17] = { "void",            4, VOID_KEYWORD },
+    [ 33] = { "volatile",        8, VOLATILE_KEYWORD },
+    [ 96] = { "while",           5, WHILE_KEYWORD },
+    [ 20] = { "_Alignas",        8, ALIGNAS_KEYWORD },
+    [120] = { "_Alignof",        8, ALIGNOF_KEYWORD },
+    [ 83] = { "_Atomic",         7, ATOMIC_KEYWORD },
+    [ 70] = { "_Bool",           5, BOOL_KEYWORD },
+    [ 98] = { "_Complex",        8, COMPLEX_KEYWORD },
+    [ 10] = { "_Generic",        8, GENERIC_KEYWORD },
+    [ 38] = { "_Imaginary",     10, IMAGINARY_KEYWORD },
+    [ 78] = { "_Noreturn",       9, NORETURN_KEYWORD },
+    [ 72] = { "_Static_assert", 14, STATIC_ASSERT_KEYWORD },
+    [112] = { "_Thread_local",  13, THREAD_LOCAL_KEYWORD },
+};
+
+/**
+ * @brief Computes the keyword table slot for an identifier.
+ * 
+ * Mixes the length with the first, second and last characters, which 
+ * is enough to tell all C11 keywords apart.
+ * 
+ * @param text The characters of the identifier.
+ * @param length The number of characters, at least 2.
+ * @return The slot in keyword_table to look at.
+ */
+static inline size_t keyword_hash(const unsigned char* text, size_t length) {
+    return (length + text[0] + 9u * text[1] + 12u * text[length - 1]) & 127u;
+}
+
+/**
+ * @brief Classifies an identifier as a keyword or a plain identifier.
+ * 
+ * @param text The characters of the identifier; they need not be 
+ * NUL-terminated.
+ * @param length The number of characters in the identifier.
+ * @return The keyword's token type, or IDENTIFIER if it is not a keyword.
+ */
+TokenType lookup_keyword(const char* text, size_t length) {
+    if (length < 2 || length > 14) {
+        return IDENTIFIER;
+    }
+
+    const KeywordEntry* entry = &keyword_table[keyword_hash((const unsigned char*)text, length)];
+
+    if (entry -> length == length && memcmp(entry -> text, text, length) == 0) {
+        return entry -> type;
+    }
+
+    return IDENTIFIER;
+}
+
+/**
+ * @brief Every C11 punctuator except the digraphs, and its token type.
+ */
+static const PunctuatorEntry punctuator_table[] = {
+    { "(",   L_PARAN },
+    { ")",   R_PARAN },
+    { "{",   L_BRACE },
+    { "}",   R_BRACE },
+    { "[",   L_BRACKET },
+    { "]",   R_BRACKET },
+    { ";",   SEMICOLON },
+    { ",",   COMMA },
+    { ".",   DOT },
+    { "->",  ARROW },
+    { "++",  PLUS_PLUS },
+    { "--",  MINUS_MINUS },
+    { "&",   AMPERSAND },
+    { "*",   STAR },
+    { "+",   PLUS },
+    { "-",   MINUS },
+    { "~",   TILDE },
+    { "!",   BANG },
+    { "/",   SLASH },
+    { "%",   PERCENT },
+    { "<<",  SHIFT_LEFT },
+    { ">>",  SHIFT_RIGHT },
+    { "<",   LESS },
+    { ">",   GREATER },
+    { "<=",  LESS_EQUAL },
+    { ">=",  GREATER_EQUAL },
+    { "==",  EQUAL_EQUAL },
+    { "!=",  NOT_EQUAL },
+    { "^",   CARET },
+    { "|",   PIPE },
+    { "&&",  AND_AND },
+    { "||",  OR_OR },
+    { "?",   QUESTION },
+    { ":",   COLON },
+    { "...", ELLIPSIS },
+    { "=",   ASSIGN },
+    { "*=",  STAR_ASSIGN },
+    { "/=",  SLASH_ASSIGN },
+    { "%=",  PERCENT_ASSIGN },
+    { "+=",  PLUS_ASSIGN },
+    { "-=",  MINUS_ASSIGN },
+    { "<<=", SHIFT_LEFT_ASSIGN },
+    { ">>=", SHIFT_RIGHT_ASSIGN },
+    { "&=",  AND_ASSIGN },
+    { "^=",  XOR_ASSIGN },
+    { "|=",  OR_ASSIGN },
+    { "#",   HASH },
+    { "##",  HASH_HASH },
+};
+
+#define DFA_DIGITS "0123456789"
+#define DFA_HEX_LETTERS "abcdefABCDEF"
+#define DFA_LETTERS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_"
+
+/**
+ * @brief Rules of the lexer DFA for literals.
+ * 
+ * Numbers are lexed like preprocessing numbers: once a literal has 
+ * started, letters, digits and dots keep it going, so a bad suffix 
+ * stays part of the literal for the parser to reject. The states only 
+ * track whether the literal is an integer or floating one. String and 
+ * character literals end at their closing quote, or before the end of 
+ * their line if they have none.
+ */
+static const DfaRule lexer_rules[] = {
+    { DFA_START,         NULL,                    DFA_UNKNOWN },
+    { DFA_START,         "0",                     DFA_ZERO },
+    { DFA_START,         "123456789",             DFA_DECIMAL },
+    { DFA_START,         "\"",                    DFA_STRING },
+    { DFA_START,         "'",                     DFA_CHAR },
+
+    { DFA_ZERO,          DFA_LETTERS,             DFA_INT_SUFFIX },
+    { DFA_ZERO,          DFA_DIGITS,              DFA_DECIMAL },
+    { DFA_ZERO,          "xX",                    DFA_HEX },
+    { DFA_ZERO,          ".",                     DFA_FRACTION },
+    { DFA_ZERO,          "eE",                    DFA_EXPONENT_SIGN },
+    { DFA_DECIMAL,       DFA_LETTERS,             DFA_INT_SUFFIX },
+    { DFA_DECIMAL,       DFA_DIGITS,              DFA_DECIMAL },
+    { DFA_DECIMAL,       ".",                     DFA_FRACTION },
+    { DFA_DECIMAL,       "eE",                    DFA_EXPONENT_SIGN },
+    { DFA_HEX,           DFA_LETTERS,             DFA_INT_SUFFIX },
+    { DFA_HEX,           DFA_DIGITS DFA_HEX_LETTERS, DFA_HEX },
+    { DFA_HEX,           ".",                     DFA_HEX_FRACTION },
+    { DFA_HEX,           "pP",                    DFA_EXPONENT_SIGN },
+    { DFA_INT_SUFFIX,    DFA_LETTERS DFA_DIGITS ".", DFA_INT_SUFFIX },
+
+    { DFA_FRACTION,      DFA_LETTERS ".",         DFA_FLOAT_SUFFIX },
+    { DFA_FRACTION,      DFA_DIGITS,              DFA_FRACTION },
+    { DFA_FRACTION,      "eE",                    DFA_EXPONENT_SIGN },
+    { DFA_HEX_FRACTION,  DFA_LETTERS ".",         DFA_FLOAT_SUFFIX },
+    { DFA_HEX_FRACTION,  DFA_DIGITS DFA_HEX_LETTERS, DFA_HEX_FRACTION },
+    { DFA_HEX_FRACTION,  "pP",                    DFA_EXPONENT_SIGN },
+    { DFA_EXPONENT_SIGN, DFA_LETTERS ".",         DFA_FLOAT_SUFFIX },
+    { DFA_EXPONENT_SIGN, DFA_DIGITS "+-",         DFA_EXPONENT },
+    { DFA_EXPONENT,      DFA_LETTERS ".",         DFA_FLOAT_SUFFIX },
+    { DFA_EXPONENT,      DFA_DIGITS,              DFA_EXPONENT },
+    { DFA_FLOAT_SUFFIX,  DFA_LETTERS DFA_DIGITS ".", DFA_FLOAT_SUFFIX },
+
+    { DFA_STRING,        NULL,                    DFA_STRING },
+    { DFA_STRING,        "\"",                    DFA_STRING_END },
+    { DFA_STRING,        "\\",                    DFA_STRING_ESCAPE },
+    { DFA_STRING,        "\n",                    DFA_STOP },
+    { DFA_STRING_ESCAPE, NULL,                    DFA_STRING },
+    { DFA_STRING_ESCAPE, "\n",                    DFA_STOP },
+    { DFA_CHAR,          NULL,                    DFA_CHAR },
+    { DFA_CHAR,          "'",                     DFA_CHAR_END },
+    { DFA_CHAR,          "\\",                    DFA_CHAR_ESCAPE },
+    { DFA_CHAR,          "\n",                    DFA_STOP },
+    { DFA_CHAR_ESCAPE,   NULL,                    DFA_CHAR },
+    { DFA_CHAR_ESCAPE,   "\n",                    DFA_STOP },
+};
+
+#undef DFA_DIGITS
+#undef DFA_HEX_LETTERS
+#undef DFA_LETTERS
+
+/**
+ * @brief Token type of a token ending in each fixed DFA state.
+ */
+static const uint8_t dfa_state_tokens[DFA_FIRST_PUNCTUATOR] = {
+    [DFA_STOP]          = TOKEN_KIND_COUNT,
+    [DFA_START]         = TOKEN_KIND_COUNT,
+    [DFA_UNKNOWN]       = UNKNOWN,
+    [DFA_ZERO]          = INT_LITERAL,
+    [DFA_DECIMAL]       = INT_LITERAL,
+    [DFA_HEX]           = INT_LITERAL,
+    [DFA_INT_SUFFIX]    = INT_LITERAL,
+    [DFA_FRACTION]      = FLOAT_LITERAL,
+    [DFA_HEX_FRACTION]  = FLOAT_LITERAL,
+    [DFA_EXPONENT_SIGN] = FLOAT_LITERAL,
+    [DFA_EXPONENT]      = FLOAT_LITERAL,
+    [DFA_FLOAT_SUFFIX]  = FLOAT_LITERAL,
+    [DFA_STRING]        = STRING_LITERAL,
+    [DFA_STRING_ESCAPE] = STRING_LITERAL,
+    [DFA_STRING_END]    = STRING_LITERAL,
+    [DFA_CHAR]          = CHAR_LITERAL,
+    [DFA_CHAR_ESCAPE]   = CHAR_LITERAL,
+    [DFA_CHAR_END]      = CHAR_LITERAL,
+};
+
+/**
+ * @brief The lexer DFA, built from the tables above by 
+ * build_lexer_dfa().
+ */
+static LexerDfa lexer_dfa;
+
+/**
+ * @brief Makes sure build_lexer_dfa() runs once, whichever thread lexes 
+ * first.
+ */
+static pthread_once_t lexer_dfa_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Builds the lexer DFA from the punctuator table and the rules.
+ * 
+ * The DFA is first built over raw bytes. The punctuators form a trie 
+ * rooted at DFA_START, and a dot followed by a digit starts a floating 
+ * literal. Bytes whose columns come out the same in every state are 
+ * then merged into one class, which keeps the final table small enough 
+ * to stay in the L1 cache.
+ */
+void build_lexer_dfa(void) {
+    uint8_t (*raw)[256] = calloc(LEXER_DFA_MAX_STATES, 256);
+    size_t state_count = DFA_FIRST_PUNCTUATOR;
+
+    if (!raw) {
+        perror("ERROR: Failed to allocate lexer DFA.");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(lexer_dfa.token, dfa_state_tokens, sizeof(dfa_state_tokens));
+
+    for (size_t i = 0; i < sizeof(lexer_rules) / sizeof(lexer_rules[0]); i++) {
+        const DfaRule* rule = &lexer_rules[i];
+
+        if (rule -> bytes) {
+            for (const char* p = rule -> bytes; *p; p++) {
+                raw[rule -> from][(unsigned char)*p] = (uint8_t)rule -> to;
+            }
+        } else {
+            memset(raw[rule -> from], (int)rule -> to, 256);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(punctuator_table) / sizeof(punctuator_table[0]); i++) {
+        uint8_t state = DFA_START;
+
+        for (const char* p = punctuator_table[i].text; *p; p++) {
+            uint8_t* next = &raw[state][(unsigned char)*p];
+
+            if (*next == DFA_STOP || *next == DFA_UNKNOWN) {
+                if (state_count == LEXER_DFA_MAX_STATES) {
+                    fprintf(stderr, "ERROR: The lexer DFA has too many states.\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                lexer_dfa.token[state_count] = TOKEN_KIND_COUNT;
+                *next = (uint8_t)state_count++;
+            }
+
+            state = *next;
+        }
+
+        lexer_dfa.token[state] = (uint8_t)punctuator_table[i].type;
+    }
+
+    uint8_t dot = raw[DFA_START]['.'];
+    for (int digit = '0'; digit <= '9'; digit++) {
+        raw[dot][digit] = DFA_FRACTION;
+    }
+
+    int representative[LEXER_DFA_MAX_CLASSES];
+    size_t class_count = 0;
+
+    for (int byte = 0; byte < 256; byte++) {
+        size_t class = 0;
+
+        while (class < class_count) {
+            size_t state = 0;
+
+            while (state < state_count && raw[state][byte] == raw[state][representative[class]]) {
+                state++;
+            }
+
+            if (state == state_count) {
+                break;
+            }
+
+            class++;
+        }
+
+        if (class == class_count) {
+            if (class_count == LEXER_DFA_MAX_CLASSES) {
+                fprintf(stderr, "ERROR: The lexer DFA has too many byte classes.\n");
+                exit(EXIT_FAILURE);
+            }
+
+            representative[class_count++] = byte;
+        }
+
+        lexer_dfa.class_of[byte] = (uint8_t)class;
+    }
+
+    for (size_t state = 0; state < state_count; state++) {
+        for (size_t class = 0; class < class_count; class++) {
+            lexer_dfa.next[state][class] = raw[state][representative[class]];
+        }
+    }
+
+    lexer_dfa.state_count = state_count;
+    lexer_dfa.class_count = class_count;
+    free(raw);
+}
+
+/**
+ * @brief Parses eight ASCII digits at once.
+ * 
+ * Each step multiplies adjacent groups by the power of ten of the group 
+ * and adds them, so 1+1, 2+2 and 4+4 digit groups are combined in three 
+ * multiplications (SWAR: SIMD within a register).
+ * 
+ * @param chunk The digits as loaded from memory on a little-endian 
+ * machine, first digit in the lowest byte.
+ * @return The value of the digits.
+ */
+uint32_t parse_eight_digits(uint64_t chunk) {
+    chunk = (chunk & 0x0f0f0f0f0f0f0f0full) * 2561 >> 8;
+    chunk = (chunk & 0x00ff00ff00ff00ffull) * 6553601 >> 16;
+
+    return (uint32_t)((chunk & 0x0000ffff0000ffffull) * 42949672960001ull >> 32);
+}
+
+/**
+ * @brief Computes the token list payload of an integer literal.
+ * 
+ * A plain decimal literal of up to ten digits is parsed here, its last 
+ * eight digits with parse_eight_digits(): the digits are copied behind 
+ * padding zeros into one 64-bit word, checked to be digits all at once 
+ * and combined. Its payload is the value when that is below 2^31.
+ * 
+ * @param text The text of the literal.
+ * @param length The length of the literal.
+ * @return The value, or the length with LITERAL_LENGTH_FLAG for any 
+ * other literal.
+ */
+uint32_t int_literal_payload(const char* text, size_t length) {
+    uint32_t unparsed = (uint32_t)length | LITERAL_LENGTH_FLAG;
+
+    if (length == 0 || length > 10 || (text[0] == '0' && length > 1)) {
+        return unparsed;
+    }
+
+    size_t head = length > 8 ? length - 8 : 0;
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < head; i++) {
+        if ((unsigned)(text[i] - '0') > 9) {
+            return unparsed;
+        }
+
+        value = value * 10 + (uint64_t)(text[i] - '0');
+    }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t chunk = 0x3030303030303030ull;
+
+    memcpy((char*)&chunk + (8 - (length - head)), text + head, length - head);
+
+    if (((chunk & 0xf0f0f0f0f0f0f0f0ull) | (((chunk + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4)) != 0x3333333333333333ull) {
+        return unparsed;
+    }
+
+    value = value * 100000000 + parse_eight_digits(chunk);
+#else
+    for (size_t i = head; i < length; i++) {
+        if ((unsigned)(text[i] - '0') > 9) {
+            return unparsed;
+        }
+
+        value = value * 10 + (uint64_t)(text[i] - '0');
+    }
+#endif
+
+    return value < LITERAL_LENGTH_FLAG ? (uint32_t)value : unparsed;
+}
+
+/**
+ * @brief Returns the length of an integer literal from its payload.
+ * 
+ * @param payload The int_literal_payload() of the literal.
+ * @return The number of characters in the literal.
+ */
+uint32_t int_literal_length(uint32_t payload) {
+    if (payload & LITERAL_LENGTH_FLAG) {
+        return payload & ~LITERAL_LENGTH_FLAG;
+    }
+
+    uint32_t length = 1;
+
+    while (payload >= 10) {
+        payload /= 10;
+        length++;
+    }
+
+    return length;
+}
+
+/**
+ * @brief Parses an integer literal of any form.
+ * 
+ * Handles decimal, octal (leading 0) and hexadecimal (0x) literals with 
+ * any valid combination of the u/U and l/L/ll/LL suffixes. Values that 
+ * do not fit in 64 bits saturate at UINT64_MAX.
+ * 
+ * @param text The text of the literal.
+ * @param length The length of the literal.
+ * @param value Receives the value.
+ * @return 1 on success, or 0 if the literal is malformed.
+ */
+int parse_integer_literal(const char* text, size_t length, uint64_t* value) {
+    unsigned base = 10;
+    size_t i = 0;
+    size_t digits = 0;
+    uint64_t result = 0;
+    int unsigned_suffix = 0;
+    int long_suffix = 0;
+
+    if (length > 1 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        base = 16;
+        i = 2;
+    } else if (length > 1 && text[0] == '0') {
+        base = 8;
+    }
+
+    for (; i < length; i++, digits++) {
+        unsigned char c = (unsigned char)text[i];
+        unsigned digit = c >= '0' && c <= '9' ? (unsigned)(c - '0') : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (unsigned)((c | 0x20) - 'a' + 10) : 16;
+
+        if (digit >= base) {
+            break;
+        }
+
+        result = result > (UINT64_MAX - digit) / base ? UINT64_MAX : result * base + digit;
+    }
+
+    while (i < length) {
+        char c = text[i];
+
+        if ((c == 'u' || c == 'U') && !unsigned_suffix) {
+            unsigned_suffix = 1;
+            i++;
+        } else if ((c == 'l' || c == 'L') && !long_suffix) {
+            long_suffix = 1;
+            i += (i + 1 < length && text[i + 1] == c) ? 2 : 1;
+        } else {
+            return 0;
+        }
+    }
+
+    *value = result;
+    return digits > 0;
+}
+
+/**
+ * @brief Finds the longest token at the start of a failed DFA walk.
+ * 
+ * Only needed when the walk stopped in a state no token ends in, which 
+ * the punctuators allow for ".." alone. Every punctuator's first byte 
+ * is a punctuator itself, so at least one byte is always matched.
+ * 
+ * @param src The source text.
+ * @param start The offset of the token.
+ * @param end The offset the walk stopped at.
+ * @param type Receives the type of the token.
+ * @return The offset just past the token.
+ */
+size_t backtrack_dfa(const char* src, size_t start, size_t end, TokenType* type) {
+    size_t matched = start + 1;
+    unsigned state = DFA_START;
+
+    *type = UNKNOWN;
+    for (size_t i = start; i < end; i++) {
+        state = lexer_dfa.next[state][lexer_dfa.class_of[(unsigned char)src[i]]];
+
+        if (lexer_dfa.token[state] != TOKEN_KIND_COUNT) {
+            *type = (TokenType)lexer_dfa.token[state];
+            matched = i + 1;
+        }
+    }
+
+    return matched;
+}
+
+/**
+ * @brief Initializes a lexer over a source buffer.
+ * 
+ * @param lexer A pointer to the Lexer to initialize.
+ * @param interner A pointer to the Interner identifiers are interned in.
+ * @param source The SourceBuffer holding the file to be lexed; it must 
+ * outlive the lexer and every token it produces.
+ */
+void init_lexer(Lexer* lexer, Interner* interner, const SourceBuffer* source) {
+    pthread_once(&lexer_dfa_once, build_lexer_dfa);
+
+    lexer -> interner = interner;
+    lexer -> source = source -> data;
+    lexer -> length = source -> length;
+    lexer -> position = 0;
+    lexer -> head = 0;
+    lexer -> count = 0;
+}
+
+/**
+ * @brief Scans the next token directly from the source.
+ * 
+ * This function walks the source buffer from the lexer's position, 
+ * skipping whitespace and comments, and classifies the characters of 
+ * the next token (a keyword, identifier, literal, or symbol). 
+ * Identifiers are measured in place and whitespace and comments are 
+ * skipped with the vectorized scan kernels; literals and punctuators 
+ * are lexed with the DFA, longest match first. Either way a token of 
+ * any length costs time proportional to its length and nothing is 
+ * copied. It bypasses the lookahead buffer; consumers should use 
+ * next_token() and peek_token().
+ * 
+ * @param lexer A pointer to the Lexer to scan with.
+ * @return The next token, or an END_OF_FILE token once the source is 
+ * exhausted.
+ */
+Token scan_token(Lexer* lexer) {
+    const char* src = lexer -> source;
+    size_t length = lexer -> length;
+    const char* end = src + length;
+    size_t i = lexer -> position;
+
+    Token token = { END_OF_FILE, (uint32_t)length, 0, NO_SYMBOL, 0 };
+    unsigned char c;
+
+    while (i < length) {
+        size_t start = i;
+        c = (unsigned char)src[i++];
+        unsigned char class = char_class[c];
+
+        token.offset = (uint32_t)start;
+
+        if (class & CHAR_SPACE) {
+            i = (size_t)(skip_whitespace(src + i, end) - src);
+            continue;
+        } else if (class & CHAR_IDENT_START) {
+            i = (size_t)(scan_identifier(src + i, end) - src);
+            token.type = lookup_keyword(src + start, i - start);
+
+            if (token.type == IDENTIFIER) {
+                token.symbol = intern(lexer -> interner, src + start, i - start);
+            }
+        } else if (c == '/' && i < length && src[i] == '/') {
+            i = (size_t)(skip_line_comment(src + i + 1, end) - src);
+            continue;
+        } else if (c == '/' && i < length && src[i] == '*') {
+            i = (size_t)(skip_block_comment(src + i + 1, end) - src);
+            continue;
+        } else if (c == '\\' && (i < length && (src[i] == '\n' || (src[i] == '\r' && i + 1 < length && src[i + 1] == '\n')))) {
+            // A backslash at the end of a line splices it to the next.
+            i += (src[i] == '\r') ? 2 : 1;
+            continue;
+        } else {
+            // Everything else is one walk of the DFA, one table lookup 
+            // and one branch per byte.
+            unsigned state = lexer_dfa.next[DFA_START][lexer_dfa.class_of[c]];
+
+            while (i < length) {
+                unsigned next = lexer_dfa.next[state][lexer_dfa.class_of[(unsigned char)src[i]]];
+
+                if (next == DFA_STOP) {
+                    break;
+                }
+
+                state = next;
+                i++;
+            }
+
+            token.type = (TokenType)lexer_dfa.token[state];
+            if (token.type == TOKEN_KIND_COUNT) {
+                i = backtrack_dfa(src, start, i, &(token.type));
+            } else if (token.type == INT_LITERAL) {
+                token.value = int_literal_payload(src + start, i - start);
+            }
+        }
+
+        token.length = (uint32_t)(i - start);
+        lexer -> position = i;
+
+        return token;
+    }
+
+    token.offset = (uint32_t)length;
+    lexer -> position = length;
+
+    return token;
+}
+
+/**
+ * @brief Consumes and returns the next token.
+ * 
+ * Tokens already buffered by peek_token() are returned first, in 
+ * order; otherwise a new token is scanned.
+ * 
+ * @param lexer A pointer to the Lexer to read from.
+ * @return The next token, or an END_OF_FILE token at the end of input.
+ */
+Token next_token(Lexer* lexer) {
+    if (lexer -> count == 0) {
+        return scan_token(lexer);
+    }
+
+    Token token = lexer -> ring[lexer -> head];
+
+    lexer -> head = (lexer -> head + 1) & (LEXER_LOOKAHEAD - 1);
+    lexer -> count--;
+
+    return token;
+}
+
+/**
+ * @brief Looks at an upcoming token without consuming it.
+ * 
+ * peek_token(lexer, 0) is the token the next call to next_token() 
+ * will return. The returned pointer is only valid until the lexer is 
+ * used again.
+ * 
+ * @param lexer A pointer to the Lexer to read from.
+ * @param k How many tokens to look ahead; must be below LEXER_LOOKAHEAD.
+ * @return A pointer to the buffered token.
+ */
+const Token* peek_token(Lexer* lexer, size_t k) {
+    while (lexer -> count <= k) {
+        size_t slot = (lexer -> head + lexer -> count) & (LEXER_LOOKAHEAD - 1);
+
+        lexer -> ring[slot] = scan_token(lexer);
+        lexer -> count++;
+    }
+
+    return &(lexer -> ring[(lexer -> head + k) & (LEXER_LOOKAHEAD - 1)]);
+}
+
+/**
+ * @brief Lexes a source buffer into a list of tokens.
+ * 
+ * A thin wrapper that drains a Lexer into a TokenList, for callers 
+ * such as the token dump that want the whole stream at once. The 
+ * END_OF_FILE token is not stored in the list.
+ * 
+ * @param arena A pointer to the Arena the token list is allocated from.
+ * @param interner A pointer to the Interner identifiers are interned in.
+ * @param source The SourceBuffer holding the file to be lexed.
+ * @return A pointer to the TokenList containing the lexed tokens.
+ * @note Returns NULL (with errno set to EFBIG) if the source is too 
+ * large for 32-bit token offsets.
+ */
+TokenList* lex(Arena* arena, Interner* interner, const SourceBuffer* source) {
+    if (source -> length > UINT32_MAX) {
+        errno = EFBIG;
+        return NULL;
+    }
+
+    TokenList* tokens = create_token_list(arena, interner, source -> data, source -> length);
+    Lexer lexer;
+
+    init_lexer(&lexer, interner, source);
+
+    for (Token token = next_token(&lexer); token.type != END_OF_FILE; token = next_token(&lexer)) {
+        add_token(tokens, &token);
+    }
+
+    return tokens;
+}
+
+/**
+ * @brief Gives a token list room for exactly size tokens.
+ * 
+ * Allocates every chunk the tokens need up front, so they can then be 
+ * stored with set_token() in any order, from any thread.
+ * 
+ * @param list A pointer to an empty TokenList.
+ * @param size The number of tokens.
+ */
+void resize_token_list(TokenList* list, size_t size) {
+    size_t chunk_count = (size + TOKEN_CHUNK_SIZE - 1) >> TOKEN_CHUNK_SHIFT;
+
+    if (chunk_count > list -> chunk_capacity) {
+        size_t old_capacity = list -> chunk_capacity;
+
+        list -> chunk_capacity = chunk_count;
+        list -> kinds = arena_realloc(list -> arena, list -> kinds, sizeof(uint8_t*) * old_capacity, sizeof(uint8_t*) * list -> chunk_capacity);
+        list -> offsets = arena_realloc(list -> arena, list -> offsets, sizeof(uint32_t*) * old_capacity, sizeof(uint32_t*) * list -> chunk_capacity);
+        list -> payloads = arena_realloc(list -> arena, list -> payloads, sizeof(uint32_t*) * old_capacity, sizeof(uint32_t*) * list -> chunk_capacity);
+    }
+
+    for (size_t chunk = list -> chunk_count; chunk < chunk_count; chunk++) {
+        list -> kinds[chunk] = arena_alloc(list -> arena, sizeof(uint8_t) * TOKEN_CHUNK_SIZE);
+        list -> offsets[chunk] = arena_alloc(list -> arena, sizeof(uint32_t) * TOKEN_CHUNK_SIZE);
+        list -> payloads[chunk] = arena_alloc(list -> arena, sizeof(uint32_t) * TOKEN_CHUNK_SIZE);
+    }
+
+    list -> chunk_count = chunk_count;
+    list -> size = size;
+}
+
+/**
+ * @brief Stores a token at a given index of a token list.
+ * 
+ * @param list A pointer to the TokenList, already sized with 
+ * resize_token_list().
+ * @param index The index of the token.
+ * @param token A pointer to the token to store.
+ */
+void set_token(TokenList* list, size_t index, const Token* token) {
+    size_t chunk = index >> TOKEN_CHUNK_SHIFT;
+    size_t slot = index & (TOKEN_CHUNK_SIZE - 1);
+
+    list -> kinds[chunk][slot] = (uint8_t)(token -> type);
+    list -> offsets[chunk][slot] = token -> offset;
+    list -> payloads[chunk][slot] = token_payload_of(token);
+}
+
+/**
+ * @brief Lexes one chunk of a file, starting at a given position.
+ * 
+ * Lexing stops at the first token that starts at or after the end of 
+ * the chunk, whose offset becomes the chunk's resume point. A token or 
+ * comment that starts inside the chunk is always finished, even when 
+ * it runs past the end.
+ * 
+ * @param job A pointer to the ParallelLex.
+ * @param chunk A pointer to the LexChunk.
+ * @param start The position to start lexing at.
+ */
+void lex_chunk_from(const ParallelLex* job, LexChunk* chunk, uint32_t start) {
+    Lexer lexer;
+
+    init_lexer(&lexer, job -> interner, job -> source);
+    lexer.position = start;
+    chunk -> count = 0;
+
+    for (;;) {
+        Token token = scan_token(&lexer);
+
+        if (token.type == END_OF_FILE || token.offset >= chunk -> end) {
+            chunk -> resume = token.offset;
+            return;
+        }
+
+        if (chunk -> count >= chunk -> capacity) {
+            chunk -> capacity = chunk -> capacity ? chunk -> capacity * 2 : 1024;
+            chunk -> tokens = realloc(chunk -> tokens, sizeof(Token) * chunk -> capacity);
+
+            if (!chunk -> tokens) {
+                perror("ERROR: Failed to allocate token chunk.");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        chunk -> tokens[chunk -> count++] = token;
+    }
+}
+
+/**
+ * @brief Lexes one chunk of a ParallelLex from the start of the chunk.
+ * 
+ * @param context A pointer to the ParallelLex.
+ * @param task The index of the chunk.
+ */
+void lex_chunk_task(void* context, size_t task) {
+    ParallelLex* job = context;
+
+    lex_chunk_from(job, &(job -> chunks[task]), job -> chunks[task].start);
+}
+
+/**
+ * @brief Copies the valid tokens of one chunk into the final list.
+ * 
+ * @param context A pointer to the ParallelLex.
+ * @param task The index of the chunk.
+ */
+void copy_chunk_task(void* context, size_t task) {
+    ParallelLex* job = context;
+    const LexChunk* chunk = &(job -> chunks[task]);
+
+    for (size_t i = chunk -> first; i < chunk -> count; i++) {
+        set_token(job -> list, chunk -> output + (i - chunk -> first), &(chunk -> tokens[i]));
+    }
+}
+
+/**
+ * @brief Lexes a source buffer on several threads.
+ * 
+ * The buffer is cut into chunks just after newlines and every chunk is 
+ * lexed on its own, as if a token started there. That guess is only 
+ * wrong when a block comment spans the cut, or the line before it ends 
+ * in a backslash; in the sequential fix-up pass that follows, each 
+ * chunk is checked against the point where lexing of the chunk before 
+ * it actually stopped. If the chunk's tokens reach that point, the 
+ * tokens before it are dropped and the rest are kept; otherwise the 
+ * chunk is lexed again from there. The chunks are then copied into one 
+ * TokenList in parallel. Small files, and calls with one thread, fall 
+ * back to lex().
+ * 
+ * @param arena A pointer to the Arena the list is allocated from.
+ * @param interner A pointer to the Interner identifiers are added to.
+ * @param source A pointer to the SourceBuffer to lex.
+ * @param thread_count The number of threads to use.
+ * @return A pointer to the TokenList, or NULL if the source is too big.
+ */
+TokenList* lex_parallel(Arena* arena, Interner* interner, const SourceBuffer* source, size_t thread_count) {
+    size_t chunk_count = source -> length / LEX_CHUNK_SIZE;
+
+    if (chunk_count > thread_count * 4) {
+        chunk_count = thread_count * 4;
+    }
+
+    if (thread_count <= 1 || chunk_count < 2 || source -> length > UINT32_MAX) {
+        return lex(arena, interner, source);
+    }
+
+    ParallelLex job = { source, interner, calloc(chunk_count, sizeof(LexChunk)), NULL };
+    if (!job.chunks) {
+        perror("ERROR: Failed to allocate lexer chunks.");
+        exit(EXIT_FAILURE);
+    }
+
+    const char* data = source -> data;
+    uint32_t start = 0;
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        size_t end = source -> length;
+
+        if (i + 1 < chunk_count) {
+            const char* newline = memchr(data + source -> length * (i + 1) / chunk_count, '\n', source -> length - source -> length * (i + 1) / chunk_count);
+            end = newline ? (size_t)(newline - data) + 1 : source -> length;
+        }
+
+        job.chunks[i].start = start;
+        job.chunks[i].end = (uint32_t)(end > start ? end : start);
+        start = job.chunks[i].end;
+    }
+
+    run_tasks(chunk_count, thread_count, lex_chunk_task, &job);
+
+    uint32_t resume = job.chunks[0].resume;
+    size_t total = job.chunks[0].count;
+
+    for (size_t i = 1; i < chunk_count; i++) {
+        LexChunk* chunk = &(job.chunks[i]);
+        size_t low = 0;
+        size_t high = chunk -> count;
+
+        // Find the first speculative token at or after the resume point.
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+
+            if (chunk -> tokens[middle].offset < resume) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        chunk -> output = total;
+
+        if (resume >= chunk -> end) {
+            chunk -> first = chunk -> count;
+            continue;
+        }
+
+        if (low < chunk -> count && chunk -> tokens[low].offset == resume) {
+            chunk -> first = low;
+        } else {
+            lex_chunk_from(&job, chunk, resume);
+            chunk -> first = 0;
+        }
+
+        resume = chunk -> resume;
+        total += chunk -> count - chunk -> first;
+    }
+
+    job.list = create_token_list(arena, interner, data, source -> length);
+    resize_token_list(job.list, total);
+    run_tasks(chunk_count, thread_count, copy_chunk_task, &job);
+
+    for (size_t i = 0; i < chunk_count; i++) {
+        free(job.chunks[i].tokens);
+    }
+    free(job.chunks);
+
+    return job.list;
+}
+
+/**
+* * LEXER END
+*/
+
+/**
+* * SCAN KERNELS
+* Vectorized loops for the runs of bytes the lexer spends most of its 
+* time in: whitespace, identifier characters, and the bodies of 
+* comments. Each kernel has a scalar version and, where the target 
+* supports it, SSE2, AVX2 and NEON versions picked at runtime by 
+* select_scan_kernels(). No kernel ever reads past the end pointer.
+*/
+
+/**
+ * @brief Kernels used until select_scan_kernels() has run.
+ */
+static ScanKernels scan_kernels = {
+    scalar_skip_whitespace,
+    scalar_scan_identifier,
+    scalar_find_byte
+};
+
+/**
+ * @brief Skips whitespace, one byte at a time.
+ * 
+ * @param p The first byte to look at.
+ * @param end One past the last byte of the buffer.
+ * @return A pointer to the first non-whitespace byte, or end.
+ */
+const char* scalar_skip_whitespace(const char* p, const char* end) {
+    while (p < end && (char_class[(unsigned char)*p] & CHAR_SPACE)) {
+        p++;
+    }
+
+    return p;
+}
+
+/**
+ * @brief Skips identifier characters, one byte at a time.
+ * 
+ * @param p The first byte to look at.
+ * @param end One past the last byte of the buffer.
+ * @return A pointer to the first byte that cannot continue an 
+ * identifier, or end.
+ */
+const char* scalar_scan_identifier(const char* p, const char* end) {
+    while (p < end && (char_class[(unsigned char)*p] & CHAR_IDENT_CONTINUE)) {
+        p++;
+    }
+
+    return p;
+}
+
+/**
+ * @brief Finds the next occurrence of a byte.
+ * 
+ * @param p The first byte to look at.
+ * @param end One past the last byte of the buffer.
+ * @param byte The byte to look for.
+ * @return A pointer to the first matching byte, or end.
+ */
+const char* scalar_find_byte(const char* p, const char* end, char byte) {
+    const char* found = memchr(p, byte, (size_t)(end - p));
+
+    return found ? found : end;
+}
+
+#if defined(__SSE2__)
+
+/**
+ * @brief Returns a bit per byte of chunk that is whitespace.
+ * 
+ * '\t' to '\r' are contiguous, so whitespace is ' ' or (c - '\t') <= 4 
+ * as an unsigned byte; min_epu8 provides the unsigned compare.
+ */
+static inline unsigned sse2_whitespace_mask(__m128i chunk) {
+    __m128i shifted = _mm_sub_epi8(chunk, _mm_set1_epi8('\t'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    __m128i space = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(control, space));
+}
+
+/**
+ * @brief Returns a bit per byte of chunk that is a decimal digit.
+ */
+static inline unsigned sse2_digit_mask(__m128i chunk) {
+    __m128i shifted = _mm_sub_epi8(chunk, _mm_set1_epi8('0'));
+
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(9)), shifted));
+}
+
+/**
+ * @brief Returns a bit per byte of chunk that can continue an identifier.
+ * 
+ * OR-ing in 0x20 folds upper case onto lower case, so letters are one 
+ * range check; digits and '_' are checked separately.
+ */
+static inline unsigned sse2_identifier_mask(__m128i chunk) {
+    __m128i lower = _mm_sub_epi8(_mm_or_si128(chunk, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i letter = _mm_cmpeq_epi8(_mm_min_epu8(lower, _mm_set1_epi8(25)), lower);
+    __m128i underscore = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(letter, underscore)) | sse2_digit_mask(chunk);
+}
+
+/**
+ * @brief SSE2 version of scalar_skip_whitespace(), 16 bytes at a time.
+ */
+const char* sse2_skip_whitespace(const char* p, const char* end) {
+    while (end - p >= 16) {
+        unsigned mask = ~sse2_whitespace_mask(_mm_loadu_si128((const __m128i*)p)) & 0xffff;
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    return scalar_skip_whitespace(p, end);
+}
+
+/**
+ * @brief SSE2 version of scalar_scan_identifier(), 16 bytes at a time.
+ */
+const char* sse2_scan_identifier(const char* p, const char* end) {
+    while (end - p >= 16) {
+        unsigned mask = ~sse2_identifier_mask(_mm_loadu_si128((const __m128i*)p)) & 0xffff;
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    return scalar_scan_identifier(p, end);
+}
+
+/**
+ * @brief SSE2 version of scalar_find_byte(), 16 bytes at a time.
+ */
+const char* sse2_find_byte(const char* p, const char* end, char byte) {
+    __m128i needle = _mm_set1_epi8(byte);
+
+    while (end - p >= 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), needle));
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    return scalar_find_byte(p, end, byte);
+}
+
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+/**
+ * @brief AVX2 version of sse2_whitespace_mask().
+ */
+__attribute__((target("avx2")))
+static inline unsigned avx2_whitespace_mask(__m256i chunk) {
+    __m256i shifted = _mm256_sub_epi8(chunk, _mm256_set1_epi8('\t'));
+    __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+    __m256i space = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' '));
+
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(control, space));
+}
+
+/**
+ * @brief AVX2 version of sse2_digit_mask().
+ */
+__attribute__((target("avx2")))
+static inline unsigned avx2_digit_mask(__m256i chunk) {
+    __m256i shifted = _mm256_sub_epi8(chunk, _mm256_set1_epi8('0'));
+
+    return (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(9)), shifted));
+}
+
+/**
+ * @brief AVX2 version of sse2_identifier_mask().
+ */
+__attribute__((target("avx2")))
+static inline unsigned avx2_identifier_mask(__m256i chunk) {
+    __m256i lower = _mm256_sub_epi8(_mm256_or_si256(chunk, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i letter = _mm256_cmpeq_epi8(_mm256_min_epu8(lower, _mm256_set1_epi8(25)), lower);
+    __m256i underscore = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_'));
+
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(letter, underscore)) | avx2_digit_mask(chunk);
+}
+
+/**
+ * @brief AVX2 version of scalar_skip_whitespace(), 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+const char* avx2_skip_whitespace(const char* p, const char* end) {
+    while (end - p >= 32) {
+        unsigned mask = ~avx2_whitespace_mask(_mm256_loadu_si256((const __m256i*)p));
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    return sse2_skip_whitespace(p, end);
+}
+
+/**
+ * @brief AVX2 version of scalar_scan_identifier(), 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+const char* avx2_scan_identifier(const char* p, const char* end) {
+    while (end - p >= 32) {
+        unsigned mask = ~avx2_identifier_mask(_mm256_loadu_si256((const __m256i*)p));
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    return sse2_scan_identifier(p, end);
+}
+
+/**
+ * @brief AVX2 version of scalar_find_byte(), 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+const char* avx2_find_byte(const char* p, const char* end, char byte) {
+    __m256i needle = _mm256_set1_epi8(byte);
+
+    while (end - p >= 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), needle));
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    return sse2_find_byte(p, end, byte);
+}
+
+#endif
+
+#if defined(__aarch64__)
+
+/**
+ * @brief Packs a NEON byte mask into 4 bits per byte.
+ * 
+ * NEON has no movemask; narrowing by 4 leaves one nibble per byte in 
+ * a 64-bit value, so the first set byte is ctz / 4.
+ */
+static inline uint64_t neon_mask(uint8x16_t matches) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+}
+
+/**
+ * @brief Returns 0xff for each whitespace byte of chunk.
+ */
+static inline uint8x16_t neon_whitespace(uint8x16_t chunk) {
+    uint8x16_t control = vcleq_u8(vsubq_u8(chunk, vdupq_n_u8('\t')), vdupq_n_u8(4));
+
+    return vorrq_u8(control, vceqq_u8(chunk, vdupq_n_u8(' ')));
+}
+
+/**
+ * @brief Returns 0xff for each decimal digit byte of chunk.
+ */
+static inline uint8x16_t neon_digit(uint8x16_t chunk) {
+    return vcleq_u8(vsubq_u8(chunk, vdupq_n_u8('0')), vdupq_n_u8(9));
+}
+
+/**
+ * @brief Returns 0xff for each byte of chunk that can continue an identifier.
+ */
+static inline uint8x16_t neon_identifier(uint8x16_t chunk) {
+    uint8x16_t letter = vcleq_u8(vsubq_u8(vorrq_u8(chunk, vdupq_n_u8(0x20)), vdupq_n_u8('a')), vdupq_n_u8(25));
+
+    return vorrq_u8(vorrq_u8(letter, neon_digit(chunk)), vceqq_u8(chunk, vdupq_n_u8('_')));
+}
+
+/**
+ * @brief NEON version of scalar_skip_whitespace(), 16 bytes at a time.
+ */
+const char* neon_skip_whitespace(const char* p, const char* end) {
+    while (end - p >= 16) {
+        uint64_t mask = ~neon_mask(neon_whitespace(vld1q_u8((const uint8_t*)p)));
+
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+
+        p += 16;
+    }
+
+    return scalar_skip_whitespace(p, end);
+}
+
+/**
+ * @brief NEON version of scalar_scan_identifier(), 16 bytes at a time.
+ */
+const char* neon_scan_identifier(const char* p, const char* end) {
+    while (end - p >= 16) {
+        uint64_t mask = ~neon_mask(neon_identifier(vld1q_u8((const uint8_t*)p)));
+
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+
+        p += 16;
+    }
+
+    return scalar_scan_identifier(p, end);
+}
+
+/**
+ * @brief NEON version of scalar_find_byte(), 16 bytes at a time.
+ */
+const char* neon_find_byte(const char* p, const char* end, char byte) {
+    uint8x16_t needle = vdupq_n_u8((uint8_t)byte);
+
+    while (end - p >= 16) {
+        uint64_t mask = neon_mask(vceqq_u8(vld1q_u8((const uint8_t*)p), needle));
+
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+
+        p += 16;
+    }
+
+    return scalar_find_byte(p, end, byte);
+}
+
+#endif
+
+/**
+ * @brief Picks the fastest scan kernels the CPU supports.
+ * 
+ * Should be called once at startup, before any lexing and before any 
+ * worker threads exist. Until it runs the scalar kernels are used.
+ */
+void select_scan_kernels(void) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        scan_kernels = (ScanKernels){ avx2_skip_whitespace, avx2_scan_identifier, avx2_find_byte };
+        return;
+    }
+#endif
+
+#if defined(__SSE2__)
+    scan_kernels = (ScanKernels){ sse2_skip_whitespace, sse2_scan_identifier, sse2_find_byte };
+#elif defined(__aarch64__)
+    scan_kernels = (ScanKernels){ neon_skip_whitespace, neon_scan_identifier, neon_find_byte };
+#endif
+}
+
+/**
+ * @brief Skips a run of whitespace.
+ * 
+ * @param p The first byte to look at.
+ * @param end One past the last byte of the buffer.
+ * @return A pointer to the first non-whitespace byte, or end.
+ */
+const char* skip_whitespace(const char* p, const char* end) {
+    return scan_kernels.skip_whitespace(p, end);
+}
+
+/**
+ * @brief Finds the end of an identifier or keyword.
+ * 
+ * @param p The first byte after the identifier's first character.
+ * @param end One past the last byte of the buffer.
+ * @return A pointer one past the identifier's last character.
+ */
+const char* scan_identifier(const char* p, const char* end) {
+    return scan_kernels.scan_identifier(p, end);
+}
+
+/**
+ * @brief Finds the next newline.
+ * 
+ * @param p The first byte to look at.
+ * @param end One past the last byte of the buffer.
+ * @return A pointer to the newline, or end.
+ */
+const char* find_newline(const char* p, const char* end) {
+    return scan_kernels.find_byte(p, end, '\n');
+}
+
+/**
+ * @brief Finds the end of a line comment.
+ * 
+ * A newline escaped with a backslash, with or without a carriage 
+ * return before it, splices the next line into the comment.
+ * 
+ * @param p The first byte after the opening "//".
+ * @param end One past the last byte of the buffer.
+ * @return A pointer to the newline ending the comment, or end.
+ */
+const char* skip_line_comment(const char* p, const char* end) {
+    const char* start = p;
+
+    while ((p = find_newline(p, end)) < end) {
+        const char* q = p > start && p[-1] == '\r' ? p - 1 : p;
+
+        if (q == start || q[-1] != '\\') {
+            return p;
+        }
+
+        p++;
+    }
+
+    return end;
+}
+
+/**
+ * @brief Finds the end of a block comment.
+ * 
+ * Jumps from one '*' to the next with the byte-search kernel, so the 
+ * comment body is scanned 16 or 32 bytes at a time.
+ * 
+ * @param p The first byte after the opening slash-star.
+ * @param end One past the last byte of the buffer.
+ * @return A pointer one past the closing star-slash, or end if the 
+ * comment is not terminated.
+ */
+const char* skip_block_comment(const char* p, const char* end) {
+    while ((p = scan_kernels.find_byte(p, end, '*')) < end) {
+        p++;
+
+        if (p < end && *p == '/') {
+            return p + 1;
+        }
+    }
+
+    return end;
+}
+
+/**
+* * SCAN KERNELS END
+*/
+
+/**
+* * TOKEN CACHE
+* On-disk cache of the raw tokens of header files.
+* A cache file holds flat arrays addressed by offsets from the start of 
+* the file, so a hit costs one mmap and a validation pass. Token kinds 
+* and offsets are used straight from the mapping; only identifier 
+* payloads are rewritten, because symbol IDs differ between runs.
+*/
+
+/**
+ * @brief Hashes a buffer of any length into 64 bits.
+ * 
+ * Mixes eight bytes at a time, so hashing a header costs far less than 
+ * lexing it. Not meant to resist deliberate collisions.
+ * 
+ * @param data The bytes to hash.
+ * @param length The number of bytes.
+ * @return The hash of the bytes.
+ */
+uint64_t hash_bytes(const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ length;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ (word * 0xbf58476d1ce4e5b9ull)) * 0x94d049bb133111ebull;
+        hash ^= hash >> 31;
+    }
+
+    for (; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/**
+ * @brief Computes the cache key of a file.
+ * 
+ * The key covers the contents of the file and everything else the raw 
+ * tokens depend on: the cache format and the set of token kinds. No 
+ * command-line flag changes how a file is lexed, so none is part of 
+ * the key.
+ * 
+ * @param source A pointer to the contents of the file.
+ * @return The cache key.
+ */
+uint64_t token_cache_key(const SourceBuffer* source) {
+    uint64_t hash = hash_bytes(source -> data, source -> length);
+
+    return hash ^ (((uint64_t)TOKEN_CACHE_VERSION << 32 | TOKEN_KIND_COUNT) * 0x9e3779b97f4a7c15ull);
+}
+
+/**
+ * @brief Builds the path of a cache file.
+ * 
+ * @param arena A pointer to the Arena the path is allocated from.
+ * @param directory The cache directory.
+ * @param key The cache key.
+ * @param extension The extension of the file, including the dot.
+ * @return The path of the cache file for key.
+ */
+char* cache_path(Arena* arena, const char* directory, uint64_t key, const char* extension) {
+    char name[32];
+    int length = snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)key, extension);
+
+    return join_path(arena, directory, strlen(directory), name, (size_t)length);
+}
+
+/**
+ * @brief Loads the tokens of a file from the cache.
+ * 
+ * Everything in the cache file is checked before it is used, so a 
+ * stale, truncated or corrupt file is a miss rather than a crash or a 
+ * wrong token. The 
+ * kinds and offsets of the returned list point into the mapping, which 
+ * makes the list read-only; it must not be added to.
+ * 
+ * @param arena A pointer to the Arena the list is allocated from.
+ * @param interner A pointer to the Interner identifiers are added to.
+ * @param directory The cache directory.
+ * @param key The cache key of the file.
+ * @param source A pointer to the contents of the file.
+ * @param guard Receives the file's include guard, or NO_SYMBOL.
+ * @param mapping Receives the mapped cache file, which must outlive 
+ * the list.
+ * @return A pointer to the TokenList, or NULL on a miss.
+ */
+TokenList* load_token_cache(Arena* arena, Interner* interner, const char* directory, uint64_t key, const SourceBuffer* source, uint32_t* guard, SourceBuffer** mapping) {
+    SourceBuffer* cache = read_source_file(cache_path(arena, directory, key, ".tok"));
+
+    if (!cache) {
+        return NULL;
+    }
+
+    const char* data = cache -> data;
+    size_t size = cache -> length;
+    TokenCacheHeader header;
+
+    if (size < sizeof(TokenCacheHeader)) {
+        free_source_buffer(cache);
+        return NULL;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    size_t count = header.token_count;
+    int valid = memcmp(header.magic, TOKEN_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == TOKEN_CACHE_VERSION && header.header_size == sizeof(TokenCacheHeader) &&
+        header.key == key && header.source_length == source -> length && header.file_size == size &&
+        header.kind_count == TOKEN_KIND_COUNT &&
+        header.kinds_offset <= size && count <= size - header.kinds_offset &&
+        header.offsets_offset % 4 == 0 && header.offsets_offset <= size && count <= (size - header.offsets_offset) / 4 &&
+        header.payloads_offset % 4 == 0 && header.payloads_offset <= size && count <= (size - header.payloads_offset) / 4 &&
+        header.strings_offset % 4 == 0 && header.strings_offset <= size && header.string_count <= (size - header.strings_offset) / sizeof(CachedString) &&
+        header.characters_offset <= size && header.characters_size <= size - header.characters_offset &&
+        (header.guard == NO_SYMBOL || header.guard < header.string_count) &&
+        cache_file_hash(data, size, sizeof(header)) == header.file_hash;
+
+    // The offsets are only known to lie inside the file once valid holds.
+    const CachedString* strings = valid ? (const CachedString*)(data + header.strings_offset) : NULL;
+    uint32_t* symbols = valid ? arena_alloc(arena, sizeof(uint32_t) * (header.string_count + 1)) : NULL;
+
+    for (uint32_t i = 0; valid && i < header.string_count; i++) {
+        valid = strings[i].length <= header.characters_size && strings[i].offset <= header.characters_size - strings[i].length;
+
+        if (valid) {
+            symbols[i] = intern(interner, data + header.characters_offset + strings[i].offset, strings[i].length);
+        }
+    }
+
+    TokenList* list = valid ? create_token_list(arena, interner, source -> data, source -> length) : NULL;
+
+    if (list) {
+        const uint8_t* kinds = (const uint8_t*)(data + header.kinds_offset);
+        const uint32_t* offsets = (const uint32_t*)(data + header.offsets_offset);
+        const uint32_t* payloads = (const uint32_t*)(data + header.payloads_offset);
+
+        resize_token_list(list, count);
+
+        for (size_t chunk = 0; chunk < list -> chunk_count; chunk++) {
+            list -> kinds[chunk] = (uint8_t*)(kinds + (chunk << TOKEN_CHUNK_SHIFT));
+            list -> offsets[chunk] = (uint32_t*)(offsets + (chunk << TOKEN_CHUNK_SHIFT));
+        }
+
+        for (size_t i = 0; valid && i < count; i++) {
+            uint32_t payload = payloads[i];
+            size_t length = kinds[i] == INT_LITERAL ? int_literal_length(payload) : payload;
+
+            if (kinds[i] == IDENTIFIER) {
+                valid = payload < header.string_count;
+                payload = valid ? symbols[payload] : 0;
+                length = valid ? strings[payloads[i]].length : 0;
+            }
+
+            valid = valid && kinds[i] < TOKEN_KIND_COUNT && offsets[i] <= source -> length && length <= source -> length - offsets[i];
+            list -> payloads[i >> TOKEN_CHUNK_SHIFT][i & (TOKEN_CHUNK_SIZE - 1)] = payload;
+        }
+    }
+
+    if (!valid) {
+        free_source_buffer(cache);
+        return NULL;
+    }
+
+    *guard = header.guard == NO_SYMBOL ? NO_SYMBOL : symbols[header.guard];
+    *mapping = cache;
+    return list;
+}
+
+/**
+ * @brief Writes the tokens of a file to the cache.
+ * 
+ * @param arena A pointer to the Arena scratch memory comes from.
+ * @param directory The cache directory.
+ * @param key The cache key of the file.
+ * @param tokens A pointer to the raw tokens of the file.
+ * @param guard The file's include guard, or NO_SYMBOL.
+ * @param source_length The length of the file.
+ */
+void store_token_cache(Arena* arena, const char* directory, uint64_t key, const TokenList* tokens, uint32_t guard, size_t source_length) {
+    const Interner* interner = tokens -> interner;
+    uint32_t* local = NULL;
+    size_t local_capacity = 0;
+    uint32_t* names = NULL;
+    size_t name_count = 0;
+    size_t name_capacity = 0;
+    TokenCacheHeader header;
+    OutputBuffer out;
+
+    memset(&header, 0, sizeof(header));
+    init_output_buffer(&out, arena, sizeof(header) + tokens -> size * 9 + 4096);
+    output_bytes(&out, &header, sizeof(header));
+
+    // Give every distinct identifier a local index, in order of first use.
+    for (size_t i = 0; i < tokens -> size; i++) {
+        if (token_kind(tokens, i) == IDENTIFIER) {
+            uint32_t symbol = token_payload(tokens, i);
+
+            local = grow_symbol_table(arena, local, &local_capacity, symbol, sizeof(uint32_t));
+            if (!local[symbol]) {
+                names = arena_grow_array(arena, names, &name_capacity, name_count + 1, sizeof(uint32_t));
+                names[name_count++] = symbol;
+                local[symbol] = (uint32_t)name_count;
+            }
+        }
+    }
+
+    header.kinds_offset = out.size;
+    for (size_t i = 0; i < tokens -> size; i++) {
+        output_u8(&out, (uint8_t)token_kind(tokens, i));
+    }
+
+    align_output(&out, 4);
+    header.offsets_offset = out.size;
+    for (size_t i = 0; i < tokens -> size; i++) {
+        output_u32(&out, token_offset(tokens, i));
+    }
+
+    header.payloads_offset = out.size;
+    for (size_t i = 0; i < tokens -> size; i++) {
+        uint32_t payload = token_payload(tokens, i);
+        output_u32(&out, token_kind(tokens, i) == IDENTIFIER ? local[payload] - 1 : payload);
+    }
+
+    header.strings_offset = out.size;
+    uint32_t character_offset = 0;
+    for (size_t i = 0; i < name_count; i++) {
+        CachedString string = { character_offset, (uint32_t)symbol_length(interner, names[i]) };
+
+        output_bytes(&out, &string, sizeof(string));
+        character_offset += string.length;
+    }
+
+    header.characters_offset = out.size;
+    for (size_t i = 0; i < name_count; i++) {
+        output_bytes(&out, symbol_text(interner, names[i]), symbol_length(interner, names[i]));
+    }
+    header.characters_size = out.size - header.characters_offset;
+
+    memcpy(header.magic, TOKEN_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TOKEN_CACHE_VERSION;
+    header.header_size = sizeof(TokenCacheHeader);
+    header.key = key;
+    header.source_length = source_length;
+    header.file_size = out.size;
+    header.token_count = (uint32_t)tokens -> size;
+    header.string_count = (uint32_t)name_count;
+    header.guard = (guard != NO_SYMBOL && guard < local_capacity && local[guard]) ? local[guard] - 1 : NO_SYMBOL;
+    header.kind_count = TOKEN_KIND_COUNT;
+    memcpy(out.data, &header, sizeof(header));
+
+    header.file_hash = cache_file_hash(out.data, out.size, sizeof(header));
+    memcpy(out.data, &header, sizeof(header));
+
+    write_cache_file(arena, cache_path(arena, directory, key, ".tok"), &out);
+}
+
+/**
+ * @brief Computes the checksum of a cache file.
+ * 
+ * Covers the whole file except the checksum itself, which is the last 
+ * field of the header, so a damaged header is caught as well as a 
+ * damaged body.
+ * 
+ * @param data The contents of the file.
+ * @param size The size of the file.
+ * @param header_size The size of the file's header.
+ * @return The checksum.
+ */
+uint64_t cache_file_hash(const char* data, size_t size, size_t header_size) {
+    uint64_t header = hash_bytes(data, header_size - sizeof(uint64_t));
+
+    return (header * 0x9e3779b97f4a7c15ull) ^ hash_bytes(data + header_size, size - header_size);
+}
+
+/**
+ * @brief Writes a cache file atomically.
+ * 
+ * The file is written under a temporary name and renamed into place, 
+ * so concurrent compilers never see a partial file. Failing to write 
+ * the cache is not an error; the next compile just misses again.
+ * 
+ * @param arena A pointer to the Arena scratch memory comes from.
+ * @param path The path of the cache file.
+ * @param out A pointer to the OutputBuffer holding the contents.
+ */
+void write_cache_file(Arena* arena, const char* path, const OutputBuffer* out) {
+    char suffix[64];
+    int suffix_length = snprintf(suffix, sizeof(suffix), ".%ld.%lu.tmp", (long)getpid(), (unsigned long)pthread_self());
+    char* temporary = arena_alloc(arena, strlen(path) + (size_t)suffix_length + 1);
+
+    strcpy(temporary, path);
+    strcat(temporary, suffix);
+
+    if (write_output_file(out, temporary) < 0 || rename(temporary, path) < 0) {
+        unlink(temporary);
+    }
+}
+
+/**
+* * TOKEN CACHE END
+*/
+
+/**
+* * PREPROCESSOR
+* Runs between lexing and parsing, on tokens instead of text.
+* Handles #include, #define, #undef, the conditional directives, 
+* #pragma once and #error. Every file is loaded and lexed once per 
+* translation unit and then reused from the file cache. Files whose 
+* contents are wrapped in an include guard, or that contain 
+* #pragma once, are skipped without reading a single token when they 
+* are included again.
+*/
+
+/**
+ * @brief Grows a table indexed by symbol ID so it has a slot for symbol.
+ * 
+ * New slots are zero-filled.
+ * 
+ * @param arena A pointer to the Arena the table is allocated from.
+ * @param table The table, or NULL.
+ * @param capacity A pointer to the number of slots in the table.
+ * @param symbol The symbol that needs a slot.
+ * @param element_size The size of one slot in bytes.
+ * @return The table, which may have moved.
+ */
+void* grow_symbol_table(Arena* arena, void* table, size_t* capacity, uint32_t symbol, size_t element_size) {
+    size_t old_capacity = table ? *capacity : 0;
+
+    if (symbol < old_capacity) {
+        return table;
+    }
+
+    table = arena_grow_array(arena, table, capacity, (size_t)symbol + 1, element_size);
+    memset((char*)table + old_capacity * element_size, 0, (*capacity - old_capacity) * element_size);
+
+    return table;
+}
+
+/**
+ * @brief Returns the macro table entry of a name, adding it if needed.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param symbol The symbol ID of the name.
+ * @return A pointer to the entry, valid until the table next grows.
+ */
+Macro* find_macro(Preprocessor* preprocessor, uint32_t symbol) {
+    preprocessor -> macros = grow_symbol_table(preprocessor -> arena, preprocessor -> macros, &(preprocessor -> macro_capacity), symbol, sizeof(Macro));
+
+    return &(preprocessor -> macros[symbol]);
+}
+
+/**
+ * @brief Checks whether a name is currently defined as a macro.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param symbol The symbol ID of the name.
+ * @return 1 if it is defined, 0 otherwise.
+ */
+int macro_defined(const Preprocessor* preprocessor, uint32_t symbol) {
+    return symbol < preprocessor -> macro_capacity && preprocessor -> macros[symbol].defined;
+}
+
+/**
+ * @brief Appends a token to a token buffer.
+ * 
+ * @param arena A pointer to the Arena the buffer is allocated from.
+ * @param buffer A pointer to the TokenBuffer.
+ * @param token A pointer to the token to append.
+ */
+void push_token(Arena* arena, TokenBuffer* buffer, const Token* token) {
+    buffer -> tokens = arena_grow_array(arena, buffer -> tokens, &(buffer -> capacity), buffer -> count + 1, sizeof(Token));
+    buffer -> tokens[buffer -> count++] = *token;
+}
+
+/**
+ * @brief Returns a pointer to the first character of a preprocessor token.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param token A pointer to a token whose offset is in the source map.
+ * @return A pointer into the file the token was lexed from.
+ */
+const char* pp_token_chars(const Preprocessor* preprocessor, const Token* token) {
+    const SourceFile* file = &(preprocessor -> map -> files[find_source_file(preprocessor -> map, token -> offset)]);
+
+    return file -> data + (token -> offset - file -> base);
+}
+
+/**
+ * @brief Checks whether a preprocessor token is spelled a given way.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param token A pointer to the token.
+ * @param text The spelling to compare against.
+ * @return 1 if the token is spelled exactly text, 0 otherwise.
+ */
+int token_is(const Preprocessor* preprocessor, const Token* token, const char* text) {
+    size_t length = strlen(text);
+
+    return token -> length == length && memcmp(pp_token_chars(preprocessor, token), text, length) == 0;
+}
+
+/**
+ * @brief Reports a preprocessor diagnostic at a position in the source 
+ * map.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param error 1 for an error, 0 for a warning.
+ * @param offset An offset in the source map.
+ * @param format A printf-style format for the message.
+ * @param arguments The arguments of the format.
+ */
+void vpreprocessor_diagnostic(Preprocessor* preprocessor, int error, uint32_t offset, const char* format, va_list arguments) {
+    SourceFile* file = &(preprocessor -> map -> files[find_source_file(preprocessor -> map, offset)]);
+    size_t line;
+    size_t column;
+
+    find_line_column(preprocessor -> map -> arena, &(file -> lines), file -> data, file -> length, offset - file -> base, &line, &column);
+    vreport_diagnostic(error, file -> name, line, column, format, arguments);
+}
+
+/**
+ * @brief Reports a preprocessor error at a position in the source map.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param offset An offset in the source map.
+ * @param format A printf-style format for the message.
+ */
+void preprocessor_error(Preprocessor* preprocessor, uint32_t offset, const char* format, ...) {
+    va_list arguments;
+
+    va_start(arguments, format);
+    vpreprocessor_diagnostic(preprocessor, 1, offset, format, arguments);
+    va_end(arguments);
+
+    preprocessor -> failed = 1;
+}
+
+/**
+ * @brief Reports a preprocessor warning at a position in the source 
+ * map; preprocessing goes on.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param offset An offset in the source map.
+ * @param format A printf-style format for the message.
+ */
+void preprocessor_warning(Preprocessor* preprocessor, uint32_t offset, const char* format, ...) {
+    va_list arguments;
+
+    va_start(arguments, format);
+    vpreprocessor_diagnostic(preprocessor, 0, offset, format, arguments);
+    va_end(arguments);
+}
+
+/**
+ * @brief Checks whether only blanks precede a position on its line.
+ * 
+ * @param data The contents of the file.
+ * @param offset A position in the file.
+ * @return 1 if the position starts its line, ignoring blanks.
+ */
+int is_line_start(const char* data, uint32_t offset) {
+    while (offset > 0 && (data[offset - 1] == ' ' || data[offset - 1] == '\t' || data[offset - 1] == '\r' || data[offset - 1] == '\f' || data[offset - 1] == '\v')) {
+        offset--;
+    }
+
+    return offset == 0 || data[offset - 1] == '\n';
+}
+
+/**
+ * @brief Checks whether a line ends between two positions.
+ * 
+ * Only meant for the gap between two tokens, which holds nothing but 
+ * whitespace and comments. Newlines inside block comments do not 
+ * count, since a comment is a single space, and neither do newlines 
+ * escaped with a backslash.
+ * 
+ * @param data The contents of the file.
+ * @param from The first position of the gap.
+ * @param to The position just past the gap.
+ * @return 1 if the gap contains a newline, 0 otherwise.
+ */
+int newline_between(const char* data, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; i++) {
+        if (data[i] == '\n' && !(i > from && (data[i - 1] == '\\' || (data[i - 1] == '\r' && i - 1 > from && data[i - 2] == '\\')))) {
+            return 1;
+        }
+
+        if (data[i] == '/' && i + 1 < to && data[i + 1] == '*') {
+            i += 2;
+            while (i + 1 < to && !(data[i] == '*' && data[i + 1] == '/')) {
+                i++;
+            }
+            i++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Checks whether a token of a raw token list has a given spelling.
+ * 
+ * @param list A pointer to the raw TokenList of one file.
+ * @param index The index of the token.
+ * @param text The spelling to compare against.
+ * @return 1 if the token is spelled exactly text, 0 otherwise.
+ */
+int raw_token_is(const TokenList* list, size_t index, const char* text) {
+    size_t length = strlen(text);
+
+    return token_length(list, index) == length && memcmp(list -> source + token_offset(list, index), text, length) == 0;
+}
+
+/**
+ * @brief Checks whether a token of a raw token list starts a directive.
+ * 
+ * @param list A pointer to the raw TokenList of one file.
+ * @param index The index of the token.
+ * @return 1 if the token is a '#' at the start of a line.
+ */
+int is_directive_start(const TokenList* list, size_t index) {
+    return token_kind(list, index) == HASH && is_line_start(list -> source, token_offset(list, index));
+}
+
+/**
+ * @brief Finds the include guard of a file.
+ * 
+ * A file has an include guard when its first two lines are 
+ * "#ifndef X" and "#define X" and the #endif matching the #ifndef, 
+ * without an #elif or #else in between, is its last line. Including 
+ * such a file while X is defined has no effect, so it can be skipped.
+ * 
+ * @param list A pointer to the raw TokenList of the file.
+ * @return The symbol of X, or NO_SYMBOL if the file is not guarded.
+ */
+uint32_t detect_include_guard(const TokenList* list) {
+    const char* data = list -> source;
+
+    if (list -> size < 6 || !is_directive_start(list, 0) || !raw_token_is(list, 1, "ifndef") || token_kind(list, 2) != IDENTIFIER ||
+        !is_directive_start(list, 3) || !raw_token_is(list, 4, "define") || token_kind(list, 5) != IDENTIFIER ||
+        token_payload(list, 2) != token_payload(list, 5)) {
+        return NO_SYMBOL;
+    }
+
+    if (!newline_between(data, token_offset(list, 2) + token_length(list, 2), token_offset(list, 3)) ||
+        (list -> size > 6 && !newline_between(data, token_offset(list, 5) + token_length(list, 5), token_offset(list, 6)))) {
+        return NO_SYMBOL;
+    }
+
+    size_t depth = 1;
+
+    for (size_t i = 6; i + 1 < list -> size; i++) {
+        if (!is_directive_start(list, i)) {
+            continue;
+        }
+
+        if (raw_token_is(list, i + 1, "if") || raw_token_is(list, i + 1, "ifdef") || raw_token_is(list, i + 1, "ifndef")) {
+            depth++;
+        } else if (depth == 1 && (raw_token_is(list, i + 1, "elif") || raw_token_is(list, i + 1, "else"))) {
+            return NO_SYMBOL;
+        } else if (raw_token_is(list, i + 1, "endif") && --depth == 0) {
+            for (size_t j = i + 2; j < list -> size; j++) {
+                if (newline_between(data, token_offset(list, j - 1) + token_length(list, j - 1), token_offset(list, j))) {
+                    return NO_SYMBOL;
+                }
+            }
+
+            return token_payload(list, 2);
+        }
+    }
+
+    return NO_SYMBOL;
+}
+
+/**
+ * @brief Takes the next token from a token reader.
+ * 
+ * Expansion markers are consumed on the way and end the expansion of 
+ * their macro.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param reader A pointer to the TokenReader.
+ * @return The next token, or an END_OF_FILE token once the reader is 
+ * exhausted or has reached a directive.
+ */
+Token reader_next(Preprocessor* preprocessor, TokenReader* reader) {
+    while (reader -> pending.count > 0) {
+        Token token = reader -> pending.tokens[--(reader -> pending.count)];
+
+        if (token.type != END_OF_FILE) {
+            return token;
+        }
+
+        preprocessor -> macros[token.symbol].expanding = 0;
+    }
+
+    if (reader -> array && reader -> position < reader -> array_count) {
+        return reader -> array[reader -> position++];
+    }
+
+    if (reader -> list && reader -> position < reader -> list -> size && !is_directive_start(reader -> list, reader -> position)) {
+        Token token = get_token(reader -> list, reader -> position++);
+
+        token.offset += reader -> base;
+        return token;
+    }
+
+    Token end = { END_OF_FILE, 0, 0, NO_SYMBOL, 0 };
+    return end;
+}
+
+/**
+ * @brief Returns the kind of the next token of a reader without taking it.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param reader A pointer to the TokenReader.
+ * @return The kind of the token reader_next() would return.
+ */
+TokenType reader_peek(Preprocessor* preprocessor, TokenReader* reader) {
+    while (reader -> pending.count > 0) {
+        const Token* token = &(reader -> pending.tokens[reader -> pending.count - 1]);
+
+        if (token -> type != END_OF_FILE) {
+            return token -> type;
+        }
+
+        preprocessor -> macros[token -> symbol].expanding = 0;
+        reader -> pending.count--;
+    }
+
+    if (reader -> array) {
+        return reader -> position < reader -> array_count ? reader -> array[reader -> position].type : END_OF_FILE;
+    }
+
+    if (reader -> list && reader -> position < reader -> list -> size && !is_directive_start(reader -> list, reader -> position)) {
+        return token_kind(reader -> list, reader -> position);
+    }
+
+    return END_OF_FILE;
+}
+
+/**
+ * @brief Fully macro-expands a list of tokens.
+ * 
+ * Used for the arguments of function-like macros, which are expanded 
+ * before they are substituted into the body.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param tokens The tokens to expand.
+ * @param count The number of tokens.
+ * @param out A pointer to the TokenBuffer the expansion is appended to.
+ */
+void expand_tokens(Preprocessor* preprocessor, const Token* tokens, size_t count, TokenBuffer* out) {
+    TokenReader reader;
+
+    memset(&reader, 0, sizeof(TokenReader));
+    reader.array = tokens;
+    reader.array_count = count;
+
+    for (Token token = next_expanded_token(preprocessor, &reader); token.type != END_OF_FILE; token = next_expanded_token(preprocessor, &reader)) {
+        push_token(preprocessor -> arena, out, &token);
+    }
+}
+
+/**
+ * @brief Expands one use of a macro.
+ * 
+ * For a function-like macro the arguments are read from the reader 
+ * first. The expansion is pushed back onto the reader, so it is 
+ * rescanned for further macros as it is read.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param reader A pointer to the TokenReader, positioned after the name.
+ * @param name A pointer to the name token.
+ * @return 1 on success, 0 if the use was malformed.
+ */
+int expand_macro(Preprocessor* preprocessor, TokenReader* reader, const Token* name) {
+    Arena* arena = preprocessor -> arena;
+    Macro macro = preprocessor -> macros[name -> symbol];
+    const char* text = symbol_text(preprocessor -> interner, name -> symbol);
+    TokenBuffer expansion = { macro.body, macro.body_count, macro.body_count };
+
+    if (macro.function_like) {
+        TokenBuffer raw = { NULL, 0, 0 };
+        TokenBuffer expanded = { NULL, 0, 0 };
+        size_t* bounds = NULL;
+        size_t bound_count = 0;
+        size_t bound_capacity = 0;
+        size_t depth = 0;
+
+        reader_next(preprocessor, reader);
+
+        for (;;) {
+            Token token = reader_next(preprocessor, reader);
+
+            if (token.type == END_OF_FILE) {
+                preprocessor_error(preprocessor, name -> offset, "Unterminated call to macro '%s'.", text);
+                return 0;
+            }
+
+            if (token.type == R_PARAN && depth == 0) {
+                break;
+            }
+
+            if (token.type == COMMA && depth == 0) {
+                bounds = arena_grow_array(arena, bounds, &bound_capacity, bound_count + 1, sizeof(size_t));
+                bounds[bound_count++] = raw.count;
+                continue;
+            }
+
+            depth += (token.type == L_PARAN);
+            depth -= (token.type == R_PARAN);
+            push_token(arena, &raw, &token);
+        }
+
+        bounds = arena_grow_array(arena, bounds, &bound_capacity, bound_count + 1, sizeof(size_t));
+        bounds[bound_count++] = raw.count;
+
+        if (macro.parameter_count == 0 && bound_count == 1 && raw.count == 0) {
+            bound_count = 0;
+        }
+
+        if (bound_count != macro.parameter_count) {
+            preprocessor_error(preprocessor, name -> offset, "Macro '%s' expects %u arguments, got %zu.", text, macro.parameter_count, bound_count);
+            return 0;
+        }
+
+        // Each argument is expanded once, however often its parameter 
+        // is used; starts holds where each expanded argument begins.
+        size_t* starts = arena_alloc(arena, sizeof(size_t) * (bound_count + 1));
+
+        for (size_t i = 0; i < bound_count; i++) {
+            size_t first = i ? bounds[i - 1] : 0;
+
+            starts[i] = expanded.count;
+            expand_tokens(preprocessor, raw.tokens + first, bounds[i] - first, &expanded);
+        }
+        starts[bound_count] = expanded.count;
+
+        expansion.tokens = NULL;
+        expansion.count = 0;
+        expansion.capacity = 0;
+
+        for (uint32_t i = 0; i < macro.body_count; i++) {
+            const Token* token = &(macro.body[i]);
+            uint32_t parameter = 0;
+
+            while (token -> type == IDENTIFIER && parameter < macro.parameter_count && macro.parameters[parameter] != token -> symbol) {
+                parameter++;
+            }
+
+            if (token -> type != IDENTIFIER || parameter == macro.parameter_count) {
+                push_token(arena, &expansion, token);
+                continue;
+            }
+
+            for (size_t j = starts[parameter]; j < starts[parameter + 1]; j++) {
+                push_token(arena, &expansion, &(expanded.tokens[j]));
+            }
+        }
+    }
+
+    Token marker = { END_OF_FILE, 0, 0, name -> symbol, 0 };
+
+    push_token(arena, &(reader -> pending), &marker);
+    for (size_t i = expansion.count; i > 0; i--) {
+        push_token(arena, &(reader -> pending), &(expansion.tokens[i - 1]));
+    }
+
+    preprocessor -> macros[name -> symbol].expanding = 1;
+    return 1;
+}
+
+/**
+ * @brief Takes the next token from a reader after macro expansion.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param reader A pointer to the TokenReader.
+ * @return The next token that is not the name of a macro being used, 
+ * or an END_OF_FILE token.
+ */
+Token next_expanded_token(Preprocessor* preprocessor, TokenReader* reader) {
+    for (;;) {
+        Token token = reader_next(preprocessor, reader);
+
+        if (token.type != IDENTIFIER || !macro_defined(preprocessor, token.symbol)) {
+            return token;
+        }
+
+        const Macro* macro = &(preprocessor -> macros[token.symbol]);
+
+        if (macro -> expanding || (macro -> function_like && reader_peek(preprocessor, reader) != L_PARAN)) {
+            return token;
+        }
+
+        expand_macro(preprocessor, reader, &token);
+    }
+}
+
+/**
+ * @brief Moves an #if expression to its next token.
+ * 
+ * @param expression A pointer to the IfExpression.
+ */
+void advance_if_expression(IfExpression* expression) {
+    expression -> current = next_expanded_token(expression -> preprocessor, &(expression -> reader));
+}
+
+/**
+ * @brief Parses a unary expression of an #if directive.
+ * 
+ * Identifiers left over after macro expansion are 0, as are keywords. 
+ * A literal is unsigned if it has a u suffix or does not fit in 
+ * intmax_t, and - and ~ keep the type of their operand.
+ * 
+ * @param expression A pointer to the IfExpression.
+ * @return The value of the expression.
+ */
+IfValue parse_if_unary(IfExpression* expression) {
+    Preprocessor* preprocessor = expression -> preprocessor;
+    Token token = expression -> current;
+    IfValue value = { 0, 0 };
+
+    if (expression -> failed) {
+        return value;
+    }
+
+    switch (token.type) {
+        case MINUS:
+            advance_if_expression(expression);
+            value = parse_if_unary(expression);
+            value.value = 0 - value.value;
+            return value;
+        case PLUS:
+            advance_if_expression(expression);
+            return parse_if_unary(expression);
+        case BANG:
+            advance_if_expression(expression);
+            value.value = !parse_if_unary(expression).value;
+            return value;
+        case TILDE:
+            advance_if_expression(expression);
+            value = parse_if_unary(expression);
+            value.value = ~value.value;
+            return value;
+        case L_PARAN:
+            advance_if_expression(expression);
+            value = parse_if_binary(expression, 1);
+
+            if (expression -> current.type != R_PARAN) {
+                expression -> failed = 1;
+                return value;
+            }
+
+            advance_if_expression(expression);
+            return value;
+        case INT_LITERAL: {
+            value.value = token.value;
+
+            if (value.value & LITERAL_LENGTH_FLAG) {
+                const char* text = pp_token_chars(preprocessor, &token);
+
+                if (!parse_integer_literal(text, token.length, &(value.value))) {
+                    expression -> failed = 1;
+                    return value;
+                }
+
+                value.is_unsigned = value.value > INT64_MAX || memchr(text, 'u', token.length) || memchr(text, 'U', token.length);
+            }
+
+            advance_if_expression(expression);
+            return value;
+        }
+        case IDENTIFIER:
+            if (token.symbol == preprocessor -> defined_symbol) {
+                // The operand of defined is read without expanding it.
+                Token operand = reader_next(preprocessor, &(expression -> reader));
+                int parenthesized = operand.type == L_PARAN;
+
+                if (parenthesized) {
+                    operand = reader_next(preprocessor, &(expression -> reader));
+                }
+
+                if (operand.type == IDENTIFIER) {
+                    value.value = macro_defined(preprocessor, operand.symbol);
+                } else if (operand.type == END_OF_FILE || lookup_keyword(pp_token_chars(preprocessor, &operand), operand.length) == IDENTIFIER) {
+                    expression -> failed = 1;
+                    return value;
+                }
+
+                if (parenthesized && reader_next(preprocessor, &(expression -> reader)).type != R_PARAN) {
+                    expression -> failed = 1;
+                    return value;
+                }
+            }
+
+            advance_if_expression(expression);
+            return value;
+        default:
+            if (token.type == END_OF_FILE || lookup_keyword(pp_token_chars(preprocessor, &token), token.length) == IDENTIFIER) {
+                expression -> failed = 1;
+                return value;
+            }
+
+            advance_if_expression(expression);
+            return value;
+    }
+}
+
+/**
+ * @brief Parses a binary expression of an #if directive.
+ * 
+ * Uses the same precedence climbing as the parser. Arithmetic is done 
+ * in 64 bits and wraps. As in C, if either operand is unsigned both 
+ * are compared and computed as unsigned, and the result of an 
+ * arithmetic operator is unsigned; comparisons and the logical 
+ * operators give a signed 0 or 1.
+ * 
+ * @param expression A pointer to the IfExpression.
+ * @param min_precedence The lowest precedence an operator may have to 
+ * be part of this expression.
+ * @return The value of the expression.
+ */
+IfValue parse_if_binary(IfExpression* expression, int min_precedence) {
+    IfValue lhs = parse_if_unary(expression);
+
+    for (;;) {
+        TokenType op = expression -> current.type;
+        int precedence = binary_precedence(op);
+
+        if (expression -> failed || precedence == 0 || precedence < min_precedence) {
+            return lhs;
+        }
+
+        int short_circuit = (op == AND_AND && !lhs.value) || (op == OR_OR && lhs.value);
+
+        advance_if_expression(expression);
+        expression -> unevaluated += short_circuit;
+        IfValue rhs = parse_if_binary(expression, precedence + 1);
+        expression -> unevaluated -= short_circuit;
+
+        int is_unsigned = lhs.is_unsigned || rhs.is_unsigned;
+        uint64_t a = lhs.value;
+        uint64_t b = rhs.value;
+        int64_t x = (int64_t)a;
+        int64_t y = (int64_t)b;
+
+        lhs.is_unsigned = 0;
+
+        switch (op) {
+            case OR_OR: lhs.value = a || b; break;
+            case AND_AND: lhs.value = a && b; break;
+            case EQUAL_EQUAL: lhs.value = a == b; break;
+            case NOT_EQUAL: lhs.value = a != b; break;
+            case LESS: lhs.value = is_unsigned ? a < b : x < y; break;
+            case LESS_EQUAL: lhs.value = is_unsigned ? a <= b : x <= y; break;
+            case GREATER: lhs.value = is_unsigned ? a > b : x > y; break;
+            case GREATER_EQUAL: lhs.value = is_unsigned ? a >= b : x >= y; break;
+            case PLUS: lhs.value = a + b; lhs.is_unsigned = is_unsigned; break;
+            case MINUS: lhs.value = a - b; lhs.is_unsigned = is_unsigned; break;
+            case STAR: lhs.value = a * b; lhs.is_unsigned = is_unsigned; break;
+            case SLASH:
+            case PERCENT:
+                lhs.is_unsigned = is_unsigned;
+
+                if (b == 0 || (!is_unsigned && x == INT64_MIN && y == -1)) {
+                    if (!expression -> unevaluated) {
+                        expression -> failed = 1;
+                        expression -> message = b == 0 ? "Division by zero in #if." : "Integer overflow in #if.";
+                    }
+
+                    lhs.value = 0;
+                } else if (is_unsigned) {
+                    lhs.value = (op == SLASH) ? a / b : a % b;
+                } else {
+                    lhs.value = (uint64_t)((op == SLASH) ? x / y : x % y);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Evaluates the condition of an #if or #elif directive.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param directive A pointer to the '#' token of the directive.
+ * @param tokens The tokens of the condition.
+ * @param count The number of tokens.
+ * @return 1 if the condition holds, 0 if it does not or is malformed.
+ */
+int evaluate_condition(Preprocessor* preprocessor, const Token* directive, const Token* tokens, size_t count) {
+    IfExpression expression;
+
+    memset(&expression, 0, sizeof(IfExpression));
+    expression.preprocessor = preprocessor;
+    expression.reader.array = tokens;
+    expression.reader.array_count = count;
+    expression.message = "Invalid expression in #if.";
+
+    advance_if_expression(&expression);
+    IfValue value = parse_if_binary(&expression, 1);
+
+    if (!expression.failed && expression.current.type != END_OF_FILE) {
+        expression.failed = 1;
+    }
+
+    // Drain the reader so every macro expanded in the condition is 
+    // usable again.
+    while (reader_next(preprocessor, &(expression.reader)).type != END_OF_FILE) {
+    }
+
+    if (expression.failed) {
+        preprocessor_error(preprocessor, directive -> offset, "%s", expression.message);
+        return 0;
+    }
+
+    return value.value != 0;
+}
+
+/**
+ * @brief Checks whether a macro is defined exactly as a new definition.
+ * 
+ * As C11 6.10.3p1 requires, the parameters must be the same, and the 
+ * replacement lists must have the same tokens, spelled the same way, 
+ * with whitespace between the same pairs of tokens.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param macro A pointer to the defined Macro.
+ * @param new_macro A pointer to the new definition.
+ * @return 1 if the definitions are the same, 0 otherwise.
+ */
+int same_macro_definition(const Preprocessor* preprocessor, const Macro* macro, const Macro* new_macro) {
+    if (macro -> function_like != new_macro -> function_like || macro -> parameter_count != new_macro -> parameter_count || macro -> body_count != new_macro -> body_count) {
+        return 0;
+    }
+
+    for (uint32_t p = 0; p < (macro -> parameter_count); p++) {
+        if (macro -> parameters[p] != new_macro -> parameters[p]) {
+            return 0;
+        }
+    }
+
+    for (uint32_t t = 0; t < (macro -> body_count); t++) {
+        const Token* a = &(macro -> body[t]);
+        const Token* b = &(new_macro -> body[t]);
+
+        if (a -> length != b -> length || memcmp(pp_token_chars(preprocessor, a), pp_token_chars(preprocessor, b), a -> length) != 0) {
+            return 0;
+        }
+
+        if (t > 0 && (a -> offset != a[-1].offset + a[-1].length) != (b -> offset != b[-1].offset + b[-1].length)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Handles a #define directive.
+ * 
+ * The # and ## operators and variadic macros are not supported, and 
+ * are reported here rather than left in the body. Redefining a macro 
+ * differently draws a warning, as in gcc and clang, and the new 
+ * definition replaces the old one.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param directive A pointer to the '#' token of the directive.
+ * @param tokens The tokens after "define".
+ * @param count The number of tokens.
+ */
+void define_macro(Preprocessor* preprocessor, const Token* directive, const Token* tokens, size_t count) {
+    if (count == 0 || tokens[0].type != IDENTIFIER) {
+        preprocessor_error(preprocessor, directive -> offset, "Macro name must be an identifier.");
+        return;
+    }
+
+    // Only a '(' right after the name, without a space, makes the 
+    // macro function-like.
+    int function_like = count > 1 && tokens[1].type == L_PARAN && tokens[1].offset == tokens[0].offset + tokens[0].length;
+    uint32_t* parameters = NULL;
+    size_t parameter_count = 0;
+    size_t parameter_capacity = 0;
+    size_t i = 1;
+
+    if (function_like) {
+        i = 2;
+
+        if (i < count && tokens[i].type == R_PARAN) {
+            i++;
+        } else {
+            for (;;) {
+                if (i < count && tokens[i].type == ELLIPSIS) {
+                    preprocessor_error(preprocessor, tokens[i].offset, "Variadic macros are not supported.");
+                    return;
+                }
+
+                if (i + 1 >= count || tokens[i].type != IDENTIFIER || (tokens[i + 1].type != COMMA && tokens[i + 1].type != R_PARAN)) {
+                    preprocessor_error(preprocessor, tokens[0].offset, "Invalid parameter list of macro '%s'.", symbol_text(preprocessor -> interner, tokens[0].symbol));
+                    return;
+                }
+
+                parameters = arena_grow_array(preprocessor -> arena, parameters, &parameter_capacity, parameter_count + 1, sizeof(uint32_t));
+                parameters[parameter_count++] = tokens[i].symbol;
+                i += 2;
+
+                if (tokens[i - 1].type == R_PARAN) {
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t t = i; t < count; t++) {
+        // In an object-like macro a lone # is an ordinary token.
+        if (tokens[t].type == HASH_HASH || (function_like && tokens[t].type == HASH)) {
+            preprocessor_error(preprocessor, tokens[t].offset, "The %s operator is not supported.", tokens[t].type == HASH ? "#" : "##");
+            return;
+        }
+    }
+
+    Token* body = arena_alloc(preprocessor -> arena, sizeof(Token) * (count - i + 1));
+    memcpy(body, tokens + i, sizeof(Token) * (count - i));
+
+    Macro definition = { body, (uint32_t)(count - i), parameters, (uint32_t)parameter_count, (uint8_t)function_like, 1, 0 };
+    Macro* macro = find_macro(preprocessor, tokens[0].symbol);
+
+    if (macro -> defined && !same_macro_definition(preprocessor, macro, &definition)) {
+        preprocessor_warning(preprocessor, tokens[0].offset, "Macro '%s' redefined.", symbol_text(preprocessor -> interner, tokens[0].symbol));
+    }
+
+    macro -> body = definition.body;
+    macro -> body_count = definition.body_count;
+    macro -> parameters = definition.parameters;
+    macro -> parameter_count = definition.parameter_count;
+    macro -> function_like = definition.function_like;
+    macro -> defined = 1;
+}
+
+/**
+ * @brief Joins a directory and a file name into a path.
+ * 
+ * @param arena A pointer to the Arena the path is allocated from.
+ * @param directory The directory, which may be empty.
+ * @param directory_length The length of the directory.
+ * @param name The file name.
+ * @param name_length The length of the file name.
+ * @return The NUL-terminated path.
+ */
+char* join_path(Arena* arena, const char* directory, size_t directory_length, const char* name, size_t name_length) {
+    int separator = directory_length > 0 && directory[directory_length - 1] != '/';
+    char* path = arena_alloc(arena, directory_length + (size_t)separator + name_length + 1);
+
+    memcpy(path, directory, directory_length);
+    if (separator) {
+        path[directory_length] = '/';
+    }
+    memcpy(path + directory_length + separator, name, name_length);
+    path[directory_length + (size_t)separator + name_length] = '\0';
+
+    return path;
+}
+
+/**
+ * @brief Records which file a path refers to.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param path The symbol of the path.
+ * @param value The file index plus one, or MISSING_FILE.
+ */
+void set_file_of_path(Preprocessor* preprocessor, uint32_t path, uint32_t value) {
+    preprocessor -> file_of_path = grow_symbol_table(preprocessor -> arena, preprocessor -> file_of_path, &(preprocessor -> file_of_path_capacity), path, sizeof(uint32_t));
+    preprocessor -> file_of_path[path] = value;
+}
+
+/**
+ * @brief Adds a file to the file cache.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param path The path the file was opened by.
+ * @param source A pointer to the contents of the file.
+ * @param tokens A pointer to the raw tokens of the file.
+ * @param guard The include guard of the file, or NO_SYMBOL.
+ * @param owned Whether the cache owns source and must free it.
+ * @return The index of the file in the cache, or MISSING_FILE if the 
+ * source map is full.
+ */
+uint32_t add_cached_file(Preprocessor* preprocessor, const char* path, SourceBuffer* source, TokenList* tokens, uint32_t guard, int owned) {
+    uint32_t file = add_source_file(preprocessor -> map, path, source -> data, source -> length);
+
+    if (file == UINT32_MAX) {
+        return MISSING_FILE;
+    }
+
+    preprocessor -> files = arena_grow_array(preprocessor -> arena, preprocessor -> files, &(preprocessor -> file_capacity), preprocessor -> file_count + 1, sizeof(CachedFile));
+
+    uint32_t index = (uint32_t)(preprocessor -> file_count++);
+    CachedFile* cached = &(preprocessor -> files[index]);
+
+    cached -> path = intern(preprocessor -> interner, path, strlen(path));
+    cached -> file = file;
+    cached -> source = owned ? source : NULL;
+    cached -> cache = NULL;
+    cached -> tokens = tokens;
+    cached -> guard = guard;
+    cached -> pragma_once = 0;
+    cached -> included = 0;
+
+    set_file_of_path(preprocessor, cached -> path, index + 1);
+
+    char* real = realpath(path, NULL);
+    if (real) {
+        set_file_of_path(preprocessor, intern(preprocessor -> interner, real, strlen(real)), index + 1);
+        free(real);
+    }
+
+    return index;
+}
+
+/**
+ * @brief Returns the cached file for a path, loading it if needed.
+ * 
+ * Paths are looked up by their interned spelling first, so including 
+ * the same header by the same name again never touches the file 
+ * system; failed lookups are cached as well. A new spelling of a file 
+ * that is already cached is recognized by its real path. Under the 
+ * compile server, files come from its header cache and stay owned by 
+ * it.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param path The path of the file.
+ * @return The index of the file in the cache, or MISSING_FILE if it 
+ * cannot be loaded.
+ */
+uint32_t load_file(Preprocessor* preprocessor, const char* path) {
+    uint32_t symbol = intern(preprocessor -> interner, path, strlen(path));
+
+    if (symbol < preprocessor -> file_of_path_capacity && preprocessor -> file_of_path[symbol]) {
+        uint32_t value = preprocessor -> file_of_path[symbol];
+        return value == MISSING_FILE ? MISSING_FILE : value - 1;
+    }
+
+    const ResidentHeader* header = NULL;
+    SourceBuffer* source = NULL;
+
+    if (preprocessor -> headers) {
+        header = find_resident_header(preprocessor -> headers, preprocessor -> interner, path, preprocessor -> cache_directory);
+    } else {
+        source = read_source_file(path);
+    }
+
+    if (!header && !source) {
+        set_file_of_path(preprocessor, symbol, MISSING_FILE);
+        return MISSING_FILE;
+    }
+
+    char* real = realpath(path, NULL);
+    if (real) {
+        uint32_t real_symbol = intern(preprocessor -> interner, real, strlen(real));
+        free(real);
+
+        if (real_symbol < preprocessor -> file_of_path_capacity && preprocessor -> file_of_path[real_symbol] && preprocessor -> file_of_path[real_symbol] != MISSING_FILE) {
+            set_file_of_path(preprocessor, symbol, preprocessor -> file_of_path[real_symbol]);
+
+            if (source) {
+                free_source_buffer(source);
+            }
+
+            return preprocessor -> file_of_path[symbol] - 1;
+        }
+    }
+
+    if (header) {
+        uint32_t index = add_cached_file(preprocessor, path, header -> source, header -> tokens, header -> guard, 0);
+
+        if (index == MISSING_FILE) {
+            set_file_of_path(preprocessor, symbol, MISSING_FILE);
+        }
+
+        return index;
+    }
+
+    SourceBuffer* cache = NULL;
+    TokenList* tokens = NULL;
+    uint32_t guard = NO_SYMBOL;
+    uint64_t key = 0;
+
+    if (preprocessor -> cache_directory) {
+        key = token_cache_key(source);
+        tokens = load_token_cache(preprocessor -> arena, preprocessor -> interner, preprocessor -> cache_directory, key, source, &guard, &cache);
+    }
+
+    if (!tokens && (tokens = lex(preprocessor -> arena, preprocessor -> interner, source))) {
+        guard = detect_include_guard(tokens);
+
+        if (preprocessor -> cache_directory) {
+            store_token_cache(preprocessor -> arena, preprocessor -> cache_directory, key, tokens, guard, source -> length);
+        }
+    }
+
+    uint32_t index = tokens ? add_cached_file(preprocessor, path, source, tokens, guard, 1) : MISSING_FILE;
+
+    if (index == MISSING_FILE) {
+        if (cache) {
+            free_source_buffer(cache);
+        }
+
+        free_source_buffer(source);
+        set_file_of_path(preprocessor, symbol, MISSING_FILE);
+    } else {
+        preprocessor -> files[index].cache = cache;
+    }
+
+    return index;
+}
+
+/**
+ * @brief Searches the include path for a header.
+ * 
+ * "name" is looked for next to the including file first; both forms 
+ * then search the -I directories in order, followed by the system 
+ * directories.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param including The cache index of the including file.
+ * @param name The header name, without quotes or brackets.
+ * @param length The length of the name.
+ * @param angled Whether the name was written in angle brackets.
+ * @return The index of the file in the cache, or MISSING_FILE.
+ */
+uint32_t find_include(Preprocessor* preprocessor, uint32_t including, const char* name, size_t length, int angled) {
+    static const char* const system_paths[] = { "/usr/local/include", "/usr/include" };
+    Arena* arena = preprocessor -> arena;
+
+    if (name[0] == '/') {
+        return load_file(preprocessor, arena_strndup(arena, name, length));
+    }
+
+    if (!angled) {
+        const char* including_path = preprocessor -> map -> files[preprocessor -> files[including].file].name;
+        const char* slash = strrchr(including_path, '/');
+        size_t directory_length = slash ? (size_t)(slash - including_path) + 1 : 0;
+        uint32_t index = load_file(preprocessor, join_path(arena, including_path, directory_length, name, length));
+
+        if (index != MISSING_FILE) {
+            return index;
+        }
+    }
+
+    for (size_t i = 0; i < preprocessor -> include_path_count; i++) {
+        const char* directory = preprocessor -> include_paths[i];
+        uint32_t index = load_file(preprocessor, join_path(arena, directory, strlen(directory), name, length));
+
+        if (index != MISSING_FILE) {
+            return index;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(system_paths) / sizeof(system_paths[0]); i++) {
+        uint32_t index = load_file(preprocessor, join_path(arena, system_paths[i], strlen(system_paths[i]), name, length));
+
+        if (index != MISSING_FILE) {
+            return index;
+        }
+    }
+
+    return MISSING_FILE;
+}
+
+/**
+ * @brief Handles an #include directive.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param including The cache index of the including file.
+ * @param directive A pointer to the '#' token of the directive.
+ * @param tokens The tokens after "include".
+ * @param count The number of tokens.
+ */
+void include_file(Preprocessor* preprocessor, uint32_t including, const Token* directive, const Token* tokens, size_t count) {
+    const char* name = NULL;
+    size_t length = 0;
+    int angled = 0;
+
+    if (count > 0 && tokens[0].type == STRING_LITERAL && tokens[0].length >= 2 && pp_token_chars(preprocessor, &tokens[0])[tokens[0].length - 1] == '"') {
+        name = pp_token_chars(preprocessor, &tokens[0]) + 1;
+        length = tokens[0].length - 2;
+    } else if (count > 0 && tokens[0].type == LESS) {
+        for (size_t i = 1; i < count; i++) {
+            if (tokens[i].type == GREATER) {
+                name = pp_token_chars(preprocessor, &tokens[0]) + 1;
+                length = tokens[i].offset - tokens[0].offset - 1;
+                angled = 1;
+                break;
+            }
+        }
+    }
+
+    if (!name || length == 0) {
+        preprocessor_error(preprocessor, directive -> offset, "Expected \"FILENAME\" or <FILENAME> after #include.");
+        return;
+    }
+
+    uint32_t index = find_include(preprocessor, including, name, length, angled);
+
+    if (index == MISSING_FILE) {
+        preprocessor_error(preprocessor, tokens[0].offset, "'%.*s' file not found.", (int)length, name);
+        return;
+    }
+
+    CachedFile* file = &(preprocessor -> files[index]);
+
+    if ((file -> pragma_once && file -> included) || (file -> guard != NO_SYMBOL && macro_defined(preprocessor, file -> guard))) {
+        return;
+    }
+
+    if (preprocessor -> depth >= MAX_INCLUDE_DEPTH) {
+        preprocessor_error(preprocessor, directive -> offset, "#include nested too deeply.");
+        return;
+    }
+
+    file -> included = 1;
+    preprocessor -> depth++;
+    preprocess_file(preprocessor, index);
+    preprocessor -> depth--;
+}
+
+/**
+ * @brief Opens a conditional block.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param directive A pointer to the '#' token of the directive.
+ * @param parent_active Whether the enclosing code is active.
+ * @param value Whether the condition holds.
+ */
+void push_conditional(Preprocessor* preprocessor, const Token* directive, int parent_active, int value) {
+    preprocessor -> conditionals = arena_grow_array(preprocessor -> arena, preprocessor -> conditionals, &(preprocessor -> conditional_capacity), preprocessor -> conditional_count + 1, sizeof(Conditional));
+
+    Conditional* conditional = &(preprocessor -> conditionals[preprocessor -> conditional_count++]);
+    conditional -> directive = *directive;
+    conditional -> parent_active = (uint8_t)parent_active;
+    conditional -> active = (uint8_t)(parent_active && value);
+    conditional -> taken = conditional -> active;
+    conditional -> seen_else = 0;
+}
+
+/**
+ * @brief Checks whether tokens are currently being kept.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @return 0 inside a conditional block that is skipped, 1 otherwise.
+ */
+int preprocessor_active(const Preprocessor* preprocessor) {
+    return preprocessor -> conditional_count == 0 || preprocessor -> conditionals[preprocessor -> conditional_count - 1].active;
+}
+
+/**
+ * @brief Reads and handles one directive.
+ * 
+ * The directive runs to the end of its line; the lexer has already 
+ * spliced lines ending in a backslash.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param file The cache index of the file being preprocessed.
+ * @param reader A pointer to the file's TokenReader, positioned at the 
+ * '#' of the directive.
+ */
+void handle_directive(Preprocessor* preprocessor, uint32_t file, TokenReader* reader) {
+    const TokenList* list = reader -> list;
+    const char* data = list -> source;
+    Token hash = get_token(list, reader -> position++);
+    uint32_t previous_end = hash.offset + hash.length;
+    TokenBuffer* line = &(preprocessor -> line);
+
+    line -> count = 0;
+    hash.offset += reader -> base;
+
+    while (reader -> position < list -> size) {
+        Token token = get_token(list, reader -> position);
+
+        if (newline_between(data, previous_end, token.offset)) {
+            break;
+        }
+
+        reader -> position++;
+        previous_end = token.offset + token.length;
+        token.offset += reader -> base;
+        push_token(preprocessor -> arena, line, &token);
+    }
+
+    if (line -> count == 0) {
+        return;
+    }
+
+    const Token* name = &(line -> tokens[0]);
+    const Token* rest = line -> tokens + 1;
+    size_t rest_count = line -> count - 1;
+    int active = preprocessor_active(preprocessor);
+    Conditional* top = preprocessor -> conditional_count > preprocessor -> conditional_base ? &(preprocessor -> conditionals[preprocessor -> conditional_count - 1]) : NULL;
+
+    if (token_is(preprocessor, name, "ifdef") || token_is(preprocessor, name, "ifndef")) {
+        if (active && (rest_count == 0 || (rest[0].type != IDENTIFIER && lookup_keyword(pp_token_chars(preprocessor, &rest[0]), rest[0].length) == IDENTIFIER))) {
+            preprocessor_error(preprocessor, hash.offset, "Macro name missing after #%.*s.", (int)name -> length, pp_token_chars(preprocessor, name));
+        }
+
+        int defined = active && rest_count > 0 && rest[0].type == IDENTIFIER && macro_defined(preprocessor, rest[0].symbol);
+        push_conditional(preprocessor, &hash, active, token_is(preprocessor, name, "ifdef") ? defined : !defined);
+    } else if (token_is(preprocessor, name, "if")) {
+        push_conditional(preprocessor, &hash, active, active && evaluate_condition(preprocessor, &hash, rest, rest_count));
+    } else if (token_is(preprocessor, name, "elif") || token_is(preprocessor, name, "else")) {
+        int is_else = token_is(preprocessor, name, "else");
+
+        if (!top) {
+            preprocessor_error(preprocessor, hash.offset, "#%s without #if.", is_else ? "else" : "elif");
+        } else if (top -> seen_else) {
+            preprocessor_error(preprocessor, hash.offset, "#%s after #else.", is_else ? "else" : "elif");
+        } else if (top -> taken || !top -> parent_active) {
+            top -> active = 0;
+            top -> seen_else = (uint8_t)is_else;
+        } else {
+            top -> active = (uint8_t)(is_else || evaluate_condition(preprocessor, &hash, rest, rest_count));
+            top -> taken = top -> active;
+            top -> seen_else = (uint8_t)is_else;
+        }
+    } else if (token_is(preprocessor, name, "endif")) {
+        if (!top) {
+            preprocessor_error(preprocessor, hash.offset, "#endif without #if.");
+        } else {
+            preprocessor -> conditional_count--;
+        }
+    } else if (!active) {
+        return;
+    } else if (token_is(preprocessor, name, "define")) {
+        define_macro(preprocessor, &hash, rest, rest_count);
+    } else if (token_is(preprocessor, name, "undef")) {
+        if (rest_count == 0 || rest[0].type != IDENTIFIER) {
+            preprocessor_error(preprocessor, hash.offset, "Macro name must be an identifier.");
+        } else if (macro_defined(preprocessor, rest[0].symbol)) {
+            preprocessor -> macros[rest[0].symbol].defined = 0;
+        }
+    } else if (token_is(preprocessor, name, "include")) {
+        include_file(preprocessor, file, &hash, rest, rest_count);
+    } else if (token_is(preprocessor, name, "pragma")) {
+        // Unknown pragmas are ignored, as the standard allows.
+        if (rest_count > 0 && token_is(preprocessor, &rest[0], "once")) {
+            preprocessor -> files[file].pragma_once = 1;
+        }
+    } else if (token_is(preprocessor, name, "error") || token_is(preprocessor, name, "warning")) {
+        const char* message = rest_count ? pp_token_chars(preprocessor, &rest[0]) : "";
+        size_t length = rest_count ? rest[rest_count - 1].offset + rest[rest_count - 1].length - rest[0].offset : 0;
+
+        if (token_is(preprocessor, name, "error")) {
+            preprocessor_error(preprocessor, hash.offset, "#error %.*s", (int)length, message);
+        } else {
+            preprocessor_warning(preprocessor, hash.offset, "#warning %.*s", (int)length, message);
+        }
+    } else if (token_is(preprocessor, name, "line")) {
+        // Diagnostics always name the physical line, so a #line that 
+        // renames lines or the file would make them wrong; say so.
+        preprocessor_warning(preprocessor, hash.offset, "#line is not supported; locations refer to the physical source.");
+    } else if (!token_is(preprocessor, name, "ident")) {
+        preprocessor_error(preprocessor, hash.offset, "Unknown preprocessing directive '#%.*s'.", (int)name -> length, pp_token_chars(preprocessor, name));
+    }
+}
+
+/**
+ * @brief Preprocesses one file into the output token list.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ * @param file The cache index of the file.
+ */
+void preprocess_file(Preprocessor* preprocessor, uint32_t file) {
+    const CachedFile* cached = &(preprocessor -> files[file]);
+    size_t saved_base = preprocessor -> conditional_base;
+    TokenReader reader;
+
+    memset(&reader, 0, sizeof(TokenReader));
+    reader.list = cached -> tokens;
+    reader.base = preprocessor -> map -> files[cached -> file].base;
+    preprocessor -> conditional_base = preprocessor -> conditional_count;
+
+    for (;;) {
+        int active = preprocessor_active(preprocessor);
+        Token token = active ? next_expanded_token(preprocessor, &reader) : reader_next(preprocessor, &reader);
+
+        if (token.type != END_OF_FILE) {
+            if (active) {
+                add_token(preprocessor -> output, &token);
+            }
+        } else if (reader.position < reader.list -> size) {
+            handle_directive(preprocessor, file, &reader);
+        } else {
+            break;
+        }
+    }
+
+    if (preprocessor -> conditional_count > preprocessor -> conditional_base) {
+        preprocessor_error(preprocessor, preprocessor -> conditionals[preprocessor -> conditional_base].directive.offset, "Unterminated conditional directive.");
+        preprocessor -> conditional_count = preprocessor -> conditional_base;
+    }
+
+    preprocessor -> conditional_base = saved_base;
+}
+
+/**
+ * @brief Creates a preprocessor for one translation unit.
+ * 
+ * @param arena A pointer to the Arena everything is allocated from.
+ * @param interner A pointer to the Interner shared with the lexer.
+ * @param include_paths The directories given with -I, in order.
+ * @param include_path_count The number of directories.
+ * @param cache_directory The token cache directory, or NULL.
+ * @param headers The compile server's header cache, or NULL.
+ * @return A pointer to the new Preprocessor.
+ */
+Preprocessor* create_preprocessor(Arena* arena, Interner* interner, const char* const* include_paths, size_t include_path_count, const char* cache_directory, HeaderCache* headers) {
+    Preprocessor* preprocessor = arena_alloc(arena, sizeof(Preprocessor));
+
+    memset(preprocessor, 0, sizeof(Preprocessor));
+    preprocessor -> arena = arena;
+    preprocessor -> interner = interner;
+    preprocessor -> map = create_source_map(arena);
+    preprocessor -> include_paths = include_paths;
+    preprocessor -> include_path_count = include_path_count;
+    preprocessor -> cache_directory = cache_directory;
+    preprocessor -> headers = headers;
+    preprocessor -> defined_symbol = intern(interner, "defined", 7);
+
+    return preprocessor;
+}
+
+/**
+ * @brief Preprocesses a translation unit.
+ * 
+ * A file without a single '#' token cannot contain a directive or use 
+ * a macro, so its token list is returned as it is.
+ * 
+ * @param preprocessor A pointer to a new Preprocessor.
+ * @param filename The name of the main file.
+ * @param source A pointer to the contents of the main file.
+ * @param tokens A pointer to the raw tokens of the main file.
+ * @return The preprocessed tokens, or NULL if a directive failed.
+ */
+TokenList* preprocess(Preprocessor* preprocessor, const char* filename, SourceBuffer* source, TokenList* tokens) {
+    size_t i = 0;
+
+    while (i < tokens -> size && token_kind(tokens, i) != HASH) {
+        i++;
+    }
+
+    if (i == tokens -> size) {
+        return tokens;
+    }
+
+    uint32_t file = add_cached_file(preprocessor, filename, source, tokens, detect_include_guard(tokens), 0);
+    if (file == MISSING_FILE) {
+        errno = EFBIG;
+        report_system_error("Preprocessing file.");
+        return NULL;
+    }
+
+    preprocessor -> output = create_token_list(preprocessor -> arena, preprocessor -> interner, source -> data, source -> length);
+    preprocessor -> output -> source_map = preprocessor -> map;
+    preprocessor -> files[file].included = 1;
+
+    preprocess_file(preprocessor, file);
+
+    return preprocessor -> failed ? NULL : preprocessor -> output;
+}
+
+/**
+ * @brief Releases the files loaded by a preprocessor.
+ * 
+ * The preprocessor itself lives in its arena. Tokens from included 
+ * files point into these files, so this must not be called before the 
+ * last stage is done with the tokens.
+ * 
+ * @param preprocessor A pointer to the Preprocessor.
+ */
+void free_preprocessor(Preprocessor* preprocessor) {
+    for (size_t i = 0; i < preprocessor -> file_count; i++) {
+        if (preprocessor -> files[i].source) {
+            free_source_buffer(preprocessor -> files[i].source);
+        }
+
+        if (preprocessor -> files[i].cache) {
+            free_source_buffer(preprocessor -> files[i].cache);
+        }
+    }
+}
+
+/**
+* * PREPROCESSOR END
+*/
+
+/**
+* * PARSER
+* Second stage.
+* Performs recursive-descent parsing on the token list and builds a flat, 
+* index-based AST of the translation unit.
+* 
+* Grammar:
+*   translation-unit := function*
+*   function         := 'int' IDENTIFIER '(' parameters ')' (block | ';')
+*   parameters       := 'void'? | 'int' IDENTIFIER (',' 'int' IDENTIFIER)*
+*   block            := '{' statement* '}'
+*   statement        := 'return' expression ';'
+*                     | 'int' IDENTIFIER ('=' expression)? ';'
+*                     | 'if' '(' expression ')' statement ('else' statement)?
+*                     | 'while' '(' expression ')' statement
+*                     | block | expression? ';'
+*   expression       := IDENTIFIER '=' expression | binary
+*   binary           := unary (binary-operator unary)*, by precedence:
+*                       || then && then == != then < <= > >= then + - 
+*                       then * / %
+*   unary            := ('-' | '+' | '~' | '!') unary | primary
+*   primary          := INT_LITERAL | IDENTIFIER | IDENTIFIER '(' arguments ')'
+*                     | '(' expression ')'
+*   arguments        := (expression (',' expression)*)?
+*/
+
+/**
+ * @brief Creates a new, empty AST.
+ * 
+ * Allocates the node pool and extra array from the arena and adds the 
+ * AST_NONE node at index 0.
+ * 
+ * @param arena A pointer to the Arena the AST is allocated from.
+ * @param tokens A pointer to the TokenList the nodes refer to.
+ * @return A pointer to the newly created Ast.
+ */
+Ast* create_ast(Arena* arena, const TokenList* tokens) {
+    Ast* ast = arena_alloc(arena, sizeof(Ast));
+
+    ast -> arena = arena;
+    ast -> tokens = tokens;
+    ast -> node_count = 0;
+    ast -> node_capacity = 64;
+    ast -> nodes = arena_alloc(arena, sizeof(AstNode) * ast -> node_capacity);
+    ast -> extra_count = 0;
+    ast -> extra_capacity = 64;
+    ast -> extra = arena_alloc(arena, sizeof(uint32_t) * ast -> extra_capacity);
+    ast -> root = 0;
+
+    add_ast_node(ast, AST_NONE, 0, 0, 0);
+
+    return ast;
+}
+
+/**
+ * @brief Appends a node to the AST's node pool.
+ * 
+ * @param ast A pointer to the Ast to add the node to.
+ * @param kind The kind of the node.
+ * @param token The index of the token the node came from.
+ * @param lhs The first kind-specific operand.
+ * @param rhs The second kind-specific operand.
+ * @return The index of the new node.
+ */
+uint32_t add_ast_node(Ast* ast, AstKind kind, uint32_t token, uint32_t lhs, uint32_t rhs) {
+    if ((ast -> node_count) >= (ast -> node_capacity)) {
+        size_t old_size = sizeof(AstNode) * (ast -> node_capacity);
+
+        ast -> node_capacity *= 2;
+        ast -> nodes = arena_realloc(ast -> arena, ast -> nodes, old_size, sizeof(AstNode) * (ast -> node_capacity));
+    }
+
+    AstNode* node = &(ast -> nodes[ast -> node_count]);
+
+    node -> kind = kind;
+    node -> token = token;
+    node -> lhs = lhs;
+    node -> rhs = rhs;
+
+    return (uint32_t)(ast -> node_count++);
+}
+
+/**
+ * @brief Pushes a node index onto the parser's scratch stack.
+ * 
+ * @param parser A pointer to the Parser.
+ * @param node The node index to push.
+ */
+void push_scratch(Parser* parser, uint32_t node) {
+    if ((parser -> scratch_count) >= (parser -> scratch_capacity)) {
+        size_t old_size = sizeof(uint32_t) * (parser -> scratch_capacity);
+
+        parser -> scratch_capacity *= 2;
+        parser -> scratch = arena_realloc(parser -> ast -> arena, parser -> scratch, old_size, sizeof(uint32_t) * (parser -> scratch_capacity));
+    }
+
+    parser -> scratch[parser -> scratch_count++] = node;
+}
+
+/**
+ * @brief Moves the top of the scratch stack into the extra array.
+ * 
+ * Everything pushed since scratch_start becomes one contiguous run in 
+ * the extra array and is popped off the scratch stack.
+ * 
+ * @param parser A pointer to the Parser.
+ * @param scratch_start The scratch stack height when the list started.
+ * @return The index of the run's first element in the extra array.
+ */
+uint32_t pop_scratch_to_extra(Parser* parser, size_t scratch_start) {
+    Ast* ast = parser -> ast;
+    size_t count = parser -> scratch_count - scratch_start;
+
+    if ((ast -> extra_count) + count > (ast -> extra_capacity)) {
+        size_t old_size = sizeof(uint32_t) * (ast -> extra_capacity);
+
+        while ((ast -> extra_count) + count > (ast -> extra_capacity)) {
+            ast -> extra_capacity *= 2;
+        }
+
+        ast -> extra = arena_realloc(ast -> arena, ast -> extra, old_size, sizeof(uint32_t) * (ast -> extra_capacity));
+    }
+
+    uint32_t start = (uint32_t)(ast -> extra_count);
+
+    memcpy(ast -> extra + start, parser -> scratch + scratch_start, sizeof(uint32_t) * count);
+    ast -> extra_count += count;
+    parser -> scratch_count = scratch_start;
+
+    return start;
+}
+
+/**
+ * @brief Returns the kind of the parser's current token.
+ * 
+ * @param parser A pointer to the Parser.
+ * @return The current token's type, or END_OF_FILE past the last token.
+ */
+TokenType parser_peek(const Parser* parser) {
+    if ((parser -> position) >= (parser -> tokens -> size)) {
+        return END_OF_FILE;
+    }
+
+    return token_kind(parser -> tokens, parser -> position);
+}
+
+/**
+ * @brief Reports a syntax error at the parser's current token.
+ * 
+ * @param parser A pointer to the Parser.
+ * @param message The error message.
+ */
+void parser_error(const Parser* parser, const char* message) {
+    const TokenList* tokens = parser -> tokens;
+    const char* filename = parser -> filename;
+    uint32_t offset = 0;
+    size_t line;
+    size_t column;
+
+    if ((parser -> position) < (tokens -> size)) {
+        offset = token_offset(tokens, parser -> position);
+    } else if (tokens -> size > 0) {
+        size_t last = tokens -> size - 1;
+        offset = token_offset(tokens, last) + token_length(tokens, last);
+    }
+
+    locate_offset(tokens, offset, &filename, &line, &column);
+    report_error(filename, line, column, "%s", message);
+}
+
+/**
+ * @brief Consumes the current token if it has the expected type.
+ * 
+ * @param parser A pointer to the Parser.
+ * @param type The expected token type.
+ * @param message The error to report if the token does not match.
+ * @return 1 if the token matched and was consumed, 0 otherwise.
+ */
+int expect_token(Parser* parser, TokenType type, const char* message) {
+    if (parser_peek(parser) != type) {
+        parser_error(parser, message);
+        return 0;
+    }
+
+    parser -> position++;
+    return 1;
+}
+
+/**
+ * @brief Returns the precedence of a binary operator.
+ * 
+ * @param type The type of the operator token.
+ * @return The operator's precedence, higher binding tighter, or 0 if 
+ * the token is not a binary operator.
+ */
+int binary_precedence(TokenType type) {
+    switch (type) {
+        case OR_OR:
+            return 1;
+        case AND_AND:
+            return 2;
+        case EQUAL_EQUAL:
+        case NOT_EQUAL:
+            return 3;
+        case LESS:
+        case LESS_EQUAL:
+        case GREATER:
+        case GREATER_EQUAL:
+            return 4;
+        case PLUS:
+        case MINUS:
+            return 5;
+        case STAR:
+        case SLASH:
+        case PERCENT:
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Parses an integer literal.
+ * 
+ * Most literals were already parsed by the lexer and their value is 
+ * their payload; the others are parsed from their text.
+ * 
+ * @param parser A pointer to the Parser, positioned at the literal.
+ * @return The index of the literal node, or 0 if it is malformed or 
+ * does not fit in 32 bits.
+ */
+uint32_t parse_int_literal(Parser* parser) {
+    uint32_t token = (uint32_t)(parser -> position);
+    uint64_t value = token_payload(parser -> tokens, token);
+
+    if (value & LITERAL_LENGTH_FLAG) {
+        if (!parse_integer_literal(token_chars(parser -> tokens, token), token_length(parser -> tokens, token), &value)) {
+            parser_error(parser, "Invalid integer literal.");
+            return 0;
+        }
+
+        if (value > UINT32_MAX) {
+            parser_error(parser, "Integer literal is too large.");
+            return 0;
+        }
+    }
+
+    parser -> position++;
+    return add_ast_node(parser -> ast, AST_INT_LITERAL, token, (uint32_t)value, 0);
+}
+
+/**
+ * @brief Parses the argument list of a call.
+ * 
+ * @param parser A pointer to the Parser, positioned at the callee's name.
+ * @return The index of the call node, or 0 on a syntax error.
+ */
+uint32_t parse_call(Parser* parser) {
+    uint32_t name = (uint32_t)(parser -> position);
+    size_t scratch_start = parser -> scratch_count;
+
+    parser -> position += 2;
+
+    if (parser_peek(parser) != R_PARAN) {
+        for (;;) {
+            uint32_t argument = parse_expression(parser);
+
+            if (!argument) {
+                return 0;
+            }
+
+            push_scratch(parser, argument);
+
+            if (parser_peek(parser) != COMMA) {
+                break;
+            }
+
+            parser -> position++;
+        }
+    }
+
+    if (!expect_token(parser, R_PARAN, "Expected ')' after call arguments.")) {
+        return 0;
+    }
+
+    uint32_t count = (uint32_t)(parser -> scratch_count - scratch_start);
+    uint32_t start = pop_scratch_to_extra(parser, scratch_start);
+
+    return add_ast_node(parser -> ast, AST_CALL, name, start, count);
+}
+
+/**
+ * @brief Parses a primary expression.
+ * 
+ * @param parser A pointer to the Parser.
+ * @return The index of the expression node, or 0 on a syntax error.
+ */
+uint32_t parse_primary(Parser* parser) {
+    uint32_t token = (uint32_t)(parser -> position);
+
+    switch (parser_peek(parser)) {
+        case INT_LITERAL:
+            return parse_int_literal(parser);
+        case IDENTIFIER:
+            if (token + 1 < parser -> tokens -> size && token_kind(parser -> tokens, token + 1) == L_PARAN) {
+                return parse_call(parser);
+            }
+
+            parser -> position++;
+            return add_ast_node(parser -> ast, AST_IDENTIFIER, token, 0, 0);
+        case L_PARAN: {
+            parser -> position++;
+
+            uint32_t expression = parse_expression(parser);
+
+            if (!expression || !expect_token(parser, R_PARAN, "Expected ')' after expression.")) {
+                return 0;
+            }
+
+            return expression;
+        }
+        default:
+            parser_error(parser, "Expected an expression.");
+            return 0;
+    }
+}
+
+/**
+ * @brief Parses a unary expression.
+ * 
+ * @param parser A pointer to the Parser.
+ * @return The index of the expression node, or 0 on a syntax error.
+ */
+uint32_t parse_unary(Parser* parser) {
+    TokenType type = parser_peek(parser);
+
+    if (type != MINUS && type != PLUS && type != TILDE && type != BANG) {
+        return parse_primary(parser);
+    }
+
+    uint32_t token = (uint32_t)(parser -> position++);
+    uint32_t operand = parse_unary(parser);
+
+    if (!operand || type == PLUS) {
+        return operand;
+    }
+
+    return add_ast_node(parser -> ast, AST_UNARY, token, operand, 0);
+}
+
+/**
+ * @brief Parses binary operators by precedence climbing.
+ * 
+ * @param parser A pointer to the Parser.
+ * @param min_precedence The lowest precedence the loop may consume.
+ * @return The index of the expression node, or 0 on a syntax error.
+ */
+uint32_t parse_binary(Parser* parser, int min_precedence) {
+    uint32_t lhs = parse_unary(parser);
+
+    while (lhs) {
+        int precedence = binary_precedence(parser_peek(parser));
+
+        if (precedence == 0 || precedence < min_precedence) {
+            break;
+        }
+
+        uint32_t token = (uint32_t)(parser -> position++);
+        uint32_t rhs = parse_binary(parser, precedence + 1);
+
+        if (!rhs) {
+            return 0;
+        }
+
+        lhs = add_ast_node(parser -> ast, AST_BINARY, token, lhs, rhs);
+    }
+
+    return lhs;
+}
+
+/**
+ * @brief Parses an expression.
+ * 
+ * @param parser A pointer to the Parser.
+ * @return The index of the expression node, or 0 on a syntax error.
+ */
+uint32_t parse_expression(Parser* parser) {
+    uint32_t token = (uint32_t)(parser -> position);
+
+    if (parser_peek(parser) == IDENTIFIER && token + 1 < parser -> tokens -> size && token_kind(parser -> tokens, token + 1) == ASSIGN) {
+        uint32_t target = add_ast_node(parser -> ast, AST_IDENTIFIER, token, 0, 0);
+
+        parser -> position += 2;
+
+        uint32_t value = parse_expression(parser);
+
+        if (!value) {
+            return 0;
+        }
+
+        return add_ast_node(parser -> ast, AST_ASSIGN, token + 1, target, value);
+    }
+
+    return parse_binary(parser, 1);
+}
+
+/**
+ * @brief Parses a parenthesized condition of an if or while statement.
+ * 
+ * @param parser A pointer to the Parser, positioned after the keyword.
+ * @return The index of the condition node, or 0 on a syntax error.
+ */
+uint32_t parse_condition(Parser* parser) {
+    if (!expect_token(parser, L_PARAN, "Expected '(' before condition.")) {
+        return 0;
+    }
+
+    uint32_t condition = parse_expression(parser);
+
+    if (!condition || !expect_token(parser, R_PARAN, "Expected ')' after condition.")) {
+        return 0;
+    }
+
+    return condition;
+}
+
+/**
+ * @brief Parses a statement.
+ * 
+ * @param parser A pointer to the Parser.
+ * @return The index of the statement node, or 0 on a syntax error.
+ */
+uint32_t parse_statement(Parser* parser) {
+    uint32_t token = (uint32_t)(parser -> position);
+
+    switch (parser_peek(parser)) {
+        case RETURN_KEYWORD: {
+            parser -> position++;
+
+            uint32_t value = parse_expression(parser);
+
+            if (!value || !expect_token(parser, SEMICOLON, "Expected ';' after return value.")) {
+                return 0;
+            }
+
+            return add_ast_node(parser -> ast, AST_RETURN, token, value, 0);
+        }
+        case INT_KEYWORD: {
+            parser -> position++;
+
+            uint32_t name = (uint32_t)(parser -> position);
+            uint32_t value = 0;
+
+            if (!expect_token(parser, IDENTIFIER, "Expected a variable name.")) {
+                return 0;
+            }
+
+            if (parser_peek(parser) == ASSIGN) {
+                parser -> position++;
+                value = parse_expression(parser);
+
+                if (!value) {
+                    return 0;
+                }
+            }
+
+            if (!expect_token(parser, SEMICOLON, "Expected ';' after declaration.")) {
+                return 0;
+            }
+
+            return add_ast_node(parser -> ast, AST_DECLARATION, name, value, 0);
+        }
+        case IF_KEYWORD: {
+            parser -> position++;
+
+            uint32_t condition = parse_condition(parser);
+            uint32_t then_statement = condition ? parse_statement(parser) : 0;
+            uint32_t else_statement = 0;
+
+            if (!then_statement) {
+                return 0;
+            }
+
+            if (parser_peek(parser) == ELSE_KEYWORD) {
+                parser -> position++;
+                else_statement = parse_statement(parser);
+
+                if (!else_statement) {
+                    return 0;
+                }
+            }
+
+            push_scratch(parser, then_statement);
+            push_scratch(parser, else_statement);
+
+            uint32_t branches = pop_scratch_to_extra(parser, parser -> scratch_count - 2);
+
+            return add_ast_node(parser -> ast, AST_IF, token, condition, branches);
+        }
+        case WHILE_KEYWORD: {
+            parser -> position++;
+
+            uint32_t condition = parse_condition(parser);
+            uint32_t body = condition ? parse_statement(parser) : 0;
+
+            if (!body) {
+                return 0;
+            }
+
+            return add_ast_node(parser -> ast, AST_WHILE, token, condition, body);
+        }
+        case L_BRACE:
+            return parse_block(parser);
+        case SEMICOLON:
+            parser -> position++;
+            return add_ast_node(parser -> ast, AST_BLOCK, token, 0, 0);
+        default: {
+            uint32_t expression = parse_expression(parser);
+
+            if (!expression || !expect_token(parser, SEMICOLON, "Expected ';' after expression.")) {
+                return 0;
+            }
+
+            return add_ast_node(parser -> ast, AST_EXPRESSION_STATEMENT, token, expression, 0);
+        }
+    }
+}
+
+/**
+ * @brief Parses a block of statements enclosed in braces.
+ * 
+ * @param parser A pointer to the Parser.
+ * @return The index of the block node, or 0 on a syntax error.
+ */
+uint32_t parse_block(Parser* parser) {
+    uint32_t token = (uint32_t)(parser -> position);
+    size_t scratch_start = parser -> scratch_count;
+
+    if (!expect_token(parser, L_BRACE, "Expected '{'.")) {
+        return 0;
+    }
+
+    while (parser_peek(parser) != R_BRACE) {
+        if (parser_peek(parser) == END_OF_FILE) {
+            parser_error(parser, "Expected '}' at the end of the block.");
+            return 0;
+        }
+
+        uint32_t statement = parse_statement(parser);
+
+        if (!statement) {
+            return 0;
+        }
+
+        push_scratch(parser, statement);
+    }
+
+    parser -> position++;
+
+    uint32_t count = (uint32_t)(parser -> scratch_count - scratch_start);
+    uint32_t start = pop_scratch_to_extra(parser, scratch_start);
+
+    return add_ast_node(parser -> ast, AST_BLOCK, token, start, count);
+}
+
+/**
+ * @brief Parses the parameter list of a function definition.
+ * 
+ * The parameter count is pushed first, so the run copied into the 
+ * extra array starts with it.
+ * 
+ * @param parser A pointer to the Parser, positioned after the '('.
+ * @return The index of the run in the extra array, or UINT32_MAX on 
+ * a syntax error.
+ */
+uint32_t parse_parameters(Parser* parser) {
+    size_t scratch_start = parser -> scratch_count;
+
+    push_scratch(parser, 0);
+
+    if (parser_peek(parser) == VOID_KEYWORD) {
+        parser -> position++;
+    } else if (parser_peek(parser) != R_PARAN) {
+        for (;;) {
+            if (!expect_token(parser, INT_KEYWORD, "Expected 'int' before parameter name.")) {
+                return UINT32_MAX;
+            }
+
+            uint32_t name = (uint32_t)(parser -> position);
+
+            if (!expect_token(parser, IDENTIFIER, "Expected a parameter name.")) {
+                return UINT32_MAX;
+            }
+
+            push_scratch(parser, add_ast_node(parser -> ast, AST_PARAM, name, 0, 0));
+
+            if (parser_peek(parser) != COMMA) {
+                break;
+            }
+
+            parser -> position++;
+        }
+    }
+
+    parser -> scratch[scratch_start] = (uint32_t)(parser -> scratch_count - scratch_start - 1);
+
+    return pop_scratch_to_extra(parser, scratch_start);
+}
+
+/**
+ * @brief Parses a function definition or declaration.
+ * 
+ * @param parser A pointer to the Parser.
+ * @return The index of the function node, or 0 on a syntax error.
+ */
+uint32_t parse_function(Parser* parser) {
+    if (!expect_token(parser, INT_KEYWORD, "Expected 'int' at the start of a function definition.")) {
+        return 0;
+    }
+
+    uint32_t name = (uint32_t)(parser -> position);
+
+    if (!expect_token(parser, IDENTIFIER, "Expected a function name.") ||
+        !expect_token(parser, L_PARAN, "Expected '(' after function name.")) {
+        return 0;
+    }
+
+    uint32_t parameters = parse_parameters(parser);
+
+    if (parameters == UINT32_MAX || !expect_token(parser, R_PARAN, "Expected ')' after parameters.")) {
+        return 0;
+    }
+
+    if (parser_peek(parser) == SEMICOLON) {
+        parser -> position++;
+        return add_ast_node(parser -> ast, AST_FUNCTION, name, 0, parameters);
+    }
+
+    uint32_t body = parse_block(parser);
+
+    if (!body) {
+        return 0;
+    }
+
+    return add_ast_node(parser -> ast, AST_FUNCTION, name, body, parameters);
+}
+
+/**
+ * @brief Parses a token list into an AST.
+ * 
+ * Parsing stops at the first syntax error, which is reported on stderr 
+ * with its file, line and column.
+ * 
+ * @param arena A pointer to the Arena the AST is allocated from.
+ * @param tokens A pointer to the TokenList to parse.
+ * @param filename The name of the file, used in error messages.
+ * @return A pointer to the Ast, or NULL on a syntax error.
+ */
+Ast* parse(Arena* arena, const TokenList* tokens, const char* filename) {
+    Parser parser;
+
+    parser.ast = create_ast(arena, tokens);
+    parser.tokens = tokens;
+    parser.filename = filename;
+    parser.position = 0;
+    parser.scratch_count = 0;
+    parser.scratch_capacity = 64;
+    parser.scratch = arena_alloc(arena, sizeof(uint32_t) * parser.scratch_capacity);
+
+    while (parser_peek(&parser) != END_OF_FILE) {
+        uint32_t function = parse_function(&parser);
+
+        if (!function) {
+            return NULL;
+        }
+
+        push_scratch(&parser, function);
+    }
+
+    uint32_t count = (uint32_t)(parser.scratch_count);
+    uint32_t start = pop_scratch_to_extra(&parser, 0);
+
+    parser.ast -> root = add_ast_node(parser.ast, AST_TRANSLATION_UNIT, 0, start, count);
+
+    return parser.ast;
+}
+
+/**
+ * @brief Prints an AST node and its children, indented by depth.
+ * 
+ * @param ast A pointer to the Ast.
+ * @param node The index of the node to print.
+ * @param depth The nesting depth of the node.
+ */
+void print_ast_node(const Ast* ast, uint32_t node, int depth) {
+    const AstNode* n = &(ast -> nodes[node]);
+    const TokenList* tokens = ast -> tokens;
+    const Interner* interner = tokens -> interner;
+
+    printf("%*s", depth * 2, "");
+
+    switch (n -> kind) {
+        case AST_TRANSLATION_UNIT:
+            printf("TranslationUnit\n");
+            for (uint32_t i = 0; i < (n -> rhs); i++) {
+                print_ast_node(ast, ast -> extra[n -> lhs + i], depth + 1);
+            }
+            break;
+        case AST_FUNCTION:
+            printf("Function %s\n", symbol_text(interner, token_payload(tokens, n -> token)));
+            for (uint32_t i = 0; i < (ast -> extra[n -> rhs]); i++) {
+                print_ast_node(ast, ast -> extra[n -> rhs + 1 + i], depth + 1);
+            }
+            if (n -> lhs) {
+                print_ast_node(ast, n -> lhs, depth + 1);
+            }
+            break;
+        case AST_PARAM:
+            printf("Param %s\n", symbol_text(interner, token_payload(tokens, n -> token)));
+            break;
+        case AST_BLOCK:
+            printf("Block\n");
+            for (uint32_t i = 0; i < (n -> rhs); i++) {
+                print_ast_node(ast, ast -> extra[n -> lhs + i], depth + 1);
+            }
+            break;
+        case AST_RETURN:
+            printf("Return\n");
+            print_ast_node(ast, n -> lhs, depth + 1);
+            break;
+        case AST_DECLARATION:
+            printf("Declaration %s\n", symbol_text(interner, token_payload(tokens, n -> token)));
+            if (n -> lhs) {
+                print_ast_node(ast, n -> lhs, depth + 1);
+            }
+            break;
+        case AST_IF:
+            printf("If\n");
+            print_ast_node(ast, n -> lhs, depth + 1);
+            print_ast_node(ast, ast -> extra[n -> rhs], depth + 1);
+            if (ast -> extra[n -> rhs + 1]) {
+                print_ast_node(ast, ast -> extra[n -> rhs + 1], depth + 1);
+            }
+            break;
+        case AST_WHILE:
+            printf("While\n");
+            print_ast_node(ast, n -> lhs, depth + 1);
+            print_ast_node(ast, n -> rhs, depth + 1);
+            break;
+        case AST_EXPRESSION_STATEMENT:
+            printf("ExpressionStatement\n");
+            print_ast_node(ast, n -> lhs, depth + 1);
+            break;
+        case AST_INT_LITERAL:
+            printf("IntLiteral %u\n", n -> lhs);
+            break;
+        case AST_IDENTIFIER:
+            printf("Identifier %s\n", symbol_text(interner, token_payload(tokens, n -> token)));
+            break;
+        case AST_ASSIGN:
+            printf("Assign\n");
+            print_ast_node(ast, n -> lhs, depth + 1);
+            print_ast_node(ast, n -> rhs, depth + 1);
+            break;
+        case AST_UNARY:
+        case AST_BINARY:
+            printf("%s %.*s\n", n -> kind == AST_UNARY ? "Unary" : "Binary", (int)token_length(tokens, n -> token), token_chars(tokens, n -> token));
+            print_ast_node(ast, n -> lhs, depth + 1);
+            if (n -> kind == AST_BINARY) {
+                print_ast_node(ast, n -> rhs, depth + 1);
+            }
+            break;
+        case AST_CALL:
+            printf("Call %s\n", symbol_text(interner, token_payload(tokens, n -> token)));
+            for (uint32_t i = 0; i < (n -> rhs); i++) {
+                print_ast_node(ast, ast -> extra[n -> lhs + i], depth + 1);
+            }
+            break;
+        default:
+            printf("None\n");
+            break;
+    }
+}
+
+/**
+ * @brief Prints an AST as an indented tree.
+ * 
+ * @param ast A pointer to the Ast to be printed.
+ */
+void print_ast(const Ast* ast) {
+    print_ast_node(ast, ast -> root, 0);
+}
+
+/**
+* * PARSER END
+*/
+
+/**
+* * IR
+* Third stage.
+* Lowers the AST of each function into SSA form: basic blocks of 
+* instructions kept in arena-backed arrays, where every instruction that 
+* produces a value is that value. SSA is built directly while lowering, 
+* with the on-the-fly algorithm of Braun et al.: each variable's current 
+* definition is tracked per block, and phis are only created where a 
+* block with several predecessors reads a variable.
+*/
+
+/**
+ * @brief Names of the IR opcodes, used by the IR dump.
+ */
+static const char* const ir_opcode_names[] = {
+    "nop", "const", "param", "copy", "phi", "call",
+    "add", "sub", "mul", "div", "mod",
+    "eq", "ne", "lt", "le", "gt", "ge",
+    "neg", "not", "lnot",
+    "jump", "branch", "return"
+};
+
+/**
+ * @brief Reports an error at a token.
+ * 
+ * @param tokens A pointer to the TokenList the token belongs to.
+ * @param filename The name of the file, used in the message.
+ * @param token The index of the token the error is about.
+ * @param message The error message.
+ */
+void report_error_at(const TokenList* tokens, const char* filename, size_t token, const char* message) {
+    size_t line;
+    size_t column;
+
+    locate_offset(tokens, token_offset(tokens, token), &filename, &line, &column);
+    report_error(filename, line, column, "%s", message);
+}
+
+/**
+ * @brief Appends an instruction to a function and returns its value.
+ * 
+ * The instruction is not placed in any block; callers add it to a 
+ * block's instruction or phi list.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena the function grows in.
+ * @param op The opcode.
+ * @param block The block the instruction belongs to.
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param imm The immediate operand.
+ * @return The index of the instruction, which is also its value.
+ */
+uint32_t add_ir_instruction(IrFunction* function, Arena* arena, IrOpcode op, uint32_t block, uint32_t a, uint32_t b, int32_t imm) {
+    function -> instructions = arena_grow_array(arena, function -> instructions, &(function -> instruction_capacity), function -> instruction_count + 1, sizeof(IrInstruction));
+
+    IrInstruction* instruction = &(function -> instructions[function -> instruction_count]);
+
+    instruction -> op = (uint8_t)op;
+    instruction -> block = block;
+    instruction -> a = a;
+    instruction -> b = b;
+    instruction -> imm = imm;
+
+    return (uint32_t)(function -> instruction_count++);
+}
+
+/**
+ * @brief Appends a run of values to a function's extra array.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena the function grows in.
+ * @param values The values to append.
+ * @param count The number of values.
+ * @return The index of the first value in the extra array.
+ */
+uint32_t add_ir_extra(IrFunction* function, Arena* arena, const uint32_t* values, size_t count) {
+    function -> extra = arena_grow_array(arena, function -> extra, &(function -> extra_capacity), function -> extra_count + count, sizeof(uint32_t));
+
+    uint32_t start = (uint32_t)(function -> extra_count);
+
+    if (count) {
+        memcpy(function -> extra + start, values, sizeof(uint32_t) * count);
+    }
+
+    function -> extra_count += count;
+    return start;
+}
+
+/**
+ * @brief Adds a new, empty basic block to a function.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena the function grows in.
+ * @return The index of the new block.
+ */
+uint32_t add_ir_block(IrFunction* function, Arena* arena) {
+    function -> blocks = arena_grow_array(arena, function -> blocks, &(function -> block_capacity), function -> block_count + 1, sizeof(IrBlock));
+
+    IrBlock* block = &(function -> blocks[function -> block_count]);
+
+    memset(block, 0, sizeof(IrBlock));
+    block -> reachable = 1;
+
+    return (uint32_t)(function -> block_count++);
+}
+
+/**
+ * @brief Appends a value to one of a block's index lists.
+ */
+void push_block_list(Arena* arena, uint32_t** list, size_t* count, size_t* capacity, uint32_t value) {
+    *list = arena_grow_array(arena, *list, capacity, *count + 1, sizeof(uint32_t));
+    (*list)[(*count)++] = value;
+}
+
+/**
+ * @brief Adds a control-flow edge between two blocks.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena the function grows in.
+ * @param from The predecessor block.
+ * @param to The successor block.
+ */
+void add_ir_edge(IrFunction* function, Arena* arena, uint32_t from, uint32_t to) {
+    IrBlock* source = &(function -> blocks[from]);
+    IrBlock* target = &(function -> blocks[to]);
+
+    source -> successors[source -> successor_count++] = to;
+    push_block_list(arena, &(target -> predecessors), &(target -> predecessor_count), &(target -> predecessor_capacity), from);
+}
+
+/**
+ * @brief Removes a control-flow edge between two blocks.
+ * 
+ * The phis of the successor lose the operand that came in over the 
+ * edge, so they stay in step with its predecessor list.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param from The predecessor block.
+ * @param to The successor block.
+ */
+void remove_ir_edge(IrFunction* function, uint32_t from, uint32_t to) {
+    IrBlock* source = &(function -> blocks[from]);
+    IrBlock* target = &(function -> blocks[to]);
+
+    for (size_t i = 0; i < (source -> successor_count); i++) {
+        if (source -> successors[i] == to) {
+            source -> successors[i] = source -> successors[1];
+            source -> successor_count--;
+            break;
+        }
+    }
+
+    for (size_t k = 0; k < (target -> predecessor_count); k++) {
+        if (target -> predecessors[k] != from) {
+            continue;
+        }
+
+        memmove(target -> predecessors + k, target -> predecessors + k + 1, sizeof(uint32_t) * (target -> predecessor_count - k - 1));
+        target -> predecessor_count--;
+
+        for (size_t i = 0; i < (target -> phi_count); i++) {
+            IrInstruction* phi = &(function -> instructions[target -> phis[i]]);
+            uint32_t* operands = function -> extra + phi -> a;
+
+            if (phi -> op == IR_PHI && k < (phi -> b)) {
+                memmove(operands + k, operands + k + 1, sizeof(uint32_t) * (phi -> b - k - 1));
+                phi -> b--;
+            }
+        }
+
+        break;
+    }
+}
+
+/**
+ * @brief Returns the index of a definition slot in the builder's map.
+ * 
+ * The map is an open-addressing table keyed by (variable, block); the 
+ * returned slot either holds that key or is empty.
+ */
+size_t find_definition_slot(const IrBuilder* builder, uint64_t key) {
+    size_t mask = builder -> definition_capacity - 1;
+    size_t slot = (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+
+    while (builder -> definition_keys[slot] && builder -> definition_keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/**
+ * @brief Records the current definition of a variable in a block.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param variable The variable.
+ * @param block The block.
+ * @param value The value the variable holds at the end of the block so far.
+ */
+void write_variable(IrBuilder* builder, uint32_t variable, uint32_t block, uint32_t value) {
+    if ((builder -> definition_count + 1) * 2 > (builder -> definition_capacity)) {
+        uint64_t* old_keys = builder -> definition_keys;
+        uint32_t* old_values = builder -> definition_values;
+        size_t old_capacity = builder -> definition_capacity;
+
+        builder -> definition_capacity *= 2;
+        builder -> definition_keys = arena_alloc(builder -> scratch, sizeof(uint64_t) * builder -> definition_capacity);
+        builder -> definition_values = arena_alloc(builder -> scratch, sizeof(uint32_t) * builder -> definition_capacity);
+        memset(builder -> definition_keys, 0, sizeof(uint64_t) * builder -> definition_capacity);
+
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_keys[i]) {
+                size_t slot = find_definition_slot(builder, old_keys[i]);
+
+                builder -> definition_keys[slot] = old_keys[i];
+                builder -> definition_values[slot] = old_values[i];
+            }
+        }
+    }
+
+    uint64_t key = (((uint64_t)variable << 32) | block) + 1;
+    size_t slot = find_definition_slot(builder, key);
+
+    if (!builder -> definition_keys[slot]) {
+        builder -> definition_keys[slot] = key;
+        builder -> definition_count++;
+    }
+
+    builder -> definition_values[slot] = value;
+}
+
+/**
+ * @brief Creates an empty phi at the start of a block.
+ * 
+ * A phi with no operands stands for an undefined value.
+ */
+uint32_t add_ir_phi(IrBuilder* builder, uint32_t block) {
+    IrFunction* function = builder -> function;
+    uint32_t phi = add_ir_instruction(function, builder -> arena, IR_PHI, block, 0, 0, 0);
+    IrBlock* target = &(function -> blocks[block]);
+
+    push_block_list(builder -> arena, &(target -> phis), &(target -> phi_count), &(target -> phi_capacity), phi);
+
+    return phi;
+}
+
+/**
+ * @brief Fills in a phi's operands from the predecessors of its block.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param variable The variable the phi merges.
+ * @param phi The phi instruction.
+ */
+void add_phi_operands(IrBuilder* builder, uint32_t variable, uint32_t phi) {
+    IrFunction* function = builder -> function;
+    uint32_t block = function -> instructions[phi].block;
+    size_t count = function -> blocks[block].predecessor_count;
+    uint32_t* operands = arena_alloc(builder -> scratch, sizeof(uint32_t) * (count ? count : 1));
+
+    // Reading a variable may add blocks and grow the arrays, so nothing 
+    // is held across the calls.
+    for (size_t i = 0; i < count; i++) {
+        operands[i] = read_variable(builder, variable, function -> blocks[block].predecessors[i]);
+    }
+
+    uint32_t start = add_ir_extra(function, builder -> arena, operands, count);
+
+    function -> instructions[phi].a = start;
+    function -> instructions[phi].b = (uint32_t)count;
+}
+
+/**
+ * @brief Looks up the value a variable holds at the end of a block.
+ * 
+ * If the block does not define the variable itself, the definition is 
+ * searched for in its predecessors, creating phis where paths merge. 
+ * In a block whose predecessors are not all known yet (not sealed) an 
+ * operand-less phi is created and completed when the block is sealed.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param variable The variable.
+ * @param block The block.
+ * @return The value of the variable.
+ */
+uint32_t read_variable(IrBuilder* builder, uint32_t variable, uint32_t block) {
+    uint64_t key = (((uint64_t)variable << 32) | block) + 1;
+    size_t slot = find_definition_slot(builder, key);
+
+    if (builder -> definition_keys[slot]) {
+        return builder -> definition_values[slot];
+    }
+
+    IrFunction* function = builder -> function;
+    IrBlock* target = &(function -> blocks[block]);
+    uint32_t value;
+
+    if (!target -> sealed) {
+        value = add_ir_phi(builder, block);
+        push_block_list(builder -> scratch, &(target -> incomplete_phis), &(target -> incomplete_phi_count), &(target -> incomplete_phi_capacity), variable);
+        push_block_list(builder -> scratch, &(target -> incomplete_phis), &(target -> incomplete_phi_count), &(target -> incomplete_phi_capacity), value);
+    } else if (target -> predecessor_count == 1) {
+        value = read_variable(builder, variable, target -> predecessors[0]);
+    } else {
+        // Writing the phi first ends the search if a loop leads back here.
+        value = add_ir_phi(builder, block);
+        write_variable(builder, variable, block, value);
+        add_phi_operands(builder, variable, value);
+    }
+
+    write_variable(builder, variable, block, value);
+    return value;
+}
+
+/**
+ * @brief Marks a block as having all of its predecessors.
+ * 
+ * Completes the phis that were created while the block was unsealed.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param block The block to seal.
+ */
+void seal_block(IrBuilder* builder, uint32_t block) {
+    IrBlock* target = &(builder -> function -> blocks[block]);
+    size_t count = target -> incomplete_phi_count;
+    uint32_t* incomplete = target -> incomplete_phis;
+
+    target -> sealed = 1;
+    target -> incomplete_phi_count = 0;
+
+    for (size_t i = 0; i < count; i += 2) {
+        add_phi_operands(builder, incomplete[i], incomplete[i + 1]);
+    }
+}
+
+/**
+ * @brief Emits an instruction at the end of the current block.
+ * 
+ * After a terminator the current block is closed; code that follows 
+ * it lexically goes into a fresh block with no predecessors, which the 
+ * optimizer later removes as unreachable.
+ * 
+ * @return The value of the instruction.
+ */
+uint32_t emit_ir(IrBuilder* builder, IrOpcode op, uint32_t a, uint32_t b, int32_t imm) {
+    IrFunction* function = builder -> function;
+
+    if (builder -> terminated) {
+        builder -> current_block = add_ir_block(function, builder -> arena);
+        function -> blocks[builder -> current_block].sealed = 1;
+        builder -> terminated = 0;
+    }
+
+    uint32_t value = add_ir_instruction(function, builder -> arena, op, builder -> current_block, a, b, imm);
+    IrBlock* block = &(function -> blocks[builder -> current_block]);
+
+    push_block_list(builder -> arena, &(block -> instructions), &(block -> instruction_count), &(block -> instruction_capacity), value);
+
+    if (op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN) {
+        builder -> terminated = 1;
+    }
+
+    return value;
+}
+
+/**
+ * @brief Ends the current block with a jump.
+ */
+void emit_ir_jump(IrBuilder* builder, uint32_t target) {
+    emit_ir(builder, IR_JUMP, 0, 0, 0);
+    add_ir_edge(builder -> function, builder -> arena, builder -> current_block, target);
+}
+
+/**
+ * @brief Ends the current block with a two-way branch on a value.
+ * 
+ * The first successor is taken when the value is non-zero.
+ */
+void emit_ir_branch(IrBuilder* builder, uint32_t condition, uint32_t if_true, uint32_t if_false) {
+    emit_ir(builder, IR_BRANCH, condition, 0, 0);
+    add_ir_edge(builder -> function, builder -> arena, builder -> current_block, if_true);
+    add_ir_edge(builder -> function, builder -> arena, builder -> current_block, if_false);
+}
+
+/**
+ * @brief Makes a block the current block.
+ */
+void switch_to_block(IrBuilder* builder, uint32_t block) {
+    builder -> current_block = block;
+    builder -> terminated = 0;
+}
+
+/**
+ * @brief Returns the current block, opening a fresh one after a terminator.
+ */
+uint32_t current_ir_block(IrBuilder* builder) {
+    if (builder -> terminated) {
+        builder -> current_block = add_ir_block(builder -> function, builder -> arena);
+        builder -> function -> blocks[builder -> current_block].sealed = 1;
+        builder -> terminated = 0;
+    }
+
+    return builder -> current_block;
+}
+
+/**
+ * @brief Returns the symbol ID of the name a node's token carries.
+ */
+uint32_t node_symbol(const IrBuilder* builder, uint32_t node) {
+    return token_payload(builder -> tokens, builder -> ast -> nodes[node].token);
+}
+
+/**
+ * @brief Reports an error about a named entity at a node's token.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param node The node the error is about.
+ * @param format A message containing one %s for the name.
+ */
+void lowering_error(IrBuilder* builder, uint32_t node, const char* format) {
+    char message[256];
+
+    snprintf(message, sizeof(message), format, symbol_text(builder -> tokens -> interner, node_symbol(builder, node)));
+    report_error_at(builder -> tokens, builder -> filename, builder -> ast -> nodes[node].token, message);
+    builder -> failed = 1;
+}
+
+/**
+ * @brief Declares a variable in the current scope.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param node The declaring node, whose token is the name.
+ * @return The new variable, or UINT32_MAX if the name is already 
+ * declared in the same scope.
+ */
+uint32_t declare_variable(IrBuilder* builder, uint32_t node) {
+    uint32_t symbol = node_symbol(builder, node);
+    Binding* binding = &(builder -> bindings[symbol]);
+
+    if (binding -> variable && binding -> depth == builder -> scope_depth) {
+        lowering_error(builder, node, "Redeclaration of '%s'.");
+        return UINT32_MAX;
+    }
+
+    builder -> shadowed = arena_grow_array(builder -> scratch, builder -> shadowed, &(builder -> shadowed_capacity), builder -> shadowed_count + 1, sizeof(ShadowedBinding));
+
+    ShadowedBinding* saved = &(builder -> shadowed[builder -> shadowed_count++]);
+
+    saved -> symbol = symbol;
+    saved -> previous = *binding;
+
+    binding -> variable = builder -> variable_count++ + 1;
+    binding -> depth = builder -> scope_depth;
+
+    return binding -> variable - 1;
+}
+
+/**
+ * @brief Leaves a scope, restoring the bindings it shadowed.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param shadowed_start The shadow stack height when the scope began.
+ */
+void leave_scope(IrBuilder* builder, size_t shadowed_start) {
+    while ((builder -> shadowed_count) > shadowed_start) {
+        ShadowedBinding* saved = &(builder -> shadowed[--(builder -> shadowed_count)]);
+
+        builder -> bindings[saved -> symbol] = saved -> previous;
+    }
+
+    builder -> scope_depth--;
+}
+
+/**
+ * @brief Lowers && or || with short-circuit evaluation.
+ * 
+ * The result lives in a hidden variable that is set on both paths, so 
+ * SSA construction merges it with a phi like any other variable.
+ * 
+ * @return The value of the expression, 0 or 1.
+ */
+uint32_t lower_logical(IrBuilder* builder, uint32_t node, int is_and) {
+    const AstNode* n = &(builder -> ast -> nodes[node]);
+    uint32_t rhs_node = n -> rhs;
+    IrFunction* function = builder -> function;
+    uint32_t result = builder -> variable_count++;
+    uint32_t lhs = lower_expression(builder, n -> lhs);
+    uint32_t zero = emit_ir(builder, IR_CONST, 0, 0, 0);
+    uint32_t rhs_block = add_ir_block(function, builder -> arena);
+    uint32_t join = add_ir_block(function, builder -> arena);
+
+    uint32_t short_circuit = emit_ir(builder, IR_CONST, 0, 0, is_and ? 0 : 1);
+
+    write_variable(builder, result, builder -> current_block, short_circuit);
+
+    if (is_and) {
+        emit_ir_branch(builder, lhs, rhs_block, join);
+    } else {
+        emit_ir_branch(builder, lhs, join, rhs_block);
+    }
+
+    seal_block(builder, rhs_block);
+    switch_to_block(builder, rhs_block);
+
+    uint32_t rhs = lower_expression(builder, rhs_node);
+    uint32_t truth = emit_ir(builder, IR_NE, rhs, zero, 0);
+
+    write_variable(builder, result, current_ir_block(builder), truth);
+    emit_ir_jump(builder, join);
+
+    seal_block(builder, join);
+    switch_to_block(builder, join);
+
+    return read_variable(builder, result, join);
+}
+
+/**
+ * @brief Lowers an expression.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param node The index of the expression node.
+ * @return The value of the expression.
+ */
+uint32_t lower_expression(IrBuilder* builder, uint32_t node) {
+    const AstNode* n = &(builder -> ast -> nodes[node]);
+
+    switch (n -> kind) {
+        case AST_INT_LITERAL:
+            return emit_ir(builder, IR_CONST, 0, 0, (int32_t)(n -> lhs));
+        case AST_IDENTIFIER: {
+            Binding* binding = &(builder -> bindings[node_symbol(builder, node)]);
+
+            if (!binding -> variable) {
+                lowering_error(builder, node, "Use of undeclared identifier '%s'.");
+                return emit_ir(builder, IR_CONST, 0, 0, 0);
+            }
+
+            return read_variable(builder, binding -> variable - 1, current_ir_block(builder));
+        }
+        case AST_ASSIGN: {
+            uint32_t target = n -> lhs;
+            uint32_t value = lower_expression(builder, n -> rhs);
+            Binding* binding = &(builder -> bindings[node_symbol(builder, target)]);
+
+            if (!binding -> variable) {
+                lowering_error(builder, target, "Use of undeclared identifier '%s'.");
+                return value;
+            }
+
+            write_variable(builder, binding -> variable - 1, current_ir_block(builder), value);
+            return value;
+        }
+        case AST_UNARY: {
+            TokenType type = token_kind(builder -> tokens, n -> token);
+            uint32_t operand = lower_expression(builder, n -> lhs);
+            IrOpcode op = type == MINUS ? IR_NEG : (type == TILDE ? IR_NOT : IR_LOGICAL_NOT);
+
+            return emit_ir(builder, op, operand, 0, 0);
+        }
+        case AST_BINARY: {
+            TokenType type = token_kind(builder -> tokens, n -> token);
+            uint32_t rhs_node = n -> rhs;
+            IrOpcode op;
+
+            if (type == AND_AND || type == OR_OR) {
+                return lower_logical(builder, node, type == AND_AND);
+            }
+
+            switch (type) {
+                case PLUS: op = IR_ADD; break;
+                case MINUS: op = IR_SUB; break;
+                case STAR: op = IR_MUL; break;
+                case SLASH: op = IR_DIV; break;
+                case PERCENT: op = IR_MOD; break;
+                case EQUAL_EQUAL: op = IR_EQ; break;
+                case NOT_EQUAL: op = IR_NE; break;
+                case LESS: op = IR_LT; break;
+                case LESS_EQUAL: op = IR_LE; break;
+                case GREATER: op = IR_GT; break;
+                default: op = IR_GE; break;
+            }
+
+            uint32_t lhs = lower_expression(builder, n -> lhs);
+            uint32_t rhs = lower_expression(builder, rhs_node);
+
+            return emit_ir(builder, op, lhs, rhs, 0);
+        }
+        case AST_CALL: {
+            uint32_t count = n -> rhs;
+            uint32_t first = n -> lhs;
+            int32_t callee = (int32_t)node_symbol(builder, node);
+            uint32_t* arguments = arena_alloc(builder -> scratch, sizeof(uint32_t) * (count ? count : 1));
+
+            for (uint32_t i = 0; i < count; i++) {
+                arguments[i] = lower_expression(builder, builder -> ast -> extra[first + i]);
+            }
+
+            uint32_t start = add_ir_extra(builder -> function, builder -> arena, arguments, count);
+
+            return emit_ir(builder, IR_CALL, start, count, callee);
+        }
+        default:
+            return emit_ir(builder, IR_CONST, 0, 0, 0);
+    }
+}
+
+/**
+ * @brief Lowers a statement.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param node The index of the statement node.
+ */
+void lower_statement(IrBuilder* builder, uint32_t node) {
+    const AstNode* n = &(builder -> ast -> nodes[node]);
+    IrFunction* function = builder -> function;
+
+    switch (n -> kind) {
+        case AST_RETURN:
+            emit_ir(builder, IR_RETURN, lower_expression(builder, n -> lhs), 0, 0);
+            break;
+        case AST_DECLARATION: {
+            uint32_t initializer = n -> lhs;
+            uint32_t value = initializer ? lower_expression(builder, initializer) : emit_ir(builder, IR_CONST, 0, 0, 0);
+            uint32_t variable = declare_variable(builder, node);
+
+            if (variable != UINT32_MAX) {
+                write_variable(builder, variable, current_ir_block(builder), value);
+            }
+            break;
+        }
+        case AST_IF: {
+            uint32_t then_node = builder -> ast -> extra[n -> rhs];
+            uint32_t else_node = builder -> ast -> extra[n -> rhs + 1];
+            uint32_t condition = lower_expression(builder, n -> lhs);
+            uint32_t then_block = add_ir_block(function, builder -> arena);
+            uint32_t else_block = else_node ? add_ir_block(function, builder -> arena) : 0;
+            uint32_t join = add_ir_block(function, builder -> arena);
+
+            emit_ir_branch(builder, condition, then_block, else_node ? else_block : join);
+
+            seal_block(builder, then_block);
+            switch_to_block(builder, then_block);
+            lower_statement(builder, then_node);
+
+            if (!builder -> terminated) {
+                emit_ir_jump(builder, join);
+            }
+
+            if (else_node) {
+                seal_block(builder, else_block);
+                switch_to_block(builder, else_block);
+                lower_statement(builder, else_node);
+
+                if (!builder -> terminated) {
+                    emit_ir_jump(builder, join);
+                }
+            }
+
+            seal_block(builder, join);
+            switch_to_block(builder, join);
+            break;
+        }
+        case AST_WHILE: {
+            uint32_t condition_node = n -> lhs;
+            uint32_t body_node = n -> rhs;
+            uint32_t header = add_ir_block(function, builder -> arena);
+            uint32_t body = add_ir_block(function, builder -> arena);
+            uint32_t exit = add_ir_block(function, builder -> arena);
+
+            emit_ir_jump(builder, header);
+            switch_to_block(builder, header);
+
+            uint32_t condition = lower_expression(builder, condition_node);
+
+            emit_ir_branch(builder, condition, body, exit);
+
+            seal_block(builder, body);
+            switch_to_block(builder, body);
+            lower_statement(builder, body_node);
+
+            if (!builder -> terminated) {
+                emit_ir_jump(builder, header);
+            }
+
+            // The loop header's last predecessor, the back edge, is known now.
+            seal_block(builder, header);
+            seal_block(builder, exit);
+            switch_to_block(builder, exit);
+            break;
+        }
+        case AST_EXPRESSION_STATEMENT:
+            lower_expression(builder, n -> lhs);
+            break;
+        case AST_BLOCK: {
+            uint32_t start = n -> lhs;
+            uint32_t count = n -> rhs;
+            size_t shadowed_start = builder -> shadowed_count;
+
+            builder -> scope_depth++;
+
+            for (uint32_t i = 0; i < count; i++) {
+                lower_statement(builder, builder -> ast -> extra[start + i]);
+            }
+
+            leave_scope(builder, shadowed_start);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Lowers a function definition into an IrFunction.
+ * 
+ * Parameters are declared in the same scope as the body's outermost 
+ * statements, as C requires. Falling off the end returns 0.
+ * 
+ * @param builder A pointer to the IrBuilder.
+ * @param node The index of the function node.
+ * @param function A pointer to the IrFunction to fill in.
+ */
+void lower_function(IrBuilder* builder, uint32_t node, IrFunction* function) {
+    const Ast* ast = builder -> ast;
+    const AstNode* n = &(ast -> nodes[node]);
+    uint32_t parameters = n -> rhs;
+    uint32_t parameter_count = ast -> extra[parameters];
+    const AstNode* body = &(ast -> nodes[n -> lhs]);
+    size_t shadowed_start = builder -> shadowed_count;
+
+    memset(function, 0, sizeof(IrFunction));
+    function -> name = node_symbol(builder, node);
+    function -> token = n -> token;
+    function -> parameter_count = parameter_count;
+
+    builder -> function = function;
+    builder -> variable_count = 0;
+    builder -> definition_count = 0;
+    memset(builder -> definition_keys, 0, sizeof(uint64_t) * builder -> definition_capacity);
+
+    switch_to_block(builder, add_ir_block(function, builder -> arena));
+    seal_block(builder, 0);
+
+    builder -> scope_depth++;
+
+    for (uint32_t i = 0; i < parameter_count; i++) {
+        uint32_t parameter = ast -> extra[parameters + 1 + i];
+        uint32_t variable = declare_variable(builder, parameter);
+        uint32_t value = emit_ir(builder, IR_PARAM, 0, 0, (int32_t)i);
+
+        if (variable != UINT32_MAX) {
+            write_variable(builder, variable, builder -> current_block, value);
+        }
+    }
+
+    for (uint32_t i = 0; i < (body -> rhs); i++) {
+        lower_statement(builder, ast -> extra[body -> lhs + i]);
+    }
+
+    if (!builder -> terminated) {
+        emit_ir(builder, IR_RETURN, emit_ir(builder, IR_CONST, 0, 0, 0), 0, 0);
+    }
+
+    leave_scope(builder, shadowed_start);
+}
+
+/**
+ * @brief Initializes an IrBuilder for the functions of a translation unit.
+ * 
+ * One builder lowers any number of functions, one after the other.
+ * 
+ * @param builder A pointer to the IrBuilder to initialize.
+ * @param arena A pointer to the Arena the IR is allocated from.
+ * @param ast A pointer to the Ast of the translation unit.
+ * @param filename The name of the file, used in error messages.
+ */
+void init_ir_builder(IrBuilder* builder, Arena* arena, const Ast* ast, const char* filename) {
+    size_t symbol_count = interner_size(ast -> tokens -> interner);
+
+    memset(builder, 0, sizeof(IrBuilder));
+
+    builder -> arena = arena;
+    builder -> scratch = arena;
+    builder -> ast = ast;
+    builder -> tokens = ast -> tokens;
+    builder -> filename = filename;
+    builder -> bindings = arena_alloc(arena, sizeof(Binding) * symbol_count);
+    builder -> definition_capacity = 256;
+    builder -> definition_keys = arena_alloc(arena, sizeof(uint64_t) * builder -> definition_capacity);
+    builder -> definition_values = arena_alloc(arena, sizeof(uint32_t) * builder -> definition_capacity);
+
+    memset(builder -> bindings, 0, sizeof(Binding) * symbol_count);
+}
+
+/**
+ * @brief Lowers a whole translation unit into an IrModule.
+ * 
+ * Names are resolved through a table indexed by symbol ID, so looking 
+ * up a variable is an array access rather than a string compare.
+ * 
+ * @param arena A pointer to the Arena the IR is allocated from.
+ * @param ast A pointer to the Ast of the translation unit.
+ * @param filename The name of the file, used in error messages.
+ * @param skip Flags, by position in the translation unit, the functions 
+ * not to lower because their code comes from the function cache; NULL 
+ * lowers every function.
+ * @return A pointer to the IrModule, or NULL if a semantic error was found.
+ */
+IrModule* lower_to_ir(Arena* arena, const Ast* ast, const char* filename, const uint8_t* skip) {
+    const AstNode* root = &(ast -> nodes[ast -> root]);
+    const Interner* interner = ast -> tokens -> interner;
+    IrModule* module = arena_alloc(arena, sizeof(IrModule));
+    IrBuilder builder;
+    size_t symbol_count = interner_size(interner);
+    uint8_t* defined = arena_alloc(arena, symbol_count);
+
+    memset(defined, 0, symbol_count);
+    init_ir_builder(&builder, arena, ast, filename);
+
+    module -> arena = arena;
+    module -> interner = interner;
+    module -> function_count = 0;
+    module -> functions = arena_alloc(arena, sizeof(IrFunction) * (root -> rhs ? root -> rhs : 1));
+
+    for (uint32_t i = 0; i < (root -> rhs); i++) {
+        uint32_t node = ast -> extra[root -> lhs + i];
+        uint32_t name = node_symbol(&builder, node);
+
+        // Declarations only name a function; there is no code to lower.
+        if (!ast -> nodes[node].lhs) {
+            continue;
+        }
+
+        if (defined[name]) {
+            lowering_error(&builder, node, "Redefinition of function '%s'.");
+        }
+
+        defined[name] = 1;
+
+        if (!skip || !skip[i]) {
+            lower_function(&builder, node, &(module -> functions[module -> function_count++]));
+        }
+    }
+
+    return builder.failed ? NULL : module;
+}
+
+/**
+ * @brief Returns how many of an instruction's a and b fields are values.
+ * 
+ * Phis and calls keep their operands in the extra array instead.
+ */
+int ir_operand_count(uint8_t op) {
+    switch (op) {
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+            return 2;
+        case IR_COPY: case IR_NEG: case IR_NOT: case IR_LOGICAL_NOT:
+        case IR_BRANCH: case IR_RETURN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Follows a value's replacement chain to its final value.
+ * 
+ * The chain is compressed on the way, so repeated lookups are O(1).
+ */
+uint32_t resolve_value(uint32_t* replacements, uint32_t value) {
+    uint32_t root = value;
+
+    while (replacements[root] != root) {
+        root = replacements[root];
+    }
+
+    while (replacements[value] != root) {
+        uint32_t next = replacements[value];
+        replacements[value] = root;
+        value = next;
+    }
+
+    return root;
+}
+
+/**
+ * @brief Rewrites every operand of a function through a replacement table.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param replacements The replacement of every value, or the value itself.
+ */
+void rewrite_operands(IrFunction* function, uint32_t* replacements) {
+    for (size_t i = 0; i < (function -> instruction_count); i++) {
+        IrInstruction* instruction = &(function -> instructions[i]);
+
+        int operands = ir_operand_count(instruction -> op);
+
+        if (instruction -> op == IR_PHI || instruction -> op == IR_CALL) {
+            for (uint32_t k = 0; k < (instruction -> b); k++) {
+                uint32_t* operand = &(function -> extra[instruction -> a + k]);
+                *operand = resolve_value(replacements, *operand);
+            }
+        }
+
+        if (operands >= 1) {
+            instruction -> a = resolve_value(replacements, instruction -> a);
+        }
+
+        if (operands >= 2) {
+            instruction -> b = resolve_value(replacements, instruction -> b);
+        }
+    }
+}
+
+/**
+ * @brief Removes copies and trivial phis by forwarding their uses.
+ * 
+ * A copy is replaced by its source. A phi whose operands are all the 
+ * same value (ignoring itself) is replaced by that value; such phis 
+ * are left behind by SSA construction and by removed edges.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena for temporary memory.
+ * @return 1 if anything changed, 0 otherwise.
+ */
+int propagate_copies(IrFunction* function, Arena* arena) {
+    uint32_t* replacements = arena_alloc(arena, sizeof(uint32_t) * (function -> instruction_count ? function -> instruction_count : 1));
+    int changed = 0;
+
+    for (size_t i = 0; i < (function -> instruction_count); i++) {
+        replacements[i] = (uint32_t)i;
+    }
+
+    for (int again = 1; again; ) {
+        again = 0;
+
+        for (size_t i = 0; i < (function -> instruction_count); i++) {
+            IrInstruction* instruction = &(function -> instructions[i]);
+            uint32_t value = (uint32_t)i;
+
+            if (resolve_value(replacements, value) != value) {
+                continue;
+            }
+
+            if (instruction -> op == IR_COPY) {
+                replacements[i] = resolve_value(replacements, instruction -> a);
+                instruction -> op = IR_NOP;
+                again = changed = 1;
+            } else if (instruction -> op == IR_PHI && instruction -> b > 0) {
+                uint32_t same = UINT32_MAX;
+                int trivial = 1;
+
+                for (uint32_t k = 0; k < (instruction -> b); k++) {
+                    uint32_t operand = resolve_value(replacements, function -> extra[instruction -> a + k]);
+
+                    if (operand == value || operand == same) {
+                        continue;
+                    }
+
+                    if (same != UINT32_MAX) {
+                        trivial = 0;
+                        break;
+                    }
+
+                    same = operand;
+                }
+
+                if (trivial && same != UINT32_MAX) {
+                    replacements[i] = same;
+                    instruction -> op = IR_NOP;
+                    again = changed = 1;
+                }
+            }
+        }
+    }
+
+    if (changed) {
+        rewrite_operands(function, replacements);
+    }
+
+    return changed;
+}
+
+/**
+ * @brief Evaluates an operation on constant operands.
+ * 
+ * Arithmetic wraps like two's complement 32-bit ints. Division by zero 
+ * and INT_MIN / -1 are left for runtime, since folding them would turn 
+ * undefined behaviour into an arbitrary constant.
+ * 
+ * @param op The opcode.
+ * @param a The first operand.
+ * @param b The second operand, ignored by unary opcodes.
+ * @param result Receives the folded value.
+ * @return 1 if the operation could be folded, 0 otherwise.
+ */
+int fold_operation(IrOpcode op, int32_t a, int32_t b, int32_t* result) {
+    uint32_t x = (uint32_t)a;
+    uint32_t y = (uint32_t)b;
+
+    switch (op) {
+        case IR_ADD: *result = (int32_t)(x + y); return 1;
+        case IR_SUB: *result = (int32_t)(x - y); return 1;
+        case IR_MUL: *result = (int32_t)(x * y); return 1;
+        case IR_DIV:
+        case IR_MOD:
+            if (b == 0 || (a == INT32_MIN && b == -1)) {
+                return 0;
+            }
+            *result = op == IR_DIV ? a / b : a % b;
+            return 1;
+        case IR_EQ: *result = a == b; return 1;
+        case IR_NE: *result = a != b; return 1;
+        case IR_LT: *result = a < b; return 1;
+        case IR_LE: *result = a <= b; return 1;
+        case IR_GT: *result = a > b; return 1;
+        case IR_GE: *result = a >= b; return 1;
+        case IR_NEG: *result = (int32_t)(0u - x); return 1;
+        case IR_NOT: *result = (int32_t)~x; return 1;
+        case IR_LOGICAL_NOT: *result = a == 0; return 1;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief Folds instructions whose operands are all constants.
+ * 
+ * Folded instructions become constants in place, so their uses see the 
+ * constant without any rewriting. A branch on a constant becomes a 
+ * jump and the edge that can no longer be taken is removed.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @return 1 if anything changed, 0 otherwise.
+ */
+int fold_constants(IrFunction* function) {
+    IrInstruction* instructions = function -> instructions;
+    int changed = 0;
+
+    for (size_t i = 0; i < (function -> instruction_count); i++) {
+        IrInstruction* instruction = &(instructions[i]);
+        int32_t result;
+
+        switch (instruction -> op) {
+            case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD:
+            case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+                if (instructions[instruction -> a].op == IR_CONST && instructions[instruction -> b].op == IR_CONST &&
+                    fold_operation(instruction -> op, instructions[instruction -> a].imm, instructions[instruction -> b].imm, &result)) {
+                    instruction -> op = IR_CONST;
+                    instruction -> imm = result;
+                    changed = 1;
+                }
+                break;
+            case IR_NEG: case IR_NOT: case IR_LOGICAL_NOT:
+                if (instructions[instruction -> a].op == IR_CONST &&
+                    fold_operation(instruction -> op, instructions[instruction -> a].imm, 0, &result)) {
+                    instruction -> op = IR_CONST;
+                    instruction -> imm = result;
+                    changed = 1;
+                }
+                break;
+            case IR_BRANCH:
+                if (instructions[instruction -> a].op == IR_CONST) {
+                    IrBlock* block = &(function -> blocks[instruction -> block]);
+                    uint32_t taken = block -> successors[instructions[instruction -> a].imm ? 0 : 1];
+                    uint32_t not_taken = block -> successors[instructions[instruction -> a].imm ? 1 : 0];
+
+                    instruction -> op = IR_JUMP;
+                    remove_ir_edge(function, instruction -> block, not_taken);
+                    block -> successors[0] = taken;
+
+                    changed = 1;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * @brief Removes blocks that cannot be reached from the entry block.
+ * 
+ * Their instructions become nops and their outgoing edges are removed, 
+ * which also drops the phi operands that flowed along them.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena for temporary memory.
+ * @return 1 if any block was removed, 0 otherwise.
+ */
+int remove_unreachable_blocks(IrFunction* function, Arena* arena) {
+    size_t count = function -> block_count;
+    uint8_t* seen = arena_alloc(arena, count);
+    uint32_t* stack = arena_alloc(arena, sizeof(uint32_t) * count);
+    size_t top = 0;
+    int changed = 0;
+
+    memset(seen, 0, count);
+    seen[0] = 1;
+    stack[top++] = 0;
+
+    while (top) {
+        IrBlock* block = &(function -> blocks[stack[--top]]);
+
+        for (size_t i = 0; i < (block -> successor_count); i++) {
+            uint32_t successor = block -> successors[i];
+
+            if (!seen[successor]) {
+                seen[successor] = 1;
+                stack[top++] = successor;
+            }
+        }
+    }
+
+    for (uint32_t b = 0; b < count; b++) {
+        IrBlock* block = &(function -> blocks[b]);
+
+        if (seen[b] || !block -> reachable) {
+            continue;
+        }
+
+        while (block -> successor_count) {
+            remove_ir_edge(function, b, block -> successors[0]);
+        }
+
+        for (size_t i = 0; i < (block -> phi_count); i++) {
+            function -> instructions[block -> phis[i]].op = IR_NOP;
+        }
+
+        for (size_t i = 0; i < (block -> instruction_count); i++) {
+            function -> instructions[block -> instructions[i]].op = IR_NOP;
+        }
+
+        block -> reachable = 0;
+        changed = 1;
+    }
+
+    return changed;
+}
+
+/**
+ * @brief Merges blocks into their predecessor where control flow is straight.
+ * 
+ * A block whose only predecessor ends in a jump to it is appended to 
+ * that predecessor, which removes the jump. Folded branches leave many 
+ * such chains behind.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena the function grows in.
+ * @return 1 if any block was merged, 0 otherwise.
+ */
+int merge_blocks(IrFunction* function, Arena* arena) {
+    int changed = 0;
+
+    for (uint32_t b = 0; b < (function -> block_count); b++) {
+        IrBlock* block = &(function -> blocks[b]);
+
+        while (block -> reachable && block -> successor_count == 1 && block -> instruction_count) {
+            uint32_t jump = block -> instructions[block -> instruction_count - 1];
+            uint32_t s = block -> successors[0];
+            IrBlock* successor = &(function -> blocks[s]);
+            int has_phis = 0;
+
+            for (size_t i = 0; i < (successor -> phi_count); i++) {
+                has_phis |= function -> instructions[successor -> phis[i]].op == IR_PHI;
+            }
+
+            if (s == b || s == 0 || successor -> predecessor_count != 1 || has_phis || function -> instructions[jump].op != IR_JUMP) {
+                break;
+            }
+
+            function -> instructions[jump].op = IR_NOP;
+            block -> instruction_count--;
+
+            for (size_t i = 0; i < (successor -> instruction_count); i++) {
+                uint32_t instruction = successor -> instructions[i];
+
+                function -> instructions[instruction].block = b;
+                push_block_list(arena, &(block -> instructions), &(block -> instruction_count), &(block -> instruction_capacity), instruction);
+            }
+
+            block -> successor_count = successor -> successor_count;
+            memcpy(block -> successors, successor -> successors, sizeof(block -> successors));
+
+            for (size_t i = 0; i < (successor -> successor_count); i++) {
+                IrBlock* target = &(function -> blocks[successor -> successors[i]]);
+
+                for (size_t k = 0; k < (target -> predecessor_count); k++) {
+                    if (target -> predecessors[k] == s) {
+                        target -> predecessors[k] = b;
+                    }
+                }
+            }
+
+            successor -> instruction_count = 0;
+            successor -> successor_count = 0;
+            successor -> predecessor_count = 0;
+            successor -> reachable = 0;
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * @brief Splits the edges that leave a branch for a block with phis.
+ * 
+ * Such an edge gets a block of its own holding just a jump, which 
+ * gives code generation a place for the moves into the phis that only 
+ * happen when that edge is taken.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena the function grows in.
+ */
+void split_critical_edges(IrFunction* function, Arena* arena) {
+    size_t block_count = function -> block_count;
+
+    for (uint32_t b = 0; b < block_count; b++) {
+        for (size_t s = 0; s < (function -> blocks[b].successor_count) && function -> blocks[b].successor_count > 1; s++) {
+            uint32_t successor = function -> blocks[b].successors[s];
+            int has_phis = 0;
+
+            for (size_t i = 0; i < (function -> blocks[successor].phi_count); i++) {
+                has_phis |= function -> instructions[function -> blocks[successor].phis[i]].op == IR_PHI;
+            }
+
+            if (!has_phis) {
+                continue;
+            }
+
+            uint32_t edge = add_ir_block(function, arena);
+            IrBlock* target = &(function -> blocks[successor]);
+            IrBlock* middle = &(function -> blocks[edge]);
+            uint32_t jump = add_ir_instruction(function, arena, IR_JUMP, edge, 0, 0, 0);
+
+            for (size_t k = 0; k < (target -> predecessor_count); k++) {
+                if (target -> predecessors[k] == b) {
+                    target -> predecessors[k] = edge;
+                    break;
+                }
+            }
+
+            function -> blocks[b].successors[s] = edge;
+            middle -> successors[0] = successor;
+            middle -> successor_count = 1;
+            middle -> sealed = 1;
+            push_block_list(arena, &(middle -> predecessors), &(middle -> predecessor_count), &(middle -> predecessor_capacity), b);
+            push_block_list(arena, &(middle -> instructions), &(middle -> instruction_count), &(middle -> instruction_capacity), jump);
+        }
+    }
+}
+
+/**
+ * @brief Marks a value and everything it depends on as live.
+ */
+void mark_live(uint8_t* live, uint32_t* stack, size_t* top, uint32_t value) {
+    if (!live[value]) {
+        live[value] = 1;
+        stack[(*top)++] = value;
+    }
+}
+
+/**
+ * @brief Removes instructions whose values are never used.
+ * 
+ * Terminators and calls are always kept; everything they transitively 
+ * depend on is live and the rest becomes nops.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena for temporary memory.
+ * @return 1 if anything was removed, 0 otherwise.
+ */
+int eliminate_dead_code(IrFunction* function, Arena* arena) {
+    size_t count = function -> instruction_count;
+    uint8_t* live = arena_alloc(arena, count ? count : 1);
+    uint32_t* stack = arena_alloc(arena, sizeof(uint32_t) * (count ? count : 1));
+    size_t top = 0;
+    int changed = 0;
+
+    memset(live, 0, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t op = function -> instructions[i].op;
+
+        if (op == IR_RETURN || op == IR_BRANCH || op == IR_JUMP || op == IR_CALL) {
+            mark_live(live, stack, &top, i);
+        }
+    }
+
+    while (top) {
+        const IrInstruction* instruction = &(function -> instructions[stack[--top]]);
+
+        int operands = ir_operand_count(instruction -> op);
+
+        if (instruction -> op == IR_PHI || instruction -> op == IR_CALL) {
+            for (uint32_t k = 0; k < (instruction -> b); k++) {
+                mark_live(live, stack, &top, function -> extra[instruction -> a + k]);
+            }
+        }
+
+        if (operands >= 1) {
+            mark_live(live, stack, &top, instruction -> a);
+        }
+
+        if (operands >= 2) {
+            mark_live(live, stack, &top, instruction -> b);
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        IrInstruction* instruction = &(function -> instructions[i]);
+
+        if (!live[i] && instruction -> op != IR_NOP) {
+            instruction -> op = IR_NOP;
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * @brief Runs the optimization passes on a function until nothing changes.
+ * 
+ * Constant folding, copy propagation, unreachable block removal and 
+ * block merging feed each other (a folded branch removes an edge, which 
+ * can make a phi trivial, whose replacement can make more operands 
+ * constant), so they are iterated together. Dead code elimination runs 
+ * last.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param arena A pointer to the Arena for temporary memory.
+ */
+void optimize_function(IrFunction* function, Arena* arena) {
+    int changed = 1;
+
+    while (changed) {
+        changed = fold_constants(function);
+        changed |= remove_unreachable_blocks(function, arena);
+        changed |= propagate_copies(function, arena);
+        changed |= merge_blocks(function, arena);
+    }
+
+    eliminate_dead_code(function, arena);
+}
+
+/**
+ * @brief Runs the optimization passes on every function of a module.
+ * 
+ * @param module A pointer to the IrModule.
+ */
+void optimize_module(IrModule* module) {
+    for (size_t i = 0; i < (module -> function_count); i++) {
+        optimize_function(&(module -> functions[i]), module -> arena);
+    }
+}
+
+/**
+ * @brief Prints one instruction of the IR dump.
+ */
+void print_ir_instruction(const IrModule* module, const IrFunction* function, uint32_t value) {
+    const IrInstruction* instruction = &(function -> instructions[value]);
+
+    switch (instruction -> op) {
+        case IR_CONST:
+        case IR_PARAM:
+            printf("    v%u = %s %d\n", value, ir_opcode_names[instruction -> op], instruction -> imm);
+            break;
+        case IR_PHI:
+        case IR_CALL:
+            printf("    v%u = %s", value, ir_opcode_names[instruction -> op]);
+            if (instruction -> op == IR_CALL) {
+                printf(" %s", symbol_text(module -> interner, (uint32_t)(instruction -> imm)));
+            }
+            for (uint32_t k = 0; k < (instruction -> b); k++) {
+                printf("%s v%u", k ? "," : "", function -> extra[instruction -> a + k]);
+            }
+            printf("\n");
+            break;
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+            printf("    v%u = %s v%u, v%u\n", value, ir_opcode_names[instruction -> op], instruction -> a, instruction -> b);
+            break;
+        case IR_COPY: case IR_NEG: case IR_NOT: case IR_LOGICAL_NOT:
+            printf("    v%u = %s v%u\n", value, ir_opcode_names[instruction -> op], instruction -> a);
+            break;
+        case IR_BRANCH:
+        case IR_RETURN:
+            printf("    %s v%u\n", ir_opcode_names[instruction -> op], instruction -> a);
+            break;
+        case IR_JUMP:
+            printf("    jump\n");
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Prints the IR of a module in a readable form.
+ * 
+ * @param module A pointer to the IrModule to be printed.
+ */
+void print_ir(const IrModule* module) {
+    for (size_t f = 0; f < (module -> function_count); f++) {
+        const IrFunction* function = &(module -> functions[f]);
+
+        printf("function %s(%u)\n", symbol_text(module -> interner, function -> name), function -> parameter_count);
+
+        for (uint32_t b = 0; b < (function -> block_count); b++) {
+            const IrBlock* block = &(function -> blocks[b]);
+
+            if (!block -> reachable) {
+                continue;
+            }
+
+            printf("  block%u:", b);
+            for (size_t i = 0; i < (block -> predecessor_count); i++) {
+                printf("%s block%u", i ? "," : " preds", block -> predecessors[i]);
+            }
+            if (block -> successor_count) {
+                printf(" ->");
+                for (size_t i = 0; i < (block -> successor_count); i++) {
+                    printf(" block%u", block -> successors[i]);
+                }
+            }
+            printf("\n");
+
+            for (size_t i = 0; i < (block -> phi_count); i++) {
+                print_ir_instruction(module, function, block -> phis[i]);
+            }
+            for (size_t i = 0; i < (block -> instruction_count); i++) {
+                print_ir_instruction(module, function, block -> instructions[i]);
+            }
+        }
+    }
+}
+
+/**
+* * IR END
+*/
+
+/**
+* * OUTPUT
+* Growable in-memory output buffer. Everything the compiler writes is 
+* built here first and handed to the operating system in one go.
+*/
+
+/**
+ * @brief Initializes an empty output buffer.
+ * 
+ * @param buffer A pointer to the OutputBuffer to initialize.
+ * @param arena A pointer to the Arena the buffer grows in.
+ * @param capacity The initial capacity in bytes.
+ */
+void init_output_buffer(OutputBuffer* buffer, Arena* arena, size_t capacity) {
+    buffer -> arena = arena;
+    buffer -> size = 0;
+    buffer -> capacity = capacity;
+    buffer -> data = arena_alloc(arena, capacity);
+}
+
+/**
+ * @brief Makes room for at least count more bytes.
+ * 
+ * @param buffer A pointer to the OutputBuffer.
+ * @param count The number of bytes about to be written.
+ * @return A pointer to where those bytes should be written.
+ */
+char* reserve_output(OutputBuffer* buffer, size_t count) {
+    if ((buffer -> size) + count > (buffer -> capacity)) {
+        size_t old_capacity = buffer -> capacity;
+
+        while ((buffer -> size) + count > (buffer -> capacity)) {
+            buffer -> capacity *= 2;
+        }
+
+        buffer -> data = arena_realloc(buffer -> arena, buffer -> data, old_capacity, buffer -> capacity);
+    }
+
+    return buffer -> data + buffer -> size;
+}
+
+/**
+ * @brief Appends raw bytes to an output buffer.
+ * 
+ * @param buffer A pointer to the OutputBuffer.
+ * @param data The bytes to append.
+ * @param count The number of bytes to append.
+ */
+void output_bytes(OutputBuffer* buffer, const void* data, size_t count) {
+    memcpy(reserve_output(buffer, count), data, count);
+    buffer -> size += count;
+}
+
+/**
+ * @brief Appends a NUL-terminated string to an output buffer.
+ * 
+ * @param buffer A pointer to the OutputBuffer.
+ * @param text The string to append, without its terminator.
+ */
+void output_string(OutputBuffer* buffer, const char* text) {
+    output_bytes(buffer, text, strlen(text));
+}
+
+/**
+ * @brief Appends printf-style formatted text to an output buffer.
+ * 
+ * The text is formatted straight into the buffer; no stdio stream is 
+ * involved.
+ * 
+ * @param buffer A pointer to the OutputBuffer.
+ * @param format The printf-style format string.
+ */
+void output_format(OutputBuffer* buffer, const char* format, ...) {
+    va_list args;
+    size_t room = (buffer -> capacity) - (buffer -> size);
+
+    va_start(args, format);
+    int length = vsnprintf(buffer -> data + buffer -> size, room, format, args);
+    va_end(args);
+
+    if ((size_t)length >= room) {
+        reserve_output(buffer, (size_t)length + 1);
+
+        va_start(args, format);
+        vsnprintf(buffer -> data + buffer -> size, (size_t)length + 1, format, args);
+        va_end(args);
+    }
+
+    buffer -> size += (size_t)length;
+}
+
+/**
+ * @brief Appends one byte to an output buffer.
+ */
+void output_u8(OutputBuffer* buffer, uint8_t value) {
+    *reserve_output(buffer, 1) = (char)value;
+    buffer -> size++;
+}
+
+/**
+ * @brief Appends a little-endian 32-bit value to an output buffer.
+ */
+void output_u32(OutputBuffer* buffer, uint32_t value) {
+    unsigned char bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+
+    output_bytes(buffer, bytes, sizeof(bytes));
+}
+
+/**
+ * @brief Appends an unsigned number to an output buffer as decimal text.
+ */
+void output_unsigned(OutputBuffer* buffer, uint64_t value) {
+    char digits[20];
+    size_t count = 0;
+
+    do {
+        digits[sizeof(digits) - ++count] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    output_bytes(buffer, digits + sizeof(digits) - count, count);
+}
+
+/**
+ * @brief Encodes an unsigned number in ULEB128.
+ * 
+ * Seven bits go into each byte, lowest first, and the top bit of every 
+ * byte but the last is set; small numbers take a single byte.
+ * 
+ * @param bytes Receives the encoding, at most 10 bytes.
+ * @param value The number to encode.
+ * @return The number of bytes written.
+ */
+size_t encode_varint(unsigned char* bytes, uint64_t value) {
+    size_t count = 0;
+
+    while (value >= 0x80) {
+        bytes[count++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+
+    bytes[count++] = (unsigned char)value;
+    return count;
+}
+
+/**
+ * @brief Appends an unsigned number to an output buffer in ULEB128.
+ */
+void output_varint(OutputBuffer* buffer, uint64_t value) {
+    unsigned char bytes[10];
+
+    output_bytes(buffer, bytes, encode_varint(bytes, value));
+}
+
+/**
+ * @brief Writes the contents of an output buffer to a stream and empties it.
+ * 
+ * @param buffer A pointer to the OutputBuffer.
+ * @param stream The stream to write to.
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int flush_output(OutputBuffer* buffer, FILE* stream) {
+    size_t size = buffer -> size;
+
+    buffer -> size = 0;
+    return fwrite(buffer -> data, 1, size, stream) == size ? 0 : -1;
+}
+
+/**
+ * @brief Flushes a stream and checks that everything written to it got 
+ * out.
+ * 
+ * stdio only records a failed write in the stream's error flag, so 
+ * without this a dump to a full disk or a closed pipe would look like 
+ * it succeeded.
+ * 
+ * @param stream The stream to finish.
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int finish_stream(FILE* stream) {
+    if (fflush(stream) == EOF) {
+        return -1;
+    }
+
+    if (ferror(stream)) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Pads an output buffer with zero bytes up to a multiple of alignment.
+ */
+void align_output(OutputBuffer* buffer, size_t alignment) {
+    while ((buffer -> size) % alignment) {
+        output_u8(buffer, 0);
+    }
+}
+
+/**
+ * @brief Writes an output buffer to a file.
+ * 
+ * The whole buffer is passed to write() at once; the loop only runs 
+ * again if the kernel accepts less than everything. A path of "-" 
+ * writes to standard output.
+ * 
+ * @param buffer A pointer to the OutputBuffer to write.
+ * @param path The file to create or truncate, or "-".
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int write_output_file(const OutputBuffer* buffer, const char* path) {
+    int to_stdout = strcmp(path, "-") == 0;
+    int fd = to_stdout ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t written = 0;
+
+    while (written < (buffer -> size)) {
+        ssize_t count = write(fd, buffer -> data + written, (buffer -> size) - written);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (!to_stdout) {
+                close(fd);
+            }
+
+            return -1;
+        }
+
+        written += (size_t)count;
+    }
+
+    if (!to_stdout) {
+        return close(fd);
+    }
+
+    return 0;
+}
+
+/**
+* * OUTPUT END
+*/
+
+/**
+* * REGISTER ALLOCATOR
+* Linear-scan register allocation over the IR (Poletto and Sarkar). 
+* Blocks are laid out in reverse postorder, instructions are numbered 
+* along that layout and each value gets one live interval covering 
+* every point where it is live. Intervals are then visited in order of 
+* their start and given a register, or a stack slot when none is free.
+* 
+* %eax, %edx and %r11d are kept out of allocation: the first two are 
+* fixed operands of division, calls and returns, and %r11d is the 
+* scratch register of memory-to-memory moves.
+*/
+
+/**
+ * @brief The registers the System V ABI passes integer arguments in.
+ */
+static const X86Register argument_registers[6] = { RDI, RSI, RDX, RCX, R8, R9 };
+
+/**
+ * @brief The registers a call may clobber, in order of preference.
+ */
+static const X86Register caller_saved_registers[] = { RCX, RSI, RDI, R8, R9, R10 };
+
+/**
+ * @brief The registers a call preserves, in order of preference.
+ */
+static const X86Register callee_saved_registers[] = { RBX, R12, R13, R14, R15 };
+
+/**
+ * @brief Collects the value operands of an instruction.
+ * 
+ * Phi operands are not included, since they are read at the end of 
+ * the predecessors rather than where the phi is.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @param instruction A pointer to the instruction.
+ * @param buffer Storage for up to two operands.
+ * @param operands Receives a pointer to the operands.
+ * @return The number of operands.
+ */
+size_t get_value_operands(const IrFunction* function, const IrInstruction* instruction, uint32_t buffer[2], const uint32_t** operands) {
+    if (instruction -> op == IR_CALL) {
+        *operands = function -> extra + instruction -> a;
+        return instruction -> b;
+    }
+
+    int count = ir_operand_count(instruction -> op);
+
+    buffer[0] = instruction -> a;
+    buffer[1] = instruction -> b;
+    *operands = buffer;
+
+    return (size_t)count;
+}
+
+/**
+ * @brief Orders the reachable blocks of a function in reverse postorder.
+ * 
+ * Successors are visited last one first, so a loop body is laid out 
+ * right after its header and a then-branch right after its condition, 
+ * the exits of both following later. With a profile, the successor 
+ * that ran more often is the one laid out next, and the blocks that 
+ * never ran are moved after all the others, out of the hot path. Each 
+ * block's loop depth is found on the way, counting the back edges 
+ * whose range in the layout covers it.
+ * 
+ * @param generator A pointer to the FunctionGenerator.
+ */
+void compute_block_layout(FunctionGenerator* generator) {
+    const IrFunction* function = generator -> function;
+    const uint64_t* counts = generator -> block_counts;
+    size_t count = function -> block_count;
+    uint32_t* order = arena_alloc(generator -> arena, sizeof(uint32_t) * count);
+    uint32_t* stack = arena_alloc(generator -> arena, sizeof(uint32_t) * count);
+    uint32_t* next = arena_alloc(generator -> arena, sizeof(uint32_t) * count);
+    uint32_t* index = arena_alloc(generator -> arena, sizeof(uint32_t) * count);
+    uint8_t* seen = arena_alloc(generator -> arena, count);
+    size_t top = 0;
+    size_t visited = 0;
+
+    memset(seen, 0, count);
+    seen[0] = 1;
+    stack[top++] = 0;
+    next[0] = (uint32_t)(function -> blocks[0].successor_count);
+
+    while (top) {
+        uint32_t block = stack[top - 1];
+
+        if (next[block] == 0) {
+            order[visited++] = block;
+            top--;
+            continue;
+        }
+
+        const IrBlock* source = &(function -> blocks[block]);
+        uint32_t slot = --next[block];
+
+        if (counts && source -> successor_count == 2 && counts[source -> successors[1]] > counts[source -> successors[0]]) {
+            slot = 1 - slot;
+        }
+
+        uint32_t successor = source -> successors[slot];
+
+        if (!seen[successor]) {
+            seen[successor] = 1;
+            next[successor] = (uint32_t)(function -> blocks[successor].successor_count);
+            stack[top++] = successor;
+        }
+    }
+
+    generator -> layout = arena_alloc(generator -> arena, sizeof(uint32_t) * count);
+    generator -> layout_count = visited;
+    generator -> loop_depths = arena_alloc(generator -> arena, sizeof(uint32_t) * count);
+    memset(generator -> loop_depths, 0, sizeof(uint32_t) * count);
+
+    size_t placed = 0;
+
+    for (size_t i = 0; i < visited; i++) {
+        if (!counts || counts[order[visited - 1 - i]]) {
+            generator -> layout[placed++] = order[visited - 1 - i];
+        }
+    }
+
+    for (size_t i = 0; counts && i < visited; i++) {
+        if (!counts[order[visited - 1 - i]]) {
+            generator -> layout[placed++] = order[visited - 1 - i];
+        }
+    }
+
+    for (size_t i = 0; i < visited; i++) {
+        index[generator -> layout[i]] = (uint32_t)i;
+    }
+
+    for (size_t i = 0; i < visited; i++) {
+        const IrBlock* block = &(function -> blocks[generator -> layout[i]]);
+
+        for (size_t s = 0; s < (block -> successor_count); s++) {
+            uint32_t header = index[block -> successors[s]];
+
+            for (uint32_t j = header; header <= i && j <= i; j++) {
+                generator -> loop_depths[generator -> layout[j]]++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Adds the live-in sets of a block's successors and the values 
+ * it passes to their phis to a live set.
+ */
+void add_live_out(const FunctionGenerator* generator, uint32_t block, uint64_t* live) {
+    const IrFunction* function = generator -> function;
+    const IrBlock* source = &(function -> blocks[block]);
+    size_t words = generator -> live_words;
+
+    for (size_t s = 0; s < (source -> successor_count); s++) {
+        uint32_t successor = source -> successors[s];
+        const IrBlock* target = &(function -> blocks[successor]);
+        const uint64_t* live_in = generator -> live_in + words * successor;
+        size_t k = 0;
+
+        for (size_t w = 0; w < words; w++) {
+            live[w] |= live_in[w];
+        }
+
+        while (k < (target -> predecessor_count) && target -> predecessors[k] != block) {
+            k++;
+        }
+
+        for (size_t i = 0; i < (target -> phi_count); i++) {
+            const IrInstruction* phi = &(function -> instructions[target -> phis[i]]);
+
+            if (phi -> op == IR_PHI && k < (phi -> b)) {
+                uint32_t operand = function -> extra[phi -> a + k];
+
+                if (function -> instructions[operand].op != IR_CONST) {
+                    live[operand >> 6] |= 1ull << (operand & 63);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes which values are live at the start of every block.
+ * 
+ * A backward dataflow problem over bit sets, iterated to a fixpoint. 
+ * Constants are never live, as they are used as immediates.
+ * 
+ * @param generator A pointer to the FunctionGenerator.
+ */
+void compute_liveness(FunctionGenerator* generator) {
+    const IrFunction* function = generator -> function;
+    size_t words = (function -> instruction_count + 63) / 64 + 1;
+    uint64_t* live = arena_alloc(generator -> arena, sizeof(uint64_t) * words);
+    int changed = 1;
+
+    generator -> live_words = words;
+    generator -> live_in = arena_alloc(generator -> arena, sizeof(uint64_t) * words * function -> block_count);
+    memset(generator -> live_in, 0, sizeof(uint64_t) * words * function -> block_count);
+
+    while (changed) {
+        changed = 0;
+
+        for (size_t i = generator -> layout_count; i-- > 0; ) {
+            uint32_t b = generator -> layout[i];
+            const IrBlock* block = &(function -> blocks[b]);
+            uint64_t* live_in = generator -> live_in + words * b;
+
+            memset(live, 0, sizeof(uint64_t) * words);
+            add_live_out(generator, b, live);
+
+            for (size_t j = block -> instruction_count; j-- > 0; ) {
+                uint32_t value = block -> instructions[j];
+                const IrInstruction* instruction = &(function -> instructions[value]);
+                uint32_t buffer[2];
+                const uint32_t* operands;
+                size_t count = get_value_operands(function, instruction, buffer, &operands);
+
+                live[value >> 6] &= ~(1ull << (value & 63));
+
+                for (size_t k = 0; k < count; k++) {
+                    if (function -> instructions[operands[k]].op != IR_CONST) {
+                        live[operands[k] >> 6] |= 1ull << (operands[k] & 63);
+                    }
+                }
+            }
+
+            for (size_t j = 0; j < (block -> phi_count); j++) {
+                live[block -> phis[j] >> 6] &= ~(1ull << (block -> phis[j] & 63));
+            }
+
+            if (memcmp(live, live_in, sizeof(uint64_t) * words) != 0) {
+                memcpy(live_in, live, sizeof(uint64_t) * words);
+                changed = 1;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Widens a value's live interval to include a position.
+ */
+void extend_interval(FunctionGenerator* generator, uint32_t value, uint32_t position) {
+    LiveInterval* interval = &(generator -> intervals[value]);
+
+    if (position < (interval -> start)) {
+        interval -> start = position;
+    }
+
+    if (position > (interval -> end)) {
+        interval -> end = position;
+    }
+}
+
+/**
+ * @brief Returns the spill weight one use or definition adds at a loop depth.
+ */
+double use_weight(uint32_t loop_depth) {
+    double weight = 1.0;
+
+    for (uint32_t i = 0; i < loop_depth && i < 8; i++) {
+        weight *= 8.0;
+    }
+
+    return weight;
+}
+
+/**
+ * @brief Works out the spill weight of a use or definition in every block.
+ * 
+ * With a profile it is the number of times the block ran per call of 
+ * the function, with a small floor so that values used only where the 
+ * profile never went still compare by length. Without one it is the 
+ * loop-depth estimate of use_weight().
+ * 
+ * @param generator A pointer to the FunctionGenerator.
+ */
+void compute_block_weights(FunctionGenerator* generator) {
+    size_t count = generator -> function -> block_count;
+    const uint64_t* counts = generator -> block_counts;
+
+    generator -> block_weights = arena_alloc(generator -> arena, sizeof(double) * (count ? count : 1));
+
+    for (size_t b = 0; b < count; b++) {
+        if (counts) {
+            double weight = (double)counts[b] / (double)counts[0];
+
+            generator -> block_weights[b] = weight > 1.0 / 1024 ? weight : 1.0 / 1024;
+        } else {
+            generator -> block_weights[b] = use_weight(generator -> loop_depths[b]);
+        }
+    }
+}
+
+/**
+ * @brief Numbers the instructions and builds the live intervals.
+ * 
+ * Each block takes a position for its phis, two per instruction, and 
+ * one for its end, where the moves into its successors' phis go. A 
+ * value's interval covers its definition, its uses and every block 
+ * boundary it is live across; a phi's interval also covers the ends 
+ * of its predecessors, since that is where it is written. Parameters 
+ * are all defined at position 0, where the prologue moves them out of 
+ * the argument registers together.
+ * 
+ * @param generator A pointer to the FunctionGenerator.
+ */
+void build_live_intervals(FunctionGenerator* generator) {
+    const IrFunction* function = generator -> function;
+    size_t count = function -> instruction_count;
+    size_t words = generator -> live_words;
+    uint64_t* live = arena_alloc(generator -> arena, sizeof(uint64_t) * words);
+    uint32_t position = 0;
+
+    generator -> intervals = arena_alloc(generator -> arena, sizeof(LiveInterval) * (count ? count : 1));
+    generator -> block_starts = arena_alloc(generator -> arena, sizeof(uint32_t) * function -> block_count);
+    generator -> block_ends = arena_alloc(generator -> arena, sizeof(uint32_t) * function -> block_count);
+    generator -> call_positions = arena_alloc(generator -> arena, sizeof(uint32_t) * (count ? count : 1));
+    generator -> call_count = 0;
+    memset(generator -> block_ends, 0xff, sizeof(uint32_t) * function -> block_count);
+
+    for (size_t i = 0; i < count; i++) {
+        LiveInterval* interval = &(generator -> intervals[i]);
+
+        interval -> value = (uint32_t)i;
+        interval -> start = UINT32_MAX;
+        interval -> end = 0;
+        interval -> weight = 0.0;
+        interval -> hint = -1;
+        interval -> crosses_call = 0;
+    }
+
+    for (size_t i = 0; i < (generator -> layout_count); i++) {
+        uint32_t b = generator -> layout[i];
+        const IrBlock* block = &(function -> blocks[b]);
+
+        generator -> block_starts[b] = position;
+        position += 2 + 2 * (uint32_t)(block -> instruction_count);
+        generator -> block_ends[b] = position - 1;
+    }
+
+    for (size_t i = 0; i < (generator -> layout_count); i++) {
+        uint32_t b = generator -> layout[i];
+        const IrBlock* block = &(function -> blocks[b]);
+        const uint64_t* live_in = generator -> live_in + words * b;
+        double weight = generator -> block_weights[b];
+        uint32_t start = generator -> block_starts[b];
+        uint32_t end = generator -> block_ends[b];
+
+        memset(live, 0, sizeof(uint64_t) * words);
+        add_live_out(generator, b, live);
+
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t bits = live[w]; bits; bits &= bits - 1) {
+                extend_interval(generator, (uint32_t)(w * 64 + __builtin_ctzll(bits)), end);
+            }
+
+            for (uint64_t bits = live_in[w]; bits; bits &= bits - 1) {
+                extend_interval(generator, (uint32_t)(w * 64 + __builtin_ctzll(bits)), start);
+            }
+        }
+
+        for (size_t j = 0; j < (block -> phi_count); j++) {
+            uint32_t phi = block -> phis[j];
+            const IrInstruction* instruction = &(function -> instructions[phi]);
+
+            if (instruction -> op != IR_PHI) {
+                continue;
+            }
+
+            extend_interval(generator, phi, start);
+            generator -> intervals[phi].weight += weight;
+
+            for (uint32_t k = 0; k < (instruction -> b); k++) {
+                uint32_t predecessor = block -> predecessors[k];
+                uint32_t operand = function -> extra[instruction -> a + k];
+
+                // Without optimization, dead code can still flow into a phi.
+                if (generator -> block_ends[predecessor] == UINT32_MAX) {
+                    continue;
+                }
+
+                extend_interval(generator, phi, generator -> block_ends[predecessor]);
+                generator -> intervals[operand].weight += generator -> block_weights[predecessor];
+            }
+        }
+
+        for (size_t j = 0; j < (block -> instruction_count); j++) {
+            uint32_t value = block -> instructions[j];
+            const IrInstruction* instruction = &(function -> instructions[value]);
+            uint32_t at = start + 2 + 2 * (uint32_t)j;
+            uint32_t buffer[2];
+            const uint32_t* operands;
+            size_t operand_count = get_value_operands(function, instruction, buffer, &operands);
+
+            if (instruction -> op == IR_PARAM) {
+                at = 0;
+
+                if (instruction -> imm < 6 && !reserved_register(argument_registers[instruction -> imm])) {
+                    generator -> intervals[value].hint = (int8_t)argument_registers[instruction -> imm];
+                }
+            }
+
+            if (instruction -> op == IR_CALL) {
+                generator -> call_positions[generator -> call_count++] = at;
+            }
+
+            for (size_t k = 0; k < operand_count; k++) {
+                extend_interval(generator, operands[k], at);
+                generator -> intervals[operands[k]].weight += weight;
+            }
+
+            if (ir_has_value(instruction -> op)) {
+                extend_interval(generator, value, at);
+                generator -> intervals[value].weight += weight;
+            }
+        }
+    }
+
+    // Call positions increase along the layout, so they are sorted.
+    for (size_t i = 0; i < count; i++) {
+        LiveInterval* interval = &(generator -> intervals[i]);
+        size_t low = 0;
+        size_t high = generator -> call_count;
+
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+
+            if (generator -> call_positions[middle] <= interval -> start) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        interval -> crosses_call = low < (generator -> call_count) && generator -> call_positions[low] < interval -> end;
+    }
+}
+
+/**
+ * @brief Orders live intervals by their start, for qsort().
+ */
+int compare_interval_starts(const void* a, const void* b) {
+    const LiveInterval* x = *(const LiveInterval* const*)a;
+    const LiveInterval* y = *(const LiveInterval* const*)b;
+
+    if (x -> start != y -> start) {
+        return x -> start < y -> start ? -1 : 1;
+    }
+
+    return x -> value < y -> value ? -1 : (x -> value > y -> value);
+}
+
+/**
+ * @brief Tells whether a register is kept out of allocation.
+ * 
+ * The third parameter arrives in %edx, so it must not be hinted there: 
+ * in int f(int a, int b, int c) { int q = a / b; return q + c; } the 
+ * division would overwrite c. Like any other value it is moved out by 
+ * the parameter moves instead.
+ * 
+ * @param reg The register.
+ * @return 1 for %eax, %edx and %r11d, 0 otherwise.
+ */
+int reserved_register(int reg) {
+    return reg == RAX || reg == RDX || reg == R11;
+}
+
+/**
+ * @brief Returns the register an interval should get out of a set of free ones.
+ * 
+ * An interval that lives across a call may only use a callee-saved 
+ * register. Otherwise its hint comes first, then the caller-saved 
+ * registers, which cost nothing to use, then the callee-saved ones. A 
+ * reserved register is never handed out, even as a hint.
+ * 
+ * @param interval A pointer to the LiveInterval.
+ * @param active The interval in each register, or NULL if it is free.
+ * @return The register, or -1 if none is free.
+ */
+int choose_register(const LiveInterval* interval, LiveInterval* const* active) {
+    if (!interval -> crosses_call) {
+        if (interval -> hint >= 0 && !reserved_register(interval -> hint) && !active[interval -> hint]) {
+            return interval -> hint;
+        }
+
+        for (size_t i = 0; i < sizeof(caller_saved_registers) / sizeof(caller_saved_registers[0]); i++) {
+            if (!active[caller_saved_registers[i]]) {
+                return caller_saved_registers[i];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(callee_saved_registers) / sizeof(callee_saved_registers[0]); i++) {
+        if (!active[callee_saved_registers[i]]) {
+            return callee_saved_registers[i];
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Returns the cost of keeping an interval in memory.
+ * 
+ * Uses and definitions weighted by block weight, divided by the length 
+ * of the interval: a long interval that is rarely used frees its 
+ * register for the most positions at the least cost.
+ */
+double spill_cost(const LiveInterval* interval) {
+    return interval -> weight / (double)(interval -> end - interval -> start + 1);
+}
+
+/**
+ * @brief Gives every value of a function a register or a stack slot.
+ * 
+ * When no suitable register is free, the cheapest interval to spill 
+ * among the current one and the active ones holding a register it 
+ * could use is moved to the stack. Spilled values keep their slot for 
+ * their whole lifetime. Constants are used as immediates.
+ * 
+ * @param generator A pointer to the FunctionGenerator.
+ */
+void allocate_registers(FunctionGenerator* generator) {
+    const IrFunction* function = generator -> function;
+    size_t count = function -> instruction_count;
+    LiveInterval** sorted = arena_alloc(generator -> arena, sizeof(LiveInterval*) * (count ? count : 1));
+    int32_t* spill_slots = arena_alloc(generator -> arena, sizeof(int32_t) * (count ? count : 1));
+    LiveInterval* active[16];
+    size_t sorted_count = 0;
+    int32_t slot_count = 0;
+    uint32_t used_registers = 0;
+
+    memset(active, 0, sizeof(active));
+    generator -> locations = arena_alloc(generator -> arena, sizeof(Location) * (count ? count : 1));
+    memset(generator -> locations, 0, sizeof(Location) * (count ? count : 1));
+
+    for (size_t i = 0; i < count; i++) {
+        const IrInstruction* instruction = &(function -> instructions[i]);
+
+        spill_slots[i] = -1;
+
+        if (instruction -> op == IR_CONST) {
+            generator -> locations[i] = immediate_location(instruction -> imm);
+        } else if (ir_has_value(instruction -> op) && generator -> intervals[i].start != UINT32_MAX) {
+            sorted[sorted_count++] = &(generator -> intervals[i]);
+        }
+    }
+
+    qsort(sorted, sorted_count, sizeof(LiveInterval*), compare_interval_starts);
+
+    for (size_t i = 0; i < sorted_count; i++) {
+        LiveInterval* interval = sorted[i];
+
+        for (int r = 0; r < 16; r++) {
+            if (active[r] && active[r] -> end < interval -> start) {
+                active[r] = NULL;
+            }
+        }
+
+        int reg = choose_register(interval, active);
+
+        if (reg < 0) {
+            LiveInterval* victim = interval;
+
+            for (int r = 0; r < 16; r++) {
+                int usable = 0;
+
+                for (size_t k = 0; k < sizeof(callee_saved_registers) / sizeof(callee_saved_registers[0]); k++) {
+                    usable |= (int)callee_saved_registers[k] == r;
+                }
+
+                for (size_t k = 0; !interval -> crosses_call && k < sizeof(caller_saved_registers) / sizeof(caller_saved_registers[0]); k++) {
+                    usable |= (int)caller_saved_registers[k] == r;
+                }
+
+                if (usable && active[r] && spill_cost(active[r]) < spill_cost(victim)) {
+                    victim = active[r];
+                    reg = r;
+                }
+            }
+
+            spill_slots[victim -> value] = slot_count++;
+
+            if (victim == interval) {
+                continue;
+            }
+        }
+
+        active[reg] = interval;
+        used_registers |= 1u << reg;
+        generator -> locations[interval -> value] = register_location((X86Register)reg);
+    }
+
+    generator -> saved_count = 0;
+
+    for (size_t i = 0; i < sizeof(callee_saved_registers) / sizeof(callee_saved_registers[0]); i++) {
+        if (used_registers & (1u << callee_saved_registers[i])) {
+            generator -> saved_registers[generator -> saved_count++] = callee_saved_registers[i];
+        }
+    }
+
+    int32_t base = 8 * (int32_t)(generator -> saved_count);
+
+    for (size_t i = 0; i < count; i++) {
+        if (spill_slots[i] >= 0) {
+            generator -> locations[i] = stack_location(-(base + 4 * (spill_slots[i] + 1)));
+        }
+    }
+
+    generator -> frame_size = (base + 4 * slot_count + 15) & ~15;
+}
+
+/**
+ * @brief Emits a set of moves as if they all happened at once.
+ * 
+ * A move is emitted once no other pending move still reads its 
+ * destination. When only cycles are left, one source is saved in 
+ * %eax, which breaks its cycle.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param moves The moves; their destinations must all differ. The 
+ * array is used as scratch space.
+ * @param count The number of moves.
+ */
+void emit_parallel_moves(Emitter* emitter, Move* moves, size_t count) {
+    size_t i = 0;
+
+    while (i < count) {
+        if (moves[i].destination.kind == moves[i].source.kind && moves[i].destination.value == moves[i].source.value) {
+            moves[i] = moves[--count];
+        } else {
+            i++;
+        }
+    }
+
+    while (count) {
+        size_t ready = count;
+
+        for (i = 0; i < count && ready == count; i++) {
+            int blocked = 0;
+
+            for (size_t j = 0; j < count && !blocked; j++) {
+                blocked = j != i && moves[j].source.kind == moves[i].destination.kind && moves[j].source.value == moves[i].destination.value;
+            }
+
+            if (!blocked) {
+                ready = i;
+            }
+        }
+
+        if (ready == count) {
+            Location saved = moves[0].source;
+
+            emit_move(emitter, register_location(RAX), saved);
+
+            for (i = 0; i < count; i++) {
+                if (moves[i].source.kind == saved.kind && moves[i].source.value == saved.value) {
+                    moves[i].source = register_location(RAX);
+                }
+            }
+
+            continue;
+        }
+
+        emit_move(emitter, moves[ready].destination, moves[ready].source);
+        moves[ready] = moves[--count];
+    }
+}
+
+/**
+* * REGISTER ALLOCATOR END
+*/
+
+/**
+* * CODEGEN
+* Fourth stage.
+* Generates x86-64 code from the IR. Every instruction helper can write 
+* either AT&T assembly text or the encoded machine code, so the same 
+* walk produces a .s file or, without going through an assembler, an 
+* ELF relocatable object.
+*/
+
+/**
+ * @brief Names of the 32-bit views of the general purpose registers.
+ */
+static const char* const register_names_32[16] = {
+    "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+    "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"
+};
+
+/**
+ * @brief Names of the 64-bit general purpose registers.
+ */
+static const char* const register_names_64[16] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"
+};
+
+/**
+ * @brief Names of the low byte views of the general purpose registers.
+ */
+static const char* const register_names_8[16] = {
+    "%al", "%cl", "%dl", "%bl", "%spl", "%bpl", "%sil", "%dil",
+    "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b"
+};
+
+/**
+ * @brief Returns a Location naming a register.
+ */
+Location register_location(X86Register reg) {
+    Location location = { LOCATION_REGISTER, (int32_t)reg };
+    return location;
+}
+
+/**
+ * @brief Returns a Location naming a stack slot at an offset from %rbp.
+ */
+Location stack_location(int32_t displacement) {
+    Location location = { LOCATION_STACK, displacement };
+    return location;
+}
+
+/**
+ * @brief Returns a Location holding a constant.
+ */
+Location immediate_location(int32_t value) {
+    Location location = { LOCATION_IMMEDIATE, value };
+    return location;
+}
+
+/**
+ * @brief Formats a 32-bit operand in AT&T syntax.
+ * 
+ * @param buffer The buffer receiving the text.
+ * @param size The size of the buffer.
+ * @param location The operand.
+ */
+void format_location(char* buffer, size_t size, Location location) {
+    switch (location.kind) {
+        case LOCATION_REGISTER:
+            snprintf(buffer, size, "%s", register_names_32[location.value]);
+            break;
+        case LOCATION_STACK:
+            snprintf(buffer, size, "%d(%%rbp)", location.value);
+            break;
+        default:
+            snprintf(buffer, size, "$%d", location.value);
+            break;
+    }
+}
+
+/**
+ * @brief Initializes an emitter.
+ * 
+ * @param emitter A pointer to the Emitter to initialize.
+ * @param arena A pointer to the Arena code and symbols are kept in.
+ * @param interner A pointer to the Interner function names come from.
+ * @param format Whether to produce assembly text or an object file.
+ */
+void init_emitter(Emitter* emitter, Arena* arena, const Interner* interner, EmitFormat format) {
+    memset(emitter, 0, sizeof(Emitter));
+    emitter -> format = format;
+    emitter -> arena = arena;
+    emitter -> interner = interner;
+
+    init_output_buffer(&(emitter -> code), arena, 64 * 1024);
+
+    if (format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    .text\n");
+    }
+}
+
+/**
+ * @brief Starts a global function.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param name The symbol ID of the function's name.
+ * @param label_count The number of local labels the function uses.
+ */
+void begin_function(Emitter* emitter, uint32_t name, size_t label_count) {
+    emitter -> symbols = arena_grow_array(emitter -> arena, emitter -> symbols, &(emitter -> symbol_capacity), emitter -> symbol_count + 1, sizeof(CodeSymbol));
+
+    CodeSymbol* symbol = &(emitter -> symbols[emitter -> symbol_count++]);
+
+    symbol -> name = name;
+    symbol -> offset = (uint32_t)(emitter -> code.size);
+    symbol -> size = 0;
+
+    emitter -> label_offsets = arena_grow_array(emitter -> arena, emitter -> label_offsets, &(emitter -> label_capacity), label_count, sizeof(uint32_t));
+    memset(emitter -> label_offsets, 0xff, sizeof(uint32_t) * label_count);
+    emitter -> fixup_count = 0;
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        const char* text = symbol_text(emitter -> interner, name);
+
+        output_format(&(emitter -> code), "    .globl %s\n    .type %s, @function\n%s:\n", text, text, text);
+    }
+}
+
+/**
+ * @brief Ends the function started by the last begin_function() call.
+ * 
+ * In machine code the jumps to local labels are patched now that 
+ * every label's position is known.
+ * 
+ * @param emitter A pointer to the Emitter.
+ */
+void end_function(Emitter* emitter) {
+    CodeSymbol* symbol = &(emitter -> symbols[emitter -> symbol_count - 1]);
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        const char* text = symbol_text(emitter -> interner, symbol -> name);
+
+        output_format(&(emitter -> code), "    .size %s, .-%s\n", text, text);
+        return;
+    }
+
+    for (size_t i = 0; i < (emitter -> fixup_count); i++) {
+        const LabelFixup* fixup = &(emitter -> fixups[i]);
+        int32_t displacement = (int32_t)(emitter -> label_offsets[fixup -> label] - (fixup -> offset + 4));
+
+        memcpy(emitter -> code.data + fixup -> offset, &displacement, sizeof(displacement));
+    }
+
+    symbol -> size = (uint32_t)(emitter -> code.size) - symbol -> offset;
+}
+
+/**
+ * @brief Emits an instruction with a ModRM operand in machine code.
+ * 
+ * Writes the REX prefix when one is needed, the opcode (a value above 
+ * 0xff is a two-byte 0x0f opcode), the ModRM byte and, for stack 
+ * slots, the %rbp-relative displacement.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param opcode The opcode.
+ * @param wide Whether the operation is 64-bit (REX.W).
+ * @param reg The register or opcode extension in the ModRM reg field.
+ * @param rm The register or stack slot operand.
+ * @param byte_registers Whether registers are used as bytes, which 
+ * needs a REX prefix for %spl, %bpl, %sil and %dil.
+ */
+void emit_modrm(Emitter* emitter, uint16_t opcode, int wide, int reg, Location rm, int byte_registers) {
+    OutputBuffer* code = &(emitter -> code);
+    int base = rm.kind == LOCATION_REGISTER ? rm.value : RBP;
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg >= R8 ? 4 : 0) | (base >= R8 ? 1 : 0);
+
+    if (rex != 0x40 || (byte_registers && ((reg >= RSP && reg <= RDI) || (rm.kind == LOCATION_REGISTER && base >= RSP && base <= RDI)))) {
+        output_u8(code, rex);
+    }
+
+    if (opcode > 0xff) {
+        output_u8(code, 0x0f);
+    }
+
+    output_u8(code, (uint8_t)opcode);
+
+    if (rm.kind == LOCATION_REGISTER) {
+        output_u8(code, (uint8_t)(0xc0 | ((reg & 7) << 3) | (base & 7)));
+    } else if (rm.value >= -128 && rm.value <= 127) {
+        output_u8(code, (uint8_t)(0x40 | ((reg & 7) << 3) | RBP));
+        output_u8(code, (uint8_t)(int8_t)rm.value);
+    } else {
+        output_u8(code, (uint8_t)(0x80 | ((reg & 7) << 3) | RBP));
+        output_u32(code, (uint32_t)rm.value);
+    }
+}
+
+/**
+ * @brief Emits mov $value, reg (32-bit).
+ */
+void emit_mov_imm32(Emitter* emitter, X86Register reg, int32_t value) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_format(&(emitter -> code), "    movl $%d, %s\n", value, register_names_32[reg]);
+        return;
+    }
+
+    if (reg >= R8) {
+        output_u8(&(emitter -> code), 0x41);
+    }
+
+    output_u8(&(emitter -> code), 0xb8 + (reg & 7));
+    output_u32(&(emitter -> code), (uint32_t)value);
+}
+
+/**
+ * @brief Emits a 32-bit move between two locations.
+ * 
+ * x86 has no memory-to-memory move, so one between two stack slots 
+ * goes through %r11d, which code generation never allocates.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param destination A register or stack slot.
+ * @param source Any location.
+ */
+void emit_move(Emitter* emitter, Location destination, Location source) {
+    if (destination.kind == source.kind && destination.value == source.value) {
+        return;
+    }
+
+    if (destination.kind == LOCATION_STACK && source.kind == LOCATION_STACK) {
+        emit_move(emitter, register_location(R11), source);
+        source = register_location(R11);
+    }
+
+    if (destination.kind == LOCATION_REGISTER && source.kind == LOCATION_IMMEDIATE) {
+        emit_mov_imm32(emitter, (X86Register)destination.value, source.value);
+        return;
+    }
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        char from[32];
+        char to[32];
+
+        format_location(from, sizeof(from), source);
+        format_location(to, sizeof(to), destination);
+        output_format(&(emitter -> code), "    movl %s, %s\n", from, to);
+    } else if (source.kind == LOCATION_IMMEDIATE) {
+        emit_modrm(emitter, 0xc7, 0, 0, destination, 0);
+        output_u32(&(emitter -> code), (uint32_t)source.value);
+    } else if (destination.kind == LOCATION_REGISTER) {
+        emit_modrm(emitter, 0x8b, 0, destination.value, source, 0);
+    } else {
+        emit_modrm(emitter, 0x89, 0, source.value, destination, 0);
+    }
+}
+
+/**
+ * @brief Emits a two-operand arithmetic or compare instruction.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param op The operation.
+ * @param destination The register holding the left operand and result.
+ * @param source The right operand, in any location.
+ */
+void emit_alu(Emitter* emitter, AluOp op, X86Register destination, Location source) {
+    static const char* const names[] = { "addl", "subl", "imull", "cmpl" };
+    static const uint16_t opcodes[] = { 0x03, 0x2b, 0x0faf, 0x3b };
+    static const uint8_t extensions[] = { 0, 5, 0, 7 };
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        char from[32];
+
+        format_location(from, sizeof(from), source);
+        output_format(&(emitter -> code), "    %s %s, %s\n", names[op], from, register_names_32[destination]);
+    } else if (source.kind != LOCATION_IMMEDIATE) {
+        emit_modrm(emitter, opcodes[op], 0, destination, source, 0);
+    } else if (op == ALU_IMUL) {
+        int short_form = source.value >= -128 && source.value <= 127;
+
+        emit_modrm(emitter, short_form ? 0x6b : 0x69, 0, destination, register_location(destination), 0);
+        emit_immediate(emitter, source.value, short_form);
+    } else {
+        int short_form = source.value >= -128 && source.value <= 127;
+
+        emit_modrm(emitter, short_form ? 0x83 : 0x81, 0, extensions[op], register_location(destination), 0);
+        emit_immediate(emitter, source.value, short_form);
+    }
+}
+
+/**
+ * @brief Emits an immediate operand as 1 or 4 bytes.
+ */
+void emit_immediate(Emitter* emitter, int32_t value, int short_form) {
+    if (short_form) {
+        output_u8(&(emitter -> code), (uint8_t)(int8_t)value);
+    } else {
+        output_u32(&(emitter -> code), (uint32_t)value);
+    }
+}
+
+/**
+ * @brief Emits one of the single-operand group 3 instructions.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param extension The opcode extension: 2 for not, 3 for neg, 7 for idiv.
+ * @param mnemonic The AT&T mnemonic.
+ * @param operand A register or stack slot.
+ */
+void emit_unary(Emitter* emitter, int extension, const char* mnemonic, Location operand) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        char text[32];
+
+        format_location(text, sizeof(text), operand);
+        output_format(&(emitter -> code), "    %s %s\n", mnemonic, text);
+    } else {
+        emit_modrm(emitter, 0xf7, 0, extension, operand, 0);
+    }
+}
+
+/**
+ * @brief Emits cltd, sign-extending %eax into %edx before a division.
+ */
+void emit_cltd(Emitter* emitter) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    cltd\n");
+    } else {
+        output_u8(&(emitter -> code), 0x99);
+    }
+}
+
+/**
+ * @brief Emits test reg, reg.
+ */
+void emit_test(Emitter* emitter, X86Register reg) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_format(&(emitter -> code), "    testl %s, %s\n", register_names_32[reg], register_names_32[reg]);
+    } else {
+        emit_modrm(emitter, 0x85, 0, reg, register_location(reg), 0);
+    }
+}
+
+/**
+ * @brief Returns the AT&T suffix of a condition code.
+ */
+const char* condition_name(X86Condition condition) {
+    switch (condition) {
+        case CONDITION_E: return "e";
+        case CONDITION_NE: return "ne";
+        case CONDITION_L: return "l";
+        case CONDITION_GE: return "ge";
+        case CONDITION_LE: return "le";
+        default: return "g";
+    }
+}
+
+/**
+ * @brief Sets a register to 1 if a condition holds and to 0 otherwise.
+ * 
+ * Emits setcc on the low byte followed by movzbl.
+ */
+void emit_set_condition(Emitter* emitter, X86Condition condition, X86Register reg) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_format(&(emitter -> code), "    set%s %s\n    movzbl %s, %s\n", condition_name(condition), register_names_8[reg], register_names_8[reg], register_names_32[reg]);
+    } else {
+        emit_modrm(emitter, 0x0f90 | condition, 0, 0, register_location(reg), 1);
+        emit_modrm(emitter, 0x0fb6, 0, reg, register_location(reg), 1);
+    }
+}
+
+/**
+ * @brief Places a local label at the current position.
+ */
+void bind_label(Emitter* emitter, uint32_t label) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        const char* name = symbol_text(emitter -> interner, emitter -> symbols[emitter -> symbol_count - 1].name);
+
+        output_format(&(emitter -> code), ".L%s.%u:\n", name, label);
+    } else {
+        emitter -> label_offsets[label] = (uint32_t)(emitter -> code.size);
+    }
+}
+
+/**
+ * @brief Emits the rel32 operand of a jump to a local label.
+ * 
+ * The label may not be bound yet, so the operand is recorded as a 
+ * fixup and patched by end_function().
+ */
+void emit_label_operand(Emitter* emitter, uint32_t label) {
+    emitter -> fixups = arena_grow_array(emitter -> arena, emitter -> fixups, &(emitter -> fixup_capacity), emitter -> fixup_count + 1, sizeof(LabelFixup));
+    emitter -> fixups[emitter -> fixup_count].offset = (uint32_t)(emitter -> code.size);
+    emitter -> fixups[emitter -> fixup_count].label = label;
+    emitter -> fixup_count++;
+
+    output_u32(&(emitter -> code), 0);
+}
+
+/**
+ * @brief Emits a jump to a local label, conditional unless CONDITION_ALWAYS.
+ */
+void emit_jump(Emitter* emitter, X86Condition condition, uint32_t label) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        const char* name = symbol_text(emitter -> interner, emitter -> symbols[emitter -> symbol_count - 1].name);
+        const char* mnemonic = condition == CONDITION_ALWAYS ? "mp" : condition_name(condition);
+
+        output_format(&(emitter -> code), "    j%s .L%s.%u\n", mnemonic, name, label);
+        return;
+    }
+
+    if (condition == CONDITION_ALWAYS) {
+        output_u8(&(emitter -> code), 0xe9);
+    } else {
+        output_u8(&(emitter -> code), 0x0f);
+        output_u8(&(emitter -> code), (uint8_t)(0x80 | condition));
+    }
+
+    emit_label_operand(emitter, label);
+}
+
+/**
+ * @brief Emits a call to a function by name.
+ * 
+ * In machine code the target is left to the linker through an 
+ * R_X86_64_PLT32 relocation, which works whether the callee is in 
+ * this object, another object or a shared library.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param name The symbol ID of the callee's name.
+ */
+void emit_call(Emitter* emitter, uint32_t name) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_format(&(emitter -> code), "    call %s@PLT\n", symbol_text(emitter -> interner, name));
+        return;
+    }
+
+    output_u8(&(emitter -> code), 0xe8);
+
+    emitter -> relocations = arena_grow_array(emitter -> arena, emitter -> relocations, &(emitter -> relocation_capacity), emitter -> relocation_count + 1, sizeof(CodeRelocation));
+    emitter -> relocations[emitter -> relocation_count].offset = (uint32_t)(emitter -> code.size);
+    emitter -> relocations[emitter -> relocation_count].name = name;
+    emitter -> relocation_count++;
+
+    output_u32(&(emitter -> code), 0);
+}
+
+/**
+ * @brief Emits a Linux system call.
+ *
+ * The arguments must already be in %rdi, %rsi and %rdx. The result is
+ * left in %rax, and %rcx and %r11 are clobbered.
+ *
+ * @param emitter A pointer to the Emitter.
+ * @param number The system call number.
+ */
+void emit_syscall(Emitter* emitter, int32_t number) {
+    emit_mov_imm32(emitter, RAX, number);
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    syscall\n");
+    } else {
+        output_u8(&(emitter -> code), 0x0f);
+        output_u8(&(emitter -> code), 0x05);
+    }
+}
+
+/**
+ * @brief Emits push of a 64-bit register.
+ */
+void emit_push(Emitter* emitter, X86Register reg) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_format(&(emitter -> code), "    pushq %s\n", register_names_64[reg]);
+        return;
+    }
+
+    if (reg >= R8) {
+        output_u8(&(emitter -> code), 0x41);
+    }
+
+    output_u8(&(emitter -> code), 0x50 + (reg & 7));
+}
+
+/**
+ * @brief Moves the stack pointer by a number of bytes.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param amount The number of bytes to add to %rsp; negative allocates.
+ */
+void emit_adjust_stack(Emitter* emitter, int32_t amount) {
+    if (amount == 0) {
+        return;
+    }
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_format(&(emitter -> code), "    %s $%d, %%rsp\n", amount < 0 ? "subq" : "addq", amount < 0 ? -amount : amount);
+    } else {
+        int32_t magnitude = amount < 0 ? -amount : amount;
+        int short_form = magnitude <= 127;
+
+        emit_modrm(emitter, short_form ? 0x83 : 0x81, 1, amount < 0 ? 5 : 0, register_location(RSP), 0);
+        emit_immediate(emitter, magnitude, short_form);
+    }
+}
+
+/**
+ * @brief Emits the function prologue, setting up %rbp and the frame.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param frame_size The size of the frame, a multiple of 16.
+ */
+void emit_prologue(Emitter* emitter, int32_t frame_size) {
+    emit_push(emitter, RBP);
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    movq %rsp, %rbp\n");
+    } else {
+        emit_modrm(emitter, 0x89, 1, RSP, register_location(RBP), 0);
+    }
+
+    emit_adjust_stack(emitter, -frame_size);
+}
+
+/**
+ * @brief Emits leave.
+ */
+void emit_leave(Emitter* emitter) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    leave\n");
+    } else {
+        output_u8(&(emitter -> code), 0xc9);
+    }
+}
+
+/**
+ * @brief Emits ret.
+ */
+void emit_ret(Emitter* emitter) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    ret\n");
+    } else {
+        output_u8(&(emitter -> code), 0xc3);
+    }
+}
+
+/**
+ * @brief Returns whether an instruction produces a value.
+ */
+int ir_has_value(uint8_t op) {
+    return op != IR_NOP && op != IR_JUMP && op != IR_BRANCH && op != IR_RETURN;
+}
+
+/**
+ * @brief Returns whether two locations are the same.
+ */
+int same_location(Location a, Location b) {
+    return a.kind == b.kind && a.value == b.value;
+}
+
+/**
+ * @brief Emits a 64-bit move between a register and its save slot.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param reg The callee-saved register.
+ * @param displacement The offset of the save slot from %rbp.
+ * @param restore Whether to load the register instead of storing it.
+ */
+void emit_save_register(Emitter* emitter, X86Register reg, int32_t displacement, int restore) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        if (restore) {
+            output_format(&(emitter -> code), "    movq %d(%%rbp), %s\n", displacement, register_names_64[reg]);
+        } else {
+            output_format(&(emitter -> code), "    movq %s, %d(%%rbp)\n", register_names_64[reg], displacement);
+        }
+    } else {
+        emit_modrm(emitter, restore ? 0x8b : 0x89, 1, reg, stack_location(displacement), 0);
+    }
+}
+
+/**
+ * @brief Emits the epilogue: restores the callee-saved registers and returns.
+ */
+void generate_epilogue(FunctionGenerator* generator) {
+    for (size_t i = 0; i < (generator -> saved_count); i++) {
+        emit_save_register(generator -> emitter, generator -> saved_registers[i], -8 * (int32_t)(i + 1), 1);
+    }
+
+    emit_leave(generator -> emitter);
+    emit_ret(generator -> emitter);
+}
+
+/**
+ * @brief Emits the moves into the phis of a block's only successor.
+ * 
+ * Critical edges have been split, so a block whose successor has phis 
+ * always ends in a jump and the moves can go right before it.
+ */
+void generate_phi_moves(FunctionGenerator* generator, uint32_t block) {
+    const IrFunction* function = generator -> function;
+    const IrBlock* source = &(function -> blocks[block]);
+    const IrBlock* target = &(function -> blocks[source -> successors[0]]);
+    Move* moves = arena_alloc(generator -> arena, sizeof(Move) * (target -> phi_count ? target -> phi_count : 1));
+    size_t count = 0;
+    size_t k = 0;
+
+    while (k < (target -> predecessor_count) && target -> predecessors[k] != block) {
+        k++;
+    }
+
+    for (size_t i = 0; i < (target -> phi_count); i++) {
+        uint32_t phi = target -> phis[i];
+        const IrInstruction* instruction = &(function -> instructions[phi]);
+
+        if (instruction -> op == IR_PHI && k < (instruction -> b)) {
+            moves[count].destination = generator -> locations[phi];
+            moves[count].source = generator -> locations[function -> extra[instruction -> a + k]];
+            count++;
+        }
+    }
+
+    emit_parallel_moves(generator -> emitter, moves, count);
+}
+
+/**
+ * @brief Generates code for a call.
+ * 
+ * The first six arguments go in registers and the rest on the stack, 
+ * with padding so %rsp stays 16-byte aligned at the call. Moving the 
+ * arguments into place is a parallel move, since an argument may sit 
+ * in another argument's register. %eax is cleared because a variadic 
+ * callee reads the number of vector registers used from %al. Values 
+ * that live across the call are in callee-saved registers or on the 
+ * stack, so nothing needs saving here.
+ */
+void generate_call(FunctionGenerator* generator, uint32_t value) {
+    Emitter* emitter = generator -> emitter;
+    const IrFunction* function = generator -> function;
+    const IrInstruction* instruction = &(function -> instructions[value]);
+    const uint32_t* arguments = function -> extra + instruction -> a;
+    uint32_t count = instruction -> b;
+    uint32_t stack_count = count > 6 ? count - 6 : 0;
+    int32_t padding = (stack_count & 1) ? 8 : 0;
+    Move moves[6];
+
+    emit_adjust_stack(emitter, -padding);
+
+    for (uint32_t i = count; i > 6; i--) {
+        emit_move(emitter, register_location(RAX), generator -> locations[arguments[i - 1]]);
+        emit_push(emitter, RAX);
+    }
+
+    for (uint32_t i = 0; i < count && i < 6; i++) {
+        moves[i].destination = register_location(argument_registers[i]);
+        moves[i].source = generator -> locations[arguments[i]];
+    }
+
+    emit_parallel_moves(emitter, moves, count < 6 ? count : 6);
+    emit_mov_imm32(emitter, RAX, 0);
+    emit_call(emitter, (uint32_t)(instruction -> imm));
+    emit_adjust_stack(emitter, (int32_t)(8 * stack_count) + padding);
+    emit_move(emitter, generator -> locations[value], register_location(RAX));
+}
+
+/**
+ * @brief Generates code for one instruction.
+ * 
+ * Results are computed directly in their register when they have one 
+ * and in %eax otherwise. Division always goes through %eax and %edx.
+ * 
+ * @param generator A pointer to the FunctionGenerator.
+ * @param value The instruction.
+ * @param next_block The block laid out after the current one, so a 
+ * jump to it can be left out.
+ */
+void generate_instruction(FunctionGenerator* generator, uint32_t value, uint32_t next_block) {
+    Emitter* emitter = generator -> emitter;
+    const IrFunction* function = generator -> function;
+    const IrInstruction* instruction = &(function -> instructions[value]);
+    const IrBlock* block = &(function -> blocks[instruction -> block]);
+    Location eax = register_location(RAX);
+    Location result = generator -> locations[value];
+    int operands = ir_operand_count(instruction -> op);
+    Location a = operands >= 1 ? generator -> locations[instruction -> a] : eax;
+    Location b = operands >= 2 ? generator -> locations[instruction -> b] : eax;
+    X86Register target = result.kind == LOCATION_REGISTER && !same_location(result, b) ? (X86Register)result.value : RAX;
+
+    switch (instruction -> op) {
+        case IR_COPY:
+            emit_move(emitter, result, a);
+            break;
+        case IR_CALL:
+            generate_call(generator, value);
+            break;
+        case IR_ADD:
+        case IR_MUL:
+        case IR_SUB:
+            // Addition and multiplication commute, so a result that 
+            // shares the right operand's register can still be computed in place.
+            if (instruction -> op != IR_SUB && same_location(result, b)) {
+                Location swap = a;
+                a = b;
+                b = swap;
+                target = (X86Register)result.value;
+            }
+
+            emit_move(emitter, register_location(target), a);
+            emit_alu(emitter, instruction -> op == IR_ADD ? ALU_ADD : (instruction -> op == IR_SUB ? ALU_SUB : ALU_IMUL), target, b);
+            emit_move(emitter, result, register_location(target));
+            break;
+        case IR_DIV:
+        case IR_MOD:
+            emit_move(emitter, eax, a);
+            if (b.kind == LOCATION_IMMEDIATE) {
+                emit_move(emitter, register_location(R11), b);
+                b = register_location(R11);
+            }
+            emit_cltd(emitter);
+            emit_unary(emitter, 7, "idivl", b);
+            emit_move(emitter, result, register_location(instruction -> op == IR_DIV ? RAX : RDX));
+            break;
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE: {
+            static const X86Condition conditions[] = { CONDITION_E, CONDITION_NE, CONDITION_L, CONDITION_LE, CONDITION_G, CONDITION_GE };
+
+            emit_move(emitter, register_location(target), a);
+            emit_alu(emitter, ALU_CMP, target, b);
+            emit_set_condition(emitter, conditions[instruction -> op - IR_EQ], target);
+            emit_move(emitter, result, register_location(target));
+            break;
+        }
+        case IR_NEG:
+        case IR_NOT:
+            emit_move(emitter, register_location(target), a);
+            emit_unary(emitter, instruction -> op == IR_NEG ? 3 : 2, instruction -> op == IR_NEG ? "negl" : "notl", register_location(target));
+            emit_move(emitter, result, register_location(target));
+            break;
+        case IR_LOGICAL_NOT:
+            emit_move(emitter, register_location(target), a);
+            emit_test(emitter, target);
+            emit_set_condition(emitter, CONDITION_E, target);
+            emit_move(emitter, result, register_location(target));
+            break;
+        case IR_JUMP:
+            generate_phi_moves(generator, instruction -> block);
+            if (block -> successors[0] != next_block) {
+                emit_jump(emitter, CONDITION_ALWAYS, block -> successors[0]);
+            }
+            break;
+        case IR_BRANCH:
+            if (a.kind != LOCATION_REGISTER) {
+                emit_move(emitter, eax, a);
+                a = eax;
+            }
+            emit_test(emitter, (X86Register)a.value);
+            if (block -> successors[0] == next_block) {
+                emit_jump(emitter, CONDITION_E, block -> successors[1]);
+            } else {
+                emit_jump(emitter, CONDITION_NE, block -> successors[0]);
+                if (block -> successors[1] != next_block) {
+                    emit_jump(emitter, CONDITION_ALWAYS, block -> successors[1]);
+                }
             }
+            break;
+        case IR_RETURN:
+            emit_move(emitter, eax, a);
+            generate_epilogue(generator);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Generates code for a function.
+ * 
+ * Registers are allocated first, so the prologue knows the frame size 
+ * and which callee-saved registers to save. Blocks are emitted in the 
+ * allocator's layout and each block's index is its label. When 
+ * instrumenting, every block starts by counting itself.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param function A pointer to the IrFunction; its critical edges are split.
+ */
+void generate_function(Emitter* emitter, IrFunction* function) {
+    FunctionGenerator generator;
+
+    memset(&generator, 0, sizeof(generator));
+    generator.emitter = emitter;
+    generator.function = function;
+    generator.arena = emitter -> arena;
+
+    split_critical_edges(function, emitter -> arena);
+
+    uint64_t checksum = emitter -> instrument || emitter -> profile ? ir_shape_hash(function) : 0;
+    uint32_t counters = emitter -> instrument ? add_profile_record(emitter, function, checksum) : 0;
+
+    if (emitter -> profile) {
+        generator.block_counts = find_profile_counts(emitter -> profile, emitter -> interner, function, checksum);
+    }
+
+    compute_block_layout(&generator);
+    compute_block_weights(&generator);
+    compute_liveness(&generator);
+    build_live_intervals(&generator);
+    allocate_registers(&generator);
+
+    begin_function(emitter, function -> name, function -> block_count);
+    emit_prologue(emitter, generator.frame_size);
+
+    for (size_t i = 0; i < generator.saved_count; i++) {
+        emit_save_register(emitter, generator.saved_registers[i], -8 * (int32_t)(i + 1), 0);
+    }
+
+    Move* moves = arena_alloc(emitter -> arena, sizeof(Move) * (function -> parameter_count ? function -> parameter_count : 1));
+    size_t move_count = 0;
+
+    for (size_t i = 0; i < (function -> instruction_count); i++) {
+        const IrInstruction* instruction = &(function -> instructions[i]);
+
+        if (instruction -> op != IR_PARAM || generator.locations[i].kind == LOCATION_NONE) {
+            continue;
+        }
+
+        moves[move_count].destination = generator.locations[i];
+        moves[move_count].source = instruction -> imm < 6 ? register_location(argument_registers[instruction -> imm]) : stack_location(16 + 8 * (instruction -> imm - 6));
+        move_count++;
+    }
+
+    emit_parallel_moves(emitter, moves, move_count);
+
+    for (size_t i = 0; i < generator.layout_count; i++) {
+        uint32_t b = generator.layout[i];
+        const IrBlock* block = &(function -> blocks[b]);
+        uint32_t next = i + 1 < generator.layout_count ? generator.layout[i + 1] : UINT32_MAX;
+
+        bind_label(emitter, b);
+
+        if (emitter -> instrument) {
+            emit_profile_increment(emitter, counters + 8 * b);
+        }
+
+        for (size_t j = 0; j < (block -> instruction_count); j++) {
+            generate_instruction(&generator, block -> instructions[j], next);
+        }
+    }
+
+    end_function(emitter);
+}
+
+/**
+ * @brief Generates code for a whole translation unit.
+ * 
+ * With a function cache, the code of every hit is copied from its 
+ * cache file and every other function is generated and then stored, 
+ * keeping the functions in source order.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param module A pointer to the IrModule of the translation unit.
+ * @param cache A pointer to the FunctionCache the module was lowered 
+ * with, or NULL.
+ */
+void generate_code(Emitter* emitter, IrModule* module, const FunctionCache* cache) {
+    if (!cache) {
+        for (size_t i = 0; i < (module -> function_count); i++) {
+            generate_function(emitter, &(module -> functions[i]));
+        }
+
+        return;
+    }
+
+    size_t next = 0;
+
+    for (size_t i = 0; i < (cache -> count); i++) {
+        if (!cache -> defined[i]) {
+            continue;
+        }
+
+        if (cache -> hits[i]) {
+            splice_cached_function(emitter, cache, i);
+            continue;
+        }
+
+        size_t relocation_start = emitter -> relocation_count;
+
+        generate_function(emitter, &(module -> functions[next++]));
+        store_cached_function(emitter, cache, i, relocation_start);
+    }
+}
+
+/**
+ * @brief Appends a section header to an ELF section header table.
+ */
+void output_section_header(OutputBuffer* buffer, uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size, uint32_t link, uint32_t info, uint64_t alignment, uint64_t entry_size) {
+    Elf64_Shdr header;
+
+    memset(&header, 0, sizeof(header));
+    header.sh_name = name;
+    header.sh_type = type;
+    header.sh_flags = flags;
+    header.sh_offset = offset;
+    header.sh_size = size;
+    header.sh_link = link;
+    header.sh_info = info;
+    header.sh_addralign = alignment;
+    header.sh_entsize = entry_size;
+
+    output_bytes(buffer, &header, sizeof(header));
+}
+
+/**
+ * @brief Wraps the emitted machine code in an ELF64 relocatable object.
+ * 
+ * The object has a .text section holding the code, its relocations, a 
+ * symbol table with one global function symbol per function followed 
+ * by the undefined symbols of functions that are called but not 
+ * defined here, its string table, the section name table and an empty 
+ * .note.GNU-stack so linkers keep the stack non-executable. An 
+ * instrumented object also has the profile data in .data and the 
+ * profile writer in .fini_array, with a section symbol for .text and 
+ * .data ahead of the function symbols for their relocations.
+ * 
+ * @param emitter A pointer to the Emitter holding the machine code.
+ * @param out A pointer to the OutputBuffer the object is written to.
+ */
+void write_elf_object(const Emitter* emitter, OutputBuffer* out) {
+    static const char section_names[] = "\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+    static const char profile_section_names[] = ".rela.fini_array\0.data";
+    enum { NAME_RELA_TEXT = 1, NAME_TEXT = 6, NAME_SYMTAB = 12, NAME_STRTAB = 20, NAME_SHSTRTAB = 28, NAME_NOTE = 38 };
+    enum { NAME_RELA_FINI_ARRAY = 54, NAME_FINI_ARRAY = 59, NAME_DATA = 71 };
+    enum { SECTION_DATA = 7, SECTION_FINI_ARRAY = 8 };
+
+    int profiled = emitter -> instrument;
+    uint32_t local_count = profiled ? 3 : 1;
+
+    Elf64_Ehdr header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = profiled ? 10 : 7;
+    header.e_shstrndx = 5;
+
+    output_bytes(out, &header, sizeof(header));
+
+    uint64_t text_offset = out -> size;
+    output_bytes(out, emitter -> code.data, emitter -> code.size);
+
+    OutputBuffer strings;
+    init_output_buffer(&strings, emitter -> arena, 4096);
+    output_u8(&strings, 0);
+
+    // Symbol table index of every name, 0 until the name gets a symbol.
+    size_t name_count = interner_size(emitter -> interner);
+    uint32_t* symbol_indices = arena_alloc(emitter -> arena, sizeof(uint32_t) * (name_count ? name_count : 1));
+    uint32_t symbol_count = local_count;
+
+    memset(symbol_indices, 0, sizeof(uint32_t) * name_count);
+
+    align_output(out, 8);
+    uint64_t symtab_offset = out -> size;
+    Elf64_Sym symbol;
+
+    memset(&symbol, 0, sizeof(symbol));
+    output_bytes(out, &symbol, sizeof(symbol));
+
+    if (profiled) {
+        symbol.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        symbol.st_shndx = 1;
+        output_bytes(out, &symbol, sizeof(symbol));
+        symbol.st_shndx = SECTION_DATA;
+        output_bytes(out, &symbol, sizeof(symbol));
+    }
+
+    for (size_t i = 0; i < (emitter -> symbol_count); i++) {
+        const CodeSymbol* code_symbol = &(emitter -> symbols[i]);
+        const char* name = symbol_text(emitter -> interner, code_symbol -> name);
+
+        symbol.st_name = (uint32_t)(strings.size);
+        symbol.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+        symbol.st_other = STV_DEFAULT;
+        symbol.st_shndx = 1;
+        symbol.st_value = code_symbol -> offset;
+        symbol.st_size = code_symbol -> size;
+
+        symbol_indices[code_symbol -> name] = symbol_count++;
+        output_bytes(&strings, name, strlen(name) + 1);
+        output_bytes(out, &symbol, sizeof(symbol));
+    }
+
+    for (size_t i = 0; i < (emitter -> relocation_count); i++) {
+        uint32_t name = emitter -> relocations[i].name;
+
+        if (symbol_indices[name]) {
+            continue;
+        }
+
+        memset(&symbol, 0, sizeof(symbol));
+        symbol.st_name = (uint32_t)(strings.size);
+        symbol.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        symbol.st_shndx = SHN_UNDEF;
+
+        symbol_indices[name] = symbol_count++;
+        output_bytes(&strings, symbol_text(emitter -> interner, name), symbol_length(emitter -> interner, name) + 1);
+        output_bytes(out, &symbol, sizeof(symbol));
+    }
+
+    uint64_t symtab_size = out -> size - symtab_offset;
+    uint64_t rela_offset = out -> size;
+
+    for (size_t i = 0; i < (emitter -> relocation_count); i++) {
+        const CodeRelocation* relocation = &(emitter -> relocations[i]);
+        Elf64_Rela entry;
+
+        entry.r_offset = relocation -> offset;
+        entry.r_info = ELF64_R_INFO(symbol_indices[relocation -> name], R_X86_64_PLT32);
+        entry.r_addend = -4;
+
+        output_bytes(out, &entry, sizeof(entry));
+    }
+
+    for (size_t i = 0; i < (emitter -> data_relocation_count); i++) {
+        Elf64_Rela entry;
+
+        entry.r_offset = emitter -> data_relocations[i].offset;
+        entry.r_info = ELF64_R_INFO(2, R_X86_64_PC32);
+        entry.r_addend = emitter -> data_relocations[i].addend;
+
+        output_bytes(out, &entry, sizeof(entry));
+    }
+
+    uint64_t rela_size = out -> size - rela_offset;
+    uint64_t strtab_offset = out -> size;
+    output_bytes(out, strings.data, strings.size);
+
+    uint64_t shstrtab_offset = out -> size;
+    output_bytes(out, section_names, sizeof(section_names));
+
+    uint64_t shstrtab_size = sizeof(section_names);
+    uint64_t data_offset = 0;
+    uint64_t fini_array_offset = 0;
+    uint64_t rela_fini_array_offset = 0;
+
+    if (profiled) {
+        output_bytes(out, profile_section_names, sizeof(profile_section_names));
+        shstrtab_size += sizeof(profile_section_names);
+
+        align_output(out, 8);
+        data_offset = out -> size;
+        output_bytes(out, emitter -> profile_data.data, emitter -> profile_data.size);
+
+        Elf64_Rela entry = { 0, ELF64_R_INFO(1, R_X86_64_64), emitter -> profile_writer };
+        uint64_t zero = 0;
+
+        align_output(out, 8);
+        fini_array_offset = out -> size;
+        output_bytes(out, &zero, sizeof(zero));
+
+        rela_fini_array_offset = out -> size;
+        output_bytes(out, &entry, sizeof(entry));
+    }
+
+    align_output(out, 8);
+    uint64_t section_headers_offset = out -> size;
+
+    output_section_header(out, 0, SHT_NULL, 0, 0, 0, 0, 0, 0, 0);
+    output_section_header(out, NAME_TEXT, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, text_offset, emitter -> code.size, 0, 0, 16, 0);
+    output_section_header(out, NAME_RELA_TEXT, SHT_RELA, SHF_INFO_LINK, rela_offset, rela_size, 3, 1, 8, sizeof(Elf64_Rela));
+    output_section_header(out, NAME_SYMTAB, SHT_SYMTAB, 0, symtab_offset, symtab_size, 4, local_count, 8, sizeof(Elf64_Sym));
+    output_section_header(out, NAME_STRTAB, SHT_STRTAB, 0, strtab_offset, strings.size, 0, 0, 1, 0);
+    output_section_header(out, NAME_SHSTRTAB, SHT_STRTAB, 0, shstrtab_offset, shstrtab_size, 0, 0, 1, 0);
+    output_section_header(out, NAME_NOTE, SHT_PROGBITS, 0, text_offset, 0, 0, 0, 1, 0);
+
+    if (profiled) {
+        output_section_header(out, NAME_DATA, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, data_offset, emitter -> profile_data.size, 0, 0, 8, 0);
+        output_section_header(out, NAME_FINI_ARRAY, SHT_FINI_ARRAY, SHF_ALLOC | SHF_WRITE, fini_array_offset, 8, 0, 0, 8, 8);
+        output_section_header(out, NAME_RELA_FINI_ARRAY, SHT_RELA, SHF_INFO_LINK, rela_fini_array_offset, sizeof(Elf64_Rela), 3, SECTION_FINI_ARRAY, 8, sizeof(Elf64_Rela));
+    }
+
+    memcpy(out -> data + offsetof(Elf64_Ehdr, e_shoff), &section_headers_offset, sizeof(section_headers_offset));
+}
+
+/**
+ * @brief Finishes code generation and collects the final output.
+ * 
+ * For assembly the emitted text is the output, followed by the 
+ * directive that marks the stack as non-executable, and is handed over 
+ * without copying. For objects the machine code is wrapped in an ELF 
+ * file. When instrumenting, the function that writes the profile out 
+ * is added first.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param out A pointer to the OutputBuffer receiving the result.
+ */
+void finish_emitter(Emitter* emitter, OutputBuffer* out) {
+    if (emitter -> instrument) {
+        emit_profile_writer(emitter);
+    }
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    .section .note.GNU-stack,\"\",@progbits\n");
+        *out = emitter -> code;
+    } else {
+        init_output_buffer(out, emitter -> arena, emitter -> code.size + 4096);
+        write_elf_object(emitter, out);
+    }
+}
+
+/**
+* * CODEGEN END
+*/
+
+/**
+* * FUNCTION CACHE
+* On-disk cache of the code generated for each function.
+* Every function definition is fingerprinted by its tokens and the 
+* options that affect its code. A function whose fingerprint is in the 
+* cache is not lowered, optimized or generated; its code is copied 
+* from the cache file and its calls are added back as relocations.
+*/
+
+/**
+ * @brief Computes the fingerprint of a function definition.
+ * 
+ * The fingerprint covers the kind and spelling of every token of the 
+ * definition, so whitespace and comments do not change it, plus the 
+ * cache format, the output format and whether optimization is on. A 
+ * function's code depends on nothing else: calls are resolved by name 
+ * by the linker and no other declaration is looked at, so the 
+ * declarations around the function are not part of its fingerprint.
+ * 
+ * @param tokens A pointer to the TokenList of the translation unit.
+ * @param first The index of the definition's first token.
+ * @param end The index one past its last token.
+ * @param format The output format.
+ * @param optimize Whether the IR is optimized.
+ * @return The fingerprint.
+ */
+uint64_t function_cache_key(const TokenList* tokens, size_t first, size_t end, EmitFormat format, int optimize) {
+    uint64_t hash = ((uint64_t)FUNCTION_CACHE_VERSION << 32 | (uint64_t)format << 1 | (optimize != 0)) * 0x9e3779b97f4a7c15ull;
+
+    for (size_t i = first; i < end; i++) {
+        TokenType kind = token_kind(tokens, i);
+
+        if (kind == END_OF_FILE) {
+            break;
+        }
+
+        hash = (hash ^ kind) * 0xbf58476d1ce4e5b9ull;
+        hash ^= hash_bytes(token_chars(tokens, i), token_length(tokens, i));
+        hash = hash << 27 | hash >> 37;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Loads the cache file of a function.
+ * 
+ * Like load_token_cache(), everything in the file is checked first, so 
+ * a stale, truncated or corrupt file is a miss.
+ * 
+ * @param cache A pointer to the FunctionCache.
+ * @param key The fingerprint of the function.
+ * @return The mapped cache file, or NULL on a miss.
+ */
+SourceBuffer* load_cached_function(const FunctionCache* cache, uint64_t key) {
+    SourceBuffer* entry = read_source_file(cache_path(cache -> arena, cache -> directory, key, ".fn"));
+
+    if (!entry) {
+        return NULL;
+    }
+
+    const char* data = entry -> data;
+    size_t size = entry -> length;
+    FunctionCacheHeader header;
+
+    if (size < sizeof(FunctionCacheHeader)) {
+        free_source_buffer(entry);
+        return NULL;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    int valid = memcmp(header.magic, FUNCTION_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == FUNCTION_CACHE_VERSION && header.header_size == sizeof(FunctionCacheHeader) &&
+        header.key == key && header.file_size == size && header.format == (uint32_t)(cache -> format) &&
+        header.code_size <= size - sizeof(header) &&
+        header.relocations_offset % 4 == 0 && header.relocations_offset <= size &&
+        header.relocation_count <= (size - header.relocations_offset) / sizeof(CachedRelocation) &&
+        header.characters_offset <= size && header.characters_size <= size - header.characters_offset &&
+        cache_file_hash(data, size, sizeof(header)) == header.file_hash;
+
+    // The offsets are only known to lie inside the file once valid holds.
+    const CachedRelocation* relocations = valid ? (const CachedRelocation*)(data + header.relocations_offset) : NULL;
+
+    for (uint32_t i = 0; valid && i < header.relocation_count; i++) {
+        const CachedRelocation* relocation = &(relocations[i]);
+
+        valid = header.code_size >= 4 && relocation -> offset <= header.code_size - 4 &&
+            relocation -> name.length > 0 && relocation -> name.length <= header.characters_size &&
+            relocation -> name.offset <= header.characters_size - relocation -> name.length;
+    }
+
+    if (!valid) {
+        free_source_buffer(entry);
+        return NULL;
+    }
+
+    return entry;
+}
+
+/**
+ * @brief Fingerprints the functions of a translation unit and looks them up.
+ * 
+ * A definition's tokens run from its 'int' up to the next top-level 
+ * node, or the end of the file.
+ * 
+ * @param arena A pointer to the Arena the cache is allocated from.
+ * @param interner A pointer to the Interner callee names are added to.
+ * @param directory The cache directory.
+ * @param ast A pointer to the Ast of the translation unit.
+ * @param format The output format.
+ * @param optimize Whether the IR is optimized.
+ * @return A pointer to the FunctionCache.
+ */
+FunctionCache* create_function_cache(Arena* arena, Interner* interner, const char* directory, const Ast* ast, EmitFormat format, int optimize) {
+    const AstNode* root = &(ast -> nodes[ast -> root]);
+    const TokenList* tokens = ast -> tokens;
+    FunctionCache* cache = arena_alloc(arena, sizeof(FunctionCache));
+    size_t count = root -> rhs;
+    size_t slots = count ? count : 1;
+
+    cache -> arena = arena;
+    cache -> interner = interner;
+    cache -> directory = directory;
+    cache -> format = format;
+    cache -> names = arena_alloc(arena, sizeof(uint32_t) * slots);
+    cache -> keys = arena_alloc(arena, sizeof(uint64_t) * slots);
+    cache -> entries = arena_alloc(arena, sizeof(SourceBuffer*) * slots);
+    cache -> defined = arena_alloc(arena, slots);
+    cache -> hits = arena_alloc(arena, slots);
+    cache -> count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        const AstNode* n = &(ast -> nodes[ast -> extra[root -> lhs + i]]);
+        size_t first = n -> token - 1;
+        size_t end = i + 1 < count ? ast -> nodes[ast -> extra[root -> lhs + i + 1]].token - 1 : tokens -> size;
+
+        cache -> names[i] = token_payload(tokens, n -> token);
+        cache -> defined[i] = n -> lhs != 0;
+        cache -> keys[i] = cache -> defined[i] ? function_cache_key(tokens, first, end, format, optimize) : 0;
+        cache -> entries[i] = cache -> defined[i] ? load_cached_function(cache, cache -> keys[i]) : NULL;
+        cache -> hits[i] = cache -> entries[i] != NULL;
+    }
+
+    return cache;
+}
+
+/**
+ * @brief Appends the cached code of a function to the emitter.
+ * 
+ * The code is position-independent apart from its calls, so it is 
+ * copied as is and each call gets its relocation back.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param cache A pointer to the FunctionCache.
+ * @param index The position of the function in the translation unit.
+ */
+void splice_cached_function(Emitter* emitter, const FunctionCache* cache, size_t index) {
+    const char* data = cache -> entries[index] -> data;
+    FunctionCacheHeader header;
+
+    memcpy(&header, data, sizeof(header));
+
+    const CachedRelocation* relocations = (const CachedRelocation*)(data + header.relocations_offset);
+    uint32_t start = (uint32_t)(emitter -> code.size);
+
+    emitter -> symbols = arena_grow_array(emitter -> arena, emitter -> symbols, &(emitter -> symbol_capacity), emitter -> symbol_count + 1, sizeof(CodeSymbol));
+
+    CodeSymbol* symbol = &(emitter -> symbols[emitter -> symbol_count++]);
+
+    symbol -> name = cache -> names[index];
+    symbol -> offset = start;
+    symbol -> size = emitter -> format == EMIT_OBJECT ? header.code_size : 0;
+
+    output_bytes(&(emitter -> code), data + header.header_size, header.code_size);
+
+    emitter -> relocations = arena_grow_array(emitter -> arena, emitter -> relocations, &(emitter -> relocation_capacity), emitter -> relocation_count + header.relocation_count, sizeof(CodeRelocation));
+
+    for (uint32_t i = 0; i < header.relocation_count; i++) {
+        const CachedRelocation* relocation = &(relocations[i]);
+        CodeRelocation* code_relocation = &(emitter -> relocations[emitter -> relocation_count++]);
+
+        code_relocation -> offset = start + relocation -> offset;
+        code_relocation -> name = intern(cache -> interner, data + header.characters_offset + relocation -> name.offset, relocation -> name.length);
+    }
+}
+
+/**
+ * @brief Writes the code of the function just generated to the cache.
+ * 
+ * @param emitter A pointer to the Emitter, right after the function's 
+ * end_function().
+ * @param cache A pointer to the FunctionCache.
+ * @param index The position of the function in the translation unit.
+ * @param relocation_start The number of relocations before the function.
+ */
+void store_cached_function(const Emitter* emitter, const FunctionCache* cache, size_t index, size_t relocation_start) {
+    const CodeSymbol* symbol = &(emitter -> symbols[emitter -> symbol_count - 1]);
+    const Interner* interner = emitter -> interner;
+    size_t code_size = emitter -> code.size - symbol -> offset;
+    FunctionCacheHeader header;
+    OutputBuffer out;
+
+    memset(&header, 0, sizeof(header));
+    init_output_buffer(&out, cache -> arena, sizeof(header) + code_size + 256);
+    output_bytes(&out, &header, sizeof(header));
+    output_bytes(&out, emitter -> code.data + symbol -> offset, code_size);
+
+    align_output(&out, 4);
+    header.relocations_offset = out.size;
+    uint32_t character_offset = 0;
+
+    for (size_t i = relocation_start; i < (emitter -> relocation_count); i++) {
+        const CodeRelocation* relocation = &(emitter -> relocations[i]);
+        CachedRelocation entry = { relocation -> offset - symbol -> offset, { character_offset, (uint32_t)symbol_length(interner, relocation -> name) } };
+
+        output_bytes(&out, &entry, sizeof(entry));
+        character_offset += entry.name.length;
+    }
+
+    header.characters_offset = out.size;
+    for (size_t i = relocation_start; i < (emitter -> relocation_count); i++) {
+        uint32_t name = emitter -> relocations[i].name;
+
+        output_bytes(&out, symbol_text(interner, name), symbol_length(interner, name));
+    }
+
+    memcpy(header.magic, FUNCTION_CACHE_MAGIC, sizeof(header.magic));
+    header.version = FUNCTION_CACHE_VERSION;
+    header.header_size = sizeof(FunctionCacheHeader);
+    header.key = cache -> keys[index];
+    header.file_size = out.size;
+    header.format = (uint32_t)(cache -> format);
+    header.code_size = (uint32_t)code_size;
+    header.relocation_count = (uint32_t)(emitter -> relocation_count - relocation_start);
+    header.characters_size = (uint32_t)(out.size - header.characters_offset);
+    memcpy(out.data, &header, sizeof(header));
+
+    header.file_hash = cache_file_hash(out.data, out.size, sizeof(header));
+    memcpy(out.data, &header, sizeof(header));
+
+    write_cache_file(cache -> arena, cache_path(cache -> arena, cache -> directory, header.key, ".fn"), &out);
+}
+
+/**
+ * @brief Releases the cache files mapped by a FunctionCache.
+ * 
+ * @param cache A pointer to the FunctionCache, or NULL.
+ */
+void free_function_cache(FunctionCache* cache) {
+    if (!cache) {
+        return;
+    }
+
+    for (size_t i = 0; i < (cache -> count); i++) {
+        if (cache -> entries[i]) {
+            free_source_buffer(cache -> entries[i]);
+        }
+    }
+}
+
+/**
+* * FUNCTION CACHE END
+*/
+
+/**
+* * PARALLEL CODEGEN
+* Compiles the functions of one translation unit on several threads.
+* Functions share nothing after parsing, so runs of them are lowered, 
+* optimized and generated by tasks of their own, and their code is 
+* put back together in source order. The output is the same as that of 
+* generate_code() for any number of threads.
+*/
+
+/**
+ * @brief Appends the code of one function of another emitter.
+ * 
+ * Jumps within the function were patched by end_function() and are 
+ * relative, so the code is copied as is; its symbol and its calls' 
+ * relocations are moved to where it lands.
+ * 
+ * @param emitter A pointer to the Emitter to append to.
+ * @param fragment A pointer to the Emitter the function was generated in.
+ * @param index The index of the function's symbol in fragment.
+ * @param relocation The index of the function's first relocation in 
+ * fragment.
+ * @return The index of the next function's first relocation.
+ */
+size_t append_function_code(Emitter* emitter, const Emitter* fragment, size_t index, size_t relocation) {
+    const CodeSymbol* source = &(fragment -> symbols[index]);
+    uint32_t end = index + 1 < fragment -> symbol_count ? fragment -> symbols[index + 1].offset : (uint32_t)(fragment -> code.size);
+    uint32_t start = (uint32_t)(emitter -> code.size);
+
+    emitter -> symbols = arena_grow_array(emitter -> arena, emitter -> symbols, &(emitter -> symbol_capacity), emitter -> symbol_count + 1, sizeof(CodeSymbol));
+
+    CodeSymbol* symbol = &(emitter -> symbols[emitter -> symbol_count++]);
+
+    *symbol = *source;
+    symbol -> offset = start;
+
+    output_bytes(&(emitter -> code), fragment -> code.data + source -> offset, end - source -> offset);
+
+    for (; relocation < (fragment -> relocation_count) && fragment -> relocations[relocation].offset < end; relocation++) {
+        emitter -> relocations = arena_grow_array(emitter -> arena, emitter -> relocations, &(emitter -> relocation_capacity), emitter -> relocation_count + 1, sizeof(CodeRelocation));
+
+        CodeRelocation* code_relocation = &(emitter -> relocations[emitter -> relocation_count++]);
+
+        code_relocation -> offset = fragment -> relocations[relocation].offset - source -> offset + start;
+        code_relocation -> name = fragment -> relocations[relocation].name;
+    }
+
+    return relocation;
+}
+
+/**
+ * @brief Lowers, optimizes and generates one run of functions.
+ * 
+ * Every function is lowered, so a run reports the same errors as 
+ * lower_to_ir(), but code is only generated while the run has none.
+ * 
+ * @param context A pointer to the ParallelCodegen.
+ * @param task The index of the run.
+ */
+void compile_function_run(void* context, size_t task) {
+    ParallelCodegen* job = context;
+    FunctionRun* run = &(job -> runs[task]);
+    const Ast* ast = job -> ast;
+    const AstNode* root = &(ast -> nodes[ast -> root]);
+    IrBuilder builder;
+    IrFunction function;
+
+    begin_diagnostics(job -> diagnostics, task);
+
+    run -> arena = create_arena(64 * 1024);
+    init_ir_builder(&builder, run -> arena, ast, job -> filename);
+    init_emitter(&(run -> emitter), run -> arena, job -> emitter -> interner, job -> emitter -> format);
+    run -> emitter.profile = job -> emitter -> profile;
+
+    for (size_t i = run -> first; i < (run -> end); i++) {
+        uint32_t position = job -> positions[i];
+        uint32_t node = ast -> extra[root -> lhs + position];
+
+        if (job -> redefined[position]) {
+            lowering_error(&builder, node, "Redefinition of function '%s'.");
+        }
+
+        if (job -> cache && job -> cache -> hits[position]) {
+            continue;
+        }
+
+        lower_function(&builder, node, &function);
+
+        if (builder.failed) {
+            continue;
+        }
+
+        if (job -> optimize) {
+            optimize_function(&function, run -> arena);
+        }
+
+        generate_function(&(run -> emitter), &function);
+    }
+
+    run -> failed = builder.failed;
+    begin_diagnostics(NULL, 0);
+}
+
+/**
+ * @brief Generates code for a whole translation unit on several threads.
+ * 
+ * Takes the place of lower_to_ir(), optimize_module() and 
+ * generate_code(). The function definitions are cut into runs of about 
+ * the same number of tokens, up to four per thread, and every run is 
+ * compiled by compile_function_run(). Redefinitions are found and the 
+ * line tables built first, so each run can report its own errors. The 
+ * runs' errors are then reported and their code appended in source 
+ * order, with the function cache's hits spliced in between and every 
+ * miss stored, as generate_code() does.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param ast A pointer to the Ast of the translation unit.
+ * @param filename The name of the file, used in error messages.
+ * @param cache A pointer to the FunctionCache, or NULL.
+ * @param optimize Whether the IR is optimized.
+ * @param thread_count The number of threads to use.
+ * @return 1 on success, 0 if a semantic error was found.
+ */
+int generate_code_parallel(Emitter* emitter, const Ast* ast, const char* filename, const FunctionCache* cache, int optimize, size_t thread_count) {
+    const AstNode* root = &(ast -> nodes[ast -> root]);
+    const TokenList* tokens = ast -> tokens;
+    Arena* arena = emitter -> arena;
+    size_t count = root -> rhs;
+    size_t slots = count ? count : 1;
+    size_t symbol_count = interner_size(tokens -> interner);
+    uint8_t* defined = arena_alloc(arena, symbol_count);
+    ParallelCodegen job = { ast, filename, emitter, cache, optimize, arena_alloc(arena, sizeof(uint32_t) * slots), arena_alloc(arena, slots), NULL, NULL };
+    size_t function_count = 0;
+    size_t total = 0;
+
+    memset(defined, 0, symbol_count);
+
+    for (size_t i = 0; i < count; i++) {
+        const AstNode* n = &(ast -> nodes[ast -> extra[root -> lhs + i]]);
+        uint32_t name = token_payload(tokens, n -> token);
+
+        job.redefined[i] = 0;
+
+        // Declarations only name a function; there is no code to lower.
+        if (!n -> lhs) {
+            continue;
+        }
+
+        job.redefined[i] = defined[name];
+        defined[name] = 1;
+
+        if (!cache || !cache -> hits[i] || job.redefined[i]) {
+            job.positions[function_count++] = (uint32_t)i;
+        }
+    }
+
+    size_t run_count = function_count < thread_count * 4 ? function_count : thread_count * 4;
+    size_t* sizes = arena_alloc(arena, sizeof(size_t) * slots);
+
+    for (size_t i = 0; i < function_count; i++) {
+        size_t position = job.positions[i];
+        size_t end = position + 1 < count ? ast -> nodes[ast -> extra[root -> lhs + position + 1]].token : tokens -> size;
+
+        sizes[i] = end - ast -> nodes[ast -> extra[root -> lhs + position]].token;
+        total += sizes[i];
+    }
+
+    job.runs = arena_alloc(arena, sizeof(FunctionRun) * (run_count ? run_count : 1));
+    job.runs[0].first = 0;
+
+    size_t run = 0;
+    size_t weight = 0;
+
+    for (size_t i = 0; i < function_count; i++) {
+        weight += sizes[i];
+
+        if (run + 1 < run_count && i + 1 < function_count && weight * run_count >= total * (run + 1)) {
+            job.runs[run].end = i + 1;
+            job.runs[++run].first = i + 1;
+        }
+    }
+
+    job.runs[run].end = function_count;
+    run_count = function_count ? run + 1 : 0;
+
+    int failed = 0;
+
+    if (run_count) {
+        Diagnostics* parent = current_diagnostics;
+        size_t parent_file = current_diagnostic_file;
+
+        // Errors are located on the runs' threads.
+        prepare_line_tables(tokens);
+        job.diagnostics = create_diagnostics(run_count, 0);
+        run_tasks(run_count, thread_count, compile_function_run, &job);
+        begin_diagnostics(parent, parent_file);
+
+        for (size_t i = 0; i < run_count; i++) {
+            forward_diagnostics(&(job.diagnostics -> buffers[i]));
+            failed |= job.runs[i].failed;
+        }
+
+        free_diagnostics(job.diagnostics);
+    }
+
+    size_t current = 0;
+    size_t symbol = 0;
+    size_t relocation = 0;
+
+    for (size_t i = 0; i < count && !failed; i++) {
+        if (!ast -> nodes[ast -> extra[root -> lhs + i]].lhs) {
+            continue;
+        }
+
+        if (cache && cache -> hits[i]) {
+            splice_cached_function(emitter, cache, i);
+            continue;
+        }
+
+        size_t relocation_start = emitter -> relocation_count;
+
+        relocation = append_function_code(emitter, &(job.runs[current].emitter), symbol++, relocation);
+
+        if (cache) {
+            store_cached_function(emitter, cache, i, relocation_start);
+        }
+
+        if (symbol == job.runs[current].end - job.runs[current].first) {
+            current++;
+            symbol = 0;
+            relocation = 0;
+        }
+    }
+
+    for (size_t i = 0; i < run_count; i++) {
+        free_arena(job.runs[i].arena);
+    }
+
+    return !failed;
+}
+
+/**
+* * PARALLEL CODEGEN END
+*/
+
+/**
+* * PROFILE
+* Profile-guided optimization. With -fprofile-generate every block of 
+* the generated code adds one to a counter of its own, and a 
+* .fini_array entry writes all of the file's counters to its profile 
+* when the program exits. Critical edges are split before the counters 
+* are placed, so the count of every edge is the count of the block at 
+* one of its ends. With -fprofile-use the counts are read back and 
+* drive the block layout and the spill weights of register allocation. 
+* A function's counts are only used if its IR has the same shape as 
+* when they were taken.
+*/
+
+/**
+ * @brief Builds the path of a file's profile.
+ * 
+ * Like gcc, the profile is named after the absolute path of the source 
+ * file with every '/' replaced by '#', so /src/a/util.c has the profile 
+ * #src#a#util.profile. Files with the same name in different 
+ * directories can then be linked into one program without overwriting 
+ * each other's profile. The profile is in the profile directory, or in 
+ * the current directory when none was given.
+ * 
+ * @param arena A pointer to the Arena the path is allocated from.
+ * @param filename The name of the source file.
+ * @param directory The profile directory, or "".
+ * @param absolute Whether the path must be absolute, for the 
+ * instrumented program to find it wherever it runs.
+ * @return The path, or NULL if the current directory is unknown.
+ */
+char* profile_path(Arena* arena, const char* filename, const char* directory, int absolute) {
+    char* current = NULL;
+
+    if (filename[0] != '/' || (absolute && directory[0] != '/')) {
+        current = getcwd(NULL, 0);
+
+        if (!current) {
+            return NULL;
+        }
+    }
+
+    const char* base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+
+    const char* dot = strrchr(base, '.');
+    size_t stem = dot && dot != base ? (size_t)(dot - filename) : strlen(filename);
+    const char* source_directory = filename[0] != '/' ? current : "";
+    const char* profile_directory = absolute && directory[0] != '/' ? current : "";
+    size_t size = strlen(profile_directory) + 1 + strlen(directory) + 1 + strlen(source_directory) + 1 + stem + sizeof(".profile");
+    char* path = arena_alloc(arena, size);
+    int length = snprintf(path, size, "%s%s%s%s", profile_directory, profile_directory[0] ? "/" : "", directory, directory[0] ? "/" : "");
+    char* name = path + length;
+
+    snprintf(name, size - (size_t)length, "%s%s%.*s.profile", source_directory, source_directory[0] ? "/" : "", (int)stem, filename);
+    free(current);
+
+    for (char* c = name; *c; c++) {
+        if (*c == '/') {
+            *c = '#';
+        }
+    }
+
+    return path;
+}
+
+/**
+ * @brief Mixes a value into a running hash.
+ */
+uint64_t mix_hash(uint64_t hash, uint64_t value) {
+    hash = (hash ^ value) * 0xbf58476d1ce4e5b9ull;
+    return hash << 27 | hash >> 37;
+}
+
+/**
+ * @brief Hashes the control flow graph and the opcodes of a function.
+ * 
+ * A profile taken from a build whose IR differs in any of these has 
+ * its counters on the wrong blocks, so it is not used.
+ * 
+ * @param function A pointer to the IrFunction.
+ * @return The hash.
+ */
+uint64_t ir_shape_hash(const IrFunction* function) {
+    uint64_t hash = mix_hash((uint64_t)PROFILE_VERSION * 0x9e3779b97f4a7c15ull, function -> block_count);
+
+    for (size_t b = 0; b < (function -> block_count); b++) {
+        const IrBlock* block = &(function -> blocks[b]);
+
+        hash = mix_hash(hash, block -> successor_count);
+
+        for (size_t s = 0; s < (block -> successor_count); s++) {
+            hash = mix_hash(hash, block -> successors[s]);
+        }
+
+        hash = mix_hash(hash, block -> instruction_count);
+
+        for (size_t i = 0; i < (block -> instruction_count); i++) {
+            hash = mix_hash(hash, function -> instructions[block -> instructions[i]].op);
+        }
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Orders profile entries by name hash, for qsort().
+ */
+int compare_profile_entries(const void* a, const void* b) {
+    const ProfileEntry* x = a;
+    const ProfileEntry* y = b;
+
+    return x -> name_hash < y -> name_hash ? -1 : (x -> name_hash > y -> name_hash);
+}
+
+/**
+ * @brief Reads a profile back.
+ * 
+ * A missing profile is not an error: the file is compiled as if 
+ * -fprofile-use had not been given. Everything in the file is checked 
+ * before it is used.
+ * 
+ * @param arena A pointer to the Arena the entries are allocated from.
+ * @param path The path of the profile.
+ * @param profile Receives the profile, or NULL if there is none.
+ * @return 1 on success, or 0 after reporting an unreadable or invalid 
+ * profile.
+ */
+int load_profile(Arena* arena, const char* path, ProfileData** profile) {
+    *profile = NULL;
+
+    SourceBuffer* file = read_source_file(path);
+
+    if (!file) {
+        if (errno == ENOENT) {
+            return 1;
+        }
+
+        report_error(NULL, 0, 0, "Failed to read '%s': %s.", path, strerror(errno));
+        return 0;
+    }
+
+    const char* data = file -> data;
+    size_t size = file -> length;
+    size_t offset = sizeof(ProfileHeader);
+    ProfileHeader header;
+    int valid = size >= sizeof(header);
+
+    if (valid) {
+        memcpy(&header, data, sizeof(header));
+        valid = memcmp(header.magic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC)) == 0 && header.version == PROFILE_VERSION &&
+            header.function_count <= (size - offset) / sizeof(ProfileRecord);
+    }
+
+    ProfileData* result = arena_alloc(arena, sizeof(ProfileData));
+
+    result -> file = file;
+    result -> entries = valid ? arena_alloc(arena, sizeof(ProfileEntry) * (header.function_count ? header.function_count : 1)) : NULL;
+    result -> count = valid ? header.function_count : 0;
+
+    for (size_t i = 0; valid && i < (result -> count); i++) {
+        ProfileRecord record;
+
+        valid = size - offset >= sizeof(record);
+
+        if (valid) {
+            memcpy(&record, data + offset, sizeof(record));
+            offset += sizeof(record);
+            valid = record.counter_count <= (size - offset) / sizeof(uint64_t);
+        }
+
+        if (valid) {
+            result -> entries[i].name_hash = record.name_hash;
+            result -> entries[i].checksum = record.checksum;
+            result -> entries[i].counters = (const uint64_t*)(data + offset);
+            result -> entries[i].counter_count = record.counter_count;
+            offset += sizeof(uint64_t) * record.counter_count;
+        }
+    }
+
+    if (!valid || offset != size) {
+        report_error(NULL, 0, 0, "'%s' is not a valid profile.", path);
+        free_source_buffer(file);
+        return 0;
+    }
+
+    qsort(result -> entries, result -> count, sizeof(ProfileEntry), compare_profile_entries);
+    *profile = result;
+
+    return 1;
+}
+
+/**
+ * @brief Looks up the block counts of a function in a profile.
+ * 
+ * @param profile A pointer to the ProfileData.
+ * @param interner A pointer to the Interner the function's name is in.
+ * @param function A pointer to the IrFunction; its critical edges are split.
+ * @param checksum The ir_shape_hash() of the function.
+ * @return The count of every block, or NULL if the profile has no 
+ * usable counts for the function or it never ran.
+ */
+const uint64_t* find_profile_counts(const ProfileData* profile, const Interner* interner, const IrFunction* function, uint64_t checksum) {
+    uint64_t name_hash = hash_bytes(symbol_text(interner, function -> name), symbol_length(interner, function -> name));
+    size_t low = 0;
+    size_t high = profile -> count;
+
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+
+        if (profile -> entries[middle].name_hash < name_hash) {
+            low = middle + 1;
         } else {
-            switch (c) {
-                case '(':
-                    add_token(tokens, L_PARAN, "(");
-                    break;
-                case ')':
-                    add_token(tokens, R_PARAN, ")");
-                    break;
-                case '{':
-                    add_token(tokens, L_BRACE, "{");
-                    break;
-                case '}':
-                    add_token(tokens, R_BRACE, "}");
-                    break;
-                case ';':
-                    add_token(tokens, SEMICOLON, ";");
-                    break;
-                default:
-                    buffer[0] = c;
-                    buffer[1] = '\0';
-                    add_token(tokens, UNKNOWN, buffer);
-                    break;
-            }
+            high = middle;
         }
     }
 
-    fclose(file);
-    return tokens;
+    if (low == profile -> count) {
+        return NULL;
+    }
+
+    const ProfileEntry* entry = &(profile -> entries[low]);
+
+    if (entry -> name_hash != name_hash || entry -> checksum != checksum || entry -> counter_count != function -> block_count || entry -> counters[0] == 0) {
+        return NULL;
+    }
+
+    return entry -> counters;
 }
 
 /**
-* * LEXER END
+ * @brief Releases a profile read by load_profile().
+ * 
+ * @param profile A pointer to the ProfileData, or NULL.
+ */
+void free_profile(ProfileData* profile) {
+    if (profile) {
+        free_source_buffer(profile -> file);
+    }
+}
+
+/**
+ * @brief Sets up the profiles of a file before code generation.
+ * 
+ * @param emitter A pointer to the Emitter of the file.
+ * @param filename The name of the source file.
+ * @param options The options of this invocation.
+ * @param profile Receives the profile read for -fprofile-use, or NULL.
+ * @return 1 on success, or 0 after reporting an error.
+ */
+int prepare_profiles(Emitter* emitter, const char* filename, const CompileOptions* options, ProfileData** profile) {
+    *profile = NULL;
+
+    if (options -> profile_use) {
+        const char* path = profile_path(emitter -> arena, filename, options -> profile_use, 0);
+
+        if (!path) {
+            report_system_error("Failed to find the current directory.");
+            return 0;
+        }
+
+        if (!load_profile(emitter -> arena, path, profile)) {
+            return 0;
+        }
+
+        emitter -> profile = *profile;
+    }
+
+    if (options -> profile_generate) {
+        const char* path = profile_path(emitter -> arena, filename, options -> profile_generate, 1);
+
+        if (!path) {
+            report_system_error("Failed to find the current directory.");
+            return 0;
+        }
+
+        enable_profile_generation(emitter, path);
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Makes an emitter instrument the code it generates.
+ * 
+ * @param emitter A pointer to the Emitter, before any function is emitted.
+ * @param path The absolute path the program writes its profile to.
+ */
+void enable_profile_generation(Emitter* emitter, const char* path) {
+    ProfileHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC));
+    header.version = PROFILE_VERSION;
+
+    emitter -> instrument = 1;
+    emitter -> profile_path = path;
+
+    init_output_buffer(&(emitter -> profile_data), emitter -> arena, 4096);
+    output_bytes(&(emitter -> profile_data), &header, sizeof(header));
+}
+
+/**
+ * @brief Adds a function's record to the profile data.
+ * 
+ * @param emitter A pointer to the instrumenting Emitter.
+ * @param function A pointer to the IrFunction; its critical edges are split.
+ * @param checksum The ir_shape_hash() of the function.
+ * @return The offset of the function's first counter in the profile data.
+ */
+uint32_t add_profile_record(Emitter* emitter, const IrFunction* function, uint64_t checksum) {
+    OutputBuffer* data = &(emitter -> profile_data);
+    ProfileRecord record;
+
+    record.name_hash = hash_bytes(symbol_text(emitter -> interner, function -> name), symbol_length(emitter -> interner, function -> name));
+    record.checksum = checksum;
+    record.counter_count = function -> block_count;
+
+    output_bytes(data, &record, sizeof(record));
+
+    uint32_t offset = (uint32_t)(data -> size);
+
+    memset(reserve_output(data, sizeof(uint64_t) * function -> block_count), 0, sizeof(uint64_t) * function -> block_count);
+    data -> size += sizeof(uint64_t) * function -> block_count;
+    emitter -> profile_function_count++;
+
+    return offset;
+}
+
+/**
+ * @brief Emits the rel32 field of a RIP-relative reference to the 
+ * profile data.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param offset The offset of the target in the profile data.
+ * @param trailing The number of bytes of the instruction after the field.
+ */
+void emit_data_operand(Emitter* emitter, uint32_t offset, int32_t trailing) {
+    emitter -> data_relocations = arena_grow_array(emitter -> arena, emitter -> data_relocations, &(emitter -> data_relocation_capacity), emitter -> data_relocation_count + 1, sizeof(DataRelocation));
+    emitter -> data_relocations[emitter -> data_relocation_count].offset = (uint32_t)(emitter -> code.size);
+    emitter -> data_relocations[emitter -> data_relocation_count].addend = (int32_t)offset - 4 - trailing;
+    emitter -> data_relocation_count++;
+
+    output_u32(&(emitter -> code), 0);
+}
+
+/**
+ * @brief Emits addq $1 to a profile counter.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param offset The offset of the counter in the profile data.
+ */
+void emit_profile_increment(Emitter* emitter, uint32_t offset) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_format(&(emitter -> code), "    addq $1, .Lcc_profile+%u(%%rip)\n", offset);
+        return;
+    }
+
+    output_u8(&(emitter -> code), 0x48);
+    output_u8(&(emitter -> code), 0x83);
+    output_u8(&(emitter -> code), 0x05);
+    emit_data_operand(emitter, offset, 1);
+    output_u8(&(emitter -> code), 1);
+}
+
+/**
+ * @brief Emits lea of an address in the profile data into a register.
+ * 
+ * @param emitter A pointer to the Emitter.
+ * @param reg The register.
+ * @param offset The offset of the address in the profile data.
+ */
+void emit_data_address(Emitter* emitter, X86Register reg, uint32_t offset) {
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_format(&(emitter -> code), "    leaq .Lcc_profile+%u(%%rip), %s\n", offset, register_names_64[reg]);
+        return;
+    }
+
+    output_u8(&(emitter -> code), reg >= R8 ? 0x4c : 0x48);
+    output_u8(&(emitter -> code), 0x8d);
+    output_u8(&(emitter -> code), (uint8_t)(0x05 | ((reg & 7) << 3)));
+    emit_data_operand(emitter, offset, 0);
+}
+
+/**
+ * @brief Emits bytes as assembler data directives.
+ */
+void output_data_directives(OutputBuffer* buffer, const unsigned char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        output_format(buffer, i % 16 == 0 ? "    .byte %u" : ", %u", data[i]);
+
+        if (i % 16 == 15 || i + 1 == size) {
+            output_string(buffer, "\n");
+        }
+    }
+}
+
+/**
+ * @brief Emits the function that writes the profile out and the data 
+ * it writes.
+ * 
+ * The function runs from .fini_array, after main has returned or the 
+ * program has called exit(), and replaces the profile with the counts 
+ * of this run. It is local to the file, so it takes no symbol: 
+ * .fini_array refers to it by its offset in .text. It makes the open, 
+ * write and close system calls itself rather than calling the C 
+ * library, so a function of the program with one of those names cannot 
+ * take its place. If the open fails, for example because the profile 
+ * directory does not exist, an error naming the profile is written to 
+ * standard error instead.
+ * 
+ * @param emitter A pointer to the instrumenting Emitter.
+ */
+void emit_profile_writer(Emitter* emitter) {
+    OutputBuffer* data = &(emitter -> profile_data);
+    uint32_t size = (uint32_t)(data -> size);
+
+    memcpy(data -> data + offsetof(ProfileHeader, function_count), &(emitter -> profile_function_count), sizeof(uint32_t));
+    output_bytes(data, emitter -> profile_path, strlen(emitter -> profile_path) + 1);
+
+    uint32_t message = (uint32_t)(data -> size);
+
+    output_format(data, "ERROR: Failed to write the profile '%s'.\n", emitter -> profile_path);
+
+    int32_t message_size = (int32_t)(data -> size - message);
+
+    align_output(data, 8);
+
+    emitter -> profile_writer = (uint32_t)(emitter -> code.size);
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), ".Lcc_profile_write:\n");
+    }
+
+    emit_prologue(emitter, 16);
+    emit_save_register(emitter, RBX, -8, 0);
+    emit_data_address(emitter, RDI, size);
+    emit_mov_imm32(emitter, RSI, O_WRONLY | O_CREAT | O_TRUNC);
+    emit_mov_imm32(emitter, RDX, 0644);
+    emit_syscall(emitter, X86_64_SYS_OPEN);
+
+    // A failed open returns -errno; the error path is short enough for 
+    // a rel8 jump over it.
+    size_t skip = 0;
+
+    emit_test(emitter, RAX);
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    jns .Lcc_profile_opened\n");
+    } else {
+        output_u8(&(emitter -> code), 0x79);
+        skip = emitter -> code.size;
+        output_u8(&(emitter -> code), 0);
+    }
+
+    emit_mov_imm32(emitter, RDI, STDERR_FILENO);
+    emit_data_address(emitter, RSI, message);
+    emit_mov_imm32(emitter, RDX, message_size);
+    emit_syscall(emitter, X86_64_SYS_WRITE);
+    emit_leave(emitter);
+    emit_ret(emitter);
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), ".Lcc_profile_opened:\n");
+    } else {
+        emitter -> code.data[skip] = (char)(emitter -> code.size - (skip + 1));
+    }
+
+    emit_move(emitter, register_location(RBX), register_location(RAX));
+    emit_move(emitter, register_location(RDI), register_location(RBX));
+    emit_data_address(emitter, RSI, 0);
+    emit_mov_imm32(emitter, RDX, (int32_t)size);
+    emit_syscall(emitter, X86_64_SYS_WRITE);
+    emit_move(emitter, register_location(RDI), register_location(RBX));
+    emit_syscall(emitter, X86_64_SYS_CLOSE);
+    emit_save_register(emitter, RBX, -8, 1);
+    emit_leave(emitter);
+    emit_ret(emitter);
+
+    if (emitter -> format == EMIT_ASSEMBLY) {
+        output_string(&(emitter -> code), "    .data\n    .p2align 3\n.Lcc_profile:\n");
+        output_data_directives(&(emitter -> code), (const unsigned char*)data -> data, data -> size);
+        output_string(&(emitter -> code), "    .section .fini_array,\"aw\"\n    .p2align 3\n    .quad .Lcc_profile_write\n");
+    }
+}
+
+/**
+* * PROFILE END
 */
\ No newline at end of file